@@ -0,0 +1,1209 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** Animation evaluation for the curves of bk3dEx.h : batches of curves
+ ** evaluated for a given time, several at once with SSE2/AVX.
+ ** MayaCurves : MayaCurveEvaluator. QuatCurves : QuatCurveEvaluator.
+ ** FloatArrayPool connections : ConnectionGraph.
+ **/
+#ifndef __BK3DANIMATION__
+#define __BK3DANIMATION__
+#include "bk3dEx.h"
+#include "bk3dMeshUtils.h" // BK3D_SSE2
+#include "bk3dParallel.h"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#if defined(BK3D_SSE2) && defined(__AVX__)
+#   include <immintrin.h>
+#   define BK3D_AVX
+#endif
+
+namespace bk3d
+{
+/*--------------------------------
+MayaCurve evaluation
+- each segment between 2 keys is turned once into cubics of the normalized time of the segment
+- non-weighted tangents are Hermite : the value is a cubic of u = (t - t0) / dt
+- weighted tangents are Bezier : x(s) = u must be inverted first (Newton), then y(s)
+- step tangents are constant cubics
+The weighted tangents of a key are the vectors weight * (cos(angle), sin(angle)), in
+(time, value) units; the Bezier control points are at a third of them, so that a
+weight of dt / cos(angle) gives the same curve as the non-weighted case
+----------------------------------*/
+#define BK3D_CURVENEWTON 8 ///< iterations to invert x(s) of the weighted segments : Newton, kept in a bisection bracket
+
+/// one segment as cubics. The first 8 floats are what the SIMD evaluation loads
+struct CurveSegment
+{
+    float xa, xb, xc;       ///< x(s) = ((xa*s + xb)*s + xc)*s. (0,0,1) when not weighted
+    float ya, yb, yc, yd;   ///< y(s) = ((ya*s + yb)*s + yc)*s + yd
+    float t0;               ///< time of the first key
+    float invDt;            ///< 0 for a constant segment
+    float pad[3];
+};
+
+/// what the evaluator keeps for each curve
+struct CurveEvalInfo
+{
+    MayaCurve*      pCurve;
+    float*          pTarget;    ///< where the value is written (FloatArray::f[c]); can be NULL
+    int             firstSeg;
+    int             nSegs;
+    int             cursor;     ///< segment of the previous evaluation (relative to firstSeg)
+    float           tFirst, tLast;
+    float           vFirst, vLast;
+    float           preSlope;   ///< in-tangent of the first key : kInfinityLinear
+    float           postSlope;  ///< out-tangent of the last key
+    int             preInfinity;
+    int             postInfinity;
+};
+
+//------------------------------------------------------------------------------------------
+/// cubics of the segment between k0 and k1
+//------------------------------------------------------------------------------------------
+INLINE void buildCurveSegment(const MayaReadKey &k0, const MayaReadKey &k1, bool bWeighted, CurveSegment &s)
+{
+    memset(&s, 0, sizeof(CurveSegment));
+    float dt = k1.time - k0.time;
+    s.t0 = k0.time;
+    s.xc = 1.0f;
+    if((dt <= 0.0f) || (k0.outTangentType == kTangentStep) || (k0.outTangentType == kTangentStepNext))
+    {
+        s.yd = (k0.outTangentType == kTangentStep) ? k0.value : k1.value;
+        s.invDt = dt > 0.0f ? 1.0f / dt : 0.0f;
+        return;
+    }
+    s.invDt = 1.0f / dt;
+    float q0 = k0.value, q3 = k1.value, q1, q2;
+    if(bWeighted)
+    {
+        // Bezier control points, x normalized to the segment and clamped to keep x(s) monotonic
+        float x1 = k0.outWeight * cosf(k0.outAngle) / (3.0f * dt);
+        float x2 = 1.0f - k1.inWeight * cosf(k1.inAngle) / (3.0f * dt);
+        x1 = x1 < 0.0f ? 0.0f : (x1 > 1.0f ? 1.0f : x1);
+        x2 = x2 < 0.0f ? 0.0f : (x2 > 1.0f ? 1.0f : x2);
+        q1 = k0.value + k0.outWeight * sinf(k0.outAngle) / 3.0f;
+        q2 = k1.value - k1.inWeight * sinf(k1.inAngle) / 3.0f;
+        s.xa = 3.0f*x1 - 3.0f*x2 + 1.0f;
+        s.xb = -6.0f*x1 + 3.0f*x2;
+        s.xc = 3.0f*x1;
+    } else {
+        // Hermite, as a Bezier with the control points at a third of the tangents
+        q1 = k0.value + tanf(k0.outAngle) * dt / 3.0f;
+        q2 = k1.value - tanf(k1.inAngle) * dt / 3.0f;
+    }
+    s.ya = -q0 + 3.0f*q1 - 3.0f*q2 + q3;
+    s.yb = 3.0f*q0 - 6.0f*q1 + 3.0f*q2;
+    s.yc = -3.0f*q0 + 3.0f*q1;
+    s.yd = q0;
+}
+
+//------------------------------------------------------------------------------------------
+/// value of a segment at u in [0,1]
+//------------------------------------------------------------------------------------------
+INLINE float evalCurveSegment(const CurveSegment &seg, float u)
+{
+    float s = u;
+    if((seg.xa != 0.0f) || (seg.xb != 0.0f))
+    {
+        float lo = 0.0f, hi = 1.0f;
+        for(int it=0; it<BK3D_CURVENEWTON; it++)
+        {
+            float f = ((seg.xa*s + seg.xb)*s + seg.xc)*s - u;
+            float d = (3.0f*seg.xa*s + 2.0f*seg.xb)*s + seg.xc;
+            if(f < 0.0f)
+                lo = s;
+            else
+                hi = s;
+            float sn = s - f / (d > 1e-6f ? d : 1e-6f);
+            s = ((sn >= lo) && (sn <= hi)) ? sn : 0.5f * (lo + hi);
+        }
+    }
+    return ((seg.ya*s + seg.yb)*s + seg.yc)*s + seg.yd;
+}
+
+//------------------------------------------------------------------------------------------
+/// brings t in [tFirst, tLast] for the infinity modes.
+/// \return 0 if tl is in the range; -1 or 1 if the value is the one of the first or last key (+ offset)
+//------------------------------------------------------------------------------------------
+INLINE int mapCurveTime(const CurveEvalInfo &ci, float t, float &tl, float &offset)
+{
+    offset = 0.0f;
+    tl = t;
+    if((t >= ci.tFirst) && (t <= ci.tLast))
+        return 0;
+    bool bPre = t < ci.tFirst;
+    int mode = bPre ? ci.preInfinity : ci.postInfinity;
+    float range = ci.tLast - ci.tFirst;
+    switch(mode)
+    {
+    case kInfinityLinear:
+        offset = bPre ? ci.preSlope * (t - ci.tFirst) : ci.postSlope * (t - ci.tLast);
+        break;
+    case kInfinityCycle:
+    case kInfinityCycleRelative:
+    case kInfinityOscillate:
+        if(range > 0.0f)
+        {
+            float cycles = floorf((t - ci.tFirst) / range);
+            tl = t - cycles * range;
+            tl = tl < ci.tFirst ? ci.tFirst : (tl > ci.tLast ? ci.tLast : tl); // rounding
+            if(mode == kInfinityCycleRelative)
+                offset = cycles * (ci.vLast - ci.vFirst);
+            else if((mode == kInfinityOscillate) && (fmodf(cycles, 2.0f) != 0.0f))
+                tl = ci.tFirst + ci.tLast - tl;
+            return 0;
+        }
+        break;
+    default: // kInfinityConstant
+        break;
+    }
+    return bPre ? -1 : 1;
+}
+
+//------------------------------------------------------------------------------------------
+/// \brief evaluates many MayaCurves for a time and writes the values into their targets.
+/// A cursor per curve remembers the segment of the previous evaluation : during playback the
+/// search is the same segment or the next one. Otherwise it's a binary search.
+/// The segments are evaluated 4 (SSE2) or 8 (AVX) curves at once
+//------------------------------------------------------------------------------------------
+struct MayaCurveEvaluator
+{
+    std::vector<CurveEvalInfo>  curves;     ///< the weighted curves get moved after the others : see evaluate()
+    std::vector<CurveSegment>   segments;   ///< segments[0] is a zero constant : see evaluateRange()
+    std::vector<float>          values;     ///< result of each curve
+    bool                        bWeighted;  ///< at least one weighted segment : Newton needed
+    bool                        bGrouped;   ///< curves[] has the weighted ones at the end
+    // per-curve scratch of evaluate()
+    std::vector<int>            segIdx;
+    std::vector<float>          u;
+    std::vector<float>          offset;
+
+    MayaCurveEvaluator() : bWeighted(false), bGrouped(true) { clear(); }
+    void clear()
+    {
+        curves.clear();
+        segments.resize(1);
+        memset(&segments[0], 0, sizeof(CurveSegment));
+        segments[0].xc = 1.0f;
+        bWeighted = false;
+    }
+    /// every curve of every MayaCurveVector of the pool; curve c of a vector writes pFloatArray->f[c]
+    void build(MayaCurvePool *pPool)
+    {
+        clear();
+        for(int v=0; pPool && (v<pPool->n); v++)
+        {
+            MayaCurveVector *pCV = pPool->p[v];
+            FloatArray *pFA = pCV->pFloatArray;
+            for(int c=0; c<pCV->nCurves; c++)
+                addCurve(pCV->pCurve[c], (pFA && (c < pFA->dim)) ? pFA->f + c : NULL);
+        }
+    }
+    /// the result goes to MayaCurve::fOut, and to pTarget if not NULL
+    void addCurve(MayaCurve *pCurve, float *pTarget)
+    {
+        CurveEvalInfo ci;
+        memset(&ci, 0, sizeof(CurveEvalInfo));
+        ci.pCurve = pCurve;
+        ci.pTarget = pTarget;
+        ci.firstSeg = (int)segments.size();
+        ci.preInfinity = pCurve->preInfinity;
+        ci.postInfinity = pCurve->postInfinity;
+        int n = pCurve->nKeys;
+        if(n > 0)
+        {
+            const MayaReadKey &kf = pCurve->key[0];
+            const MayaReadKey &kl = pCurve->key[n-1];
+            ci.tFirst = kf.time; ci.vFirst = kf.value;
+            ci.tLast = kl.time;  ci.vLast = kl.value;
+            ci.preSlope = tanf(kf.inAngle);
+            ci.postSlope = tanf(kl.outAngle);
+        }
+        CurveSegment seg;
+        if(n < 2)
+        {
+            // constant : one key or none
+            MayaReadKey k;
+            memset(&k, 0, sizeof(MayaReadKey));
+            k.time = ci.tFirst;
+            k.value = ci.vFirst;
+            buildCurveSegment(k, k, false, seg);
+            segments.push_back(seg);
+        }
+        for(int k=0; k<n-1; k++)
+        {
+            buildCurveSegment(pCurve->key[k], pCurve->key[k+1], pCurve->isWeighted, seg);
+            if((seg.xa != 0.0f) || (seg.xb != 0.0f))
+                bWeighted = true;
+            segments.push_back(seg);
+        }
+        ci.nSegs = (int)segments.size() - ci.firstSeg;
+        curves.push_back(ci);
+        bGrouped = false;
+    }
+    static bool isNotWeighted(const CurveEvalInfo &ci) { return !ci.pCurve->isWeighted; }
+    /// segment of tl, from the cursor of the curve
+    inline int findSegment(CurveEvalInfo &ci, float tl)
+    {
+        const CurveSegment *s = &segments[ci.firstSeg];
+        int n = ci.nSegs;
+        int i = ci.cursor;
+        if((tl >= s[i].t0) && ((i+1 >= n) || (tl < s[i+1].t0)))
+            return i;
+        if((i+1 < n) && (tl >= s[i+1].t0) && ((i+2 >= n) || (tl < s[i+2].t0)))
+            i++;
+        else {
+            // last segment starting before tl
+            int lo = 0, hi = n - 1;
+            while(lo < hi)
+            {
+                int mid = (lo + hi + 1) >> 1;
+                if(s[mid].t0 <= tl)
+                    lo = mid;
+                else
+                    hi = mid - 1;
+            }
+            i = lo;
+        }
+        ci.cursor = i;
+        return i;
+    }
+    /// curves [c0, c1) : segments and normalized times, then the cubics several curves at once
+    void evaluateRange(float time, int c0, int c1)
+    {
+        for(int c=c0; c<c1; c++)
+        {
+            CurveEvalInfo &ci = curves[c];
+            float t = ci.pCurve->inputIsTime ? time : ci.pCurve->fIn;
+            float tl;
+            int where = mapCurveTime(ci, t, tl, offset[c]);
+            if(where != 0)
+            {
+                // value of an end key : the zero segment + offset
+                segIdx[c] = 0;
+                u[c] = 0.0f;
+                offset[c] += where < 0 ? ci.vFirst : ci.vLast;
+                continue;
+            }
+            const CurveSegment &seg = segments[ci.firstSeg + findSegment(ci, tl)];
+            float uc = (tl - seg.t0) * seg.invDt;
+            segIdx[c] = (int)(&seg - &segments[0]);
+            u[c] = uc < 0.0f ? 0.0f : (uc > 1.0f ? 1.0f : uc);
+        }
+        int c = c0;
+        const float *segs = (const float*)&segments[0];
+#if defined(BK3D_AVX)
+        for(; c + 8 <= c1; c += 8)
+        {
+            // 2 groups of 4 floats per segment, transposed to SoA
+            __m128 lo[8], hi[8];
+            for(int k=0; k<8; k++)
+            {
+                const float *p = segs + segIdx[c+k] * (sizeof(CurveSegment)/sizeof(float));
+                lo[k] = _mm_loadu_ps(p);
+                hi[k] = _mm_loadu_ps(p + 4);
+            }
+            _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+            _MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+            _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+            _MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+            __m256 xa = _mm256_insertf128_ps(_mm256_castps128_ps256(lo[0]), lo[4], 1);
+            __m256 xb = _mm256_insertf128_ps(_mm256_castps128_ps256(lo[1]), lo[5], 1);
+            __m256 xc = _mm256_insertf128_ps(_mm256_castps128_ps256(lo[2]), lo[6], 1);
+            __m256 ya = _mm256_insertf128_ps(_mm256_castps128_ps256(lo[3]), lo[7], 1);
+            __m256 yb = _mm256_insertf128_ps(_mm256_castps128_ps256(hi[0]), hi[4], 1);
+            __m256 yc = _mm256_insertf128_ps(_mm256_castps128_ps256(hi[1]), hi[5], 1);
+            __m256 yd = _mm256_insertf128_ps(_mm256_castps128_ps256(hi[2]), hi[6], 1);
+            __m256 uu = _mm256_loadu_ps(&u[c]);
+            __m256 s = uu;
+            // lanes with x(s) = s don't need it
+            __m256 curved = _mm256_or_ps(_mm256_cmp_ps(xa, _mm256_setzero_ps(), _CMP_NEQ_UQ), _mm256_cmp_ps(xb, _mm256_setzero_ps(), _CMP_NEQ_UQ));
+            if(bWeighted && _mm256_movemask_ps(curved))
+            {
+                const __m256 zero = _mm256_setzero_ps(), half = _mm256_set1_ps(0.5f), minD = _mm256_set1_ps(1e-6f);
+                const __m256 two = _mm256_set1_ps(2.0f), three = _mm256_set1_ps(3.0f);
+                __m256 lo = zero, hi = _mm256_set1_ps(1.0f);
+                for(int it=0; it<BK3D_CURVENEWTON; it++)
+                {
+                    __m256 f = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(xa, s), xb), s), xc), s), uu);
+                    __m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(three, xa), s), _mm256_mul_ps(two, xb)), s), xc);
+                    __m256 below = _mm256_cmp_ps(f, zero, _CMP_LT_OQ);
+                    lo = _mm256_blendv_ps(lo, s, below);
+                    hi = _mm256_blendv_ps(s, hi, below);
+                    __m256 sn = _mm256_sub_ps(s, _mm256_div_ps(f, _mm256_max_ps(d, minD)));
+                    __m256 in = _mm256_and_ps(_mm256_cmp_ps(sn, lo, _CMP_GE_OQ), _mm256_cmp_ps(sn, hi, _CMP_LE_OQ));
+                    s = _mm256_blendv_ps(_mm256_mul_ps(half, _mm256_add_ps(lo, hi)), sn, in);
+                }
+            }
+            __m256 y = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(ya, s), yb), s), yc), s), yd);
+            _mm256_storeu_ps(&values[c], _mm256_add_ps(y, _mm256_loadu_ps(&offset[c])));
+        }
+#endif
+#if defined(BK3D_SSE2)
+        for(; c + 4 <= c1; c += 4)
+        {
+            __m128 lo[4], hi[4];
+            for(int k=0; k<4; k++)
+            {
+                const float *p = segs + segIdx[c+k] * (sizeof(CurveSegment)/sizeof(float));
+                lo[k] = _mm_loadu_ps(p);
+                hi[k] = _mm_loadu_ps(p + 4);
+            }
+            _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+            _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+            __m128 xa = lo[0], xb = lo[1], xc = lo[2], ya = lo[3];
+            __m128 yb = hi[0], yc = hi[1], yd = hi[2];
+            __m128 uu = _mm_loadu_ps(&u[c]);
+            __m128 s = uu;
+            // lanes with x(s) = s don't need it
+            __m128 curved = _mm_or_ps(_mm_cmpneq_ps(xa, _mm_setzero_ps()), _mm_cmpneq_ps(xb, _mm_setzero_ps()));
+            if(bWeighted && _mm_movemask_ps(curved))
+            {
+                const __m128 zero = _mm_setzero_ps(), half = _mm_set1_ps(0.5f), minD = _mm_set1_ps(1e-6f);
+                const __m128 two = _mm_set1_ps(2.0f), three = _mm_set1_ps(3.0f);
+                __m128 lo = zero, hi = _mm_set1_ps(1.0f);
+                for(int it=0; it<BK3D_CURVENEWTON; it++)
+                {
+                    __m128 f = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(xa, s), xb), s), xc), s), uu);
+                    __m128 d = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(three, xa), s), _mm_mul_ps(two, xb)), s), xc);
+                    // SSE2 has no blendv : and/andnot/or
+                    __m128 below = _mm_cmplt_ps(f, zero);
+                    lo = _mm_or_ps(_mm_and_ps(below, s), _mm_andnot_ps(below, lo));
+                    hi = _mm_or_ps(_mm_and_ps(below, hi), _mm_andnot_ps(below, s));
+                    __m128 sn = _mm_sub_ps(s, _mm_div_ps(f, _mm_max_ps(d, minD)));
+                    __m128 in = _mm_and_ps(_mm_cmpge_ps(sn, lo), _mm_cmple_ps(sn, hi));
+                    s = _mm_or_ps(_mm_and_ps(in, sn), _mm_andnot_ps(in, _mm_mul_ps(half, _mm_add_ps(lo, hi))));
+                }
+            }
+            __m128 y = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(ya, s), yb), s), yc), s), yd);
+            _mm_storeu_ps(&values[c], _mm_add_ps(y, _mm_loadu_ps(&offset[c])));
+        }
+#endif
+        for(; c<c1; c++)
+            values[c] = evalCurveSegment(segments[segIdx[c]], u[c]) + offset[c];
+        for(c=c0; c<c1; c++)
+        {
+            curves[c].pCurve->fOut = values[c];
+            if(curves[c].pTarget)
+                *curves[c].pTarget = values[c];
+        }
+    }
+    /// evaluates all the curves at time (or at MayaCurve::fIn for the ones not driven by time)
+    /// \param maxThreads : see parallelFor(). Chunks of 4096 curves
+    void evaluate(float time, int maxThreads = 1)
+    {
+        int n = (int)curves.size();
+        if(n == 0)
+            return;
+        // so that most SIMD blocks are all weighted or all not : the Newton iterations are skipped for the latter
+        if(!bGrouped)
+        {
+            std::stable_partition(curves.begin(), curves.end(), isNotWeighted);
+            bGrouped = true;
+        }
+        values.resize(n);
+        segIdx.resize(n);
+        u.resize(n);
+        offset.resize(n);
+        const int chunk = 4096;
+        parallelFor((n + chunk - 1) / chunk, [&](int i) {
+            evaluateRange(time, i * chunk, (i+1) * chunk < n ? (i+1) * chunk : n);
+        }, maxThreads);
+    }
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief straightforward evaluation of one curve, straight from its keys (binary search,
+/// bisection for the weighted tangents). Slow : meant as a reference for MayaCurveEvaluator
+//------------------------------------------------------------------------------------------
+INLINE float evaluateMayaCurve(const MayaCurve *pCurve, float t)
+{
+    int n = pCurve->nKeys;
+    if(n == 0)
+        return 0.0f;
+    const MayaReadKey *k = pCurve->key;
+    CurveEvalInfo ci;
+    memset(&ci, 0, sizeof(CurveEvalInfo));
+    ci.tFirst = k[0].time;  ci.vFirst = k[0].value;
+    ci.tLast = k[n-1].time; ci.vLast = k[n-1].value;
+    ci.preSlope = tanf(k[0].inAngle);
+    ci.postSlope = tanf(k[n-1].outAngle);
+    ci.preInfinity = pCurve->preInfinity;
+    ci.postInfinity = pCurve->postInfinity;
+    float tl, offset;
+    int where = mapCurveTime(ci, t, tl, offset);
+    if(where < 0)
+        return ci.vFirst + offset;
+    if(where > 0)
+        return ci.vLast + offset;
+    if(n == 1)
+        return k[0].value + offset;
+    int lo = 0, hi = n - 2;
+    while(lo < hi)
+    {
+        int mid = (lo + hi + 1) >> 1;
+        if(k[mid].time <= tl)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    const MayaReadKey &k0 = k[lo];
+    const MayaReadKey &k1 = k[lo+1];
+    float dt = k1.time - k0.time;
+    if((dt <= 0.0f) || (k0.outTangentType == kTangentStep))
+        return (k0.outTangentType == kTangentStep ? k0.value : k1.value) + offset;
+    if(k0.outTangentType == kTangentStepNext)
+        return k1.value + offset;
+    // control points in (time, value)
+    float px[4], py[4];
+    px[0] = k0.time; py[0] = k0.value;
+    px[3] = k1.time; py[3] = k1.value;
+    if(pCurve->isWeighted)
+    {
+        px[1] = k0.time + k0.outWeight * cosf(k0.outAngle) / 3.0f;
+        py[1] = k0.value + k0.outWeight * sinf(k0.outAngle) / 3.0f;
+        px[2] = k1.time - k1.inWeight * cosf(k1.inAngle) / 3.0f;
+        py[2] = k1.value - k1.inWeight * sinf(k1.inAngle) / 3.0f;
+        px[1] = px[1] < k0.time ? k0.time : (px[1] > k1.time ? k1.time : px[1]);
+        px[2] = px[2] < k0.time ? k0.time : (px[2] > k1.time ? k1.time : px[2]);
+    } else {
+        px[1] = k0.time + dt / 3.0f;
+        py[1] = k0.value + tanf(k0.outAngle) * dt / 3.0f;
+        px[2] = k1.time - dt / 3.0f;
+        py[2] = k1.value - tanf(k1.inAngle) * dt / 3.0f;
+    }
+    // x(s) is monotonic : bisection
+    float s0 = 0.0f, s1 = 1.0f, s = 0.5f;
+    for(int it=0; it<32; it++)
+    {
+        s = 0.5f * (s0 + s1);
+        float r = 1.0f - s;
+        float x = r*r*r*px[0] + 3.0f*r*r*s*px[1] + 3.0f*r*s*s*px[2] + s*s*s*px[3];
+        if(x < tl)
+            s0 = s;
+        else
+            s1 = s;
+    }
+    float r = 1.0f - s;
+    return r*r*r*py[0] + 3.0f*r*r*s*py[1] + 3.0f*r*s*s*py[2] + s*s*s*py[3] + offset;
+}
+
+/*--------------------------------
+QuatCurve evaluation
+- the keys of a QuatCurve are sampled rotations : the curve is the interpolation between
+  the 2 keys around the time, along the shortest path (q1 negated when dot(q0,q1) < 0)
+- before the first key and after the last one the curve is constant
+- the result is normalized and written into pFloatArray->f[0..3]
+----------------------------------*/
+enum QuatInterpolation
+{
+    QUATINTERP_NLERP = 0,   ///< normalized linear interpolation : cheap, but the speed isn't constant
+    QUATINTERP_FASTSLERP,   ///< nlerp with t corrected by a polynomial of t and dot(q0,q1) : close to slerp (< 1e-3 rad)
+    QUATINTERP_SLERP,       ///< exact : acos and sin per curve
+};
+
+/// what the evaluator keeps for each quaternion curve
+struct QuatEvalInfo
+{
+    QuatCurve*      pCurve;
+    float*          pTarget;    ///< 4 floats (FloatArray::f); can be NULL
+    int             cursor;     ///< key before the time of the previous evaluation
+    int             :32;
+};
+
+//------------------------------------------------------------------------------------------
+/// t of the nlerp that gives about the slerp at t, for d = |dot(q0,q1)|
+//------------------------------------------------------------------------------------------
+INLINE float fastSlerpT(float t, float d)
+{
+    float a = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+    float b = 0.848013f + d * (-1.06021f + d * 0.215638f);
+    float k = a * (t - 0.5f) * (t - 0.5f) + b;
+    return t + t * (t - 0.5f) * (t - 1.0f) * k;
+}
+//------------------------------------------------------------------------------------------
+/// weights of q0 and q1 for a slerp at t, for d = |dot(q0,q1)|
+//------------------------------------------------------------------------------------------
+INLINE void slerpWeights(float t, float d, float &w0, float &w1)
+{
+    if(d > 0.9995f)
+    {
+        // sin(theta) too small : nlerp is exact enough
+        w0 = 1.0f - t;
+        w1 = t;
+        return;
+    }
+    float theta = acosf(d);
+    float invSin = 1.0f / sinf(theta);
+    w0 = sinf((1.0f - t) * theta) * invSin;
+    w1 = sinf(t * theta) * invSin;
+}
+
+//------------------------------------------------------------------------------------------
+/// \brief evaluates many QuatCurves for a time and writes the quaternions into their targets.
+/// A cursor per curve remembers the keys of the previous evaluation, like MayaCurveEvaluator.
+/// The keys are gathered into SoA blocks (x[], y[], z[], w[]) and interpolated 4 curves at once
+/// with SSE2 (8 with AVX)
+//------------------------------------------------------------------------------------------
+struct QuatCurveEvaluator
+{
+    std::vector<QuatEvalInfo>   curves;
+    QuatInterpolation           mode;
+    // SoA scratch of evaluate() : the 2 keys of each curve, the interpolation factor and the result
+    std::vector<float>          q0[4];
+    std::vector<float>          q1[4];
+    std::vector<float>          u;
+    std::vector<float>          w0, w1;     ///< QUATINTERP_SLERP weights
+    std::vector<float>          result[4];
+
+    QuatCurveEvaluator() : mode(QUATINTERP_FASTSLERP) {}
+    void clear() { curves.clear(); }
+    /// every curve of the pool; a curve writes its pFloatArray if it has 4 floats
+    void build(QuatCurvePool *pPool)
+    {
+        clear();
+        for(int i=0; pPool && (i<pPool->n); i++)
+        {
+            QuatCurve *pC = pPool->p[i];
+            FloatArray *pFA = pC->pFloatArray;
+            addCurve(pC, (pFA && (pFA->dim >= 4)) ? pFA->f : NULL);
+        }
+    }
+    void addCurve(QuatCurve *pCurve, float *pTarget)
+    {
+        QuatEvalInfo ci;
+        memset(&ci, 0, sizeof(QuatEvalInfo));
+        ci.pCurve = pCurve;
+        ci.pTarget = pTarget;
+        curves.push_back(ci);
+    }
+    /// key before t (clamped to [0, nKeys-2]), from the cursor of the curve
+    static inline int findKey(QuatEvalInfo &ci, float t)
+    {
+        const QuatReadKey *k = ci.pCurve->key;
+        int n = ci.pCurve->nKeys - 1; // segments
+        int i = ci.cursor;
+        if((t >= k[i].time) && ((i+1 >= n) || (t < k[i+1].time)))
+            return i;
+        if((i+1 < n) && (t >= k[i+1].time) && ((i+2 >= n) || (t < k[i+2].time)))
+            i++;
+        else {
+            int lo = 0, hi = n - 1;
+            while(lo < hi)
+            {
+                int mid = (lo + hi + 1) >> 1;
+                if(k[mid].time <= t)
+                    lo = mid;
+                else
+                    hi = mid - 1;
+            }
+            i = lo;
+        }
+        ci.cursor = i;
+        return i;
+    }
+    /// curves [c0, c1) : keys gathered to SoA, then interpolated several curves at once
+    void evaluateRange(float time, int c0, int c1)
+    {
+        for(int c=c0; c<c1; c++)
+        {
+            QuatEvalInfo &ci = curves[c];
+            const QuatReadKey *k = ci.pCurve->key;
+            int n = ci.pCurve->nKeys;
+            const float *pa, *pb;
+            float uc = 0.0f;
+            if(n == 0)
+            {
+                static const float identity[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+                pa = pb = identity;
+            } else if((n == 1) || (time <= k[0].time)) {
+                pa = pb = k[0].value;
+            } else if(time >= k[n-1].time) {
+                pa = pb = k[n-1].value;
+            } else {
+                int i = findKey(ci, time);
+                float dt = k[i+1].time - k[i].time;
+                uc = dt > 0.0f ? (time - k[i].time) / dt : 1.0f;
+                uc = uc < 0.0f ? 0.0f : (uc > 1.0f ? 1.0f : uc);
+                pa = k[i].value;
+                pb = k[i+1].value;
+            }
+            for(int j=0; j<4; j++)
+            {
+                q0[j][c] = pa[j];
+                q1[j][c] = pb[j];
+            }
+            u[c] = uc;
+        }
+        if(mode == QUATINTERP_SLERP)
+        {
+            for(int c=c0; c<c1; c++)
+            {
+                float d = q0[0][c]*q1[0][c] + q0[1][c]*q1[1][c] + q0[2][c]*q1[2][c] + q0[3][c]*q1[3][c];
+                slerpWeights(u[c], fabsf(d), w0[c], w1[c]);
+            }
+        }
+        int c = c0;
+#if defined(BK3D_AVX)
+        for(; c + 8 <= c1; c += 8)
+        {
+            __m256 ax = _mm256_loadu_ps(&q0[0][c]), ay = _mm256_loadu_ps(&q0[1][c]), az = _mm256_loadu_ps(&q0[2][c]), aw = _mm256_loadu_ps(&q0[3][c]);
+            __m256 bx = _mm256_loadu_ps(&q1[0][c]), by = _mm256_loadu_ps(&q1[1][c]), bz = _mm256_loadu_ps(&q1[2][c]), bw = _mm256_loadu_ps(&q1[3][c]);
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_add_ps(_mm256_mul_ps(az, bz), _mm256_mul_ps(aw, bw)));
+            // shortest path : the sign of d goes on the weight of q1
+            __m256 sign = _mm256_and_ps(d, _mm256_set1_ps(-0.0f));
+            __m256 ka, kb;
+            if(mode == QUATINTERP_SLERP)
+            {
+                ka = _mm256_loadu_ps(&w0[c]);
+                kb = _mm256_loadu_ps(&w1[c]);
+            } else {
+                __m256 t = _mm256_loadu_ps(&u[c]);
+                if(mode == QUATINTERP_FASTSLERP)
+                {
+                    __m256 ad = _mm256_xor_ps(d, sign);
+                    __m256 a = _mm256_add_ps(_mm256_set1_ps(1.0904f), _mm256_mul_ps(ad, _mm256_add_ps(_mm256_set1_ps(-3.2452f),
+                        _mm256_mul_ps(ad, _mm256_sub_ps(_mm256_set1_ps(3.55645f), _mm256_mul_ps(ad, _mm256_set1_ps(1.43519f)))))));
+                    __m256 b = _mm256_add_ps(_mm256_set1_ps(0.848013f), _mm256_mul_ps(ad, _mm256_add_ps(_mm256_set1_ps(-1.06021f), _mm256_mul_ps(ad, _mm256_set1_ps(0.215638f)))));
+                    __m256 th = _mm256_sub_ps(t, _mm256_set1_ps(0.5f));
+                    __m256 k = _mm256_add_ps(_mm256_mul_ps(a, _mm256_mul_ps(th, th)), b);
+                    t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, th), _mm256_sub_ps(t, _mm256_set1_ps(1.0f))), k));
+                }
+                ka = _mm256_sub_ps(_mm256_set1_ps(1.0f), t);
+                kb = t;
+            }
+            kb = _mm256_xor_ps(kb, sign);
+            __m256 rx = _mm256_add_ps(_mm256_mul_ps(ka, ax), _mm256_mul_ps(kb, bx));
+            __m256 ry = _mm256_add_ps(_mm256_mul_ps(ka, ay), _mm256_mul_ps(kb, by));
+            __m256 rz = _mm256_add_ps(_mm256_mul_ps(ka, az), _mm256_mul_ps(kb, bz));
+            __m256 rw = _mm256_add_ps(_mm256_mul_ps(ka, aw), _mm256_mul_ps(kb, bw));
+            __m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rx, rx), _mm256_mul_ps(ry, ry)), _mm256_add_ps(_mm256_mul_ps(rz, rz), _mm256_mul_ps(rw, rw)));
+            __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(_mm256_max_ps(len2, _mm256_set1_ps(1e-30f))));
+            _mm256_storeu_ps(&result[0][c], _mm256_mul_ps(rx, inv));
+            _mm256_storeu_ps(&result[1][c], _mm256_mul_ps(ry, inv));
+            _mm256_storeu_ps(&result[2][c], _mm256_mul_ps(rz, inv));
+            _mm256_storeu_ps(&result[3][c], _mm256_mul_ps(rw, inv));
+        }
+#endif
+#if defined(BK3D_SSE2)
+        for(; c + 4 <= c1; c += 4)
+        {
+            __m128 ax = _mm_loadu_ps(&q0[0][c]), ay = _mm_loadu_ps(&q0[1][c]), az = _mm_loadu_ps(&q0[2][c]), aw = _mm_loadu_ps(&q0[3][c]);
+            __m128 bx = _mm_loadu_ps(&q1[0][c]), by = _mm_loadu_ps(&q1[1][c]), bz = _mm_loadu_ps(&q1[2][c]), bw = _mm_loadu_ps(&q1[3][c]);
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+            __m128 sign = _mm_and_ps(d, _mm_set1_ps(-0.0f));
+            __m128 ka, kb;
+            if(mode == QUATINTERP_SLERP)
+            {
+                ka = _mm_loadu_ps(&w0[c]);
+                kb = _mm_loadu_ps(&w1[c]);
+            } else {
+                __m128 t = _mm_loadu_ps(&u[c]);
+                if(mode == QUATINTERP_FASTSLERP)
+                {
+                    __m128 ad = _mm_xor_ps(d, sign);
+                    __m128 a = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(ad, _mm_add_ps(_mm_set1_ps(-3.2452f),
+                        _mm_mul_ps(ad, _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(ad, _mm_set1_ps(1.43519f)))))));
+                    __m128 b = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(ad, _mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(ad, _mm_set1_ps(0.215638f)))));
+                    __m128 th = _mm_sub_ps(t, _mm_set1_ps(0.5f));
+                    __m128 k = _mm_add_ps(_mm_mul_ps(a, _mm_mul_ps(th, th)), b);
+                    t = _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, th), _mm_sub_ps(t, _mm_set1_ps(1.0f))), k));
+                }
+                ka = _mm_sub_ps(_mm_set1_ps(1.0f), t);
+                kb = t;
+            }
+            kb = _mm_xor_ps(kb, sign);
+            __m128 rx = _mm_add_ps(_mm_mul_ps(ka, ax), _mm_mul_ps(kb, bx));
+            __m128 ry = _mm_add_ps(_mm_mul_ps(ka, ay), _mm_mul_ps(kb, by));
+            __m128 rz = _mm_add_ps(_mm_mul_ps(ka, az), _mm_mul_ps(kb, bz));
+            __m128 rw = _mm_add_ps(_mm_mul_ps(ka, aw), _mm_mul_ps(kb, bw));
+            __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_add_ps(_mm_mul_ps(rz, rz), _mm_mul_ps(rw, rw)));
+            __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_max_ps(len2, _mm_set1_ps(1e-30f))));
+            _mm_storeu_ps(&result[0][c], _mm_mul_ps(rx, inv));
+            _mm_storeu_ps(&result[1][c], _mm_mul_ps(ry, inv));
+            _mm_storeu_ps(&result[2][c], _mm_mul_ps(rz, inv));
+            _mm_storeu_ps(&result[3][c], _mm_mul_ps(rw, inv));
+        }
+#endif
+        for(; c<c1; c++)
+        {
+            float d = q0[0][c]*q1[0][c] + q0[1][c]*q1[1][c] + q0[2][c]*q1[2][c] + q0[3][c]*q1[3][c];
+            float ka, kb;
+            if(mode == QUATINTERP_SLERP)
+            {
+                ka = w0[c];
+                kb = w1[c];
+            } else {
+                float t = mode == QUATINTERP_FASTSLERP ? fastSlerpT(u[c], fabsf(d)) : u[c];
+                ka = 1.0f - t;
+                kb = t;
+            }
+            if(d < 0.0f)
+                kb = -kb;
+            float r[4], len2 = 0.0f;
+            for(int j=0; j<4; j++)
+            {
+                r[j] = ka * q0[j][c] + kb * q1[j][c];
+                len2 += r[j] * r[j];
+            }
+            float inv = 1.0f / sqrtf(len2 > 1e-30f ? len2 : 1e-30f);
+            for(int j=0; j<4; j++)
+                result[j][c] = r[j] * inv;
+        }
+        for(c=c0; c<c1; c++)
+        {
+            float *p = curves[c].pTarget;
+            if(p)
+            {
+                p[0] = result[0][c]; p[1] = result[1][c]; p[2] = result[2][c]; p[3] = result[3][c];
+            }
+        }
+    }
+    /// evaluates all the curves at time
+    /// \param maxThreads : see parallelFor(). Chunks of 4096 curves
+    void evaluate(float time, int maxThreads = 1)
+    {
+        int n = (int)curves.size();
+        if(n == 0)
+            return;
+        for(int j=0; j<4; j++)
+        {
+            q0[j].resize(n);
+            q1[j].resize(n);
+            result[j].resize(n);
+        }
+        u.resize(n);
+        w0.resize(n);
+        w1.resize(n);
+        const int chunk = 4096;
+        parallelFor((n + chunk - 1) / chunk, [&](int i) {
+            evaluateRange(time, i * chunk, (i+1) * chunk < n ? (i+1) * chunk : n);
+        }, maxThreads);
+    }
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief straightforward slerp of one QuatCurve in double precision, straight from its keys
+/// (binary search). Slow : meant as a reference for QuatCurveEvaluator
+//------------------------------------------------------------------------------------------
+INLINE void evaluateQuatCurve(const QuatCurve *pCurve, float t, float q[4])
+{
+    int n = pCurve->nKeys;
+    const QuatReadKey *k = pCurve->key;
+    if(n == 0)
+    {
+        q[0] = q[1] = q[2] = 0.0f; q[3] = 1.0f;
+        return;
+    }
+    int lo = 0;
+    double u = 0.0;
+    if((n > 1) && (t > k[0].time))
+    {
+        if(t >= k[n-1].time)
+            lo = n - 1;
+        else {
+            int hi = n - 2;
+            while(lo < hi)
+            {
+                int mid = (lo + hi + 1) >> 1;
+                if(k[mid].time <= t)
+                    lo = mid;
+                else
+                    hi = mid - 1;
+            }
+            double dt = (double)k[lo+1].time - (double)k[lo].time;
+            u = dt > 0.0 ? ((double)t - (double)k[lo].time) / dt : 1.0;
+        }
+    }
+    const float *a = k[lo].value;
+    const float *b = k[lo + (u > 0.0 ? 1 : 0)].value;
+    double d = 0.0;
+    for(int j=0; j<4; j++)
+        d += (double)a[j] * (double)b[j];
+    double sb = d < 0.0 ? -1.0 : 1.0;
+    d = fabs(d);
+    double ka = 1.0 - u, kb = u;
+    if(d < 1.0 - 1e-9)
+    {
+        double theta = acos(d);
+        ka = sin((1.0 - u) * theta) / sin(theta);
+        kb = sin(u * theta) / sin(theta);
+    }
+    double r[4], len2 = 0.0;
+    for(int j=0; j<4; j++)
+    {
+        r[j] = ka * a[j] + sb * kb * b[j];
+        len2 += r[j] * r[j];
+    }
+    double inv = len2 > 0.0 ? 1.0 / sqrt(len2) : 0.0;
+    for(int j=0; j<4; j++)
+        q[j] = (float)(r[j] * inv);
+}
+
+/*--------------------------------
+FloatArray connections
+The FloatArrayPools of the Meshes, Bones and IKHandles connect a source FloatArray (the result of
+a curve...) to a destination, by its name.
+ConnectionGraph resolves all of them once into copies of floats, ordered so that a copy writing
+into a FloatArray comes before the copies reading it. Each frame is then a linear loop.
+Destinations :
+- the one given by ConnectionGraph::setTarget(), if any
+- else the destName as "transform_component" (see findComponentf())
+- else the destName as a component of the owner ("translate"...) for Bones and IKHandles
+- for Meshes : a Blendshape weight, by the name of its BS Slot or by its index in ival[0]
+pfTarget shares its bytes with ival[] and comes from the file : it is never used as a pointer.
+----------------------------------*/
+/// one copy of the compiled connections
+struct ConnectionOp
+{
+    const float*    pSrc;
+    float*          pDst;
+    unsigned char*  pDirty;     ///< set to 1 when written; can be NULL
+    int             n;          ///< amount of floats
+    int             group;      ///< independent subgraph
+};
+/// destination of a connection given by the application (see ConnectionGraph::setTarget())
+struct ConnectionTarget
+{
+    const FloatArrayPool::Connection*   pCn;
+    float*                              pDst;
+    Bone*                               pBone;  ///< owner of pDst, or NULL
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief the connections of a file compiled into a flat program of copies.
+/// Copies that share nothing (no FloatArray read after being written, no destination, no dirty
+/// flag) are in different groups : run() can process the groups in parallel
+//------------------------------------------------------------------------------------------
+struct ConnectionGraph
+{
+    std::vector<ConnectionOp>   ops;        ///< by group, in dependency order inside a group
+    std::vector<int>            chunks;     ///< ops [chunks[i], chunks[i+1]) : whole groups, for run()
+    std::vector<unsigned int>   targetBones; ///< IDs of the bones the ops write into : for TransformUpdater::markDirty()
+    std::vector<ConnectionTarget> targets;  ///< setTarget() : kept by clear()
+    int                         nConnections;
+    int                         nByName;    ///< destinations found through destName
+    int                         nUnresolved;
+    int                         nCycles;    ///< ops in a dependency cycle : put after the others of their group
+    int                         nGroups;
+
+    ConnectionGraph() { clear(); }
+    void clear()
+    {
+        ops.clear();
+        chunks.clear();
+        targetBones.clear();
+        nConnections = nByName = nUnresolved = nCycles = nGroups = 0;
+    }
+    /// \brief writes the source of a connection into pDst instead of its destName. Before compile()
+    /// \param pBone : the bone pDst belongs to, if any : it gets dirty when written
+    void setTarget(const FloatArrayPool::Connection *pCn, float *pDst, Bone *pBone = NULL)
+    {
+        for(size_t t=0; t<targets.size(); t++)
+            if(targets[t].pCn == pCn)
+            {
+                targets[t].pDst = pDst;
+                targets[t].pBone = pBone;
+                return;
+            }
+        ConnectionTarget t = { pCn, pDst, pBone };
+        targets.push_back(t);
+    }
+    /// destination of a connection from setTarget()
+    bool resolveExplicitTarget(const FloatArrayPool::Connection &cn, ConnectionOp &op)
+    {
+        for(size_t t=0; t<targets.size(); t++)
+        {
+            if(targets[t].pCn != &cn)
+                continue;
+            op.pDst = targets[t].pDst;
+            if(targets[t].pBone)
+            {
+                op.pDirty = &targets[t].pBone->BoneData().bDirty;
+                targetBones.push_back(targets[t].pBone->ID);
+            }
+            return op.pDst != NULL;
+        }
+        return false;
+    }
+    /// destination of a connection of a Bone or IKHandle
+    bool resolveBoneTarget(FileHeader *pH, const NameIndex *pIndex, Bone *pBone, const FloatArrayPool::Connection &cn, ConnectionOp &op)
+    {
+        unsigned int component = 0;
+        const char *comp = strrchr(cn.destName, '_');
+        Bone *pt = NULL;
+        if(comp)
+        {
+            component = getTransformComponentId(comp + 1);
+            if(component)
+                pt = findTransform(pH, cn.destName, (int)(comp - cn.destName), pIndex);
+        }
+        if(!pt)
+        {
+            component = getTransformComponentId(cn.destName);
+            pt = pBone;
+        }
+        if(!component)
+            return false;
+        op.pDst = getTransformComponentf(pt, component, &op.pDirty);
+        if(!op.pDst)
+            return false;
+        int sz = component == TRANSFCOMP_Quat ? 4 : 3;
+        op.n = op.n < sz ? op.n : sz;
+        targetBones.push_back(pt->ID);
+        nByName++;
+        return true;
+    }
+    /// destination of a connection of a Mesh : a Blendshape weight
+    bool resolveMeshTarget(Mesh *pMesh, const FloatArrayPool::Connection &cn, ConnectionOp &op)
+    {
+        FloatArray *pW = pMesh->pBSWeights;
+        if(pW)
+        {
+            op.n = 1;
+            for(int i=0; pMesh->pBSSlots && (i<pMesh->pBSSlots->n) && (i<pW->dim); i++)
+                if(!strncmp(pMesh->pBSSlots->p[i]->name, cn.destName, NODENAMESZ))
+                {
+                    op.pDst = pW->f + i;
+                    nByName++;
+                    return true;
+                }
+            if((cn.ival[1] == 0) && (cn.ival[0] >= 0) && (cn.ival[0] < pW->dim))
+            {
+                op.pDst = pW->f + cn.ival[0];
+                return true;
+            }
+        }
+        return false;
+    }
+    /// resolves and orders all the connections of the file
+    /// \param pIndex : optional, to find the destNames without a linear search
+    /// \return the amount of ops
+    int compile(FileHeader *pH, const NameIndex *pIndex = NULL)
+    {
+        clear();
+        //
+        // the pools and their owner. An IKHandle can also be in the transforms
+        //
+        struct Owner { FloatArrayPool *pPool; Bone *pBone; Mesh *pMesh; };
+        std::vector<Owner> owners;
+        for(int i=0; pH->pMeshes && (i<pH->pMeshes->n); i++)
+            if(pH->pMeshes->p[i]->pFloatArrays)
+            {
+                Owner o = { pH->pMeshes->p[i]->pFloatArrays, NULL, pH->pMeshes->p[i] };
+                owners.push_back(o);
+            }
+        for(int i=0; pH->pTransforms && (i<pH->pTransforms->nBones); i++)
+            if(pH->pTransforms->pBones[i]->pFloatArrays)
+            {
+                Owner o = { pH->pTransforms->pBones[i]->pFloatArrays, pH->pTransforms->pBones[i], NULL };
+                owners.push_back(o);
+            }
+        for(int i=0; pH->pIKHandles && (i<pH->pIKHandles->n); i++)
+            if(pH->pIKHandles->p[i]->pFloatArrays)
+            {
+                Owner o = { pH->pIKHandles->p[i]->pFloatArrays, pH->pIKHandles->p[i], NULL };
+                owners.push_back(o);
+            }
+        std::stable_sort(owners.begin(), owners.end(), [](const Owner &a, const Owner &b) { return a.pPool < b.pPool; });
+        owners.erase(std::unique(owners.begin(), owners.end(), [](const Owner &a, const Owner &b) { return a.pPool == b.pPool; }), owners.end());
+        //
+        // ops, with the whole source FloatArray to find who reads what
+        //
+        std::vector<const float*> srcEnd;
+        for(size_t o=0; o<owners.size(); o++)
+        {
+            FloatArrayPool *pPool = owners[o].pPool;
+            for(int c=0; c<pPool->n; c++)
+            {
+                const FloatArrayPool::Connection &cn = pPool->p[c];
+                nConnections++;
+                FloatArray *pSrc = cn.p;
+                if(!pSrc || (pSrc->dim <= 0))
+                {
+                    nUnresolved++;
+                    continue;
+                }
+                ConnectionOp op;
+                memset(&op, 0, sizeof(ConnectionOp));
+                op.pSrc = pSrc->f;
+                op.n = pSrc->dim;
+                bool ok = resolveExplicitTarget(cn, op)
+                    || (owners[o].pMesh ? resolveMeshTarget(owners[o].pMesh, cn, op)
+                                        : resolveBoneTarget(pH, pIndex, owners[o].pBone, cn, op));
+                if(!ok)
+                {
+                    nUnresolved++;
+                    continue;
+                }
+                ops.push_back(op);
+                srcEnd.push_back(pSrc->f + pSrc->dim);
+            }
+        }
+        std::sort(targetBones.begin(), targetBones.end());
+        targetBones.erase(std::unique(targetBones.begin(), targetBones.end()), targetBones.end());
+        int n = (int)ops.size();
+        if(n == 0)
+            return 0;
+        //
+        // edges : op a writes into the source FloatArray of op b. The FloatArrays don't overlap,
+        // so in the sources sorted by address, the ones overlapping [dst, dst+n) are contiguous
+        //
+        std::vector<int> bySrc(n);
+        for(int i=0; i<n; i++)
+            bySrc[i] = i;
+        std::sort(bySrc.begin(), bySrc.end(), [&](int a, int b) { return ops[a].pSrc < ops[b].pSrc; });
+        std::vector<int> edgeFirst(n + 1, 0), edges, inDegree(n, 0);
+        for(int a=0; a<n; a++)
+        {
+            const float *d0 = ops[a].pDst, *d1 = ops[a].pDst + ops[a].n;
+            int lo = 0, hi = n; // first source starting at d1 or after
+            while(lo < hi)
+            {
+                int mid = (lo + hi) >> 1;
+                if(ops[bySrc[mid]].pSrc < d1)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            for(int k=lo-1; (k >= 0) && (srcEnd[bySrc[k]] > d0); k--)
+            {
+                edges.push_back(bySrc[k]);
+                inDegree[bySrc[k]]++;
+            }
+            edgeFirst[a+1] = (int)edges.size();
+        }
+        //
+        // groups : union of the ops linked by an edge, by a destination or by a dirty flag
+        //
+        std::vector<int> parent(n);
+        for(int i=0; i<n; i++)
+            parent[i] = i;
+        auto root = [&](int i) { while(parent[i] != i) i = parent[i] = parent[parent[i]]; return i; };
+        auto unite = [&](int a, int b) { a = root(a); b = root(b); if(a != b) parent[b] = a; };
+        for(int a=0; a<n; a++)
+            for(int e=edgeFirst[a]; e<edgeFirst[a+1]; e++)
+                unite(a, edges[e]);
+        std::vector<int> byDst(bySrc);
+        std::sort(byDst.begin(), byDst.end(), [&](int a, int b) { return ops[a].pDst < ops[b].pDst; });
+        const float *dstEnd = NULL;
+        for(int k=0; k<n; k++)
+        {
+            const ConnectionOp &op = ops[byDst[k]];
+            if((k > 0) && (op.pDst < dstEnd))
+                unite(byDst[k-1], byDst[k]);
+            if(op.pDst + op.n > dstEnd)
+                dstEnd = op.pDst + op.n;
+        }
+        std::sort(byDst.begin(), byDst.end(), [&](int a, int b) { return ops[a].pDirty < ops[b].pDirty; });
+        for(int k=1; k<n; k++)
+            if(ops[byDst[k]].pDirty && (ops[byDst[k]].pDirty == ops[byDst[k-1]].pDirty))
+                unite(byDst[k-1], byDst[k]);
+        std::vector<int> groupId(n, -1);
+        for(int i=0; i<n; i++)
+        {
+            int r = root(i);
+            if(groupId[r] < 0)
+                groupId[r] = nGroups++;
+            ops[i].group = groupId[r];
+        }
+        //
+        // levels (Kahn), then the ops by group and level
+        //
+        std::vector<int> level(n, 0), queue;
+        for(int i=0; i<n; i++)
+            if(inDegree[i] == 0)
+                queue.push_back(i);
+        int maxLevel = 0;
+        for(size_t q=0; q<queue.size(); q++)
+        {
+            int a = queue[q];
+            maxLevel = level[a] > maxLevel ? level[a] : maxLevel;
+            for(int e=edgeFirst[a]; e<edgeFirst[a+1]; e++)
+            {
+                int b = edges[e];
+                level[b] = level[a] + 1 > level[b] ? level[a] + 1 : level[b];
+                if(--inDegree[b] == 0)
+                    queue.push_back(b);
+            }
+        }
+        for(int i=0; i<n; i++)
+            if(inDegree[i] > 0)
+            {
+                level[i] = maxLevel + 1;
+                nCycles++;
+            }
+        std::vector<int> order(n);
+        for(int i=0; i<n; i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return ops[a].group != ops[b].group ? ops[a].group < ops[b].group : level[a] < level[b]; });
+        std::vector<ConnectionOp> sorted(n);
+        for(int i=0; i<n; i++)
+            sorted[i] = ops[order[i]];
+        ops.swap(sorted);
+        //
+        // chunks of whole groups, of at least 256 ops
+        //
+        chunks.push_back(0);
+        for(int i=1; i<n; i++)
+            if((ops[i].group != ops[i-1].group) && (i - chunks.back() >= 256))
+                chunks.push_back(i);
+        chunks.push_back(n);
+        return n;
+    }
+    /// copies ops [i0, i1)
+    inline void runRange(int i0, int i1)
+    {
+        for(int i=i0; i<i1; i++)
+        {
+            const ConnectionOp &op = ops[i];
+            for(int k=0; k<op.n; k++)
+                op.pDst[k] = op.pSrc[k];
+            if(op.pDirty)
+                *op.pDirty = 1;
+        }
+    }
+    /// propagates all the connections. To call after the curves got evaluated
+    /// \param maxThreads : see parallelFor()
+    void run(int maxThreads = 1)
+    {
+        int nChunks = (int)chunks.size() - 1;
+        if((maxThreads == 1) || (nChunks <= 1))
+        {
+            runRange(0, (int)ops.size());
+            return;
+        }
+        parallelFor(nChunks, [&](int i) { runRange(chunks[i], chunks[i+1]); }, maxThreads);
+    }
+};
+
+} //namespace bk3d
+
+#endif //__BK3DANIMATION__
@@ -92,8 +92,11 @@ namespace bk3d
 #define NODE_BONE 18
 #define NODE_RIGIDBODY  19
 #define NODE_CONSTRAINT 20
+// extension nodes : built after load by bk3dMeshUtils.h
+#define NODE_MESHLETPOOL 21
+#define NODE_LODPOOL    22
 //...
-#define NODE_END        21
+#define NODE_END        23
 /// @}
 //
 // Macro to reserve 64 bits in any case : x86 or x64
@@ -0,0 +1,276 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** Blendshapes of the bk3d Meshes on the CPU : the weighted deltas of
+ ** Mesh::pBSSlots summed into the position and normal of the base Slots.
+ **/
+#ifndef __BK3DBLENDSHAPES__
+#define __BK3DBLENDSHAPES__
+#include "bk3dEx.h"
+#include "bk3dMeshUtils.h" // BK3D_SSE2, findAttribute(), readAttributeComponent()
+#include "bk3dParallel.h"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#if defined(BK3D_SSE2) && defined(__AVX__)
+#   include <immintrin.h>
+#   define BK3D_AVX
+#endif
+
+namespace bk3d
+{
+/*--------------------------------
+Blendshapes
+- Blendshape i is the Slot i of Mesh::pBSSlots; its weight is Mesh::pBSWeights->f[i]
+- a Blendshape Slot has MESH_POSITION deltas, maybe MESH_NORMAL deltas, and MESH_VERTEXID when
+  it only lists some vertices (sparse). The deltas are read once, as floats
+- the base position and normal are kept aside : update() restarts from them, adds the shapes
+  having a weight != 0 and writes the result into the base Slots of the Mesh
+- nothing is done as long as no weight changed
+----------------------------------*/
+#define BK3D_BLENDRANGE 4096 ///< vertices per parallel job
+
+/// how update() computes
+enum BlendShapeSIMD
+{
+    BLENDSIMD_SCALAR = 0,
+    BLENDSIMD_SSE2,
+    BLENDSIMD_AVX,
+};
+INLINE BlendShapeSIMD getBestBlendShapeSIMD()
+{
+#if defined(BK3D_AVX)
+    return BLENDSIMD_AVX;
+#elif defined(BK3D_SSE2)
+    return BLENDSIMD_SSE2;
+#else
+    return BLENDSIMD_SCALAR;
+#endif
+}
+
+//------------------------------------------------------------------------------------------
+/// dst[i] += w * src[i] for i in [0, n)
+//------------------------------------------------------------------------------------------
+INLINE void addScaled(float *dst, const float *src, float w, int n, BlendShapeSIMD simd)
+{
+    int i = 0;
+#if defined(BK3D_AVX)
+    if(simd == BLENDSIMD_AVX)
+    {
+        __m256 w8 = _mm256_set1_ps(w);
+        for(; i+8<=n; i+=8)
+            _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(w8, _mm256_loadu_ps(src + i))));
+    }
+#endif
+#if defined(BK3D_SSE2)
+    if(simd != BLENDSIMD_SCALAR)
+    {
+        __m128 w4 = _mm_set1_ps(w);
+        for(; i+4<=n; i+=4)
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(w4, _mm_loadu_ps(src + i))));
+    }
+#endif
+    for(; i<n; i++)
+        dst[i] += w * src[i];
+}
+
+/// deltas of one Blendshape Slot
+struct BlendShape
+{
+    int                       weightId;   ///< in Mesh::pBSWeights
+    std::vector<unsigned int> vertexIds;  ///< sorted. Empty if the shape has all the vertices
+    std::vector<float>        deltas;     ///< position + normal (6 floats) per vertex of the shape
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief Blendshapes of one Mesh : the deltas, the base position and normal, and the weights
+/// of the last update()
+//------------------------------------------------------------------------------------------
+struct BlendShapeMesh
+{
+    Mesh*                   pMesh;
+    int                     nVertices;
+    bool                    bHasNormals;
+    Attribute*              pPos;       ///< where the result goes
+    Attribute*              pNormal;    ///< NULL if no normal (or not float)
+    std::vector<float>      base;       ///< position + normal (6 floats) per vertex, without any shape
+    std::vector<BlendShape> shapes;
+    std::vector<float>      weights;    ///< of the last update()
+    std::vector<int>        active;     ///< shapes with a weight != 0 in the last update()
+    unsigned int            frame;      ///< incremented by each update() that did something
+
+    BlendShapeMesh() : pMesh(NULL), nVertices(0), bHasNormals(false), pPos(NULL), pNormal(NULL), frame(0) {}
+    /// \return false if the Mesh has no Blendshape or no float positions
+    bool build(Mesh *pM)
+    {
+        pMesh = pM;
+        nVertices = 0;
+        shapes.clear();
+        pPos = findAttribute(pM, MESH_POSITION);
+        pNormal = findAttribute(pM, MESH_NORMAL);
+        if(!pM->pBSSlots || (pM->pBSSlots->n == 0) || !pM->pBSWeights || !pPos || (pPos->formatGL != GL_FLOAT) || (pPos->numComp < 3))
+            return false;
+        if(pNormal && ((pNormal->formatGL != GL_FLOAT) || (pNormal->numComp < 3)))
+            pNormal = NULL;
+        bHasNormals = pNormal != NULL;
+        nVertices = pM->pSlots->p[pPos->slot]->vertexCount;
+        base.resize(nVertices * 6);
+        for(int v=0; v<nVertices; v++)
+        {
+            float *p = &base[v * 6];
+            readPosition(pPos, v, NULL, p);
+            for(int c=0; c<3; c++)
+                p[3+c] = pNormal ? readAttributeComponent(pNormal, v, c) : 0.0f;
+        }
+        for(int i=0; (i<pM->pBSSlots->n) && (i<pM->pBSWeights->dim); i++)
+        {
+            Slot *pSlot = pM->pBSSlots->p[i];
+            Attribute *pDPos = NULL, *pDNormal = NULL, *pVtxId = NULL;
+            for(int a=0; pSlot->pAttributes && (a<pSlot->pAttributes->n); a++)
+            {
+                Attribute *pA = pSlot->pAttributes->p[a];
+                if(!strcmp(pA->name, MESH_POSITION))
+                    pDPos = pA;
+                else if(!strcmp(pA->name, MESH_NORMAL))
+                    pDNormal = pA;
+                else if(!strcmp(pA->name, MESH_VERTEXID))
+                    pVtxId = pA;
+            }
+            if(!pDPos || (pDPos->numComp < 3) || (!pVtxId && ((int)pSlot->vertexCount != nVertices)))
+                continue;
+            if(pDNormal && (pDNormal->numComp < 3))
+                pDNormal = NULL;
+            shapes.push_back(BlendShape());
+            BlendShape &bs = shapes.back();
+            bs.weightId = i;
+            // sparse : sorted by vertex, so that a range of vertices is a range of the shape
+            std::vector<std::pair<unsigned int, unsigned int> > order; // vertex, entry
+            for(unsigned int k=0; k<pSlot->vertexCount; k++)
+            {
+                unsigned int v = pVtxId ? (unsigned int)readAttributeComponent(pVtxId, k, 0) : k;
+                if(v < (unsigned int)nVertices)
+                    order.push_back(std::pair<unsigned int, unsigned int>(v, k));
+            }
+            if(pVtxId)
+                std::sort(order.begin(), order.end());
+            bs.deltas.resize(order.size() * 6);
+            if(pVtxId)
+                bs.vertexIds.resize(order.size());
+            for(size_t e=0; e<order.size(); e++)
+            {
+                if(pVtxId)
+                    bs.vertexIds[e] = order[e].first;
+                for(int c=0; c<3; c++)
+                {
+                    bs.deltas[e * 6 + c] = readAttributeComponent(pDPos, order[e].second, c);
+                    bs.deltas[e * 6 + 3 + c] = pDNormal && bHasNormals ? readAttributeComponent(pDNormal, order[e].second, c) : 0.0f;
+                }
+            }
+        }
+        weights.assign(pM->pBSWeights->dim, 0.0f);
+        active.clear();
+        return !shapes.empty();
+    }
+    /// \return true if a weight of Mesh::pBSWeights differs from the last update(). Fills active
+    bool updateWeights()
+    {
+        bool bChanged = false;
+        for(size_t i=0; i<weights.size(); i++)
+            if(weights[i] != pMesh->pBSWeights->f[i])
+            {
+                weights[i] = pMesh->pBSWeights->f[i];
+                bChanged = true;
+            }
+        active.clear();
+        for(size_t s=0; s<shapes.size(); s++)
+            if(weights[shapes[s].weightId] != 0.0f)
+                active.push_back((int)s);
+        return bChanged;
+    }
+    /// vertices [v0, v1) : base + the active shapes, into out (6 floats per vertex, from v0)
+    void blendRange(int v0, int v1, float *out, BlendShapeSIMD simd) const
+    {
+        memcpy(out, &base[v0 * 6], (v1 - v0) * 6 * sizeof(float));
+        for(size_t a=0; a<active.size(); a++)
+        {
+            const BlendShape &bs = shapes[active[a]];
+            float w = weights[bs.weightId];
+            if(bs.vertexIds.empty())
+            {
+                addScaled(out, &bs.deltas[v0 * 6], w, (v1 - v0) * 6, simd);
+                continue;
+            }
+            size_t e = std::lower_bound(bs.vertexIds.begin(), bs.vertexIds.end(), (unsigned int)v0) - bs.vertexIds.begin();
+            for(; (e < bs.vertexIds.size()) && (bs.vertexIds[e] < (unsigned int)v1); e++)
+            {
+                float *o = out + (bs.vertexIds[e] - v0) * 6;
+                const float *d = &bs.deltas[e * 6];
+                for(int c=0; c<6; c++)
+                    o[c] += w * d[c];
+            }
+        }
+        if(!bHasNormals)
+            return;
+        for(int v=0; v<v1-v0; v++)
+        {
+            float *n = out + v * 6 + 3;
+            float len2 = n[0]*n[0] + n[1]*n[1] + n[2]*n[2];
+            float inv = len2 > 0.0f ? 1.0f / sqrtf(len2) : 0.0f;
+            n[0] *= inv; n[1] *= inv; n[2] *= inv;
+        }
+    }
+    /// \brief blends the shapes into the base Slots of the Mesh if a weight changed (or bForce)
+    /// \param maxThreads : see parallelFor(). Ranges of BK3D_BLENDRANGE vertices
+    /// \return the amount of vertices written
+    int update(int maxThreads = 0, BlendShapeSIMD simd = getBestBlendShapeSIMD(), bool bForce = false)
+    {
+        if((nVertices == 0) || (!updateWeights() && !bForce))
+            return 0;
+        int nRanges = (nVertices + BK3D_BLENDRANGE - 1) / BK3D_BLENDRANGE;
+        parallelFor(nRanges, [&](int r) {
+            int v0 = r * BK3D_BLENDRANGE;
+            int v1 = v0 + BK3D_BLENDRANGE < nVertices ? v0 + BK3D_BLENDRANGE : nVertices;
+            // 96KB per range : per thread rather than on the stack of the job threads
+            static thread_local std::vector<float> s_tmp;
+            s_tmp.resize(BK3D_BLENDRANGE * 6);
+            float *tmp = &s_tmp[0];
+            blendRange(v0, v1, tmp, simd);
+            for(int v=v0; v<v1; v++)
+            {
+                memcpy((char*)pPos->pAttributeBufferData + v * pPos->strideBytes, tmp + (v - v0) * 6, 3 * sizeof(float));
+                if(pNormal)
+                    memcpy((char*)pNormal->pAttributeBufferData + v * pNormal->strideBytes, tmp + (v - v0) * 6 + 3, 3 * sizeof(float));
+            }
+        }, maxThreads);
+        frame++;
+        return nVertices;
+    }
+};
+
+} //namespace bk3d
+
+#endif //__BK3DBLENDSHAPES__
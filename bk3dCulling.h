@@ -0,0 +1,214 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** View-frustum culling of the bounding volumes of bk3d Meshes and PrimGroups.
+ ** The bounds are copied once in a SoA layout so that they can be tested 4 by 4.
+ ** Also the occlusion test against a depth buffer read back on the CPU
+ **/
+#ifndef __BK3DCULLING__
+#define __BK3DCULLING__
+#include "bk3dMeshUtils.h"
+
+namespace bk3d
+{
+///
+/// \brief bounding spheres and boxes of many items (Meshes, PrimGroups...) in SoA layout
+///
+/// Arrays are padded to a multiple of 4. An item gets culled if either its sphere or its box is
+/// out of the frustum. A missing volume (zero radius, empty box) never culls anything
+///
+struct BoundsSoA
+{
+    unsigned int        n;
+    std::vector<float>  sx, sy, sz, r;      ///< spheres
+    std::vector<float>  cx, cy, cz;         ///< box centers
+    std::vector<float>  ex, ey, ez;         ///< box half extents
+
+    BoundsSoA() : n(0) {}
+    void resize(unsigned int count)
+    {
+        n = count;
+        unsigned int padded = (count + 3) & ~3;
+        std::vector<float>* arrays[] = { &sx, &sy, &sz, &r, &cx, &cy, &cz, &ex, &ey, &ez };
+        for(int a=0; a<10; a++)
+            arrays[a]->assign(padded, 0.0f);
+    }
+    void set(unsigned int i, const BSphere &bs, const AABBox &bb)
+    {
+        sx[i] = bs.pos.x; sy[i] = bs.pos.y; sz[i] = bs.pos.z;
+        r[i] = bs.radius > 0.0f ? bs.radius : 1e30f;
+        bool validBox = (bb.max.x >= bb.min.x) && (bb.max.y >= bb.min.y) && (bb.max.z >= bb.min.z)
+            && ((bb.max.x > bb.min.x) || (bb.max.y > bb.min.y) || (bb.max.z > bb.min.z));
+        cx[i] = (bb.min.x + bb.max.x)*0.5f; cy[i] = (bb.min.y + bb.max.y)*0.5f; cz[i] = (bb.min.z + bb.max.z)*0.5f;
+        ex[i] = validBox ? (bb.max.x - bb.min.x)*0.5f : 1e30f;
+        ey[i] = validBox ? (bb.max.y - bb.min.y)*0.5f : 1e30f;
+        ez[i] = validBox ? (bb.max.z - bb.min.z)*0.5f : 1e30f;
+    }
+    /// the box of an item, or the box of its sphere if it has no box. false if it has neither
+    bool getBox(unsigned int i, float *c, float *e) const
+    {
+        if(ex[i] < 1e30f)
+        {
+            c[0] = cx[i]; c[1] = cy[i]; c[2] = cz[i];
+            e[0] = ex[i]; e[1] = ey[i]; e[2] = ez[i];
+            return true;
+        }
+        if(r[i] < 1e30f)
+        {
+            c[0] = sx[i]; c[1] = sy[i]; c[2] = sz[i];
+            e[0] = e[1] = e[2] = r[i];
+            return true;
+        }
+        return false;
+    }
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief the 6 normalized planes of the frustum of a (column-major, OpenGL) matrix.
+/// With a world-view-projection matrix, the planes are in the object space of the bounds
+//------------------------------------------------------------------------------------------
+INLINE void extractFrustumPlanes(const float *m, float planes[6][4])
+{
+    for(int p=0; p<6; p++)
+    {
+        int row = p >> 1;
+        float s = (p & 1) ? -1.0f : 1.0f;
+        for(int c=0; c<4; c++)
+            planes[p][c] = m[c*4+3] + s * m[c*4+row];
+        float l = sqrtf(planes[p][0]*planes[p][0] + planes[p][1]*planes[p][1] + planes[p][2]*planes[p][2]);
+        if(l > 0.0f)
+            for(int c=0; c<4; c++)
+                planes[p][c] /= l;
+    }
+}
+
+//------------------------------------------------------------------------------------------
+/// \brief tests all the bounds against the frustum planes
+/// \param visible : receives 1 or 0 per item (at least b.n entries)
+/// \return the amount of visible items
+//------------------------------------------------------------------------------------------
+INLINE unsigned int cullBounds(const BoundsSoA &b, const float planes[6][4], unsigned char *visible)
+{
+    unsigned int count = 0;
+    unsigned int i = 0;
+#ifdef BK3D_SSE2
+    for(; i+4 <= b.n; i+=4)
+    {
+        __m128 sx = _mm_loadu_ps(&b.sx[i]), sy = _mm_loadu_ps(&b.sy[i]), sz = _mm_loadu_ps(&b.sz[i]), r = _mm_loadu_ps(&b.r[i]);
+        __m128 cx = _mm_loadu_ps(&b.cx[i]), cy = _mm_loadu_ps(&b.cy[i]), cz = _mm_loadu_ps(&b.cz[i]);
+        __m128 ex = _mm_loadu_ps(&b.ex[i]), ey = _mm_loadu_ps(&b.ey[i]), ez = _mm_loadu_ps(&b.ez[i]);
+        __m128 out = _mm_setzero_ps();
+        for(int p=0; p<6; p++)
+        {
+            __m128 nx = _mm_set1_ps(planes[p][0]), ny = _mm_set1_ps(planes[p][1]), nz = _mm_set1_ps(planes[p][2]);
+            __m128 d = _mm_set1_ps(planes[p][3]);
+            // sphere : n.s + d + r < 0
+            __m128 ds = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, sx), _mm_mul_ps(ny, sy)), _mm_add_ps(_mm_mul_ps(nz, sz), d));
+            out = _mm_or_ps(out, _mm_cmplt_ps(_mm_add_ps(ds, r), _mm_setzero_ps()));
+            // box : n.c + d + |n|.e < 0
+            __m128 db = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), d));
+            __m128 pr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(planes[p][0])), ex), _mm_mul_ps(_mm_set1_ps(fabsf(planes[p][1])), ey)),
+                                   _mm_mul_ps(_mm_set1_ps(fabsf(planes[p][2])), ez));
+            out = _mm_or_ps(out, _mm_cmplt_ps(_mm_add_ps(db, pr), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(out);
+        for(int k=0; k<4; k++)
+        {
+            visible[i+k] = (mask >> k) & 1 ? 0 : 1;
+            count += visible[i+k];
+        }
+    }
+#endif
+    for(; i<b.n; i++)
+    {
+        bool in = true;
+        for(int p=0; (p<6) && in; p++)
+        {
+            const float *pl = planes[p];
+            if(pl[0]*b.sx[i] + pl[1]*b.sy[i] + pl[2]*b.sz[i] + pl[3] + b.r[i] < 0.0f)
+                in = false;
+            else if(pl[0]*b.cx[i] + pl[1]*b.cy[i] + pl[2]*b.cz[i] + pl[3]
+                + fabsf(pl[0])*b.ex[i] + fabsf(pl[1])*b.ey[i] + fabsf(pl[2])*b.ez[i] < 0.0f)
+                in = false;
+        }
+        visible[i] = in ? 1 : 0;
+        count += visible[i];
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------------------
+/// \brief occlusion test of a box against a max-depth buffer (one level of a Hi-Z pyramid)
+///
+/// The box is projected with mvp (column-major, OpenGL). It is occluded if its nearest depth is
+/// behind the farthest depth of all the texels its screen rectangle covers.
+/// \param maxDepth : w*h depths in [0,1], 'stride' floats apart (2 for a min/max RG pyramid : pass &data[1])
+/// \param maxTexels : bigger footprints are reported visible (not worth the loop)
+/// \param dilate : texels added around the footprint, when mvp and maxDepth aren't from the same frame
+/// \return false when not sure (box crossing the near plane, off-screen...)
+//------------------------------------------------------------------------------------------
+INLINE bool isBoxOccluded(const float *mvp, const float *center, const float *extent,
+    const float *maxDepth, int w, int h, int stride, int maxTexels, int dilate=0)
+{
+    float xmin = 1e30f, ymin = 1e30f, xmax = -1e30f, ymax = -1e30f, zmin = 1e30f;
+    for(int c=0; c<8; c++)
+    {
+        float p[3] = { center[0] + ((c & 1) ? extent[0] : -extent[0]),
+                       center[1] + ((c & 2) ? extent[1] : -extent[1]),
+                       center[2] + ((c & 4) ? extent[2] : -extent[2]) };
+        float clip[4];
+        for(int r=0; r<4; r++)
+            clip[r] = mvp[r]*p[0] + mvp[4+r]*p[1] + mvp[8+r]*p[2] + mvp[12+r];
+        if(clip[3] <= 1e-5f)
+            return false;
+        float x = clip[0]/clip[3], y = clip[1]/clip[3], z = clip[2]/clip[3];
+        if(x < xmin) xmin = x;
+        if(x > xmax) xmax = x;
+        if(y < ymin) ymin = y;
+        if(y > ymax) ymax = y;
+        if(z < zmin) zmin = z;
+    }
+    if((xmax < -1.0f) || (xmin > 1.0f) || (ymax < -1.0f) || (ymin > 1.0f))
+        return false;
+    int x0 = (int)((xmin*0.5f + 0.5f) * (float)w), x1 = (int)((xmax*0.5f + 0.5f) * (float)w);
+    int y0 = (int)((ymin*0.5f + 0.5f) * (float)h), y1 = (int)((ymax*0.5f + 0.5f) * (float)h);
+    x0 -= dilate; y0 -= dilate; x1 += dilate; y1 += dilate;
+    x0 = x0 < 0 ? 0 : x0; y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 >= w ? w-1 : x1; y1 = y1 >= h ? h-1 : y1;
+    if((x1-x0+1) * (y1-y0+1) > maxTexels)
+        return false;
+    float depth = zmin*0.5f + 0.5f;
+    for(int y=y0; y<=y1; y++)
+        for(int x=x0; x<=x1; x++)
+            if(depth <= maxDepth[(y*w + x)*stride])
+                return false;
+    return true;
+}
+
+} //namespace bk3d
+
+#endif //__BK3DCULLING__
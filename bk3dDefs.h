@@ -333,6 +333,16 @@ enum D3D11_PRIMITIVE_TOPOLOGY
   typedef GLenum GLType;
   typedef GLenum GLTopology;
 #endif
+// compact vertex formats (see bk3dMeshUtils.h). Not part of the GL 1.1 header
+#ifndef GL_HALF_FLOAT
+#define    GL_HALF_FLOAT                     0x140B
+#endif
+#ifndef GL_INT_2_10_10_10_REV
+#define    GL_INT_2_10_10_10_REV             0x8D9F
+#endif
+#ifndef GL_UNSIGNED_INT_2_10_10_10_REV
+#define    GL_UNSIGNED_INT_2_10_10_10_REV    0x8368
+#endif
 enum OGL_PATCH_VERTICES
 {
 	GL_PATCH_VERTICES_0	= 32,
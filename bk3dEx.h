@@ -37,6 +37,7 @@
 #ifndef __BK3DEX__
 #define __BK3DEX__
 #include "bk3dBase.h"
+#include <vector>
 #ifndef DBGASSERT
 #   pragma message("DBGASSERT wasn't defined. Defining it as NULL")
 #   define DBGASSERT(a)
@@ -911,101 +912,235 @@ struct Constraint : public Bone
 
 
 //------------------------------------------------------------------------------------------
-/// Helper to find some components.
-/// The name MUST be in the form of name + '_' + component-name
+/// \brief Name index of the Nodes of a file : flat open-addressing hash table of
+/// (kind, Node::name) -> Node. Build it once after load; lookups don't allocate and
+/// can take a name that isn't 0-terminated (like the node part of "node_component")
 //------------------------------------------------------------------------------------------
-INLINE float* findComponentf(FileHeader *pH, const char *compname, unsigned char **pDirty)
+enum NameIndexKind
 {
-    float *pComp = NULL;
-    if(!compname)
-        return NULL;
-    char *name, *comp = NULL;
-    int l = (int)strlen(compname)+1;
-    name = new char[l];
-#if     _MSC_VER > 1310
-    strcpy_s(name, l, compname);
-#else
-    strcpy(name, compname);
-#endif
-    for(int i=l-1; i>=0; i--) if(name[i] == '_') 
-    { 
-        name[i] = '\0';
-        comp = name + i + 1;
-        break;
+    NAMEIDX_TRANSFORM = 0,
+    NAMEIDX_MESH,
+    NAMEIDX_MATERIAL,
+    NAMEIDX_MAYACURVE,
+    NAMEIDX_QUATCURVE,
+};
+struct NameIndex
+{
+    struct Entry
+    {
+        unsigned int    hash;   ///< 0 for an empty entry
+        int             kind;
+        Node*           pNode;
+    };
+    std::vector<Entry>  entries;
+    unsigned int        mask;
+    int                 count;
+
+    NameIndex() : mask(0), count(0) {}
+    static unsigned int hashName(const char *name, int len, int kind)
+    {
+        unsigned int h = 2166136261u ^ (unsigned int)kind;
+        for(int i=0; (i<len) && name[i]; i++)
+            h = (h ^ (unsigned char)name[i]) * 16777619u;
+        return h ? h : 1;
+    }
+    /// (re)builds the table from the pools of the file
+    void build(FileHeader *pH)
+    {
+        int n = 0;
+        if(pH->pTransforms)   n += pH->pTransforms->nBones;
+        if(pH->pMeshes)       n += pH->pMeshes->n;
+        if(pH->pMaterials)    n += pH->pMaterials->nMaterials;
+        if(pH->pMayaCurves)   n += pH->pMayaCurves->n;
+        if(pH->pQuatCurves)   n += pH->pQuatCurves->n;
+        // at most half full
+        unsigned int sz = 16;
+        while(sz < (unsigned int)n*2)
+            sz <<= 1;
+        Entry empty = { 0, 0, NULL };
+        entries.assign(sz, empty);
+        mask = sz - 1;
+        count = 0;
+        for(int i=0; pH->pTransforms && (i<pH->pTransforms->nBones); i++)
+            insert(pH->pTransforms->pBones[i], NAMEIDX_TRANSFORM);
+        for(int i=0; pH->pMeshes && (i<pH->pMeshes->n); i++)
+            insert(pH->pMeshes->p[i], NAMEIDX_MESH);
+        for(int i=0; pH->pMaterials && (i<pH->pMaterials->nMaterials); i++)
+            insert(pH->pMaterials->pMaterials[i], NAMEIDX_MATERIAL);
+        for(int i=0; pH->pMayaCurves && (i<pH->pMayaCurves->n); i++)
+            insert(pH->pMayaCurves->p[i], NAMEIDX_MAYACURVE);
+        for(int i=0; pH->pQuatCurves && (i<pH->pQuatCurves->n); i++)
+            insert(pH->pQuatCurves->p[i], NAMEIDX_QUATCURVE);
     }
-    if(!comp) {
-        delete [] name;
+    /// the first Node of a name is kept, as the linear searches did
+    void insert(Node *pNode, int kind)
+    {
+        int len = (int)strnlen(pNode->name, NODENAMESZ);
+        if(find(pNode->name, len, kind))
+            return;
+        unsigned int h = hashName(pNode->name, len, kind);
+        unsigned int i = h & mask;
+        while(entries[i].hash)
+            i = (i + 1) & mask;
+        entries[i].hash = h;
+        entries[i].kind = kind;
+        entries[i].pNode = pNode;
+        count++;
+    }
+    /// \param len : amount of chars of name to use
+    Node* find(const char *name, int len, int kind) const
+    {
+        if(entries.empty())
+            return NULL;
+        unsigned int h = hashName(name, len, kind);
+        for(unsigned int i = h & mask; entries[i].hash; i = (i + 1) & mask)
+        {
+            const Entry &e = entries[i];
+            if((e.hash == h) && (e.kind == kind) && !strncmp(e.pNode->name, name, len)
+                && ((len >= NODENAMESZ) || (e.pNode->name[len] == '\0')))
+                return e.pNode;
+        }
         return NULL;
     }
-    //search in transforms
-    for(int i=0; i<pH->pTransforms->nBones; i++)
+    Node* find(const char *name, int kind) const { return find(name, (int)strlen(name), kind); }
+    Bone* findTransform(const char *name) const { return (Bone*)find(name, NAMEIDX_TRANSFORM); }
+};
+
+//------------------------------------------------------------------------------------------
+/// transform of a name : through the index when there is one, else a linear search
+//------------------------------------------------------------------------------------------
+INLINE Bone* findTransform(FileHeader *pH, const char *name, int len, const NameIndex *pIndex)
+{
+    if(pIndex)
+        return (Bone*)pIndex->find(name, len, NAMEIDX_TRANSFORM);
+    for(int i=0; pH->pTransforms && (i<pH->pTransforms->nBones); i++)
     {
         Bone *pt = pH->pTransforms->pBones[i];
-        if(strcmp(pt->name, name))
-            continue;
-        if(pDirty) *pDirty = &(pt->BoneData().bDirty);
-        if(!strcmp(comp, "translate")) {        
-            pComp = pt->Pos();
-        } else if(!strcmp(comp, "scale")) {     
-            pComp = ((Transform*)pt)->Scale();
-        } else if(!strcmp(comp, "rotation")) {  
-            pComp = ((Transform*)pt)->TransformData().rotation;
-        } else if((strcmp(comp, "quat"))) {  
-            pComp = pt->BoneData().quat;
-        } //some more to add...
+        if(!strncmp(pt->name, name, len) && ((len >= NODENAMESZ) || (pt->name[len] == '\0')))
+            return pt;
+    }
+    return NULL;
+}
+//------------------------------------------------------------------------------------------
+/// component of a transform from a TRANSFCOMP_xxx value (see above)
+//------------------------------------------------------------------------------------------
+INLINE float* getTransformComponentf(Bone *pt, unsigned int component, unsigned char **pDirty)
+{
+    float *pComp = NULL;
+    if(pDirty) *pDirty = &(pt->BoneData().bDirty);
+    switch(component)
+    {
+      case TRANSFCOMP_pos:
+        pComp = pt->Pos();
+        break;
+      case TRANSFCOMP_scale:
+        pComp = ((Transform*)pt)->Scale();
+        break;
+      case TRANSFCOMP_rotation:
+        pComp = ((Transform*)pt)->Rotation();
+        break;
+      case TRANSFCOMP_Quat:
+        pComp = pt->Quat();
+        break;
+      case TRANSFCOMP_bindpose_matrix:
+        pComp = pt->MatrixInvBindpose();
+        break;
+      case TRANSFCOMP_rotationOrder:
+      case TRANSFCOMP_scalePivot:
+      case TRANSFCOMP_scalePivotTranslate:
+      case TRANSFCOMP_rotationPivot:
+      case TRANSFCOMP_rotationPivotTranslate:
+      case TRANSFCOMP_rotationOrientation:
+      case TRANSFCOMP_jointOrientation:
+        //assert(!"TODO");
         break;
     }
+    return pComp;
+}
+//------------------------------------------------------------------------------------------
+/// TRANSFCOMP_xxx of a component name ("translate", "scale", "rotation", "quat"); 0 if unknown
+//------------------------------------------------------------------------------------------
+INLINE unsigned int getTransformComponentId(const char *comp)
+{
+    if(!strcmp(comp, "translate"))
+        return TRANSFCOMP_pos;
+    else if(!strcmp(comp, "scale"))
+        return TRANSFCOMP_scale;
+    else if(!strcmp(comp, "rotation"))
+        return TRANSFCOMP_rotation;
+    else if(!strcmp(comp, "quat"))
+        return TRANSFCOMP_Quat;
+    return 0; //some more to add...
+}
+
+//------------------------------------------------------------------------------------------
+/// Helper to find some components.
+/// The name MUST be in the form of name + '_' + component-name
+/// \param pIndex : optional index built after load. Without it the transforms are searched linearly
+//------------------------------------------------------------------------------------------
+INLINE float* findComponentf(FileHeader *pH, const char *compname, unsigned char **pDirty, const NameIndex *pIndex=NULL)
+{
+    if(!compname)
+        return NULL;
+    const char *comp = strrchr(compname, '_');
+    if(!comp)
+        return NULL;
+    int len = (int)(comp - compname);
+    comp++;
+    unsigned int component = getTransformComponentId(comp);
+    if(!component)
+        return NULL;
+    //search in transforms
+    Bone *pt = findTransform(pH, compname, len, pIndex);
     //search in Mesh ? (TODO later)
     //...
-    delete [] name;
-    return pComp;
+    return pt ? getTransformComponentf(pt, component, pDirty) : NULL;
 }
 
 //------------------------------------------------------------------------------------------
 /// Helper to find some components.
 /// This one requires a name and a component value from TRANSFCOMP_xxx (see above)
 //------------------------------------------------------------------------------------------
-INLINE float* findComponentf(FileHeader *pH, const char *name, unsigned int component, unsigned char **pDirty, Bone** ppBone=NULL)
+INLINE float* findComponentf(FileHeader *pH, const char *name, unsigned int component, unsigned char **pDirty, Bone** ppBone=NULL, const NameIndex *pIndex=NULL)
 {
-    float *pComp = NULL;
     //search in transforms
-    for(int i=0; i<pH->pTransforms->nBones; i++)
+    Bone *pt = findTransform(pH, name, (int)strlen(name), pIndex);
+    if(!pt)
+        return NULL;
+    if(ppBone) *ppBone = pt;
+    return getTransformComponentf(pt, component, pDirty);
+}
+
+//------------------------------------------------------------------------------------------
+/// Batch version of findComponentf() to bind many channels at once
+//------------------------------------------------------------------------------------------
+struct ComponentRequest
+{
+    const char*     name;       ///< transform name
+    unsigned int    component;  ///< TRANSFCOMP_xxx
+};
+struct ComponentBinding
+{
+    float*          pComp;      ///< NULL if not found
+    unsigned char*  pDirty;
+    Bone*           pBone;
+};
+/// \return the amount of requests that got resolved
+INLINE int resolveComponents(const NameIndex &index, const ComponentRequest *pReqs, int n, ComponentBinding *pOut)
+{
+    int resolved = 0;
+    for(int i=0; i<n; i++)
     {
-        Bone *pt = pH->pTransforms->pBones[i];
-        if(strcmp(pt->name, name))
-            continue;
-        if(ppBone) *ppBone = pt;
-        if(pDirty) *pDirty = &(pt->BoneData().bDirty);
-        switch(component)
-        {
-          case TRANSFCOMP_pos:
-            pComp = pt->Pos();
-            break;
-          case TRANSFCOMP_scale:
-            pComp = ((Transform*)pt)->Scale();
-            break;
-          case TRANSFCOMP_rotation:
-            pComp = ((Transform*)pt)->Rotation();
-            break;
-          case TRANSFCOMP_Quat:
-            pComp = pt->Quat();
-            break;
-          case TRANSFCOMP_bindpose_matrix:
-            pComp = pt->MatrixInvBindpose();
-            break;
-          case TRANSFCOMP_rotationOrder:
-          case TRANSFCOMP_scalePivot:
-          case TRANSFCOMP_scalePivotTranslate:
-          case TRANSFCOMP_rotationPivot:
-          case TRANSFCOMP_rotationPivotTranslate:
-          case TRANSFCOMP_rotationOrientation:
-          case TRANSFCOMP_jointOrientation:
-            //assert(!"TODO");
-            break;
-        }
-        break;
+        ComponentBinding &b = pOut[i];
+        b.pComp = NULL;
+        b.pDirty = NULL;
+        b.pBone = index.findTransform(pReqs[i].name);
+        if(b.pBone)
+            b.pComp = getTransformComponentf(b.pBone, pReqs[i].component, &b.pDirty);
+        if(b.pComp)
+            resolved++;
     }
-    return pComp;
+    return resolved;
 }
 
 } //namespace bk3d
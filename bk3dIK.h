@@ -0,0 +1,727 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** Inverse kinematics of the bk3d IKHandles : CCD or FABRIK over the effector
+ ** chains, with the TransformDOF limits, and the roll/rotate influence handles.
+ **/
+#ifndef __BK3DIK__
+#define __BK3DIK__
+#include "bk3dEx.h"
+#include "bk3dTransforms.h" // TransformUpdater, quatToMatrix3()
+#include "bk3dParallel.h"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+namespace bk3d
+{
+/*--------------------------------
+IK
+- a chain is the list of the effector transforms of an IKHandle, root to tip. The end-effector
+  is the bone tail (posBoneTail) of the tip; the target is the position of the handle
+- the solver runs after the transform update : it rotates the local matrices of the chain joints
+  (BoneDataType::matrix, translation and scale kept) and marks them with
+  TransformUpdater::markLocalChanged(). A second updateChanged() moves their subtrees
+- a joint restarts each frame from its pose before IK : the one of the animation when something
+  rewrote its local matrix, the previous one otherwise. IK doesn't accumulate over the frames
+- the TransformDOF limits are relative to the rest pose (the local matrices at build()) :
+  DOF_CONE : the swing off the cone axis is at most DOFAlpha degrees
+  DOF_SINGLE_AXIS_X : a hinge around X, within [AxisLimitStart, AxisLimitStart + AxisLimitRange]
+  DOF_TWIST_ALONG_BONE : only the twist around the bone, same range
+  the cone axis and X are taken in the frame of TransformDOF::quat when it is set
+- NODE_IKHANDLEROLLINFLUENCE : the twist of the handle (around its X) is spread on the joints,
+  around their bones, scaled by their effector weights
+- NODE_IKHANDLEROTATEINFLUENCE : the joints copy the rotation of the handle, scaled the same way
+- handles are solved by priority (IKHandleData::priority, lowest first). The chains sharing joints,
+  or under the joints of another chain, form a group solved in order; the groups run in parallel
+----------------------------------*/
+#define BK3D_IKDEFAULTITER  20
+#define BK3D_IKTOLERANCE    1e-3f ///< relative to the length of the chain
+
+/// what solves the NODE_IKHANDLE chains
+enum IKMethod
+{
+    IKMETHOD_CCD = 0,   ///< cyclic coordinate descent : one joint at a time, tip to root
+    IKMETHOD_FABRIK,    ///< forward and backward reaching on the positions, then back to rotations
+};
+
+//------------------------------------------------------------------------------------------
+/// quaternions as x,y,z,w
+//------------------------------------------------------------------------------------------
+INLINE void quatMul(float *r, const float *a, const float *b)
+{
+    float x = a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1];
+    float y = a[3]*b[1] - a[0]*b[2] + a[1]*b[3] + a[2]*b[0];
+    float z = a[3]*b[2] + a[0]*b[1] - a[1]*b[0] + a[2]*b[3];
+    float w = a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2];
+    r[0] = x; r[1] = y; r[2] = z; r[3] = w;
+}
+INLINE void quatConj(float *r, const float *q)
+{
+    r[0] = -q[0]; r[1] = -q[1]; r[2] = -q[2]; r[3] = q[3];
+}
+INLINE void quatNormalize(float *q)
+{
+    float l = sqrtf(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+    float inv = l > 0.0f ? 1.0f / l : 0.0f;
+    q[0] *= inv; q[1] *= inv; q[2] *= inv; q[3] = l > 0.0f ? q[3] * inv : 1.0f;
+}
+/// r = q v q*. r can be v
+INLINE void quatRotate(float *r, const float *q, const float *v)
+{
+    float t[3] = { 2.0f*(q[1]*v[2] - q[2]*v[1]), 2.0f*(q[2]*v[0] - q[0]*v[2]), 2.0f*(q[0]*v[1] - q[1]*v[0]) };
+    float x = v[0] + q[3]*t[0] + q[1]*t[2] - q[2]*t[1];
+    float y = v[1] + q[3]*t[1] + q[2]*t[0] - q[0]*t[2];
+    float z = v[2] + q[3]*t[2] + q[0]*t[1] - q[1]*t[0];
+    r[0] = x; r[1] = y; r[2] = z;
+}
+/// axis normalized; angle in radians
+INLINE void quatFromAxisAngle(float *q, const float *axis, float a)
+{
+    float s = sinf(0.5f * a);
+    q[0] = axis[0] * s; q[1] = axis[1] * s; q[2] = axis[2] * s; q[3] = cosf(0.5f * a);
+}
+/// shortest rotation bringing the direction of a onto the one of b. Identity if one is null
+INLINE void quatFromTo(float *q, const float *a, const float *b)
+{
+    q[0] = q[1] = q[2] = 0.0f; q[3] = 1.0f;
+    float la = sqrtf(a[0]*a[0] + a[1]*a[1] + a[2]*a[2]), lb = sqrtf(b[0]*b[0] + b[1]*b[1] + b[2]*b[2]);
+    if((la < 1e-12f) || (lb < 1e-12f))
+        return;
+    float inv = 1.0f / (la * lb);
+    float d = (a[0]*b[0] + a[1]*b[1] + a[2]*b[2]) * inv;
+    if(d < -0.999999f)
+    {
+        // opposite : any axis orthogonal to a
+        float axis[3] = { 0.0f, -a[2], a[1] };
+        if(fabsf(a[0]) > fabsf(a[2]))
+        {
+            axis[0] = -a[1]; axis[1] = a[0]; axis[2] = 0.0f;
+        }
+        float l = sqrtf(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+        q[0] = axis[0] / l; q[1] = axis[1] / l; q[2] = axis[2] / l; q[3] = 0.0f;
+        return;
+    }
+    q[0] = (a[1]*b[2] - a[2]*b[1]) * inv;
+    q[1] = (a[2]*b[0] - a[0]*b[2]) * inv;
+    q[2] = (a[0]*b[1] - a[1]*b[0]) * inv;
+    q[3] = 1.0f + d;
+    quatNormalize(q);
+}
+/// the same rotation axis, the angle scaled by s
+INLINE void quatScaleAngle(float *r, const float *q, float s)
+{
+    float sg = q[3] < 0.0f ? -1.0f : 1.0f;
+    float w = sg * q[3] > 1.0f ? 1.0f : sg * q[3];
+    float ls = sqrtf(q[0]*q[0] + q[1]*q[1] + q[2]*q[2]);
+    if(ls < 1e-9f)
+    {
+        r[0] = r[1] = r[2] = 0.0f; r[3] = 1.0f;
+        return;
+    }
+    float axis[3] = { sg * q[0] / ls, sg * q[1] / ls, sg * q[2] / ls };
+    quatFromAxisAngle(r, axis, 2.0f * acosf(w) * s);
+}
+/// angle of the rotation, in [0, pi]
+INLINE float quatAngle(const float *q)
+{
+    float w = fabsf(q[3]) > 1.0f ? 1.0f : fabsf(q[3]);
+    return 2.0f * acosf(w);
+}
+/// from a to b by t. Shortest path
+INLINE void quatSlerp(float *r, const float *a, const float *b, float t)
+{
+    float ia[4], d[4], s[4];
+    quatConj(ia, a);
+    quatMul(d, b, ia);
+    quatScaleAngle(s, d, t);
+    quatMul(r, s, a);
+}
+/// \brief q = swing * twist, twist being around axis (normalized)
+/// \return the angle of the twist, in radians, signed along axis
+INLINE float quatSwingTwist(const float *q, const float *axis, float *swing, float *twist)
+{
+    float p = q[0]*axis[0] + q[1]*axis[1] + q[2]*axis[2];
+    float t[4] = { axis[0]*p, axis[1]*p, axis[2]*p, q[3] };
+    if(t[0]*t[0] + t[1]*t[1] + t[2]*t[2] + t[3]*t[3] < 1e-12f)
+    {
+        t[0] = t[1] = t[2] = 0.0f; t[3] = 1.0f;
+    }
+    quatNormalize(t);
+    float it[4];
+    quatConj(it, t);
+    if(swing)
+        quatMul(swing, q, it);
+    if(twist)
+        memcpy(twist, t, sizeof(t));
+    float a = 2.0f * atan2f(t[0]*axis[0] + t[1]*axis[1] + t[2]*axis[2], t[3]);
+    return a > 3.14159265f ? a - 2.0f * 3.14159265f : (a < -3.14159265f ? a + 2.0f * 3.14159265f : a);
+}
+/// rotation of the 3x3 part of a column major matrix, its scale taken out (no shear expected)
+INLINE void quatFromMatrix(float *q, const float *m)
+{
+    float R[9]; // row major
+    for(int c=0; c<3; c++)
+    {
+        float l = sqrtf(m[c*4]*m[c*4] + m[c*4+1]*m[c*4+1] + m[c*4+2]*m[c*4+2]);
+        float inv = l > 0.0f ? 1.0f / l : 0.0f;
+        for(int r=0; r<3; r++)
+            R[r*3+c] = m[c*4+r] * inv;
+    }
+    float tr = R[0] + R[4] + R[8];
+    if(tr > 0.0f)
+    {
+        float s = 0.5f / sqrtf(tr + 1.0f);
+        q[3] = 0.25f / s;
+        q[0] = (R[7] - R[5]) * s; q[1] = (R[2] - R[6]) * s; q[2] = (R[3] - R[1]) * s;
+    }
+    else if((R[0] > R[4]) && (R[0] > R[8]))
+    {
+        float s = 2.0f * sqrtf(1.0f + R[0] - R[4] - R[8]);
+        q[3] = (R[7] - R[5]) / s;
+        q[0] = 0.25f * s; q[1] = (R[1] + R[3]) / s; q[2] = (R[2] + R[6]) / s;
+    }
+    else if(R[4] > R[8])
+    {
+        float s = 2.0f * sqrtf(1.0f + R[4] - R[0] - R[8]);
+        q[3] = (R[2] - R[6]) / s;
+        q[0] = (R[1] + R[3]) / s; q[1] = 0.25f * s; q[2] = (R[5] + R[7]) / s;
+    }
+    else
+    {
+        float s = 2.0f * sqrtf(1.0f + R[8] - R[0] - R[4]);
+        q[3] = (R[3] - R[1]) / s;
+        q[0] = (R[2] + R[6]) / s; q[1] = (R[5] + R[7]) / s; q[2] = 0.25f * s;
+    }
+    quatNormalize(q);
+}
+
+/// an IKHandle and the joints it drives
+struct IKChain
+{
+    IKHandle*                   pHandle;
+    unsigned int                handleID;
+    int                         type;       ///< nodeType of the handle
+    int                         priority;
+    int                         maxIter;
+    std::vector<unsigned int>   joints;     ///< bone IDs, root to tip
+    std::vector<float>          weights;    ///< effector weight of each joint
+    int                         iterations; ///< by the last solve()
+    float                       error;      ///< end-effector to handle after the last solve(), relative to the chain length
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief the IKHandles of a TransformPool, solved after each TransformUpdater update
+//------------------------------------------------------------------------------------------
+struct IKSolver
+{
+    TransformPool*              pPool;
+    TransformUpdater*           pUpdater;
+    IKMethod                    method;
+    float                       tolerance;  ///< relative to the length of a chain
+    std::vector<IKChain>        chains;
+    std::vector<int>            groupChains;///< chain indices : a group after the other, by priority in a group
+    std::vector<int>            groupFirst; ///< group g : groupChains[groupFirst[g], groupFirst[g+1])
+    std::vector<Bone*>          bones;      ///< by ID
+    std::vector<float>          restQuat;   ///< rotation of the local matrix of each bone at build(); 4 floats
+    std::vector<unsigned int>   jointIDs;   ///< the bones a chain rotates
+    std::vector<MatrixType>     base;       ///< local matrix of each of jointIDs before IK
+    std::vector<MatrixType>     last;       ///< local matrix of each of jointIDs after the last solve()
+    // stats of the last solve()
+    int                         nIterations;
+    int                         nConverged;
+    float                       maxError;
+
+    IKSolver() : pPool(NULL), pUpdater(NULL), method(IKMETHOD_CCD), tolerance(BK3D_IKTOLERANCE),
+        nIterations(0), nConverged(0), maxError(0.0f) {}
+    /// \brief the chains of the handles of pHandles whose transforms are in the pool of the updater.
+    /// The updater must have been built and updated once
+    void build(IKHandlePool *pHandles, TransformUpdater *pTU)
+    {
+        pUpdater = pTU;
+        pPool = pTU->pPool;
+        chains.clear();
+        groupChains.clear();
+        groupFirst.clear();
+        jointIDs.clear();
+        int n = pPool ? pPool->nBones : 0;
+        if((n == 0) || !pHandles)
+            return;
+        bones.assign(n, (Bone*)NULL);
+        restQuat.resize(n * 4);
+        for(int i=0; i<n; i++)
+        {
+            Bone *pB = pPool->pBones[i];
+            bones[pB->ID] = pB;
+            quatFromMatrix(&restQuat[pB->ID * 4], pPool->tableBoneData[pB->ID].matrix.m);
+        }
+        std::vector<int> jointSlot(n, -1);
+        for(int h=0; h<pHandles->n; h++)
+        {
+            IKHandle *pH = pHandles->p[h];
+            int ne = pH->getNumEffectors();
+            if((ne == 0) || (pH->parentPool.p != pPool) || (pH->ID >= (unsigned int)n))
+                continue;
+            IKChain c;
+            c.pHandle = pH;
+            c.handleID = pH->ID;
+            c.type = pH->nodeType;
+            c.priority = pH->pIKHandleData ? pH->Priority() : 0;
+            c.maxIter = pH->pIKHandleData && (pH->MaxIter() > 0) ? pH->MaxIter() : BK3D_IKDEFAULTITER;
+            c.iterations = 0;
+            c.error = 0.0f;
+            // the effectors are from the tip to the root
+            bool bValid = true;
+            for(int e=ne-1; e>=0; e--)
+            {
+                Bone *pB = pH->getEffectorTransform(e);
+                if(!pB || (pB->ID >= (unsigned int)n) || (pB->parentPool.p != pPool))
+                    bValid = false;
+                else {
+                    c.joints.push_back(pB->ID);
+                    c.weights.push_back(pH->pEffectorWeights ? pH->EffectorWeight(e) : 1.0f);
+                }
+            }
+            if(!bValid)
+                continue;
+            for(size_t j=0; j<c.joints.size(); j++)
+                if(jointSlot[c.joints[j]] < 0)
+                {
+                    jointSlot[c.joints[j]] = (int)jointIDs.size();
+                    jointIDs.push_back(c.joints[j]);
+                }
+            chains.push_back(c);
+        }
+        base.resize(jointIDs.size());
+        last.resize(jointIDs.size());
+        if(!last.empty())
+            memset(&last[0], 0xFF, last.size() * sizeof(MatrixType)); // NaNs : no previous solve
+        // groups : chains sharing joints, or under a joint of another chain (their targets and
+        // joints move with it). Union-find over the chains
+        int nc = (int)chains.size();
+        std::vector<int> owner(n, -1), uf(nc);
+        for(int c=0; c<nc; c++)
+            uf[c] = c;
+        auto find = [&](int c) { while(uf[c] != c) c = uf[c] = uf[uf[c]]; return c; };
+        for(int c=0; c<nc; c++)
+            for(size_t j=0; j<chains[c].joints.size(); j++)
+            {
+                int &o = owner[chains[c].joints[j]];
+                if(o < 0)
+                    o = c;
+                else
+                    uf[find(o)] = find(c);
+            }
+        for(int c=0; c<nc; c++)
+        {
+            std::vector<unsigned int> starts(chains[c].joints);
+            starts.push_back(chains[c].handleID);
+            for(size_t s=0; s<starts.size(); s++)
+                for(int b=pUpdater->parent[starts[s]]; b>=0; b=pUpdater->parent[b])
+                    if(owner[b] >= 0)
+                        uf[find(owner[b])] = find(c);
+        }
+        // by group, then priority, then depth of the root joint
+        groupChains.resize(nc);
+        std::vector<int> root(nc);
+        for(int c=0; c<nc; c++)
+        {
+            groupChains[c] = c;
+            root[c] = find(c);
+        }
+        std::sort(groupChains.begin(), groupChains.end(), [&](int a, int b) {
+            if(root[a] != root[b])
+                return root[a] < root[b];
+            if(chains[a].priority != chains[b].priority)
+                return chains[a].priority < chains[b].priority;
+            return pUpdater->depth[chains[a].joints[0]] < pUpdater->depth[chains[b].joints[0]];
+        });
+        for(int i=0; i<nc; i++)
+            if((i == 0) || (root[groupChains[i]] != root[groupChains[i-1]]))
+                groupFirst.push_back(i);
+        groupFirst.push_back(nc);
+    }
+    /// absolute matrix from the local ones up the hierarchy : valid while the chains get solved
+    void worldMatrix(int ID, float *m) const
+    {
+        const BoneDataType *pData = pPool->tableBoneData;
+        int p = pUpdater->parent[ID];
+        if(pUpdater->localSrc[ID] == LOCALSRC_ABS)
+            memcpy(m, pPool->tableMatrixAbs[ID].m, sizeof(MatrixType));
+        else if(p < 0)
+            memcpy(m, pData[ID].matrix.m, sizeof(MatrixType));
+        else
+        {
+            float mp[16];
+            worldMatrix(p, mp);
+            matrixMul(m, mp, pData[ID].matrix.m);
+        }
+    }
+    /// direction of the bone in its own frame : to its tail; X if it has none
+    void boneAxis(unsigned int ID, float *axis) const
+    {
+        const float *t = &pPool->tableBoneData[ID].posBoneTail.x;
+        float l = sqrtf(t[0]*t[0] + t[1]*t[1] + t[2]*t[2]);
+        if(l < 1e-9f)
+        {
+            axis[0] = 1.0f; axis[1] = axis[2] = 0.0f;
+            return;
+        }
+        axis[0] = t[0] / l; axis[1] = t[1] / l; axis[2] = t[2] / l;
+    }
+    /// \brief axis of the TransformDOF of the bone (of the cone, of the hinge) in its parent space
+    /// \return the mode, DOF_UNDEF when the joint is free
+    TransformDOFMode limitAxis(unsigned int ID, float *axis) const
+    {
+        const TransformDOF *pDOF = bones[ID]->pDOF;
+        if(!pDOF || (pDOF->mode == DOF_UNDEF))
+            return DOF_UNDEF;
+        // in the rest frame of the joint, then in its parent space
+        const float *dq = &pDOF->quat.x;
+        bool bHasFrame = dq[0]*dq[0] + dq[1]*dq[1] + dq[2]*dq[2] + dq[3]*dq[3] > 0.5f;
+        const float X[3] = { 1.0f, 0.0f, 0.0f };
+        if((pDOF->mode == DOF_TWIST_ALONG_BONE) || ((pDOF->mode == DOF_CONE) && !bHasFrame))
+            boneAxis(ID, axis);
+        else if(bHasFrame)
+            quatRotate(axis, dq, X);
+        else
+            memcpy(axis, X, sizeof(X));
+        quatRotate(axis, &restQuat[ID * 4], axis);
+        return pDOF->mode;
+    }
+    /// the TransformDOF of the bone applied to a local rotation q (parent space)
+    void applyDOF(unsigned int ID, float *q) const
+    {
+        float axis[3];
+        if(limitAxis(ID, axis) == DOF_UNDEF)
+            return;
+        const TransformDOF *pDOF = bones[ID]->pDOF;
+        const float *rest = &restQuat[ID * 4];
+        float irest[4], rel[4];
+        quatConj(irest, rest);
+        quatMul(rel, q, irest);
+        float swing[4], twist[4];
+        float a = quatSwingTwist(rel, axis, swing, twist);
+        if(pDOF->mode == DOF_CONE)
+        {
+            float maxSwing = pDOF->DOFAlpha * 3.14159265f / 180.0f;
+            float s = quatAngle(swing);
+            if(s > maxSwing)
+            {
+                float clamped[4];
+                quatScaleAngle(clamped, swing, maxSwing / s);
+                quatMul(rel, clamped, twist);
+            }
+        }
+        else
+        {
+            // hinge : the twist only, within the range
+            if(pDOF->AxisLimitRange > 0.0f)
+            {
+                float lo = pDOF->AxisLimitStart * 3.14159265f / 180.0f;
+                float hi = lo + pDOF->AxisLimitRange * 3.14159265f / 180.0f;
+                a = a < lo ? lo : (a > hi ? hi : a);
+            }
+            quatFromAxisAngle(rel, axis, a);
+        }
+        quatMul(q, rel, rest);
+        quatNormalize(q);
+    }
+    /// solves one chain : writes the local matrices of its joints
+    void solveChain(IKChain &c)
+    {
+        BoneDataType *pData = pPool->tableBoneData;
+        float weight = c.pHandle->pIKHandleData ? c.pHandle->Weight() : 1.0f;
+        int n = (int)c.joints.size();
+        c.iterations = 0;
+        c.error = 0.0f;
+        if(weight <= 0.0f)
+            return;
+        // local rotations : before (q0) and being solved (q)
+        std::vector<float> q0(n * 4), q(n * 4);
+        for(int k=0; k<n; k++)
+            quatFromMatrix(&q0[k * 4], pData[c.joints[k]].matrix.m);
+        q = q0;
+        if((c.type == NODE_IKHANDLEROLLINFLUENCE) || (c.type == NODE_IKHANDLEROTATEINFLUENCE))
+        {
+            // rotation of the handle since the rest pose, in its own frame
+            float hq[4], irest[4], rel[4];
+            quatFromMatrix(hq, pData[c.handleID].matrix.m);
+            quatConj(irest, &restQuat[c.handleID * 4]);
+            quatMul(rel, irest, hq);
+            const float X[3] = { 1.0f, 0.0f, 0.0f };
+            float roll = c.type == NODE_IKHANDLEROLLINFLUENCE ? quatSwingTwist(rel, X, NULL, NULL) : 0.0f;
+            for(int k=0; k<n; k++)
+            {
+                float d[4];
+                if(c.type == NODE_IKHANDLEROLLINFLUENCE)
+                {
+                    float axis[3];
+                    boneAxis(c.joints[k], axis);
+                    quatFromAxisAngle(d, axis, roll * c.weights[k] * weight);
+                }
+                else
+                    quatScaleAngle(d, rel, c.weights[k] * weight);
+                quatMul(&q[k * 4], &q0[k * 4], d);
+                applyDOF(c.joints[k], &q[k * 4]);
+            }
+        }
+        else
+        {
+            // world : positions of the joints and of the end-effector, rotation of the parents
+            std::vector<float> P(n * 3), Wp(n * 4);
+            float E[3], T[3], m[16];
+            for(int k=0; k<n; k++)
+            {
+                int p = pUpdater->parent[c.joints[k]];
+                if(p >= 0)
+                {
+                    worldMatrix(p, m);
+                    quatFromMatrix(&Wp[k * 4], m);
+                }
+                else
+                {
+                    Wp[k * 4] = Wp[k * 4 + 1] = Wp[k * 4 + 2] = 0.0f; Wp[k * 4 + 3] = 1.0f;
+                }
+                worldMatrix(c.joints[k], m);
+                memcpy(&P[k * 3], m + 12, 3 * sizeof(float));
+                if(k == n - 1)
+                {
+                    const float *t = &pData[c.joints[k]].posBoneTail.x;
+                    for(int r=0; r<3; r++)
+                        E[r] = m[r]*t[0] + m[4+r]*t[1] + m[8+r]*t[2] + m[12+r];
+                }
+            }
+            worldMatrix(c.handleID, m);
+            memcpy(T, m + 12, sizeof(T));
+            // lengths, for FABRIK and the tolerance
+            std::vector<float> len(n);
+            float chainLen = 0.0f;
+            for(int k=0; k<n; k++)
+            {
+                const float *a = &P[k * 3], *b = k + 1 < n ? &P[(k + 1) * 3] : E;
+                len[k] = sqrtf((b[0]-a[0])*(b[0]-a[0]) + (b[1]-a[1])*(b[1]-a[1]) + (b[2]-a[2])*(b[2]-a[2]));
+                chainLen += len[k];
+            }
+            float tol = tolerance * (chainLen > 1e-6f ? chainLen : 1e-6f);
+            // rotates joint j by the world rotation D (weighted, limited) : its subtree follows
+            auto rotateJoint = [&](int j, const float *D) {
+                float dw[4], iwp[4], dl[4], qn[4];
+                quatScaleAngle(dw, D, c.weights[j]);
+                // in the parent space of the joint
+                quatConj(iwp, &Wp[j * 4]);
+                quatMul(dl, iwp, dw);
+                quatMul(dl, dl, &Wp[j * 4]);
+                quatMul(qn, dl, &q[j * 4]);
+                applyDOF(c.joints[j], qn);
+                // what is left after the limits, back in world space
+                float iq[4];
+                quatConj(iq, &q[j * 4]);
+                quatMul(dl, qn, iq);
+                quatMul(dw, &Wp[j * 4], dl);
+                quatMul(dw, dw, iwp);
+                memcpy(&q[j * 4], qn, sizeof(qn));
+                const float *pj = &P[j * 3];
+                for(int k=j+1; k<=n; k++)
+                {
+                    float *pk = k < n ? &P[k * 3] : E;
+                    float v[3] = { pk[0] - pj[0], pk[1] - pj[1], pk[2] - pj[2] };
+                    quatRotate(v, dw, v);
+                    pk[0] = pj[0] + v[0]; pk[1] = pj[1] + v[1]; pk[2] = pj[2] + v[2];
+                    if(k < n)
+                    {
+                        quatMul(&Wp[k * 4], dw, &Wp[k * 4]);
+                        quatNormalize(&Wp[k * 4]);
+                    }
+                }
+            };
+            // turns joint j so that 'from' goes toward 'to'. A hinge turns around its axis only : the
+            // vectors are taken in its plane. A cone first twists around its bone to bring the
+            // end-effector closer to the target, which the joints below can't do when they are hinges
+            auto aimJoint = [&](int j, const float *from, const float *to) {
+                const float *pj = &P[j * 3];
+                float a[3] = { from[0] - pj[0], from[1] - pj[1], from[2] - pj[2] };
+                float b[3] = { to[0] - pj[0], to[1] - pj[1], to[2] - pj[2] };
+                float axis[3], D[4];
+                TransformDOFMode mode = limitAxis(c.joints[j], axis);
+                if(mode == DOF_CONE)
+                {
+                    float bone[3], e[3] = { E[0] - pj[0], E[1] - pj[1], E[2] - pj[2] };
+                    float t[3] = { T[0] - pj[0], T[1] - pj[1], T[2] - pj[2] };
+                    boneAxis(c.joints[j], bone);
+                    quatRotate(bone, &q[j * 4], bone);
+                    quatRotate(bone, &Wp[j * 4], bone);
+                    float de = e[0]*bone[0] + e[1]*bone[1] + e[2]*bone[2], dt = t[0]*bone[0] + t[1]*bone[1] + t[2]*bone[2];
+                    for(int r=0; r<3; r++)
+                    {
+                        e[r] -= de * bone[r];
+                        t[r] -= dt * bone[r];
+                    }
+                    quatFromTo(D, e, t);
+                    rotateJoint(j, D);
+                    a[0] = from[0] - pj[0]; a[1] = from[1] - pj[1]; a[2] = from[2] - pj[2];
+                }
+                else if(mode != DOF_UNDEF)
+                {
+                    quatRotate(axis, &Wp[j * 4], axis);
+                    float da = a[0]*axis[0] + a[1]*axis[1] + a[2]*axis[2], db = b[0]*axis[0] + b[1]*axis[1] + b[2]*axis[2];
+                    for(int r=0; r<3; r++)
+                    {
+                        a[r] -= da * axis[r];
+                        b[r] -= db * axis[r];
+                    }
+                }
+                quatFromTo(D, a, b);
+                rotateJoint(j, D);
+            };
+            // with limits, an iteration can move away from the target : the best pose is kept
+            std::vector<float> X((n + 1) * 3), best(q);
+            float bestErr = 3.4e38f;
+            for(int it=0; ; it++)
+            {
+                float err[3] = { E[0] - T[0], E[1] - T[1], E[2] - T[2] };
+                float e = sqrtf(err[0]*err[0] + err[1]*err[1] + err[2]*err[2]);
+                if(e < bestErr)
+                {
+                    bestErr = e;
+                    best = q;
+                }
+                if((e < tol) || (it == c.maxIter))
+                    break;
+                c.iterations++;
+                if(method == IKMETHOD_CCD)
+                {
+                    for(int j=n-1; j>=0; j--)
+                        aimJoint(j, E, T);
+                    continue;
+                }
+                // FABRIK : X[k] the positions wanted, backward from the target. The forward pass
+                // goes through the rotations, root first : the limits apply and the joints below follow
+                memcpy(&X[0], &P[0], n * 3 * sizeof(float));
+                memcpy(&X[n * 3], T, sizeof(T));
+                for(int k=n-1; k>=0; k--)
+                {
+                    float *xk = &X[k * 3], *xn = &X[(k + 1) * 3];
+                    float d[3] = { xk[0] - xn[0], xk[1] - xn[1], xk[2] - xn[2] };
+                    float l = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+                    float s = l > 1e-12f ? len[k] / l : 0.0f;
+                    for(int r=0; r<3; r++)
+                        xk[r] = xn[r] + d[r] * s;
+                }
+                for(int k=0; k<n; k++)
+                    aimJoint(k, k + 1 < n ? &P[(k + 1) * 3] : E, &X[(k + 1) * 3]);
+            }
+            q = best;
+            c.error = bestErr / (chainLen > 1e-6f ? chainLen : 1e-6f);
+        }
+        // partial weight : between the pose before IK and the solution
+        for(int k=0; k<n; k++)
+        {
+            float *qk = &q[k * 4];
+            if(weight < 1.0f)
+                quatSlerp(qk, &q0[k * 4], qk, weight);
+            // the 3x3 part turned by the change of rotation; translation and scale kept
+            float iq0[4], dq[4], R[9];
+            quatConj(iq0, &q0[k * 4]);
+            quatMul(dq, qk, iq0);
+            quatToMatrix3(dq, R);
+            float *L = pData[c.joints[k]].matrix.m;
+            for(int col=0; col<3; col++)
+            {
+                float v[3] = { L[col*4], L[col*4+1], L[col*4+2] };
+                for(int r=0; r<3; r++)
+                    L[col*4+r] = R[r*3]*v[0] + R[r*3+1]*v[1] + R[r*3+2]*v[2];
+            }
+        }
+    }
+    /// \brief solves all the chains, groups across threads. The joints that moved are given to
+    /// TransformUpdater::markLocalChanged() : call its updateChanged() next
+    /// \return the amount of joints that moved
+    int solve(int maxThreads = 0)
+    {
+        nIterations = 0;
+        nConverged = 0;
+        maxError = 0.0f;
+        if(chains.empty())
+            return 0;
+        BoneDataType *pData = pPool->tableBoneData;
+        // pose before IK : what the animation wrote, or the one of the previous frame
+        for(size_t j=0; j<jointIDs.size(); j++)
+        {
+            MatrixType &L = pData[jointIDs[j]].matrix;
+            if(memcmp(&L, &last[j], sizeof(MatrixType)))
+                base[j] = L;
+            else
+                L = base[j];
+        }
+        int nGroups = (int)groupFirst.size() - 1;
+        parallelFor(nGroups, [&](int g) {
+            for(int i=groupFirst[g]; i<groupFirst[g+1]; i++)
+                solveChain(chains[groupChains[i]]);
+        }, maxThreads);
+        for(size_t c=0; c<chains.size(); c++)
+        {
+            nIterations += chains[c].iterations;
+            if(chains[c].error <= tolerance)
+                nConverged++;
+            maxError = chains[c].error > maxError ? chains[c].error : maxError;
+        }
+        int moved = 0;
+        for(size_t j=0; j<jointIDs.size(); j++)
+        {
+            MatrixType &L = pData[jointIDs[j]].matrix;
+            if(!memcmp(&L, &last[j], sizeof(MatrixType)))
+                continue;
+            last[j] = L;
+            pUpdater->markLocalChanged(jointIDs[j]);
+            moved++;
+        }
+        return moved;
+    }
+    /// \brief gives back the pose before IK to the joints still holding a solution (IK turned off).
+    /// Call updateChanged() next
+    /// \return the amount of joints restored
+    int restore()
+    {
+        int moved = 0;
+        for(size_t j=0; j<jointIDs.size(); j++)
+        {
+            MatrixType &L = pPool->tableBoneData[jointIDs[j]].matrix;
+            if(memcmp(&L, &last[j], sizeof(MatrixType)))
+                continue;
+            L = base[j];
+            memset(&last[j], 0xFF, sizeof(MatrixType));
+            pUpdater->markLocalChanged(jointIDs[j]);
+            moved++;
+        }
+        return moved;
+    }
+};
+
+} //namespace bk3d
+
+#endif //__BK3DIK__
@@ -0,0 +1,440 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** Work-stealing job system : the threads of the frame graph (animation,
+ ** skinning, culling...) and of bk3d::parallelFor().
+ **/
+#ifndef __BK3DJOBS__
+#define __BK3DJOBS__
+#include "bk3dParallel.h"
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+
+namespace bk3d
+{
+/*--------------------------------
+Job system
+- a deque of tasks per thread. A thread pushes and pops at the back of its own deque (what it
+  pushed last is still in its cache); idle threads steal at the front of the others
+- thread 0 is the one that called init() : the GL thread. It takes part in the work while it
+  waits in run() or in a parallelFor(). So do the job threads waiting in a nested parallelFor() :
+  a wait never blocks a thread
+- the frame graph : add() the jobs, depends() between them, then run(). A job starts when the
+  jobs it depends on are done. A job only depends on jobs added before it : the order of add()
+  is a topological order. kick() and wait() instead of run() let the calling thread do other
+  work (render the previous frame...) while the graph runs
+- run() measures the frame : the time each thread spent in tasks (utilization) and the longest
+  chain of dependent jobs (critical path), which bounds the frame whatever the amount of threads
+- JobSystem is a ParallelForScheduler : with setParallelForScheduler(), bk3d::parallelFor() runs
+  on its threads instead of starting new ones at each call
+----------------------------------*/
+
+/// a unit of work in the deques : a job of the graph or a helper of a parallelFor()
+struct JobTask
+{
+    void    (*run)(void *ctx, int i);
+    void*   ctx;
+    int     i;
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief threads with work stealing, a graph of jobs per frame and parallelFor()
+//------------------------------------------------------------------------------------------
+struct JobSystem : public ParallelForScheduler
+{
+    /// a node of the frame graph
+    struct Job
+    {
+        const char*             name;
+        std::function<void()>   f;
+        std::vector<int>        successors;
+        int                     nDeps;
+        std::atomic<int>        depsLeft;
+        double                  start, end; ///< ms since run() started
+        int                     thread;     ///< that ran it
+    };
+    struct Worker
+    {
+        std::mutex              lock;
+        std::deque<JobTask>     tasks;
+        std::atomic<long long>  busyNs;     ///< in tasks since run() started, waits excluded
+        int                     depth;      ///< tasks nested by the waits of the thread
+        std::chrono::high_resolution_clock::time_point tStart; ///< of the outermost task
+    };
+    std::vector<Worker*>        workers;    ///< [0] : the thread that called init()
+    std::vector<std::thread>    threads;
+    std::atomic<int>            nQueued;
+    std::atomic<int>            nSteals;
+    std::atomic<bool>           bQuit;
+    std::mutex                  sleepLock;
+    std::condition_variable     wake;
+    std::deque<Job>             jobs;       ///< the graph : add() since clear()
+    std::atomic<int>            jobsLeft;
+    bool                        bKicked;    ///< wait() to come
+    std::chrono::high_resolution_clock::time_point tRun;
+    // stats of the last run()
+    double                      frameMs;
+    double                      busyMs;     ///< all the threads
+    float                       utilization;///< busyMs / (frameMs * threads)
+    double                      criticalMs;
+    std::vector<int>            criticalPath; ///< jobs, first to last
+
+    JobSystem() : nQueued(0), nSteals(0), bQuit(false), jobsLeft(0), bKicked(false), frameMs(0.0), busyMs(0.0),
+        utilization(0.0f), criticalMs(0.0) {}
+    ~JobSystem() { shutdown(); }
+    /// index of the calling thread in workers. -1 for a thread that isn't of the system
+    static int& threadIndex()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+    /// \param nThreads : 0 for one per hardware thread. The calling thread is one of them
+    void init(int nThreads = 0)
+    {
+        shutdown();
+        int n = nThreads > 0 ? nThreads : (int)std::thread::hardware_concurrency();
+        n = n > 0 ? n : 1;
+        bQuit = false;
+        nQueued = 0;
+        for(int t=0; t<n; t++)
+        {
+            workers.push_back(new Worker);
+            workers[t]->busyNs = 0;
+            workers[t]->depth = 0;
+        }
+        threadIndex() = 0;
+        for(int t=1; t<n; t++)
+            threads.push_back(std::thread([this, t]() { workerLoop(t); }));
+    }
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> l(sleepLock);
+            bQuit = true;
+        }
+        wake.notify_all();
+        for(size_t t=0; t<threads.size(); t++)
+            threads[t].join();
+        threads.clear();
+        for(size_t t=0; t<workers.size(); t++)
+            delete workers[t];
+        workers.clear();
+        jobs.clear();
+    }
+    virtual int getNumThreads() { return workers.empty() ? 1 : (int)workers.size(); }
+    //--------------------------------------------------------------------------------------
+    // deques
+    //--------------------------------------------------------------------------------------
+    void push(const JobTask &task)
+    {
+        int idx = threadIndex() >= 0 ? threadIndex() : 0;
+        {
+            std::lock_guard<std::mutex> l(workers[idx]->lock);
+            workers[idx]->tasks.push_back(task);
+        }
+        nQueued++;
+        // a thread about to sleep has checked nQueued under sleepLock : it can't miss this
+        {
+            std::lock_guard<std::mutex> l(sleepLock);
+        }
+        wake.notify_one();
+    }
+    /// own deque first (last in), then the others (first in)
+    bool pop(JobTask &task)
+    {
+        if(nQueued.load() == 0)
+            return false;
+        int n = (int)workers.size();
+        int idx = threadIndex() >= 0 ? threadIndex() : 0;
+        for(int k=0; k<n; k++)
+        {
+            Worker *pW = workers[(idx + k) % n];
+            std::lock_guard<std::mutex> l(pW->lock);
+            if(pW->tasks.empty())
+                continue;
+            if(k == 0)
+            {
+                task = pW->tasks.back();
+                pW->tasks.pop_back();
+            } else {
+                task = pW->tasks.front();
+                pW->tasks.pop_front();
+                nSteals++;
+            }
+            nQueued--;
+            return true;
+        }
+        return false;
+    }
+    static long long nsSince(const std::chrono::high_resolution_clock::time_point &t)
+    {
+        return (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - t).count();
+    }
+    void execute(const JobTask &task)
+    {
+        Worker *pW = workers[threadIndex() >= 0 ? threadIndex() : 0];
+        if(pW->depth++ == 0)
+            pW->tStart = std::chrono::high_resolution_clock::now();
+        task.run(task.ctx, task.i);
+        if(--pW->depth == 0)
+            pW->busyNs += nsSince(pW->tStart);
+    }
+    /// the busy time of the outermost task so far : before the end of a job makes run() return
+    void flushBusy()
+    {
+        Worker *pW = workers[threadIndex() >= 0 ? threadIndex() : 0];
+        if(pW->depth == 0)
+            return;
+        std::chrono::high_resolution_clock::time_point t = std::chrono::high_resolution_clock::now();
+        pW->busyNs += (long long)std::chrono::duration_cast<std::chrono::nanoseconds>(t - pW->tStart).count();
+        pW->tStart = t;
+    }
+    /// runs tasks until counter reaches 0. The time without a task isn't busy time
+    void helpUntil(std::atomic<int> &counter)
+    {
+        Worker *pW = workers[threadIndex() >= 0 ? threadIndex() : 0];
+        while(counter.load() > 0)
+        {
+            JobTask task;
+            if(pop(task))
+            {
+                execute(task);
+                continue;
+            }
+            std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+            std::this_thread::yield();
+            if(pW->depth > 0)
+                pW->busyNs -= nsSince(t0);
+        }
+    }
+    void workerLoop(int idx)
+    {
+        threadIndex() = idx;
+        int spins = 0;
+        while(!bQuit)
+        {
+            JobTask task;
+            if(pop(task))
+            {
+                execute(task);
+                spins = 0;
+                continue;
+            }
+            // a few tries before sleeping : the next task of the frame is often close
+            if(++spins < 64)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> l(sleepLock);
+            wake.wait(l, [this]() { return (nQueued.load() > 0) || bQuit; });
+            spins = 0;
+        }
+    }
+    //--------------------------------------------------------------------------------------
+    // parallel-for
+    //--------------------------------------------------------------------------------------
+    struct ParallelForCtx
+    {
+        const std::function<void(int)> *pF;
+        int                 n;
+        std::atomic<int>    next;
+        std::atomic<int>    helpers;    ///< still running
+    };
+    static void runParallelFor(void *ctx, int)
+    {
+        ParallelForCtx *pC = (ParallelForCtx*)ctx;
+        int i;
+        while((i = pC->next.fetch_add(1)) < pC->n)
+            (*pC->pF)(i);
+        pC->helpers--;
+    }
+    /// \brief items fetched one by one, like bk3d::parallelFor(). Helpers go in the deque of
+    /// the calling thread for the others to steal; the calling thread works, then helps until
+    /// the last helper is done
+    virtual void parallelFor(int n, const std::function<void(int)> &f, int maxThreads)
+    {
+        int nt = maxThreads > 0 ? maxThreads : getNumThreads();
+        nt = nt < getNumThreads() ? nt : getNumThreads();
+        nt = nt < n ? nt : n;
+        if(workers.empty() || (nt <= 1))
+        {
+            for(int i=0; i<n; i++)
+                f(i);
+            return;
+        }
+        ParallelForCtx ctx;
+        ctx.pF = &f;
+        ctx.n = n;
+        ctx.next = 0;
+        ctx.helpers = nt - 1;
+        for(int t=1; t<nt; t++)
+        {
+            JobTask task = { runParallelFor, &ctx, 0 };
+            push(task);
+        }
+        int i;
+        while((i = ctx.next.fetch_add(1)) < n)
+            f(i);
+        helpUntil(ctx.helpers);
+    }
+    //--------------------------------------------------------------------------------------
+    // frame graph
+    //--------------------------------------------------------------------------------------
+    void clear()
+    {
+        jobs.clear();
+    }
+    /// \return the index of the job, for depends()
+    int add(const char *name, const std::function<void()> &f)
+    {
+        jobs.emplace_back();
+        Job &job = jobs.back();
+        job.name = name;
+        job.f = f;
+        job.nDeps = 0;
+        job.depsLeft = 0;
+        job.start = job.end = 0.0;
+        job.thread = -1;
+        return (int)jobs.size() - 1;
+    }
+    /// job starts after 'on' is done. 'on' must have been added before job
+    /// \return false if it wasn't
+    bool depends(int job, int on)
+    {
+        if((on < 0) || (on >= job) || (job >= (int)jobs.size()))
+            return false;
+        jobs[on].successors.push_back(job);
+        jobs[job].nDeps++;
+        return true;
+    }
+    double msSinceRun() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tRun).count();
+    }
+    static void runJob(void *ctx, int j)
+    {
+        JobSystem *pJS = (JobSystem*)ctx;
+        Job &job = pJS->jobs[j];
+        job.thread = threadIndex();
+        job.start = pJS->msSinceRun();
+        job.f();
+        job.end = pJS->msSinceRun();
+        for(size_t s=0; s<job.successors.size(); s++)
+            if(--pJS->jobs[job.successors[s]].depsLeft == 0)
+            {
+                JobTask task = { runJob, pJS, job.successors[s] };
+                pJS->push(task);
+            }
+        if(!pJS->workers.empty())
+            pJS->flushBusy();
+        pJS->jobsLeft--;
+    }
+    /// \brief runs the graph; returns when all the jobs are done. From the thread of init()
+    void run()
+    {
+        kick();
+        wait();
+    }
+    /// \brief starts the graph on the job threads and returns : the calling thread can work on
+    /// something else (GL...) until wait(). Without job threads, the graph runs here and now
+    void kick()
+    {
+        int n = (int)jobs.size();
+        bKicked = true;
+        tRun = std::chrono::high_resolution_clock::now();
+        for(size_t t=0; t<workers.size(); t++)
+            workers[t]->busyNs = 0;
+        jobsLeft = n;
+        for(int j=0; j<n; j++)
+            jobs[j].depsLeft = jobs[j].nDeps;
+        if(workers.empty())
+            for(int j=0; j<n; j++)
+            {
+                jobs[j].start = msSinceRun();
+                jobs[j].f();
+                jobs[j].end = msSinceRun();
+            }
+        else {
+            for(int j=0; j<n; j++)
+                if(jobs[j].nDeps == 0)
+                {
+                    JobTask task = { runJob, this, j };
+                    push(task);
+                }
+        }
+    }
+    /// \brief takes part in the graph kicked until all its jobs are done, then measures it.
+    /// frameMs goes from kick() to the end of the last job
+    void wait()
+    {
+        if(!bKicked)
+            return;
+        bKicked = false;
+        if(!workers.empty())
+            helpUntil(jobsLeft);
+        int n = (int)jobs.size();
+        frameMs = 0.0;
+        for(int j=0; j<n; j++)
+            frameMs = jobs[j].end > frameMs ? jobs[j].end : frameMs;
+        busyMs = 0.0;
+        for(size_t t=0; t<workers.size(); t++)
+            busyMs += (double)workers[t]->busyNs.load() / 1e6;
+        if(workers.empty())
+            busyMs = frameMs;
+        utilization = frameMs > 0.0 ? (float)(busyMs / (frameMs * getNumThreads())) : 0.0f;
+        // critical path : the jobs are in a topological order
+        std::vector<double> longest(n, 0.0), before(n, 0.0);
+        std::vector<int> from(n, -1);
+        int last = -1;
+        for(int j=0; j<n; j++)
+        {
+            longest[j] = before[j] + jobs[j].end - jobs[j].start;
+            for(size_t s=0; s<jobs[j].successors.size(); s++)
+            {
+                int k = jobs[j].successors[s];
+                if(longest[j] > before[k])
+                {
+                    before[k] = longest[j];
+                    from[k] = j;
+                }
+            }
+            if((last < 0) || (longest[j] > longest[last]))
+                last = j;
+        }
+        criticalMs = last >= 0 ? longest[last] : 0.0;
+        criticalPath.clear();
+        for(int j=last; j>=0; j=from[j])
+            criticalPath.insert(criticalPath.begin(), j);
+    }
+};
+
+} //namespace bk3d
+
+#endif //__BK3DJOBS__
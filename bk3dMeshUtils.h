@@ -0,0 +1,1331 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** Post-load processing of bk3d Meshes : things we can do on the baked
+ ** data right after bk3d::load() and before creating the API buffers.
+ **/
+#ifndef __BK3DMESHUTILS__
+#define __BK3DMESHUTILS__
+#include "bk3dBase.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#if !defined(BK3D_NOSIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+#   include <emmintrin.h>
+#   define BK3D_SSE2
+#endif
+
+namespace bk3d
+{
+/*--------------------------------
+Vertex attribute quantization
+----------------------------------*/
+/// how the normals got stored by quantizeMesh(). The vertex shader needs it to decode them
+enum NormalEncoding
+{
+    NORMAL_FLOAT = 0,          ///< untouched : 3 floats (or whatever was baked)
+    NORMAL_OCT16 = 1,          ///< octahedral mapping in 2 x 16 bits signed normalized
+    NORMAL_UNORM1010102 = 2,   ///< 10:10:10:2 unsigned normalized. n = v*2-1
+};
+
+/// \brief dequantization parameters of a Mesh, to be passed to the vertex shader
+///
+/// P = posBias + Pnormalized * posScale. When the Mesh wasn't quantized, posBias = 0 and posScale = 1
+struct MeshQuantization
+{
+    float           posBias[3];
+    float           posScale[3];
+    NormalEncoding  normalEnc;
+    bool            bQuantized;
+    MeshQuantization() { init(); }
+    void init()
+    {
+        memset((void*)this, 0, sizeof(MeshQuantization));
+        posScale[0] = posScale[1] = posScale[2] = 1.0f;
+    }
+};
+
+/// error report for one quantized attribute
+struct AttributeQuantReport
+{
+    char            meshName[NODENAMESZ];
+    char            attrName[NODENAMESZ];
+    GLType          formatGLBefore;
+    GLType          formatGLAfter;
+    unsigned int    bytesBefore;    ///< bytes per vertex for this attribute
+    unsigned int    bytesAfter;
+    float           maxError;       ///< position: object units; normal: degrees; texcoord: uv units
+    float           avgError;
+};
+
+//------------------------------------------------------------------------------------------
+/// size in bytes of one component of a GL vertex format
+//------------------------------------------------------------------------------------------
+INLINE unsigned int formatGLComponentSize(GLType fmt)
+{
+    switch(fmt)
+    {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+        return 1;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT:
+        return 2;
+    case GL_DOUBLE:
+        return 8;
+    default:
+        return 4;
+    }
+}
+//------------------------------------------------------------------------------------------
+/// size in bytes of a whole attribute. Packed formats hold all the components in 4 bytes
+//------------------------------------------------------------------------------------------
+INLINE unsigned int attributeSizeBytes(Attribute *pA)
+{
+    if((pA->formatGL == GL_INT_2_10_10_10_REV)||(pA->formatGL == GL_UNSIGNED_INT_2_10_10_10_REV))
+        return 4;
+    return formatGLComponentSize(pA->formatGL) * pA->numComp;
+}
+//------------------------------------------------------------------------------------------
+/// tells if the attribute must be fetched with normalization (glVertexAttribPointer's 'normalized')
+//------------------------------------------------------------------------------------------
+INLINE bool isNormalizedFormat(Attribute *pA)
+{
+    if((pA->formatGL == GL_FLOAT)||(pA->formatGL == GL_HALF_FLOAT)||(pA->formatGL == GL_DOUBLE))
+        return false;
+    // bone offsets are indices : never normalized
+    if(!strcmp(pA->name, MESH_BONESOFFSETS)||!strcmp(pA->name, MESH_VERTEXID))
+        return false;
+    return true;
+}
+
+//------------------------------------------------------------------------------------------
+/// IEEE 754 half float conversion (round to nearest even)
+//------------------------------------------------------------------------------------------
+INLINE unsigned short floatToHalf(float f)
+{
+    unsigned int x;
+    memcpy(&x, &f, 4);
+    unsigned int sign = (x >> 16) & 0x8000;
+    int          e    = (int)((x >> 23) & 0xFF) - 127 + 15;
+    unsigned int m    = x & 0x7FFFFF;
+    if(((x >> 23) & 0xFF) == 0xFF) // Inf/NaN
+        return (unsigned short)(sign | 0x7C00 | (m ? 0x200 : 0));
+    if(e >= 31)
+        return (unsigned short)(sign | 0x7C00);
+    if(e <= 0)
+    {
+        if(e < -10)
+            return (unsigned short)sign;
+        m |= 0x800000;
+        unsigned int shift = 14 - e;
+        unsigned int h = m >> shift;
+        unsigned int rem = m & ((1u << shift) - 1);
+        unsigned int half = 1u << (shift - 1);
+        if((rem > half) || ((rem == half) && (h & 1)))
+            h++;
+        return (unsigned short)(sign | h);
+    }
+    unsigned int h = ((unsigned int)e << 10) | (m >> 13);
+    unsigned int rem = m & 0x1FFF;
+    if((rem > 0x1000) || ((rem == 0x1000) && (h & 1)))
+        h++; // may carry into the exponent : still correct
+    return (unsigned short)(sign | h);
+}
+INLINE float halfToFloat(unsigned short h)
+{
+    unsigned int sign = (h & 0x8000) << 16;
+    unsigned int e    = (h >> 10) & 0x1F;
+    unsigned int m    = h & 0x3FF;
+    unsigned int x;
+    if(e == 0)
+    {
+        if(m == 0)
+            x = sign;
+        else
+        {
+            e = 127 - 15 + 1;
+            while(!(m & 0x400)) { m <<= 1; e--; }
+            x = sign | (e << 23) | ((m & 0x3FF) << 13);
+        }
+    }
+    else if(e == 31)
+        x = sign | 0x7F800000 | (m << 13);
+    else
+        x = sign | ((e + 127 - 15) << 23) | (m << 13);
+    float f;
+    memcpy(&f, &x, 4);
+    return f;
+}
+
+//------------------------------------------------------------------------------------------
+/// octahedral normal encoding. n doesn't need to be normalized
+//------------------------------------------------------------------------------------------
+INLINE void octEncode(const float *n, short *out)
+{
+    float l = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    float x = l > 0.0f ? n[0]/l : 0.0f;
+    float y = l > 0.0f ? n[1]/l : 0.0f;
+    if(n[2] < 0.0f)
+    {
+        float ox = x;
+        x = (1.0f - fabsf(y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+        y = (1.0f - fabsf(ox)) * (y >= 0.0f ? 1.0f : -1.0f);
+    }
+    out[0] = (short)(x * 32767.0f + (x >= 0.0f ? 0.5f : -0.5f));
+    out[1] = (short)(y * 32767.0f + (y >= 0.0f ? 0.5f : -0.5f));
+}
+INLINE void octDecode(const short *in, float *n)
+{
+    float x = in[0] < -32767 ? -1.0f : (float)in[0] / 32767.0f;
+    float y = in[1] < -32767 ? -1.0f : (float)in[1] / 32767.0f;
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    float t = z < 0.0f ? -z : 0.0f;
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+    float l = sqrtf(x*x + y*y + z*z);
+    n[0] = x/l; n[1] = y/l; n[2] = z/l;
+}
+INLINE unsigned int packUnorm1010102(const float *n)
+{
+    unsigned int r = 0;
+    for(int c=0; c<3; c++)
+    {
+        float v = n[c]*0.5f + 0.5f;
+        v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+        r |= ((unsigned int)(v * 1023.0f + 0.5f)) << (10*c);
+    }
+    return r;
+}
+INLINE void unpackUnorm1010102(unsigned int p, float *n)
+{
+    for(int c=0; c<3; c++)
+        n[c] = (float)((p >> (10*c)) & 0x3FF) / 1023.0f * 2.0f - 1.0f;
+    float l = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+    if(l > 0.0f) { n[0] /= l; n[1] /= l; n[2] /= l; }
+}
+
+//------------------------------------------------------------------------------------------
+/// \brief quantize the vertex attributes of a Mesh
+///
+/// - position (3 floats) : 16 bits unsigned normalized, relative to the bounds of the positions
+///   (8 bytes with padding). Mesh::aabbox isn't used : it can be stale or empty
+/// - normal (3 floats) : octahedral 2x16 bits or 10:10:10:2, depending on normalEnc
+/// - texcoords (floats) : half floats
+/// - others : copied as they are
+///
+/// Each Slot gets a new interleaved buffer (malloc) and formatGL, numComp, strideBytes and
+/// dataOffsetBytes of its Attributes are rewritten. The original data stay in the file buffer memory.
+/// \remark Meshes with blendshapes or skinning are left untouched : CPU deformers work on floats.
+/// Sparse Slots (MESH_VERTEXID) are also skipped
+/// \return true if something got quantized. q receives the dequantization parameters in any case
+//------------------------------------------------------------------------------------------
+INLINE bool quantizeMesh(Mesh *pMesh, NormalEncoding normalEnc, MeshQuantization &q, std::vector<AttributeQuantReport> *pReport = NULL)
+{
+    enum Kind { KEEP, POS16, NORMALOCT, NORMAL1010102, HALF };
+    q.init();
+    if(!pMesh->pSlots)
+        return false;
+    if((pMesh->pBSSlots && (pMesh->pBSSlots->n > 0)) || (pMesh->numJointInfluence > 0))
+        return false;
+    //
+    // bounds of the positions that will be quantized : the same Slots and Attributes as below
+    //
+    float posMin[3] = { 1e30f, 1e30f, 1e30f }, posMax[3] = { -1e30f, -1e30f, -1e30f };
+    float posScale[3], posInvScale[3];
+    for(int s=0; s<pMesh->pSlots->n; s++)
+    {
+        Slot *pS = pMesh->pSlots->p[s];
+        AttributePool *pAP = pS->pAttributes;
+        bool bSparse = false;
+        for(int a=0; pAP && (a<pAP->n); a++)
+            if(!strcmp(pAP->p[a]->name, MESH_VERTEXID))
+                bSparse = true;
+        for(int a=0; pAP && !bSparse && (a<pAP->n); a++)
+        {
+            Attribute *pA = pAP->p[a];
+            if((pA->formatGL != GL_FLOAT) || strcmp(pA->name, MESH_POSITION) || (pA->numComp != 3))
+                continue;
+            unsigned int srcStride = pA->strideBytes ? pA->strideBytes : pS->vtxBufferStrideBytes;
+            const char  *src = (const char*)pS->pVtxBufferData + pA->dataOffsetBytes;
+            for(unsigned int v=0; v<pS->vertexCount; v++, src += srcStride)
+                for(int c=0; c<3; c++)
+                {
+                    float f = ((const float*)src)[c];
+                    posMin[c] = f < posMin[c] ? f : posMin[c];
+                    posMax[c] = f > posMax[c] ? f : posMax[c];
+                }
+        }
+    }
+    for(int c=0; c<3; c++)
+    {
+        if(posMin[c] > posMax[c]) // no position
+            posMin[c] = posMax[c] = 0.0f;
+        // 0 when flat along c : every vertex is exactly at posMin
+        posScale[c] = posMax[c] - posMin[c];
+        posInvScale[c] = posScale[c] > 0.0f ? 1.0f/posScale[c] : 0.0f;
+    }
+    bool bChanged = false;
+    for(int s=0; s<pMesh->pSlots->n; s++)
+    {
+        Slot *pS = pMesh->pSlots->p[s];
+        AttributePool *pAP = pS->pAttributes;
+        if(!pAP || (pAP->n == 0) || (pS->vertexCount == 0))
+            continue;
+        bool bSparse = false;
+        for(int a=0; a<pAP->n; a++)
+            if(!strcmp(pAP->p[a]->name, MESH_VERTEXID))
+                bSparse = true;
+        if(bSparse)
+            continue;
+        //
+        // new layout of the Slot
+        //
+        std::vector<Kind>         kinds(pAP->n);
+        std::vector<unsigned int> sizes(pAP->n);
+        std::vector<unsigned int> offsets(pAP->n);
+        bool         bSlotChanged = false;
+        unsigned int stride = 0;
+        for(int a=0; a<pAP->n; a++)
+        {
+            Attribute *pA = pAP->p[a];
+            Kind k = KEEP;
+            if(pA->formatGL == GL_FLOAT)
+            {
+                if(!strcmp(pA->name, MESH_POSITION) && (pA->numComp == 3))
+                    k = POS16;
+                else if(!strcmp(pA->name, MESH_NORMAL) && (pA->numComp == 3))
+                    k = normalEnc == NORMAL_OCT16 ? NORMALOCT : (normalEnc == NORMAL_UNORM1010102 ? NORMAL1010102 : KEEP);
+                else if(!strncmp(pA->name, "texcoord", 8))
+                    k = HALF;
+            }
+            unsigned int sz;
+            switch(k)
+            {
+            case POS16:         sz = 8; break;
+            case NORMALOCT:     sz = 4; break;
+            case NORMAL1010102: sz = 4; break;
+            case HALF:          sz = 2 * pA->numComp; break;
+            default:            sz = attributeSizeBytes(pA); break;
+            }
+            sz = (sz + 3) & ~3u; // keep attributes aligned on 4 bytes
+            kinds[a] = k;
+            sizes[a] = sz;
+            offsets[a] = stride;
+            stride += sz;
+            if(k != KEEP)
+                bSlotChanged = true;
+        }
+        if(!bSlotChanged || (stride > 255)) // strideBytes is 8 bits
+            continue;
+        //
+        // write the new buffer
+        //
+        char *pNewBuf = (char*)malloc(stride * pS->vertexCount);
+        memset(pNewBuf, 0, stride * pS->vertexCount);
+        for(int a=0; a<pAP->n; a++)
+        {
+            Attribute   *pA = pAP->p[a];
+            unsigned int srcStride = pA->strideBytes ? pA->strideBytes : pS->vtxBufferStrideBytes;
+            const char  *src = (const char*)pS->pVtxBufferData + pA->dataOffsetBytes;
+            char        *dst = pNewBuf + offsets[a];
+            double       errSum = 0.0;
+            float        errMax = 0.0f;
+            for(unsigned int v=0; v<pS->vertexCount; v++, src += srcStride, dst += stride)
+            {
+                const float *f = (const float*)src;
+                float err = 0.0f;
+                switch(kinds[a])
+                {
+                case POS16:
+                    for(int c=0; c<3; c++)
+                    {
+                        float t = (f[c] - posMin[c]) * posInvScale[c];
+                        t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+                        unsigned short u = (unsigned short)(t * 65535.0f + 0.5f);
+                        ((unsigned short*)dst)[c] = u;
+                        float e = fabsf(posMin[c] + (float)u / 65535.0f * posScale[c] - f[c]);
+                        if(e > err) err = e;
+                    }
+                    break;
+                case NORMALOCT:
+                case NORMAL1010102:
+                    {
+                        float l = sqrtf(f[0]*f[0] + f[1]*f[1] + f[2]*f[2]);
+                        float n[3] = { l > 0.0f ? f[0]/l : 0.0f, l > 0.0f ? f[1]/l : 0.0f, l > 0.0f ? f[2]/l : 1.0f };
+                        float d[3];
+                        if(kinds[a] == NORMALOCT)
+                        {
+                            octEncode(n, (short*)dst);
+                            octDecode((short*)dst, d);
+                        } else {
+                            *(unsigned int*)dst = packUnorm1010102(n);
+                            unpackUnorm1010102(*(unsigned int*)dst, d);
+                        }
+                        float dp = n[0]*d[0] + n[1]*d[1] + n[2]*d[2];
+                        dp = dp > 1.0f ? 1.0f : (dp < -1.0f ? -1.0f : dp);
+                        err = acosf(dp) * 180.0f / 3.14159265f;
+                    }
+                    break;
+                case HALF:
+                    for(int c=0; c<pA->numComp; c++)
+                    {
+                        unsigned short h = floatToHalf(f[c]);
+                        ((unsigned short*)dst)[c] = h;
+                        float e = fabsf(halfToFloat(h) - f[c]);
+                        if(e > err) err = e;
+                    }
+                    break;
+                default:
+                    memcpy(dst, src, attributeSizeBytes(pA));
+                    break;
+                }
+                errSum += err;
+                if(err > errMax) errMax = err;
+            }
+            if(pReport && (kinds[a] != KEEP))
+            {
+                AttributeQuantReport r;
+                memset(&r, 0, sizeof(r));
+                strncpy(r.meshName, pMesh->name, NODENAMESZ-1);
+                strncpy(r.attrName, pA->name, NODENAMESZ-1);
+                r.formatGLBefore = pA->formatGL;
+                r.bytesBefore = attributeSizeBytes(pA);
+                r.bytesAfter = sizes[a];
+                r.maxError = errMax;
+                r.avgError = (float)(errSum / (double)pS->vertexCount);
+                switch(kinds[a])
+                {
+                case POS16:         r.formatGLAfter = GL_UNSIGNED_SHORT; break;
+                case NORMALOCT:     r.formatGLAfter = GL_SHORT; break;
+                case NORMAL1010102: r.formatGLAfter = GL_UNSIGNED_INT_2_10_10_10_REV; break;
+                default:            r.formatGLAfter = GL_HALF_FLOAT; break;
+                }
+                pReport->push_back(r);
+            }
+        }
+        //
+        // rewrite the Attributes and the Slot
+        //
+        for(int a=0; a<pAP->n; a++)
+        {
+            Attribute *pA = pAP->p[a];
+            switch(kinds[a])
+            {
+            case POS16:
+                pA->formatGL = GL_UNSIGNED_SHORT;
+                pA->formatDXGI = DXGI_FORMAT_R16G16B16A16_UNORM;
+                pA->formatDX9 = D3DDECLTYPE_USHORT4N;
+                break;
+            case NORMALOCT:
+                pA->formatGL = GL_SHORT;
+                pA->numComp = 2;
+                pA->formatDXGI = DXGI_FORMAT_R16G16_SNORM;
+                pA->formatDX9 = D3DDECLTYPE_SHORT2N;
+                break;
+            case NORMAL1010102:
+                pA->formatGL = GL_UNSIGNED_INT_2_10_10_10_REV;
+                pA->numComp = 4;
+                pA->formatDXGI = DXGI_FORMAT_R10G10B10A2_UNORM;
+                pA->formatDX9 = D3DDECLTYPE_UNDEF;
+                break;
+            case HALF:
+                pA->formatGL = GL_HALF_FLOAT;
+                pA->formatDXGI = pA->numComp == 1 ? DXGI_FORMAT_R16_FLOAT : (pA->numComp == 2 ? DXGI_FORMAT_R16G16_FLOAT : DXGI_FORMAT_R16G16B16A16_FLOAT);
+                pA->formatDX9 = pA->numComp <= 2 ? D3DDECLTYPE_FLOAT16_2 : D3DDECLTYPE_FLOAT16_4;
+                break;
+            default:
+                break;
+            }
+            pA->strideBytes = (unsigned char)stride;
+            pA->dataOffsetBytes = offsets[a];
+            pA->alignedByteOffset = (unsigned char)offsets[a];
+            pA->pAttributeBufferData = pNewBuf + offsets[a];
+        }
+        pS->vtxBufferStrideBytes = stride;
+        pS->vtxBufferSizeBytes = stride * pS->vertexCount;
+        pS->pVtxBufferData = pNewBuf;
+        bChanged = true;
+        for(int a=0; a<pAP->n; a++)
+        {
+            if(kinds[a] == POS16)
+            {
+                for(int c=0; c<3; c++) { q.posBias[c] = posMin[c]; q.posScale[c] = posScale[c]; }
+            }
+            else if(kinds[a] == NORMALOCT)
+                q.normalEnc = NORMAL_OCT16;
+            else if(kinds[a] == NORMAL1010102)
+                q.normalEnc = NORMAL_UNORM1010102;
+        }
+    }
+    q.bQuantized = bChanged;
+    return bChanged;
+}
+
+/*--------------------------------
+Index buffers : 16 bits demotion and delta compression
+----------------------------------*/
+//------------------------------------------------------------------------------------------
+/// \brief demote a 32 bits PrimGroup to 16 bits indices whenever the range of referenced vertices allows it
+///
+/// Indices are rebased on minIndex : the draw call must then use minIndex as the base vertex
+/// (glDrawElementsBaseVertex). The PrimGroup gets its own index buffer (malloc) : pOwnerOfIB is set to NULL
+/// because a shared index buffer can't be rebased for only one of its users.
+/// \return true if the PrimGroup got demoted. *pBaseVertex receives the value to pass to the draw call
+/// (0 if nothing changed)
+//------------------------------------------------------------------------------------------
+INLINE bool demoteIndices(PrimGroup *pPG, int *pBaseVertex)
+{
+    if(pBaseVertex)
+        *pBaseVertex = 0;
+    if((pPG->indexFormatGL != GL_UNSIGNED_INT) || (pPG->indexPerVertex > 1) || !pPG->pIndexBufferData || (pPG->indexCount == 0))
+        return false;
+    const unsigned int *src = (const unsigned int*)pPG->pIndexBufferData;
+    unsigned int restart = pPG->primRestartIndex;
+    // don't trust minIndex/maxIndex blindly : some exporters leave them to 0
+    unsigned int mn = 0xFFFFFFFF, mx = 0;
+    for(unsigned int i=0; i<pPG->indexCount; i++)
+    {
+        unsigned int idx = src[i];
+        if(restart && (idx == restart))
+            continue;
+        if(idx < mn) mn = idx;
+        if(idx > mx) mx = idx;
+    }
+    if(mn > mx)
+        return false;
+    // 0xFFFF is kept for primitive restart
+    if((mx - mn) >= (restart ? 0xFFFFu : 0x10000u))
+        return false;
+    unsigned short *dst = (unsigned short*)malloc(pPG->indexCount * sizeof(unsigned short));
+    for(unsigned int i=0; i<pPG->indexCount; i++)
+    {
+        unsigned int idx = src[i];
+        dst[i] = (restart && (idx == restart)) ? (unsigned short)0xFFFF : (unsigned short)(idx - mn);
+    }
+    pPG->pIndexBufferData = dst;
+    pPG->pOwnerOfIB = NULL;
+    pPG->indexOffset = 0;
+    pPG->indexArrayByteOffset = 0;
+    pPG->indexArrayByteSize = pPG->indexCount * sizeof(unsigned short);
+    pPG->indexFormatGL = GL_UNSIGNED_SHORT;
+    pPG->indexFormatDX9 = D3DFMT_INDEX16;
+    pPG->indexFormatDXGI = DXGI_FORMAT_R16_UINT;
+    pPG->minIndex = mn;
+    pPG->maxIndex = mx;
+    if(restart)
+        pPG->primRestartIndex = 0xFFFF;
+    if(pBaseVertex)
+        *pBaseVertex = (int)mn;
+    return true;
+}
+
+//------------------------------------------------------------------------------------------
+/// \brief Delta encoding of an index buffer
+///
+/// Layout : [count (4 bytes)] then blocks of BK3D_IDXBLOCK deltas. Each block is a width byte (1, 2 or 4)
+/// followed by the zigzag'ed deltas stored in this width. The last block can be partial.
+/// Triangle lists have a strong locality, so most of the blocks end up in 1 byte per index.
+/// This is meant for the storage (the file); indices must be decoded before creating the GPU buffers
+//------------------------------------------------------------------------------------------
+#define BK3D_IDXBLOCK 16
+INLINE unsigned int zigzagEncode(int d)         { return ((unsigned int)d << 1) ^ (unsigned int)(d >> 31); }
+INLINE int          zigzagDecode(unsigned int z) { return (int)(z >> 1) ^ -(int)(z & 1); }
+
+INLINE void encodeIndices(const void *pIndices, GLType format, unsigned int count, std::vector<unsigned char> &out)
+{
+    out.resize(4);
+    memcpy(&out[0], &count, 4);
+    unsigned int prev = 0;
+    for(unsigned int b=0; b<count; b+=BK3D_IDXBLOCK)
+    {
+        unsigned int n = count - b < BK3D_IDXBLOCK ? count - b : BK3D_IDXBLOCK;
+        unsigned int z[BK3D_IDXBLOCK];
+        unsigned int zmax = 0;
+        for(unsigned int i=0; i<n; i++)
+        {
+            unsigned int idx = format == GL_UNSIGNED_SHORT ? ((const unsigned short*)pIndices)[b+i] : ((const unsigned int*)pIndices)[b+i];
+            z[i] = zigzagEncode((int)(idx - prev));
+            prev = idx;
+            if(z[i] > zmax) zmax = z[i];
+        }
+        unsigned char w = zmax < 0x100 ? 1 : (zmax < 0x10000 ? 2 : 4);
+        size_t o = out.size();
+        out.resize(o + 1 + n*w);
+        out[o++] = w;
+        for(unsigned int i=0; i<n; i++, o+=w)
+        {
+            if(w == 1)      out[o] = (unsigned char)z[i];
+            else if(w == 2) { unsigned short s = (unsigned short)z[i]; memcpy(&out[o], &s, 2); }
+            else            memcpy(&out[o], &z[i], 4);
+        }
+    }
+}
+/// amount of indices stored in a buffer made by encodeIndices()
+INLINE unsigned int encodedIndexCount(const unsigned char *src)
+{
+    unsigned int count;
+    memcpy(&count, src, 4);
+    return count;
+}
+//------------------------------------------------------------------------------------------
+/// \brief decodes what encodeIndices() did, into GL_UNSIGNED_SHORT or GL_UNSIGNED_INT indices.
+///
+/// Full blocks are decoded with SSE2 : widening, zigzag and a prefix-sum in registers
+//------------------------------------------------------------------------------------------
+INLINE void decodeIndices(const unsigned char *src, void *pDst, GLType format)
+{
+    unsigned int count = encodedIndexCount(src);
+    src += 4;
+    unsigned int prev = 0;
+    unsigned int b = 0;
+#ifdef BK3D_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    for(; b + BK3D_IDXBLOCK <= count; b += BK3D_IDXBLOCK)
+    {
+        unsigned char w = *src++;
+        __m128i v[4];
+        if(w == 1)
+        {
+            __m128i x = _mm_loadu_si128((const __m128i*)src);
+            __m128i lo = _mm_unpacklo_epi8(x, zero);
+            __m128i hi = _mm_unpackhi_epi8(x, zero);
+            v[0] = _mm_unpacklo_epi16(lo, zero); v[1] = _mm_unpackhi_epi16(lo, zero);
+            v[2] = _mm_unpacklo_epi16(hi, zero); v[3] = _mm_unpackhi_epi16(hi, zero);
+        }
+        else if(w == 2)
+        {
+            __m128i lo = _mm_loadu_si128((const __m128i*)src);
+            __m128i hi = _mm_loadu_si128((const __m128i*)(src + 16));
+            v[0] = _mm_unpacklo_epi16(lo, zero); v[1] = _mm_unpackhi_epi16(lo, zero);
+            v[2] = _mm_unpacklo_epi16(hi, zero); v[3] = _mm_unpackhi_epi16(hi, zero);
+        }
+        else
+        {
+            for(int k=0; k<4; k++)
+                v[k] = _mm_loadu_si128((const __m128i*)(src + 16*k));
+        }
+        src += BK3D_IDXBLOCK * w;
+        __m128i carry = _mm_set1_epi32((int)prev);
+        for(int k=0; k<4; k++)
+        {
+            // zigzag decode
+            __m128i d = _mm_xor_si128(_mm_srli_epi32(v[k], 1), _mm_sub_epi32(zero, _mm_and_si128(v[k], one)));
+            // inclusive prefix sum of 4 lanes + what we had before
+            d = _mm_add_epi32(d, _mm_slli_si128(d, 4));
+            d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+            v[k] = _mm_add_epi32(d, carry);
+            carry = _mm_shuffle_epi32(v[k], _MM_SHUFFLE(3,3,3,3));
+        }
+        prev = (unsigned int)_mm_cvtsi128_si32(carry);
+        if(format == GL_UNSIGNED_SHORT)
+        {
+            // no unsigned pack in SSE2 : bias to signed range, pack and bias back
+            unsigned short *dst = (unsigned short*)pDst + b;
+            for(int k=0; k<4; k+=2)
+            {
+                __m128i p = _mm_packs_epi32(_mm_sub_epi32(v[k], bias), _mm_sub_epi32(v[k+1], bias));
+                _mm_storeu_si128((__m128i*)(dst + 4*k), _mm_xor_si128(p, _mm_set1_epi16((short)0x8000)));
+            }
+        }
+        else
+        {
+            unsigned int *dst = (unsigned int*)pDst + b;
+            for(int k=0; k<4; k++)
+                _mm_storeu_si128((__m128i*)(dst + 4*k), v[k]);
+        }
+    }
+#endif
+    // scalar path : remaining blocks, or everything when SSE2 isn't there
+    for(; b<count; b+=BK3D_IDXBLOCK)
+    {
+        unsigned int n = count - b < BK3D_IDXBLOCK ? count - b : BK3D_IDXBLOCK;
+        unsigned char w = *src++;
+        for(unsigned int i=0; i<n; i++, src+=w)
+        {
+            unsigned int z;
+            if(w == 1)      z = *src;
+            else if(w == 2) { unsigned short s; memcpy(&s, src, 2); z = s; }
+            else            memcpy(&z, src, 4);
+            prev += (unsigned int)zigzagDecode(z);
+            if(format == GL_UNSIGNED_SHORT)
+                ((unsigned short*)pDst)[b+i] = (unsigned short)prev;
+            else
+                ((unsigned int*)pDst)[b+i] = prev;
+        }
+    }
+}
+
+/*--------------------------------
+Meshlets : clusters of triangles with their own bounds
+----------------------------------*/
+#define BK3D_MESHLET_MAXVERTICES  64
+#define BK3D_MESHLET_MAXTRIANGLES 124
+
+/// a cluster of triangles of a PrimGroup. Bounds are in object space
+struct Meshlet
+{
+    BSphere         bsphere;
+    Vec3Type        coneAxis;       ///< average normal of the triangles
+    float           coneCutoff;     ///< sin of the spread angle of the normals. 1.0 means the cone is useless
+    unsigned int    indexOffset;    ///< first element in the index buffer of the PrimGroup
+    unsigned int    triangleCount;
+    unsigned int    vertexCount;    ///< amount of unique vertices
+};
+///
+/// \brief extension Node (NODE_MESHLETPOOL) : the meshlets of a PrimGroup
+///
+/// The triangles of the PrimGroup are reordered so that each meshlet is a contiguous range of its index buffer.
+/// Then a meshlet can be drawn with the regular index buffer and an offset; culled ones are just skipped.
+/// The node is self-contained (nodeByteSize covers the meshlets) so that it can be chained to the file
+///
+struct MeshletPool : public Node
+{
+    PTR64(PrimGroup *pPrimGroup);   ///< the PrimGroup that these meshlets split
+    unsigned int    n;              ///< amount of meshlets
+    unsigned int    maxVertices;    ///< limits used when building
+    unsigned int    maxTriangles;
+    int             : 32;
+    Meshlet         m[1];           ///< array of n meshlets
+
+    static MeshletPool* create(unsigned int n)
+    {
+        size_t sz = sizeof(MeshletPool) + (n > 0 ? n-1 : 0) * sizeof(Meshlet);
+        MeshletPool* p = (MeshletPool*)malloc(sz);
+        memset((void*)p, 0, sz);
+        p->nodeType = NODE_MESHLETPOOL;
+        p->version = RAWMESHVERSION;
+        p->nodeByteSize = (unsigned int)sz;
+        strncpy(p->name, "MeshletPool", NODENAMESZ-1);
+        p->n = n;
+        return p;
+    }
+};
+
+//------------------------------------------------------------------------------------------
+/// returns the attribute of the Mesh having this name (MESH_POSITION...) or NULL
+//------------------------------------------------------------------------------------------
+INLINE Attribute* findAttribute(Mesh *pMesh, const char *name)
+{
+    if(!pMesh->pAttributes)
+        return NULL;
+    for(int a=0; a<pMesh->pAttributes->n; a++)
+        if(!strcmp(pMesh->pAttributes->p[a]->name, name))
+            return pMesh->pAttributes->p[a];
+    return NULL;
+}
+//------------------------------------------------------------------------------------------
+/// reads a position as floats. Handles the 16 bits positions of quantizeMesh() when q is given
+//------------------------------------------------------------------------------------------
+INLINE bool canReadPositions(Attribute *pA)
+{
+    return pA && (pA->numComp >= 3) && ((pA->formatGL == GL_FLOAT) || (pA->formatGL == GL_UNSIGNED_SHORT));
+}
+INLINE void readPosition(Attribute *pA, unsigned int vtx, const MeshQuantization *q, float *p)
+{
+    const char *src = (const char*)pA->pAttributeBufferData + vtx * pA->strideBytes;
+    if(pA->formatGL == GL_FLOAT)
+    {
+        memcpy(p, src, 3*sizeof(float));
+        return;
+    }
+    const unsigned short *u = (const unsigned short*)src;
+    for(int c=0; c<3; c++)
+        p[c] = q ? q->posBias[c] + (float)u[c] / 65535.0f * q->posScale[c] : (float)u[c] / 65535.0f;
+}
+//------------------------------------------------------------------------------------------
+/// component c of vertex v of an attribute, as a float (no normalization)
+//------------------------------------------------------------------------------------------
+INLINE float readAttributeComponent(Attribute *pA, unsigned int v, int c)
+{
+    const char *p = (const char*)pA->pAttributeBufferData + v * pA->strideBytes;
+    switch(pA->formatGL)
+    {
+    case GL_FLOAT:          return ((const float*)p)[c];
+    case GL_INT:            return (float)((const int*)p)[c];
+    case GL_UNSIGNED_INT:   return (float)((const unsigned int*)p)[c];
+    case GL_SHORT:          return (float)((const short*)p)[c];
+    case GL_UNSIGNED_SHORT: return (float)((const unsigned short*)p)[c];
+    case GL_BYTE:           return (float)((const char*)p)[c];
+    case GL_UNSIGNED_BYTE:  return (float)((const unsigned char*)p)[c];
+    case GL_HALF_FLOAT:     return halfToFloat(((const unsigned short*)p)[c]);
+    default:                return 0.0f;
+    }
+}
+
+//------------------------------------------------------------------------------------------
+/// reads an index of a PrimGroup, whatever its format
+//------------------------------------------------------------------------------------------
+INLINE unsigned int readIndex(const void *pIndices, GLType format, unsigned int i)
+{
+    switch(format)
+    {
+    case GL_UNSIGNED_BYTE:  return ((const unsigned char*)pIndices)[i];
+    case GL_UNSIGNED_SHORT: return ((const unsigned short*)pIndices)[i];
+    default:                return ((const unsigned int*)pIndices)[i];
+    }
+}
+INLINE void writeIndex(void *pIndices, GLType format, unsigned int i, unsigned int idx)
+{
+    switch(format)
+    {
+    case GL_UNSIGNED_BYTE:  ((unsigned char*)pIndices)[i] = (unsigned char)idx; break;
+    case GL_UNSIGNED_SHORT: ((unsigned short*)pIndices)[i] = (unsigned short)idx; break;
+    default:                ((unsigned int*)pIndices)[i] = idx; break;
+    }
+}
+
+//------------------------------------------------------------------------------------------
+/// \brief splits a triangle-list PrimGroup in meshlets
+///
+/// Greedy clustering : a meshlet grows from a seed triangle by picking the adjacent triangle that
+/// adds the fewest new vertices, until maxVertices or maxTriangles is reached.
+/// The index buffer of the PrimGroup gets reordered in place (the rendering doesn't change).
+/// \param baseVertex : added to the indices to fetch the vertices (see demoteIndices())
+/// \param q : needed if the positions were quantized. Can be NULL
+/// \return the new MeshletPool (free() it), or NULL if the PrimGroup can't be processed
+/// (not triangles, shared index buffer, unreadable positions)
+//------------------------------------------------------------------------------------------
+INLINE MeshletPool* buildMeshlets(Mesh *pMesh, PrimGroup *pPG, int baseVertex, const MeshQuantization *q,
+    unsigned int maxVertices = BK3D_MESHLET_MAXVERTICES, unsigned int maxTriangles = BK3D_MESHLET_MAXTRIANGLES)
+{
+    if((pPG->topologyGL != GL_TRIANGLES) || (pPG->indexPerVertex > 1) || !pPG->pIndexBufferData
+        || (pPG->pOwnerOfIB && (pPG->pOwnerOfIB != pPG)) || (pPG->indexCount < 3) || (maxVertices < 3))
+        return NULL;
+    Attribute *pAPos = findAttribute(pMesh, MESH_POSITION);
+    if(!canReadPositions(pAPos))
+        return NULL;
+    const unsigned int nTri = pPG->indexCount / 3;
+    std::vector<unsigned int> idx(nTri*3);
+    unsigned int vMin = 0xFFFFFFFF, vMax = 0;
+    for(unsigned int i=0; i<nTri*3; i++)
+    {
+        idx[i] = readIndex(pPG->pIndexBufferData, pPG->indexFormatGL, i);
+        if(idx[i] < vMin) vMin = idx[i];
+        if(idx[i] > vMax) vMax = idx[i];
+    }
+    const unsigned int nVtx = vMax - vMin + 1;
+    //
+    // vertex -> triangles adjacency (CSR)
+    //
+    std::vector<unsigned int> adjOffsets(nVtx + 1, 0);
+    std::vector<unsigned int> adjTris(nTri*3);
+    for(unsigned int i=0; i<nTri*3; i++)
+        adjOffsets[idx[i] - vMin + 1]++;
+    for(unsigned int v=0; v<nVtx; v++)
+        adjOffsets[v+1] += adjOffsets[v];
+    {
+        std::vector<unsigned int> fill(adjOffsets.begin(), adjOffsets.end() - 1);
+        for(unsigned int i=0; i<nTri*3; i++)
+            adjTris[fill[idx[i] - vMin]++] = i / 3;
+    }
+    //
+    // greedy clustering
+    //
+    std::vector<unsigned char> used(nTri, 0);
+    std::vector<int>           stamp(nVtx, -1);
+    std::vector<unsigned int>  order;
+    std::vector<unsigned int>  candidates;
+    std::vector<Meshlet>       meshlets;
+    order.reserve(nTri);
+    unsigned int seed = 0;
+    for(;;)
+    {
+        while((seed < nTri) && used[seed])
+            seed++;
+        if(seed >= nTri)
+            break;
+        int id = (int)meshlets.size();
+        Meshlet ml;
+        memset(&ml, 0, sizeof(ml));
+        ml.indexOffset = (unsigned int)order.size() * 3;
+        candidates.clear();
+        candidates.push_back(seed);
+        while(ml.triangleCount < maxTriangles)
+        {
+            int best = -1;
+            unsigned int bestScore = 4;
+            size_t w = 0;
+            for(size_t c=0; c<candidates.size(); c++)
+            {
+                unsigned int t = candidates[c];
+                if(used[t])
+                    continue;
+                candidates[w++] = t;
+                unsigned int score = 0;
+                for(int k=0; k<3; k++)
+                    if(stamp[idx[t*3+k] - vMin] != id)
+                        score++;
+                if(score < bestScore)
+                {
+                    bestScore = score;
+                    best = (int)t;
+                }
+            }
+            candidates.resize(w);
+            if((best < 0) || (ml.vertexCount + bestScore > maxVertices))
+                break;
+            used[best] = 1;
+            order.push_back((unsigned int)best);
+            ml.triangleCount++;
+            for(int k=0; k<3; k++)
+            {
+                unsigned int v = idx[best*3+k] - vMin;
+                if(stamp[v] == id)
+                    continue;
+                stamp[v] = id;
+                ml.vertexCount++;
+                for(unsigned int a=adjOffsets[v]; a<adjOffsets[v+1]; a++)
+                    if(!used[adjTris[a]])
+                        candidates.push_back(adjTris[a]);
+            }
+        }
+        meshlets.push_back(ml);
+    }
+    //
+    // bounds and normal cones
+    //
+    for(size_t m=0; m<meshlets.size(); m++)
+    {
+        Meshlet &ml = meshlets[m];
+        float bmin[3] = { 1e30f, 1e30f, 1e30f }, bmax[3] = { -1e30f, -1e30f, -1e30f };
+        std::vector<float> normals;
+        normals.reserve(ml.triangleCount*3);
+        for(unsigned int t=0; t<ml.triangleCount; t++)
+        {
+            unsigned int tri = order[ml.indexOffset/3 + t];
+            float p[3][3];
+            for(int k=0; k<3; k++)
+            {
+                readPosition(pAPos, idx[tri*3+k] + baseVertex, q, p[k]);
+                for(int c=0; c<3; c++)
+                {
+                    if(p[k][c] < bmin[c]) bmin[c] = p[k][c];
+                    if(p[k][c] > bmax[c]) bmax[c] = p[k][c];
+                }
+            }
+            float e1[3] = { p[1][0]-p[0][0], p[1][1]-p[0][1], p[1][2]-p[0][2] };
+            float e2[3] = { p[2][0]-p[0][0], p[2][1]-p[0][1], p[2][2]-p[0][2] };
+            float n[3] = { e1[1]*e2[2]-e1[2]*e2[1], e1[2]*e2[0]-e1[0]*e2[2], e1[0]*e2[1]-e1[1]*e2[0] };
+            float l = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+            if(l > 0.0f)
+            {
+                normals.push_back(n[0]/l); normals.push_back(n[1]/l); normals.push_back(n[2]/l);
+            }
+        }
+        float c[3] = { (bmin[0]+bmax[0])*0.5f, (bmin[1]+bmax[1])*0.5f, (bmin[2]+bmax[2])*0.5f };
+        float r2 = 0.0f;
+        for(unsigned int t=0; t<ml.triangleCount; t++)
+        {
+            unsigned int tri = order[ml.indexOffset/3 + t];
+            for(int k=0; k<3; k++)
+            {
+                float p[3];
+                readPosition(pAPos, idx[tri*3+k] + baseVertex, q, p);
+                float d2 = (p[0]-c[0])*(p[0]-c[0]) + (p[1]-c[1])*(p[1]-c[1]) + (p[2]-c[2])*(p[2]-c[2]);
+                if(d2 > r2) r2 = d2;
+            }
+        }
+        ml.bsphere.pos.x = c[0]; ml.bsphere.pos.y = c[1]; ml.bsphere.pos.z = c[2];
+        ml.bsphere.radius = sqrtf(r2);
+        float a[3] = { 0.0f, 0.0f, 0.0f };
+        for(size_t k=0; k<normals.size(); k+=3)
+        {
+            a[0] += normals[k]; a[1] += normals[k+1]; a[2] += normals[k+2];
+        }
+        float al = sqrtf(a[0]*a[0] + a[1]*a[1] + a[2]*a[2]);
+        ml.coneCutoff = 1.0f;
+        if(al > 0.0f)
+        {
+            a[0] /= al; a[1] /= al; a[2] /= al;
+            float minDot = 1.0f;
+            for(size_t k=0; k<normals.size(); k+=3)
+            {
+                float d = a[0]*normals[k] + a[1]*normals[k+1] + a[2]*normals[k+2];
+                if(d < minDot) minDot = d;
+            }
+            ml.coneAxis.x = a[0]; ml.coneAxis.y = a[1]; ml.coneAxis.z = a[2];
+            // beyond 90 degrees of spread, the cone can't cull anything
+            if(minDot > 0.0f)
+                ml.coneCutoff = sqrtf(1.0f - minDot*minDot);
+        }
+    }
+    //
+    // write back the reordered triangles
+    //
+    for(size_t t=0; t<order.size(); t++)
+        for(int k=0; k<3; k++)
+            writeIndex(pPG->pIndexBufferData, pPG->indexFormatGL, (unsigned int)t*3+k, idx[order[t]*3+k]);
+
+    MeshletPool *pPool = MeshletPool::create((unsigned int)meshlets.size());
+    pPool->pPrimGroup = pPG;
+    pPool->maxVertices = maxVertices;
+    pPool->maxTriangles = maxTriangles;
+    strncpy(pPool->name, pPG->name, NODENAMESZ-1);
+    if(!meshlets.empty())
+        memcpy(pPool->m, &meshlets[0], meshlets.size() * sizeof(Meshlet));
+    return pPool;
+}
+//------------------------------------------------------------------------------------------
+/// \brief true if all the triangles of the meshlet face away from the eye (object space)
+//------------------------------------------------------------------------------------------
+INLINE bool isMeshletBackfacing(const Meshlet &ml, const float *eye)
+{
+    if(ml.coneCutoff >= 1.0f)
+        return false;
+    float d[3] = { ml.bsphere.pos.x - eye[0], ml.bsphere.pos.y - eye[1], ml.bsphere.pos.z - eye[2] };
+    float l = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+    return (d[0]*ml.coneAxis.x + d[1]*ml.coneAxis.y + d[2]*ml.coneAxis.z) >= ml.coneCutoff * l + ml.bsphere.radius;
+}
+
+/*--------------------------------
+LODs : simplified index sets of a PrimGroup, over the same vertices
+----------------------------------*/
+#define BK3D_MAXLODS 4
+
+/// a simplified version of the triangles of a PrimGroup
+struct LodLevel
+{
+    unsigned int    indexOffset;    ///< first element in the index data of the LodPool
+    unsigned int    indexCount;
+    float           error;          ///< max geometric deviation (object space) compared to the original triangles
+    int             : 32;
+};
+///
+/// \brief extension Node (NODE_LODPOOL) : the LODs of a PrimGroup
+///
+/// LOD 0 is the PrimGroup itself and isn't stored; lod[0] is LOD 1 and so on.
+/// The indices use the format and base vertex of the PrimGroup and are stored right after the node
+///
+struct LodPool : public Node
+{
+    PTR64(PrimGroup *pPrimGroup);
+    PTR64(void      *pIndexBufferData); ///< points right after the node
+    unsigned int    n;                  ///< amount of LODs, LOD 0 excluded
+    unsigned int    indexArrayByteSize;
+    LodLevel        lod[BK3D_MAXLODS-1];
+
+    static LodPool* create(unsigned int indexBytes)
+    {
+        size_t sz = ((sizeof(LodPool) + 15) & ~15) + indexBytes;
+        LodPool* p = (LodPool*)malloc(sz);
+        memset((void*)p, 0, sz);
+        p->nodeType = NODE_LODPOOL;
+        p->version = RAWMESHVERSION;
+        p->nodeByteSize = (unsigned int)sz;
+        strncpy(p->name, "LodPool", NODENAMESZ-1);
+        p->pIndexBufferData = (char*)p + ((sizeof(LodPool) + 15) & ~15);
+        p->indexArrayByteSize = indexBytes;
+        return p;
+    }
+};
+
+/// symmetric 4x4 matrix of the quadric error metric : a b c d / e f g / h i / j
+struct Quadric
+{
+    double q[10];
+    void clear() { memset(q, 0, sizeof(q)); }
+    void addPlane(double a, double b, double c, double d)
+    {
+        q[0] += a*a; q[1] += a*b; q[2] += a*c; q[3] += a*d;
+        q[4] += b*b; q[5] += b*c; q[6] += b*d;
+        q[7] += c*c; q[8] += c*d;
+        q[9] += d*d;
+    }
+    void add(const Quadric &o) { for(int i=0; i<10; i++) q[i] += o.q[i]; }
+    double eval(const float *p) const
+    {
+        double x = p[0], y = p[1], z = p[2];
+        return q[0]*x*x + 2.0*q[1]*x*y + 2.0*q[2]*x*z + 2.0*q[3]*x
+             + q[4]*y*y + 2.0*q[5]*y*z + 2.0*q[6]*y
+             + q[7]*z*z + 2.0*q[8]*z
+             + q[9];
+    }
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief generates the LODs of a triangle-list PrimGroup by quadric-error edge collapses
+///
+/// Vertices are never moved or created (a vertex collapses onto one of its neighbours), so that
+/// all the LODs share the vertex Slots of the Mesh. Border vertices and attribute seams (many
+/// vertices at the same position) are locked to keep the silhouette and the texture mapping.
+/// \param ratios : triangle count of each LOD relative to the PrimGroup, decreasing (ex: 0.5, 0.25, 0.125)
+/// \param nRatios : at most BK3D_MAXLODS-1
+/// \param baseVertex : see demoteIndices()
+/// \param q : needed if the positions were quantized. Can be NULL
+/// \return a LodPool (free() it) or NULL if the PrimGroup can't be processed or didn't simplify
+//------------------------------------------------------------------------------------------
+INLINE LodPool* buildLods(Mesh *pMesh, PrimGroup *pPG, int baseVertex, const MeshQuantization *q,
+    const float *ratios, int nRatios)
+{
+    if((pPG->topologyGL != GL_TRIANGLES) || (pPG->indexPerVertex > 1) || !pPG->pIndexBufferData
+        || (pPG->indexCount < 3) || (nRatios < 1))
+        return NULL;
+    Attribute *pAPos = findAttribute(pMesh, MESH_POSITION);
+    if(!canReadPositions(pAPos))
+        return NULL;
+    if(nRatios > BK3D_MAXLODS-1)
+        nRatios = BK3D_MAXLODS-1;
+    const unsigned int nTri = pPG->indexCount / 3;
+    std::vector<unsigned int> tris(nTri*3);
+    unsigned int vMin = 0xFFFFFFFF, vMax = 0;
+    for(unsigned int i=0; i<nTri*3; i++)
+    {
+        tris[i] = readIndex(pPG->pIndexBufferData, pPG->indexFormatGL, i);
+        if(tris[i] < vMin) vMin = tris[i];
+        if(tris[i] > vMax) vMax = tris[i];
+    }
+    const unsigned int nVtx = vMax - vMin + 1;
+    for(unsigned int i=0; i<nTri*3; i++)
+        tris[i] -= vMin;
+    std::vector<float> pos(nVtx*3);
+    for(unsigned int v=0; v<nVtx; v++)
+        readPosition(pAPos, v + vMin + baseVertex, q, &pos[v*3]);
+    //
+    // locked vertices : borders (edges used once) and seams (same position)
+    //
+    std::vector<unsigned char> locked(nVtx, 0);
+    {
+        std::vector<unsigned long long> edges(nTri*3);
+        for(unsigned int t=0; t<nTri; t++)
+            for(int k=0; k<3; k++)
+            {
+                unsigned long long a = tris[t*3+k], b = tris[t*3+(k+1)%3];
+                edges[t*3+k] = a < b ? (a << 32) | b : (b << 32) | a;
+            }
+        std::sort(edges.begin(), edges.end());
+        for(size_t e=0; e<edges.size(); )
+        {
+            size_t e2 = e+1;
+            while((e2 < edges.size()) && (edges[e2] == edges[e]))
+                e2++;
+            if(e2 - e == 1)
+            {
+                locked[(unsigned int)(edges[e] >> 32)] = 1;
+                locked[(unsigned int)(edges[e] & 0xFFFFFFFF)] = 1;
+            }
+            e = e2;
+        }
+        std::vector<unsigned int> byPos(nVtx);
+        for(unsigned int v=0; v<nVtx; v++)
+            byPos[v] = v;
+        std::sort(byPos.begin(), byPos.end(), [&](unsigned int a, unsigned int b) {
+            return memcmp(&pos[a*3], &pos[b*3], 3*sizeof(float)) < 0; });
+        for(unsigned int v=1; v<nVtx; v++)
+            if(!memcmp(&pos[byPos[v]*3], &pos[byPos[v-1]*3], 3*sizeof(float)))
+                locked[byPos[v]] = locked[byPos[v-1]] = 1;
+    }
+    //
+    // quadrics and vertex -> triangles adjacency
+    //
+    std::vector<Quadric> quadrics(nVtx);
+    std::vector<std::vector<unsigned int> > vtxTris(nVtx);
+    for(unsigned int v=0; v<nVtx; v++)
+        quadrics[v].clear();
+    for(unsigned int t=0; t<nTri; t++)
+    {
+        const float *p0 = &pos[tris[t*3]*3], *p1 = &pos[tris[t*3+1]*3], *p2 = &pos[tris[t*3+2]*3];
+        double e1[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] };
+        double e2[3] = { p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2] };
+        double n[3] = { e1[1]*e2[2]-e1[2]*e2[1], e1[2]*e2[0]-e1[0]*e2[2], e1[0]*e2[1]-e1[1]*e2[0] };
+        double l = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if(l > 0.0)
+        {
+            n[0] /= l; n[1] /= l; n[2] /= l;
+            double d = -(n[0]*p0[0] + n[1]*p0[1] + n[2]*p0[2]);
+            for(int k=0; k<3; k++)
+                quadrics[tris[t*3+k]].addPlane(n[0], n[1], n[2], d);
+        }
+        for(int k=0; k<3; k++)
+            vtxTris[tris[t*3+k]].push_back(t);
+    }
+    //
+    // collapses u -> v sorted by cost. Stale entries are detected with the vertex versions
+    //
+    struct Collapse
+    {
+        double cost;
+        unsigned int u, v, verU, verV;
+        bool operator>(const Collapse &o) const { return cost > o.cost; }
+    };
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse> > heap;
+    std::vector<unsigned int>  version(nVtx, 0);
+    std::vector<unsigned char> removedVtx(nVtx, 0);
+    std::vector<unsigned char> removedTri(nTri, 0);
+    auto pushCollapse = [&](unsigned int u, unsigned int v) {
+        if(locked[u])
+            return;
+        Quadric Q = quadrics[u];
+        Q.add(quadrics[v]);
+        Collapse c = { Q.eval(&pos[v*3]), u, v, version[u], version[v] };
+        if(c.cost < 0.0)
+            c.cost = 0.0;
+        heap.push(c);
+    };
+    for(unsigned int t=0; t<nTri; t++)
+        for(int k=0; k<3; k++)
+        {
+            pushCollapse(tris[t*3+k], tris[t*3+(k+1)%3]);
+            pushCollapse(tris[t*3+(k+1)%3], tris[t*3+k]);
+        }
+    // would replacing u by v flip (or collapse to nothing) a triangle that remains ?
+    auto flips = [&](unsigned int u, unsigned int v) -> bool {
+        const std::vector<unsigned int> &ut = vtxTris[u];
+        for(size_t i=0; i<ut.size(); i++)
+        {
+            unsigned int t = ut[i];
+            if(removedTri[t] || (tris[t*3] == v) || (tris[t*3+1] == v) || (tris[t*3+2] == v))
+                continue;
+            double n0[3], n1[3];
+            for(int pass=0; pass<2; pass++)
+            {
+                const float *p[3];
+                for(int k=0; k<3; k++)
+                    p[k] = &pos[((pass && (tris[t*3+k] == u)) ? v : tris[t*3+k])*3];
+                double e1[3] = { p[1][0]-p[0][0], p[1][1]-p[0][1], p[1][2]-p[0][2] };
+                double e2[3] = { p[2][0]-p[0][0], p[2][1]-p[0][1], p[2][2]-p[0][2] };
+                double *n = pass ? n1 : n0;
+                n[0] = e1[1]*e2[2]-e1[2]*e2[1]; n[1] = e1[2]*e2[0]-e1[0]*e2[2]; n[2] = e1[0]*e2[1]-e1[1]*e2[0];
+            }
+            double d = n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2];
+            double l0 = n0[0]*n0[0] + n0[1]*n0[1] + n0[2]*n0[2];
+            double l1 = n1[0]*n1[0] + n1[1]*n1[1] + n1[2]*n1[2];
+            if((d <= 0.0) || (d*d < 0.04 * l0 * l1)) // more than ~80 degrees of rotation
+                return true;
+        }
+        return false;
+    };
+    //
+    // collapse until each target is reached and snapshot the remaining triangles
+    //
+    std::vector<unsigned int> lodIndices;
+    LodLevel lods[BK3D_MAXLODS-1];
+    int nLods = 0;
+    unsigned int liveTris = nTri;
+    unsigned int prevTris = nTri;
+    double maxCost = 0.0;
+    for(int l=0; l<nRatios; l++)
+    {
+        unsigned int target = (unsigned int)(ratios[l] * (float)nTri);
+        while((liveTris > target) && !heap.empty())
+        {
+            Collapse c = heap.top();
+            heap.pop();
+            if(removedVtx[c.u] || removedVtx[c.v] || (c.verU != version[c.u]) || (c.verV != version[c.v]))
+                continue;
+            if(flips(c.u, c.v))
+                continue;
+            if(c.cost > maxCost)
+                maxCost = c.cost;
+            std::vector<unsigned int> &ut = vtxTris[c.u];
+            std::vector<unsigned int> &vt = vtxTris[c.v];
+            for(size_t i=0; i<ut.size(); i++)
+            {
+                unsigned int t = ut[i];
+                if(removedTri[t])
+                    continue;
+                if((tris[t*3] == c.v) || (tris[t*3+1] == c.v) || (tris[t*3+2] == c.v))
+                {
+                    removedTri[t] = 1;
+                    liveTris--;
+                    continue;
+                }
+                for(int k=0; k<3; k++)
+                    if(tris[t*3+k] == c.u)
+                        tris[t*3+k] = c.v;
+                vt.push_back(t);
+            }
+            ut.clear();
+            removedVtx[c.u] = 1;
+            quadrics[c.v].add(quadrics[c.u]);
+            version[c.v]++;
+            // compact the triangles of v and queue the collapses around it again
+            size_t w = 0;
+            for(size_t i=0; i<vt.size(); i++)
+                if(!removedTri[vt[i]])
+                    vt[w++] = vt[i];
+            vt.resize(w);
+            for(size_t i=0; i<vt.size(); i++)
+                for(int k=0; k<3; k++)
+                {
+                    unsigned int n = tris[vt[i]*3+k];
+                    if(n == c.v)
+                        continue;
+                    pushCollapse(c.v, n);
+                    pushCollapse(n, c.v);
+                }
+        }
+        if(liveTris >= prevTris)
+            break; // can't simplify further
+        prevTris = liveTris;
+        LodLevel &lod = lods[nLods++];
+        memset(&lod, 0, sizeof(lod));
+        lod.indexOffset = (unsigned int)lodIndices.size();
+        lod.indexCount = liveTris * 3;
+        lod.error = (float)sqrt(maxCost);
+        for(unsigned int t=0; t<nTri; t++)
+            if(!removedTri[t])
+                for(int k=0; k<3; k++)
+                    lodIndices.push_back(tris[t*3+k] + vMin);
+        if(heap.empty())
+            break;
+    }
+    if(nLods == 0)
+        return NULL;
+    unsigned int idxSize = formatGLComponentSize(pPG->indexFormatGL);
+    LodPool *pPool = LodPool::create((unsigned int)lodIndices.size() * idxSize);
+    pPool->pPrimGroup = pPG;
+    pPool->n = nLods;
+    strncpy(pPool->name, pPG->name, NODENAMESZ-1);
+    memcpy(pPool->lod, lods, nLods * sizeof(LodLevel));
+    for(size_t i=0; i<lodIndices.size(); i++)
+        writeIndex(pPool->pIndexBufferData, pPG->indexFormatGL, (unsigned int)i, lodIndices[i]);
+    return pPool;
+}
+//------------------------------------------------------------------------------------------
+/// \brief picks a LOD from the size of the bounding sphere on screen
+/// \param pixelRadius : projected radius of the bounding sphere in pixels
+/// \param fullDetailRadius : projected radius above which LOD 0 is used. Each halving of the size
+/// goes one LOD further
+/// \return the LOD (0 = the PrimGroup itself) ; clamped to the LODs available in pLods
+//------------------------------------------------------------------------------------------
+INLINE int selectLod(const LodPool *pLods, float pixelRadius, float fullDetailRadius)
+{
+    if(!pLods || (pixelRadius >= fullDetailRadius))
+        return 0;
+    int l = pixelRadius > 0.0f ? (int)(logf(fullDetailRadius / pixelRadius) * 1.442695f) + 1 : BK3D_MAXLODS;
+    return l > (int)pLods->n ? (int)pLods->n : l;
+}
+
+} //namespace bk3d
+
+#endif //__BK3DMESHUTILS__
@@ -0,0 +1,113 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** Minimal threading helper for the bk3d processing functions
+ ** (meshlets, LODs, skinning...) : a parallel-for over independent items.
+ **/
+#ifndef __BK3DPARALLEL__
+#define __BK3DPARALLEL__
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <functional>
+
+#ifndef INLINE
+#   define INLINE inline
+#endif
+
+namespace bk3d
+{
+//------------------------------------------------------------------------------------------
+/// \brief threads that parallelFor() can give its work to (a job system...) rather than
+/// starting threads of its own at each call
+//------------------------------------------------------------------------------------------
+struct ParallelForScheduler
+{
+    virtual ~ParallelForScheduler() {}
+    virtual int  getNumThreads() = 0;
+    /// calls f(i) for i in [0,n) on at most maxThreads threads, the calling one included
+    virtual void parallelFor(int n, const std::function<void(int)> &f, int maxThreads) = 0;
+};
+INLINE ParallelForScheduler*& parallelForScheduler()
+{
+    static ParallelForScheduler *pScheduler = NULL;
+    return pScheduler;
+}
+/// NULL to go back to the threads of parallelFor() itself
+INLINE void setParallelForScheduler(ParallelForScheduler *pScheduler)
+{
+    parallelForScheduler() = pScheduler;
+}
+//------------------------------------------------------------------------------------------
+/// amount of threads parallelFor() will use by default
+//------------------------------------------------------------------------------------------
+INLINE int getNumWorkerThreads()
+{
+    if(parallelForScheduler())
+        return parallelForScheduler()->getNumThreads();
+    int n = (int)std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+//------------------------------------------------------------------------------------------
+/// \brief calls f(i) for i in [0,n) across threads. Items are fetched one by one, so uneven
+/// items (PrimGroups of different sizes...) get balanced. The calling thread takes part in the work.
+/// With a ParallelForScheduler, its threads do the work.
+/// \param maxThreads : 0 for getNumWorkerThreads(); 1 to run everything on the calling thread
+//------------------------------------------------------------------------------------------
+template<typename F> INLINE void parallelFor(int n, F f, int maxThreads = 0)
+{
+    int nt = maxThreads > 0 ? maxThreads : getNumWorkerThreads();
+    if(nt > n)
+        nt = n;
+    if(nt <= 1)
+    {
+        for(int i=0; i<n; i++)
+            f(i);
+        return;
+    }
+    if(parallelForScheduler())
+    {
+        parallelForScheduler()->parallelFor(n, std::function<void(int)>(f), nt);
+        return;
+    }
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        int i;
+        while((i = next.fetch_add(1)) < n)
+            f(i);
+    };
+    std::vector<std::thread> threads;
+    for(int t=1; t<nt; t++)
+        threads.push_back(std::thread(worker));
+    worker();
+    for(size_t t=0; t<threads.size(); t++)
+        threads[t].join();
+}
+
+} //namespace bk3d
+
+#endif //__BK3DPARALLEL__
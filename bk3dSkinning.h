@@ -0,0 +1,338 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** Linear blend skinning of the bk3d Meshes on the CPU : positions and
+ ** normals deformed by the skin matrices of their transforms.
+ **/
+#ifndef __BK3DSKINNING__
+#define __BK3DSKINNING__
+#include "bk3dEx.h"
+#include "bk3dMeshUtils.h" // BK3D_SSE2, findAttribute(), readAttributeComponent()
+#include "bk3dParallel.h"
+#include <math.h>
+#include <vector>
+#if defined(BK3D_SSE2) && defined(__AVX__)
+#   include <immintrin.h>
+#   define BK3D_AVX
+#endif
+
+namespace bk3d
+{
+/*--------------------------------
+CPU skinning
+- the influences (MESH_BONESOFFSETS + MESH_BONESWEIGHTS, or MESH_2BONES2WEIGHTS) are read once into
+  4 bone indices + 4 normalized weights per vertex. A bone index is an entry of Mesh::pTransforms
+- the skin matrix of a bone is its MatrixAbsInvBindposeMatrix (Mabs * inverse(bindpose))
+- for each vertex the skin matrices are blended by the weights, then applied to the position and
+  to the normal (renormalized : the blended matrix isn't orthogonal)
+- the result goes to 2 buffers of interleaved position + normal (6 floats) : one is being written
+  while the other one is the last complete result (getDeformed()), being uploaded or drawn
+----------------------------------*/
+#define BK3D_SKINMAXINFLUENCES 4
+#define BK3D_SKINRANGE 4096 ///< vertices per parallel job
+
+/// how skinRange() computes
+enum SkinningSIMD
+{
+    SKINSIMD_SCALAR = 0,
+    SKINSIMD_SSE2,
+    SKINSIMD_AVX,
+};
+INLINE SkinningSIMD getBestSkinningSIMD()
+{
+#if defined(BK3D_AVX)
+    return SKINSIMD_AVX;
+#elif defined(BK3D_SSE2)
+    return SKINSIMD_SSE2;
+#else
+    return SKINSIMD_SCALAR;
+#endif
+}
+
+/// influences of a vertex. Unused ones have a weight of 0
+struct SkinInfluences
+{
+    unsigned short  bone[BK3D_SKINMAXINFLUENCES];
+    float           weight[BK3D_SKINMAXINFLUENCES];
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief skinning state of one Mesh : its influences, the bind pose, the skin matrices of the
+/// last skin() and the 2 deformed buffers
+//------------------------------------------------------------------------------------------
+struct SkinnedMesh
+{
+    Mesh*                       pMesh;
+    int                         nVertices;
+    std::vector<float>          bindPose;   ///< position + normal (6 floats) per vertex
+    std::vector<SkinInfluences> influences;
+    std::vector<MatrixType>     palette;    ///< skin matrix of each entry of Mesh::pTransforms
+    std::vector<float>          deformed[2];///< position + normal per vertex
+    int                         front;      ///< deformed[front] is the last complete result
+    bool                        bHasNormals;
+    unsigned int                frame;      ///< incremented by each skin() that did something
+
+    SkinnedMesh() : pMesh(NULL), nVertices(0), front(0), bHasNormals(false), frame(0) {}
+    /// \return false if the Mesh isn't skinned (numJointInfluence, influences, transforms) or if its
+    /// positions aren't floats
+    bool build(Mesh *pM)
+    {
+        pMesh = pM;
+        nVertices = 0;
+        Attribute *pPos = findAttribute(pM, MESH_POSITION);
+        Attribute *pNormal = findAttribute(pM, MESH_NORMAL);
+        Attribute *pBones = findAttribute(pM, MESH_BONESOFFSETS);
+        Attribute *pWeights = findAttribute(pM, MESH_BONESWEIGHTS);
+        Attribute *p2B2W = findAttribute(pM, MESH_2BONES2WEIGHTS);
+        if((pM->numJointInfluence <= 0) || !pPos || (pPos->formatGL != GL_FLOAT) || (pPos->numComp < 3)
+        || !pM->pTransforms || (pM->pTransforms->n == 0))
+            return false;
+        if(!(pBones && pWeights) && !(p2B2W && (p2B2W->numComp >= 4)))
+            return false;
+        nVertices = pM->pSlots->p[pPos->slot]->vertexCount;
+        bHasNormals = pNormal && (pNormal->formatGL == GL_FLOAT) && (pNormal->numComp >= 3);
+        readBindPose();
+        // influences. A sparse Slot (MESH_VERTEXID) only lists some vertices : the others don't move
+        SkinInfluences none;
+        memset(&none, 0, sizeof(SkinInfluences));
+        influences.assign(nVertices, none);
+        Attribute *pInf = p2B2W ? p2B2W : pWeights;
+        Slot *pSlot = pM->pSlots->p[pInf->slot];
+        Attribute *pVtxId = NULL;
+        for(int a=0; pSlot->pAttributes && (a<pSlot->pAttributes->n); a++)
+            if(!strcmp(pSlot->pAttributes->p[a]->name, MESH_VERTEXID))
+                pVtxId = pSlot->pAttributes->p[a];
+        int nRefs = pM->pTransforms->n;
+        int nInf = p2B2W ? 2 : (pWeights->numComp < BK3D_SKINMAXINFLUENCES ? pWeights->numComp : BK3D_SKINMAXINFLUENCES);
+        if(!p2B2W && (pM->numJointInfluence < nInf))
+            nInf = pM->numJointInfluence;
+        for(unsigned int k=0; k<pSlot->vertexCount; k++)
+        {
+            int v = pVtxId ? (int)readAttributeComponent(pVtxId, k, 0) : (int)k;
+            if((v < 0) || (v >= nVertices))
+                continue;
+            // the valid influences are packed at the start : skinRange() stops at the first weight of 0
+            SkinInfluences &si = influences[v];
+            float sum = 0.0f;
+            int n = 0;
+            for(int i=0; i<nInf; i++)
+            {
+                int b = (int)(p2B2W ? readAttributeComponent(p2B2W, k, i*2) : readAttributeComponent(pBones, k, i));
+                float w = p2B2W ? readAttributeComponent(p2B2W, k, i*2+1) : readAttributeComponent(pWeights, k, i);
+                if((b < 0) || (b >= nRefs) || !(w > 0.0f))
+                    continue;
+                si.bone[n] = (unsigned short)b;
+                si.weight[n++] = w;
+                sum += w;
+            }
+            for(int i=0; (sum > 0.0f) && (i<BK3D_SKINMAXINFLUENCES); i++)
+                si.weight[i] /= sum;
+        }
+        palette.resize(nRefs);
+        memset(&palette[0], 0, nRefs * sizeof(MatrixType));
+        deformed[0] = bindPose;
+        deformed[1] = bindPose;
+        front = 0;
+        return true;
+    }
+    /// (re)reads the positions and normals of the Mesh. Needed when something else (blendshapes...)
+    /// modified them : the next skin() must then be forced
+    void readBindPose()
+    {
+        Attribute *pPos = findAttribute(pMesh, MESH_POSITION);
+        Attribute *pNormal = findAttribute(pMesh, MESH_NORMAL);
+        bindPose.resize(nVertices * 6);
+        for(int v=0; v<nVertices; v++)
+        {
+            float *p = &bindPose[v * 6];
+            readPosition(pPos, v, NULL, p);
+            for(int c=0; c<3; c++)
+                p[3+c] = bHasNormals ? readAttributeComponent(pNormal, v, c) : 0.0f;
+        }
+    }
+    /// gathers the skin matrices. \return false if they are the same as for the previous skin()
+    bool updatePalette()
+    {
+        bool bChanged = false;
+        if(!pMesh)
+            return false;
+        for(size_t i=0; i<palette.size(); i++)
+        {
+            Bone *pB = pMesh->pTransforms->p[i];
+            const MatrixType *pM = pB->pMatrixAbsInvBindposeMatrix ? pB->pMatrixAbsInvBindposeMatrix : pB->pMatrixAbs;
+            if(pM && memcmp(&palette[i], pM, sizeof(MatrixType)))
+            {
+                palette[i] = *pM;
+                bChanged = true;
+            }
+        }
+        return bChanged;
+    }
+    /// vertices [v0, v1) into out
+    void skinRange(int v0, int v1, float *out, SkinningSIMD simd) const
+    {
+        const float *src = &bindPose[0];
+        const MatrixType *pal = &palette[0];
+        const SkinInfluences *inf = &influences[0];
+        switch(simd)
+        {
+#if defined(BK3D_AVX)
+        case SKINSIMD_AVX:
+            for(int v=v0; v<v1; v++)
+            {
+                // 2 columns per register : (c0 c1) (c2 c3)
+                const SkinInfluences &si = inf[v];
+                const float *s = src + v * 6;
+                float *d = out + v * 6;
+                if(si.weight[0] == 0.0f)
+                {
+                    memcpy(d, s, 6 * sizeof(float));
+                    continue;
+                }
+                __m256 w = _mm256_set1_ps(si.weight[0]);
+                __m256 m01 = _mm256_mul_ps(w, _mm256_loadu_ps(pal[si.bone[0]].m));
+                __m256 m23 = _mm256_mul_ps(w, _mm256_loadu_ps(pal[si.bone[0]].m + 8));
+                for(int i=1; (i<BK3D_SKINMAXINFLUENCES) && (si.weight[i] != 0.0f); i++)
+                {
+                    w = _mm256_set1_ps(si.weight[i]);
+                    m01 = _mm256_add_ps(m01, _mm256_mul_ps(w, _mm256_loadu_ps(pal[si.bone[i]].m)));
+                    m23 = _mm256_add_ps(m23, _mm256_mul_ps(w, _mm256_loadu_ps(pal[si.bone[i]].m + 8)));
+                }
+                __m256 pxy = _mm256_setr_ps(s[0], s[0], s[0], s[0], s[1], s[1], s[1], s[1]);
+                __m256 nxy = _mm256_setr_ps(s[3], s[3], s[3], s[3], s[4], s[4], s[4], s[4]);
+                __m256 pz1 = _mm256_setr_ps(s[2], s[2], s[2], s[2], 1.0f, 1.0f, 1.0f, 1.0f);
+                __m256 nz0 = _mm256_setr_ps(s[5], s[5], s[5], s[5], 0.0f, 0.0f, 0.0f, 0.0f);
+                __m256 p2 = _mm256_add_ps(_mm256_mul_ps(m01, pxy), _mm256_mul_ps(m23, pz1));
+                __m256 n2 = _mm256_add_ps(_mm256_mul_ps(m01, nxy), _mm256_mul_ps(m23, nz0));
+                __m128 p = _mm_add_ps(_mm256_castps256_ps128(p2), _mm256_extractf128_ps(p2, 1));
+                __m128 n = _mm_add_ps(_mm256_castps256_ps128(n2), _mm256_extractf128_ps(n2, 1));
+                __m128 nn = _mm_mul_ps(n, n);
+                float len2 = _mm_cvtss_f32(nn) + _mm_cvtss_f32(_mm_shuffle_ps(nn, nn, 1)) + _mm_cvtss_f32(_mm_shuffle_ps(nn, nn, 2));
+                n = _mm_mul_ps(n, _mm_set1_ps(len2 > 0.0f ? 1.0f / sqrtf(len2) : 0.0f));
+                // xyz of p then xyz of n : the 4th float of p gets overwritten by n
+                _mm_storeu_ps(d, p);
+                float nf[4];
+                _mm_storeu_ps(nf, n);
+                d[3] = nf[0]; d[4] = nf[1]; d[5] = nf[2];
+            }
+            break;
+#endif
+#if defined(BK3D_SSE2)
+        case SKINSIMD_SSE2:
+            for(int v=v0; v<v1; v++)
+            {
+                const SkinInfluences &si = inf[v];
+                const float *s = src + v * 6;
+                float *d = out + v * 6;
+                if(si.weight[0] == 0.0f)
+                {
+                    memcpy(d, s, 6 * sizeof(float));
+                    continue;
+                }
+                __m128 c[4];
+                __m128 w = _mm_set1_ps(si.weight[0]);
+                const float *m = pal[si.bone[0]].m;
+                for(int k=0; k<4; k++)
+                    c[k] = _mm_mul_ps(w, _mm_loadu_ps(m + k*4));
+                for(int i=1; (i<BK3D_SKINMAXINFLUENCES) && (si.weight[i] != 0.0f); i++)
+                {
+                    w = _mm_set1_ps(si.weight[i]);
+                    m = pal[si.bone[i]].m;
+                    for(int k=0; k<4; k++)
+                        c[k] = _mm_add_ps(c[k], _mm_mul_ps(w, _mm_loadu_ps(m + k*4)));
+                }
+                __m128 p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0], _mm_set1_ps(s[0])), _mm_mul_ps(c[1], _mm_set1_ps(s[1]))),
+                                      _mm_add_ps(_mm_mul_ps(c[2], _mm_set1_ps(s[2])), c[3]));
+                __m128 n = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0], _mm_set1_ps(s[3])), _mm_mul_ps(c[1], _mm_set1_ps(s[4]))),
+                                      _mm_mul_ps(c[2], _mm_set1_ps(s[5])));
+                float pf[4], nf[4];
+                _mm_storeu_ps(pf, p);
+                _mm_storeu_ps(nf, n);
+                float len2 = nf[0]*nf[0] + nf[1]*nf[1] + nf[2]*nf[2];
+                float inv = len2 > 0.0f ? 1.0f / sqrtf(len2) : 0.0f;
+                d[0] = pf[0]; d[1] = pf[1]; d[2] = pf[2];
+                d[3] = nf[0] * inv; d[4] = nf[1] * inv; d[5] = nf[2] * inv;
+            }
+            break;
+#endif
+        default:
+            for(int v=v0; v<v1; v++)
+            {
+                const SkinInfluences &si = inf[v];
+                const float *s = src + v * 6;
+                float *d = out + v * 6;
+                if(si.weight[0] == 0.0f)
+                {
+                    memcpy(d, s, 6 * sizeof(float));
+                    continue;
+                }
+                float m[16];
+                for(int k=0; k<16; k++)
+                    m[k] = si.weight[0] * pal[si.bone[0]].m[k];
+                for(int i=1; (i<BK3D_SKINMAXINFLUENCES) && (si.weight[i] != 0.0f); i++)
+                    for(int k=0; k<16; k++)
+                        m[k] += si.weight[i] * pal[si.bone[i]].m[k];
+                float n[3];
+                for(int r=0; r<3; r++)
+                {
+                    d[r] = m[r]*s[0] + m[4+r]*s[1] + m[8+r]*s[2] + m[12+r];
+                    n[r] = m[r]*s[3] + m[4+r]*s[4] + m[8+r]*s[5];
+                }
+                float len2 = n[0]*n[0] + n[1]*n[1] + n[2]*n[2];
+                float inv = len2 > 0.0f ? 1.0f / sqrtf(len2) : 0.0f;
+                d[3] = n[0] * inv; d[4] = n[1] * inv; d[5] = n[2] * inv;
+            }
+            break;
+        }
+    }
+    /// \brief skins into the back buffer and makes it the front one. Does nothing when the skin
+    /// matrices didn't change, unless bForce.
+    /// Without pMesh, the palette is used as it was filled
+    /// \param maxThreads : see parallelFor(). Ranges of BK3D_SKINRANGE vertices
+    /// \return the amount of vertices skinned
+    int skin(int maxThreads = 0, SkinningSIMD simd = getBestSkinningSIMD(), bool bForce = false)
+    {
+        if((nVertices == 0) || (!updatePalette() && !bForce))
+            return 0;
+        int back = front ^ 1;
+        float *out = &deformed[back][0];
+        int nRanges = (nVertices + BK3D_SKINRANGE - 1) / BK3D_SKINRANGE;
+        parallelFor(nRanges, [&](int r) {
+            int v0 = r * BK3D_SKINRANGE;
+            skinRange(v0, v0 + BK3D_SKINRANGE < nVertices ? v0 + BK3D_SKINRANGE : nVertices, out, simd);
+        }, maxThreads);
+        front = back;
+        frame++;
+        return nVertices;
+    }
+    /// interleaved position + normal of each vertex : the last complete result
+    inline const float* getDeformed() const { return &deformed[front][0]; }
+};
+
+} //namespace bk3d
+
+#endif //__BK3DSKINNING__
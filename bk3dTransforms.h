@@ -0,0 +1,799 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** Update of the transform hierarchy of a TransformPool : local matrices from
+ ** the components, then absolute matrices level by level.
+ **/
+#ifndef __BK3DTRANSFORMS__
+#define __BK3DTRANSFORMS__
+#include "bk3dEx.h"
+#include "bk3dMeshUtils.h" // BK3D_SSE2
+#include "bk3dParallel.h"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+namespace bk3d
+{
+/*--------------------------------
+Transform hierarchy update
+- the bones are sorted by depth once : a level only needs the absolute matrices of the previous one
+- a bone with bDirty gets its local matrix (BoneDataType::matrix) again from its components
+- a bone gets its absolute matrix again when it is dirty or when its parent's one changed : the
+  clean subtrees are left as they are
+- updateChanged() only visits the subtrees of the bones given to markDirty()
+- the matrices are column major (OpenGL) : Mabs = MabsParent * Mlocal
+- the parents are found with Bone::pParent and Bone::ID, not BoneDataType::parentID : 16 bits
+  aren't enough for the big hierarchies
+----------------------------------*/
+#define BK3D_TRANSFORMS_PARALLELLEVEL 2048 ///< levels with less bones than this are done by the calling thread
+
+/// how the local matrix of a bone is obtained
+enum LocalMatrixSource
+{
+    LOCALSRC_MATRIX = 0,    ///< BoneDataType::matrix is the source : kept as it is
+    LOCALSRC_POSQUAT,       ///< from the pos (in the matrix), the quaternion and the scale of TransformSimple
+    LOCALSRC_ABS,           ///< only the absolute matrix is baked : kept as it is, no parent involved
+    LOCALSRC_MAYA,          ///< Maya transform or joint : see composeMayaLocal()
+};
+
+//------------------------------------------------------------------------------------------
+/// m = translate(pos) * rotate(q) * scale(s). s can be NULL
+//------------------------------------------------------------------------------------------
+INLINE void matrixFromPosQuatScale(float *m, const float *pos, const float *q, const float *s)
+{
+    float x = q[0], y = q[1], z = q[2], w = q[3];
+    float sx = s ? s[0] : 1.0f, sy = s ? s[1] : 1.0f, sz = s ? s[2] : 1.0f;
+    m[0] = (1.0f - 2.0f*(y*y + z*z)) * sx; m[1] = 2.0f*(x*y + w*z) * sx;          m[2] = 2.0f*(x*z - w*y) * sx;          m[3] = 0.0f;
+    m[4] = 2.0f*(x*y - w*z) * sy;          m[5] = (1.0f - 2.0f*(x*x + z*z)) * sy; m[6] = 2.0f*(y*z + w*x) * sy;          m[7] = 0.0f;
+    m[8] = 2.0f*(x*z + w*y) * sz;          m[9] = 2.0f*(y*z - w*x) * sz;          m[10] = (1.0f - 2.0f*(x*x + y*y)) * sz; m[11] = 0.0f;
+    m[12] = pos[0]; m[13] = pos[1]; m[14] = pos[2]; m[15] = 1.0f;
+}
+//------------------------------------------------------------------------------------------
+/// r = a * b, column major. r can't be a or b
+//------------------------------------------------------------------------------------------
+INLINE void matrixMul(float *r, const float *a, const float *b)
+{
+#if defined(BK3D_SSE2)
+    __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+    for(int j=0; j<4; j++)
+    {
+        // column j of r : the columns of a weighted by column j of b
+        const float *bj = b + j*4;
+        __m128 c = _mm_mul_ps(a0, _mm_set1_ps(bj[0]));
+        c = _mm_add_ps(c, _mm_mul_ps(a1, _mm_set1_ps(bj[1])));
+        c = _mm_add_ps(c, _mm_mul_ps(a2, _mm_set1_ps(bj[2])));
+        c = _mm_add_ps(c, _mm_mul_ps(a3, _mm_set1_ps(bj[3])));
+        _mm_storeu_ps(r + j*4, c);
+    }
+#else
+    for(int j=0; j<4; j++)
+        for(int i=0; i<4; i++)
+            r[j*4+i] = a[i]*b[j*4] + a[4+i]*b[j*4+1] + a[8+i]*b[j*4+2] + a[12+i]*b[j*4+3];
+#endif
+}
+
+/*--------------------------------
+Maya transform composition
+The chain of a Maya transform (see bk3d::Transform), with the joint orientation of the joints :
+  Mlocal = T * MrotPivotTransl * MrotPivot * MjointOrient * Mrotation * MrotOrient * MrotPivotInv
+           * MscalePivotTransl * MscalePivot * Mscale * MscalePivotInv
+is composed in closed form : with M = MjointOrient * Mrotation * MrotOrient
+  3x3 = M * Mscale
+  translation = M * (scalePivot + scalePivotTranslate - rotationPivot - scale*scalePivot)
+                + rotationPivot + rotationPivotTranslate + pos
+Mrotation is written directly from the 3 Euler angles for each rotationOrder. A bone takes one of
+3 paths, chosen in TransformUpdater::build() from validComps and the values : Euler only, with the
+orientations, with the pivots. Components that are identity or zero are left out
+----------------------------------*/
+enum MayaComposePath
+{
+    MAYAPATH_EULER = 0,     ///< T * Mrotation * Mscale
+    MAYAPATH_ORIENT,        ///< + joint orientation and/or rotation orientation
+    MAYAPATH_PIVOTS,        ///< + the pivots
+    NUM_MAYAPATHS
+};
+#define MAYACOMPOSE_JOINTORIENT 1 ///< bits of TransformUpdater::mayaFlags
+#define MAYACOMPOSE_ROTORIENT   2
+#define MAYACOMPOSE_PIVOTS      4
+
+/// the axes of the 6 rotation orders, first applied first : "xyz" is Rz * Ry * Rx
+static const unsigned char s_eulerAxes[6][3] = { {0,1,2}, {1,2,0}, {2,0,1}, {0,2,1}, {1,0,2}, {2,1,0} };
+//------------------------------------------------------------------------------------------
+/// index in s_eulerAxes of a rotationOrder ("xyz", "ZYX"...). "xyz" when not valid
+//------------------------------------------------------------------------------------------
+INLINE int getEulerOrderId(const char *order)
+{
+    for(int o=0; o<6; o++)
+    {
+        int k = 0;
+        while((k < 3) && ((order[k] | 0x20) == 'x' + s_eulerAxes[o][k]))
+            k++;
+        if(k == 3)
+            return o;
+    }
+    return 0;
+}
+//------------------------------------------------------------------------------------------
+/// \brief rotation of the Euler angles (radians, one per axis) in the order o, row major.
+/// The "xyz" form is relabeled for the other orders; the odd permutations use the opposite angles
+//------------------------------------------------------------------------------------------
+INLINE void eulerToMatrix3(const float *angles, int o, float *R)
+{
+    const unsigned char *ax = s_eulerAxes[o];
+    float sg = o >= 3 ? -1.0f : 1.0f;
+    float a = sg * angles[ax[0]], b = sg * angles[ax[1]], c = sg * angles[ax[2]];
+    float ca = cosf(a), sa = sinf(a), cb = cosf(b), sb = sinf(b), cc = cosf(c), sc = sinf(c);
+    float X[9] = { cb*cc, sa*sb*cc - ca*sc, ca*sb*cc + sa*sc,
+                   cb*sc, sa*sb*sc + ca*cc, ca*sb*sc - sa*cc,
+                   -sb,   sa*cb,            ca*cb };
+    for(int r=0; r<3; r++)
+        for(int k=0; k<3; k++)
+            R[ax[r]*3 + ax[k]] = X[r*3 + k];
+}
+//------------------------------------------------------------------------------------------
+/// rotation of a quaternion, row major
+//------------------------------------------------------------------------------------------
+INLINE void quatToMatrix3(const float *q, float *R)
+{
+    float x = q[0], y = q[1], z = q[2], w = q[3];
+    R[0] = 1.0f - 2.0f*(y*y + z*z); R[1] = 2.0f*(x*y - w*z);        R[2] = 2.0f*(x*z + w*y);
+    R[3] = 2.0f*(x*y + w*z);        R[4] = 1.0f - 2.0f*(x*x + z*z); R[5] = 2.0f*(y*z - w*x);
+    R[6] = 2.0f*(x*z - w*y);        R[7] = 2.0f*(y*z + w*x);        R[8] = 1.0f - 2.0f*(x*x + y*y);
+}
+INLINE void matrix3Mul(float *r, const float *a, const float *b)
+{
+    for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+            r[i*3+j] = a[i*3]*b[j] + a[i*3+1]*b[3+j] + a[i*3+2]*b[6+j];
+}
+/// what the composition reads for one bone. The components that aren't valid are zero (pivots),
+/// identity (orientations) or one (scale)
+struct MayaComposeInput
+{
+    float   angles[3];      ///< radians
+    float   pos[3];
+    float   scale[3];
+    float   jointOrient[4];
+    float   rotOrient[4];
+    float   scalePivot[3], scalePivotTranslate[3];
+    float   rotPivot[3], rotPivotTranslate[3];
+};
+//------------------------------------------------------------------------------------------
+/// gathers the components of a Transform for the composition. \return the MAYACOMPOSE_xxx bits
+/// of what isn't identity
+//------------------------------------------------------------------------------------------
+INLINE int getMayaComposeInput(const MayaTransformData &td, unsigned int vc, const float *pos, const float *scale, MayaComposeInput &in)
+{
+    static const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    static const float identity[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    static const float one[3] = { 1.0f, 1.0f, 1.0f };
+    const float degToRad = 3.14159265358979f / 180.0f;
+    const float *rot = (vc & TRANSFCOMP_rotation) ? &td.rotation.x : zero;
+    for(int k=0; k<3; k++)
+        in.angles[k] = rot[k] * degToRad;
+    memcpy(in.pos, pos, 3 * sizeof(float));
+    memcpy(in.scale, scale ? scale : one, 3 * sizeof(float));
+    memcpy(in.jointOrient, (vc & TRANSFCOMP_jointOrientation) ? &td.jointOrientation.x : identity, 4 * sizeof(float));
+    memcpy(in.rotOrient, (vc & TRANSFCOMP_rotationOrientation) ? &td.rotationOrientation.x : identity, 4 * sizeof(float));
+    memcpy(in.scalePivot, (vc & TRANSFCOMP_scalePivot) ? &td.scalePivot.x : zero, 3 * sizeof(float));
+    memcpy(in.scalePivotTranslate, (vc & TRANSFCOMP_scalePivotTranslate) ? &td.scalePivotTranslate.x : zero, 3 * sizeof(float));
+    memcpy(in.rotPivot, (vc & TRANSFCOMP_rotationPivot) ? &td.rotationPivot.x : zero, 3 * sizeof(float));
+    memcpy(in.rotPivotTranslate, (vc & TRANSFCOMP_rotationPivotTranslate) ? &td.rotationPivotTranslate.x : zero, 3 * sizeof(float));
+    int flags = 0;
+    if((in.jointOrient[0] != 0.0f) || (in.jointOrient[1] != 0.0f) || (in.jointOrient[2] != 0.0f))
+        flags |= MAYACOMPOSE_JOINTORIENT;
+    if((in.rotOrient[0] != 0.0f) || (in.rotOrient[1] != 0.0f) || (in.rotOrient[2] != 0.0f))
+        flags |= MAYACOMPOSE_ROTORIENT;
+    for(int k=0; k<3; k++)
+        if((in.scalePivot[k] != 0.0f) || (in.scalePivotTranslate[k] != 0.0f) || (in.rotPivot[k] != 0.0f) || (in.rotPivotTranslate[k] != 0.0f))
+            flags |= MAYACOMPOSE_PIVOTS;
+    return flags;
+}
+INLINE int getMayaComposePath(int flags)
+{
+    return (flags & MAYACOMPOSE_PIVOTS) ? MAYAPATH_PIVOTS : (flags ? MAYAPATH_ORIENT : MAYAPATH_EULER);
+}
+//------------------------------------------------------------------------------------------
+/// local matrix (column major) of one bone, closed form
+//------------------------------------------------------------------------------------------
+INLINE void composeMayaLocal(const MayaComposeInput &in, int path, int order, float *m)
+{
+    float M[9], R[9], tmp[9];
+    eulerToMatrix3(in.angles, order, R);
+    if(path >= MAYAPATH_ORIENT)
+    {
+        float Q[9];
+        quatToMatrix3(in.rotOrient, Q);
+        matrix3Mul(tmp, R, Q);
+        quatToMatrix3(in.jointOrient, Q);
+        matrix3Mul(M, Q, tmp);
+    } else
+        memcpy(M, R, sizeof(M));
+    float t[3] = { in.pos[0], in.pos[1], in.pos[2] };
+    if(path == MAYAPATH_PIVOTS)
+    {
+        float v[3];
+        for(int k=0; k<3; k++)
+        {
+            v[k] = in.scalePivot[k] + in.scalePivotTranslate[k] - in.rotPivot[k] - in.scale[k] * in.scalePivot[k];
+            t[k] += in.rotPivot[k] + in.rotPivotTranslate[k];
+        }
+        for(int r=0; r<3; r++)
+            t[r] += M[r*3]*v[0] + M[r*3+1]*v[1] + M[r*3+2]*v[2];
+    }
+    for(int c=0; c<3; c++)
+    {
+        for(int r=0; r<3; r++)
+            m[c*4+r] = M[r*3+c] * in.scale[c];
+        m[c*4+3] = 0.0f;
+    }
+    m[12] = t[0]; m[13] = t[1]; m[14] = t[2]; m[15] = 1.0f;
+}
+
+#if defined(BK3D_SSE2)
+//------------------------------------------------------------------------------------------
+/// sin and cos of 4 angles : reduction to [-pi/4, pi/4] then the polynomials of Cephes (~1e-7)
+//------------------------------------------------------------------------------------------
+INLINE void sincos4(__m128 x, __m128 &s, __m128 &c)
+{
+    __m128i j = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.636619772f))); // round(x * 2/pi)
+    __m128 fj = _mm_cvtepi32_ps(j);
+    // x - j*pi/2 in 3 parts, for the precision
+    __m128 y = _mm_sub_ps(x, _mm_mul_ps(fj, _mm_set1_ps(1.5703125f)));
+    y = _mm_sub_ps(y, _mm_mul_ps(fj, _mm_set1_ps(4.837512969970703125e-4f)));
+    y = _mm_sub_ps(y, _mm_mul_ps(fj, _mm_set1_ps(7.54978995489188216e-8f)));
+    __m128 z = _mm_mul_ps(y, y);
+    __m128 ps = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), z), _mm_set1_ps(8.3321608736e-3f));
+    ps = _mm_add_ps(_mm_mul_ps(ps, z), _mm_set1_ps(-1.6666654611e-1f));
+    ps = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ps, z), y), y);
+    __m128 pc = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), z), _mm_set1_ps(-1.388731625493765e-3f));
+    pc = _mm_add_ps(_mm_mul_ps(pc, z), _mm_set1_ps(4.166664568298827e-2f));
+    pc = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(pc, z), z), _mm_mul_ps(_mm_set1_ps(0.5f), z)), _mm_set1_ps(1.0f));
+    // quadrant : sin = (s, c, -s, -c), cos = (c, -s, -c, s)
+    __m128i q = _mm_and_si128(j, _mm_set1_epi32(3));
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 sinv = _mm_or_ps(_mm_and_ps(swap, pc), _mm_andnot_ps(swap, ps));
+    __m128 cosv = _mm_or_ps(_mm_and_ps(swap, ps), _mm_andnot_ps(swap, pc));
+    __m128 signS = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30));
+    __m128 signC = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+    s = _mm_xor_ps(sinv, signS);
+    c = _mm_xor_ps(cosv, signC);
+}
+/// rotation of 4 quaternions, SoA, row major
+INLINE void quatToMatrix3x4(const __m128 *q, __m128 *R)
+{
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+    __m128 x = q[0], y = q[1], z = q[2], w = q[3];
+    __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+    __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+    __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+    R[0] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))); R[1] = _mm_mul_ps(two, _mm_sub_ps(xy, wz)); R[2] = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+    R[3] = _mm_mul_ps(two, _mm_add_ps(xy, wz)); R[4] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))); R[5] = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+    R[6] = _mm_mul_ps(two, _mm_sub_ps(xz, wy)); R[7] = _mm_mul_ps(two, _mm_add_ps(yz, wx)); R[8] = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+}
+INLINE void matrix3Mulx4(__m128 *r, const __m128 *a, const __m128 *b)
+{
+    for(int i=0; i<3; i++)
+        for(int j=0; j<3; j++)
+            r[i*3+j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[i*3], b[j]), _mm_mul_ps(a[i*3+1], b[3+j])), _mm_mul_ps(a[i*3+2], b[6+j]));
+}
+//------------------------------------------------------------------------------------------
+/// composeMayaLocal() of 4 bones of the same path and rotation order, at once
+//------------------------------------------------------------------------------------------
+INLINE void composeMayaLocal4(const MayaComposeInput *const *in, int path, int order, float *const *m)
+{
+    // SoA : v[k] = field k of the 4 bones
+    #define BK3D_LOADSOA(field) _mm_setr_ps(in[0]->field, in[1]->field, in[2]->field, in[3]->field)
+    const unsigned char *ax = s_eulerAxes[order];
+    __m128 sg = _mm_set1_ps(order >= 3 ? -1.0f : 1.0f);
+    __m128 sa, ca, sb, cb, sc, cc;
+    sincos4(_mm_mul_ps(sg, BK3D_LOADSOA(angles[ax[0]])), sa, ca);
+    sincos4(_mm_mul_ps(sg, BK3D_LOADSOA(angles[ax[1]])), sb, cb);
+    sincos4(_mm_mul_ps(sg, BK3D_LOADSOA(angles[ax[2]])), sc, cc);
+    __m128 X[9], R[9], M[9];
+    __m128 sasb = _mm_mul_ps(sa, sb), casb = _mm_mul_ps(ca, sb);
+    X[0] = _mm_mul_ps(cb, cc); X[1] = _mm_sub_ps(_mm_mul_ps(sasb, cc), _mm_mul_ps(ca, sc)); X[2] = _mm_add_ps(_mm_mul_ps(casb, cc), _mm_mul_ps(sa, sc));
+    X[3] = _mm_mul_ps(cb, sc); X[4] = _mm_add_ps(_mm_mul_ps(sasb, sc), _mm_mul_ps(ca, cc)); X[5] = _mm_sub_ps(_mm_mul_ps(casb, sc), _mm_mul_ps(sa, cc));
+    X[6] = _mm_sub_ps(_mm_setzero_ps(), sb); X[7] = _mm_mul_ps(sa, cb); X[8] = _mm_mul_ps(ca, cb);
+    // the relabeling of the order is only a renaming of the registers
+    for(int r=0; r<3; r++)
+        for(int k=0; k<3; k++)
+            R[ax[r]*3 + ax[k]] = X[r*3 + k];
+    if(path >= MAYAPATH_ORIENT)
+    {
+        __m128 q[4], Q[9], tmp[9];
+        for(int k=0; k<4; k++)
+            q[k] = BK3D_LOADSOA(rotOrient[k]);
+        quatToMatrix3x4(q, Q);
+        matrix3Mulx4(tmp, R, Q);
+        for(int k=0; k<4; k++)
+            q[k] = BK3D_LOADSOA(jointOrient[k]);
+        quatToMatrix3x4(q, Q);
+        matrix3Mulx4(M, Q, tmp);
+    } else
+        memcpy(M, R, sizeof(M));
+    __m128 s[3], t[3];
+    for(int k=0; k<3; k++)
+    {
+        s[k] = BK3D_LOADSOA(scale[k]);
+        t[k] = BK3D_LOADSOA(pos[k]);
+    }
+    if(path == MAYAPATH_PIVOTS)
+    {
+        __m128 v[3];
+        for(int k=0; k<3; k++)
+        {
+            __m128 sp = BK3D_LOADSOA(scalePivot[k]), rp = BK3D_LOADSOA(rotPivot[k]);
+            v[k] = _mm_sub_ps(_mm_sub_ps(_mm_add_ps(sp, BK3D_LOADSOA(scalePivotTranslate[k])), rp), _mm_mul_ps(s[k], sp));
+            t[k] = _mm_add_ps(t[k], _mm_add_ps(rp, BK3D_LOADSOA(rotPivotTranslate[k])));
+        }
+        for(int r=0; r<3; r++)
+            t[r] = _mm_add_ps(t[r], _mm_add_ps(_mm_add_ps(_mm_mul_ps(M[r*3], v[0]), _mm_mul_ps(M[r*3+1], v[1])), _mm_mul_ps(M[r*3+2], v[2])));
+    }
+    #undef BK3D_LOADSOA
+    // back to 4 column major matrices : each column is a 4x4 transpose
+    __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    for(int c=0; c<3; c++)
+    {
+        __m128 c0 = _mm_mul_ps(M[c], s[c]), c1 = _mm_mul_ps(M[3+c], s[c]), c2 = _mm_mul_ps(M[6+c], s[c]), c3 = zero;
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        _mm_storeu_ps(m[0] + c*4, c0);
+        _mm_storeu_ps(m[1] + c*4, c1);
+        _mm_storeu_ps(m[2] + c*4, c2);
+        _mm_storeu_ps(m[3] + c*4, c3);
+    }
+    __m128 t0 = t[0], t1 = t[1], t2 = t[2], t3 = one;
+    _MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+    _mm_storeu_ps(m[0] + 12, t0);
+    _mm_storeu_ps(m[1] + 12, t1);
+    _mm_storeu_ps(m[2] + 12, t2);
+    _mm_storeu_ps(m[3] + 12, t3);
+}
+#endif
+
+//------------------------------------------------------------------------------------------
+/// \brief the chain of 4x4 matrices, one after the other in double precision. Slow : meant as a
+/// reference for composeMayaLocal()
+//------------------------------------------------------------------------------------------
+INLINE void composeMayaLocalNaive(const MayaComposeInput &in, int order, float *m)
+{
+    struct M4 {
+        double v[16]; // column major
+        M4() { memset(v, 0, sizeof(v)); v[0] = v[5] = v[10] = v[15] = 1.0; }
+        M4 operator*(const M4 &b) const {
+            M4 r;
+            for(int c=0; c<4; c++)
+                for(int i=0; i<4; i++)
+                    r.v[c*4+i] = v[i]*b.v[c*4] + v[4+i]*b.v[c*4+1] + v[8+i]*b.v[c*4+2] + v[12+i]*b.v[c*4+3];
+            return r;
+        }
+        static M4 translate(const float *t, double sign = 1.0) { M4 r; for(int k=0; k<3; k++) r.v[12+k] = sign * t[k]; return r; }
+        static M4 scale(const float *s) { M4 r; for(int k=0; k<3; k++) r.v[k*5] = s[k]; return r; }
+        static M4 axis(int a, double angle) {
+            M4 r; double c = cos(angle), s = sin(angle);
+            int i = (a + 1) % 3, j = (a + 2) % 3;
+            r.v[i*4+i] = c; r.v[j*4+j] = c; r.v[i*4+j] = s; r.v[j*4+i] = -s;
+            return r;
+        }
+        static M4 quat(const float *q) {
+            M4 r; double x = q[0], y = q[1], z = q[2], w = q[3];
+            r.v[0] = 1 - 2*(y*y + z*z); r.v[1] = 2*(x*y + w*z);     r.v[2] = 2*(x*z - w*y);
+            r.v[4] = 2*(x*y - w*z);     r.v[5] = 1 - 2*(x*x + z*z); r.v[6] = 2*(y*z + w*x);
+            r.v[8] = 2*(x*z + w*y);     r.v[9] = 2*(y*z - w*x);     r.v[10] = 1 - 2*(x*x + y*y);
+            return r;
+        }
+    };
+    const unsigned char *ax = s_eulerAxes[order];
+    M4 rot = M4::axis(ax[2], in.angles[ax[2]]) * M4::axis(ax[1], in.angles[ax[1]]) * M4::axis(ax[0], in.angles[ax[0]]);
+    M4 r = M4::translate(in.pos) * M4::translate(in.rotPivotTranslate) * M4::translate(in.rotPivot)
+         * M4::quat(in.jointOrient) * rot * M4::quat(in.rotOrient) * M4::translate(in.rotPivot, -1.0)
+         * M4::translate(in.scalePivotTranslate) * M4::translate(in.scalePivot) * M4::scale(in.scale)
+         * M4::translate(in.scalePivot, -1.0);
+    for(int k=0; k<16; k++)
+        m[k] = (float)r.v[k];
+}
+
+//------------------------------------------------------------------------------------------
+/// \brief updates the matrices of a TransformPool : tableBoneData[].matrix, tableMatrixAbs and
+/// tableMatrixAbsInvBindposeMatrix, for the dirty bones and their subtrees. Clears bDirty.
+///
+/// 2 ways to use it :
+/// - update() : every bone is checked (bDirty, changed parent). Fine when most of the bones move
+/// - markDirty() by the writers, then updateChanged() : only the marked bones and their subtrees
+///   are visited. The cost follows the amount of changes, not the size of the hierarchy
+///
+/// Both leave the journal of the bones they updated in changedIDs, sorted by depth : what the
+/// consumers of the matrices (GPU upload, skinning, bounds...) have to process again
+//------------------------------------------------------------------------------------------
+struct TransformUpdater
+{
+    TransformPool*              pPool;
+    std::vector<unsigned int>   order;      ///< bone IDs sorted by depth
+    std::vector<int>            levels;     ///< order[levels[l], levels[l+1]) : the bones of depth l
+    std::vector<int>            parent;     ///< parent ID of each bone; -1 for the roots
+    std::vector<unsigned short> depth;
+    std::vector<int>            childFirst; ///< children of a bone : children[childFirst[ID], childFirst[ID+1])
+    std::vector<unsigned int>   children;
+    std::vector<unsigned char>  localSrc;   ///< LocalMatrixSource of each bone
+    std::vector<const float*>   pScale;     ///< scale of the TransformSimple's; NULL otherwise
+    std::vector<unsigned char>  mayaKey;    ///< LOCALSRC_MAYA : path * 6 + rotation order
+    std::vector<unsigned char>  composed;   ///< local matrix done by composeLocals() for this update
+    std::vector<unsigned int>   composeList; ///< scratch of composeLocals()
+    std::vector<unsigned char>  changed;    ///< update() : absolute matrix updated. updateChanged() : bone queued
+    std::vector<unsigned int>   pending;    ///< bones given to markDirty() since the last updateChanged()
+    std::vector<unsigned int>   changedIDs; ///< journal : the bones updated by the last update()/updateChanged()
+    std::vector<int>            changedLevels; ///< changedIDs[changedLevels[l], changedLevels[l+1]) : depth l
+    std::atomic<int>            nUpdated;   ///< absolute matrices computed by the last update()
+
+    TransformUpdater() : pPool(NULL), nUpdated(0) {}
+    /// sorts the bones by depth and finds how to get their local matrices. All the bones
+    /// are marked dirty, so that the first update()/updateChanged() computes everything
+    void build(TransformPool *pTP)
+    {
+        pPool = pTP;
+        order.clear();
+        levels.clear();
+        pending.clear();
+        changedIDs.clear();
+        changedLevels.clear();
+        int n = pTP ? pTP->nBones : 0;
+        parent.assign(n, -1);
+        localSrc.assign(n, LOCALSRC_MATRIX);
+        pScale.assign(n, (const float*)NULL);
+        mayaKey.assign(n, 0);
+        composed.assign(n, 0);
+        changed.assign(n, 0);
+        if(n == 0)
+            return;
+        for(int i=0; i<n; i++)
+        {
+            Bone *pB = pTP->pBones[i];
+            unsigned int ID = pB->ID;
+            if(pB->pParent)
+                parent[ID] = pB->pParent->ID;
+            unsigned int vc = pB->ValidComps();
+            // the Maya pivots and orientations aren't in the quaternion : the matrix stays the source for these
+            const unsigned int mayaComps = TRANSFCOMP_scalePivot|TRANSFCOMP_scalePivotTranslate|TRANSFCOMP_rotationPivot
+                |TRANSFCOMP_rotationPivotTranslate|TRANSFCOMP_rotationOrientation|TRANSFCOMP_jointOrientation;
+            if((pB->nodeType == NODE_TRANSFORM) && pTP->tableMayaTransformData.p && (vc & TRANSFCOMP_rotation))
+            {
+                // the path depends on what isn't identity now : build() again if the pivots get animated
+                MayaComposeInput in;
+                int flags = getMayaComposeInput(pTP->tableMayaTransformData[ID], vc, pB->Pos(), NULL, in);
+                localSrc[ID] = LOCALSRC_MAYA;
+                mayaKey[ID] = (unsigned char)(getMayaComposePath(flags) * 6 + getEulerOrderId(pTP->tableMayaTransformData[ID].rotationOrder));
+            }
+            else if((vc & (TRANSFCOMP_Quat|TRANSFCOMP_Quat_ready)) && !(vc & mayaComps))
+                localSrc[ID] = LOCALSRC_POSQUAT;
+            else if((vc & (TRANSFCOMP_abs_matrix|TRANSFCOMP_abs_matrix_ready)) && !(vc & (TRANSFCOMP_matrix|TRANSFCOMP_matrix_ready)))
+                localSrc[ID] = LOCALSRC_ABS;
+            if(((pB->nodeType == NODE_TRANSFORMSIMPLE) || (pB->nodeType == NODE_TRANSFORM)) && (vc & TRANSFCOMP_scale))
+                pScale[ID] = pB->asTransfSimple()->scale;
+            pB->setDirty(true);
+        }
+        // depth of each bone : the parents are resolved first, whatever the order of the IDs
+        std::vector<int> d(n, -1), stack;
+        int maxDepth = 0;
+        for(int i=0; i<n; i++)
+        {
+            int b = i;
+            while((b >= 0) && (d[b] < 0))
+            {
+                stack.push_back(b);
+                b = parent[b];
+            }
+            int dd = b >= 0 ? d[b] : -1;
+            while(!stack.empty())
+            {
+                d[stack.back()] = ++dd;
+                stack.pop_back();
+            }
+            maxDepth = d[i] > maxDepth ? d[i] : maxDepth;
+        }
+        depth.assign(d.begin(), d.end());
+        // counting sort : by depth, then by ID
+        levels.assign(maxDepth + 2, 0);
+        for(int i=0; i<n; i++)
+            levels[d[i] + 1]++;
+        for(int l=0; l<=maxDepth; l++)
+            levels[l+1] += levels[l];
+        order.resize(n);
+        std::vector<int> fill(levels.begin(), levels.end() - 1);
+        for(int i=0; i<n; i++)
+            order[fill[d[i]]++] = i;
+        // children lists, for the propagation of updateChanged()
+        childFirst.assign(n + 1, 0);
+        for(int i=0; i<n; i++)
+            if(parent[i] >= 0)
+                childFirst[parent[i] + 1]++;
+        for(int i=0; i<n; i++)
+            childFirst[i+1] += childFirst[i];
+        children.resize(childFirst[n]);
+        fill.assign(childFirst.begin(), childFirst.end() - 1);
+        for(int i=0; i<n; i++)
+            if(parent[i] >= 0)
+                children[fill[parent[i]]++] = i;
+        // the roots cover everything
+        for(int i=levels[0]; i<levels[1]; i++)
+            markDirty(order[i]);
+    }
+    /// local matrix if dirty, then the absolute ones
+    inline void computeBone(unsigned int ID)
+    {
+        TransformPool *pTP = pPool;
+        BoneDataType &bd = pTP->tableBoneData[ID];
+        MatrixType *pAbs = pTP->tableMatrixAbs;
+        MatrixType *pInvBP = pTP->tableMatrixInvBindpose;
+        MatrixType *pAbsInvBP = pTP->tableMatrixAbsInvBindposeMatrix;
+        int p = parent[ID];
+        if(bd.bDirty && (localSrc[ID] == LOCALSRC_POSQUAT))
+            matrixFromPosQuatScale(bd.matrix.m, bd.matrix.pos(), &bd.quat.x, pScale[ID]);
+        else if(bd.bDirty && (localSrc[ID] == LOCALSRC_MAYA))
+        {
+            // dirty without going through composeLocals() (bDirty set directly)
+            if(!composed[ID])
+                composeLocalScalar(ID);
+            composed[ID] = 0;
+        }
+        if(localSrc[ID] != LOCALSRC_ABS)
+        {
+            if(p >= 0)
+                matrixMul(pAbs[ID].m, pAbs[p].m, bd.matrix.m);
+            else
+                pAbs[ID] = bd.matrix;
+        }
+        if(pAbsInvBP && pInvBP)
+            matrixMul(pAbsInvBP[ID].m, pAbs[ID].m, pInvBP[ID].m);
+        bd.bDirty = 0;
+    }
+    /// local matrix of a LOCALSRC_MAYA bone, alone
+    void composeLocalScalar(unsigned int ID)
+    {
+        BoneDataType &bd = pPool->tableBoneData[ID];
+        MayaComposeInput in;
+        getMayaComposeInput(pPool->tableMayaTransformData[ID], bd.validComps, bd.matrix.pos(), pScale[ID], in);
+        composeMayaLocal(in, mayaKey[ID] / 6, mayaKey[ID] % 6, bd.matrix.m);
+    }
+    /// \brief local matrices of the dirty LOCALSRC_MAYA bones of the list, sorted by path and rotation
+    /// order so that they get composed 4 at once
+    void composeLocals(const unsigned int *pIDs, int n, int maxThreads = 1)
+    {
+        const int nKeys = NUM_MAYAPATHS * 6;
+        int first[nKeys + 1];
+        memset(first, 0, sizeof(first));
+        for(int i=0; i<n; i++)
+            if((localSrc[pIDs[i]] == LOCALSRC_MAYA) && pPool->tableBoneData[pIDs[i]].bDirty)
+                first[mayaKey[pIDs[i]] + 1]++;
+        for(int k=0; k<nKeys; k++)
+            first[k+1] += first[k];
+        if(first[nKeys] == 0)
+            return;
+        composeList.resize(first[nKeys]);
+        int fill[nKeys];
+        memcpy(fill, first, sizeof(fill));
+        for(int i=0; i<n; i++)
+            if((localSrc[pIDs[i]] == LOCALSRC_MAYA) && pPool->tableBoneData[pIDs[i]].bDirty)
+            {
+                composeList[fill[mayaKey[pIDs[i]]]++] = pIDs[i];
+                composed[pIDs[i]] = 1;
+            }
+        // batches of 4 bones of the same key
+        std::vector<int> batches;
+        for(int k=0; k<nKeys; k++)
+            for(int i=first[k]; i<first[k+1]; i+=4)
+                batches.push_back(i);
+        batches.push_back(first[nKeys]);
+        int nBatches = (int)batches.size() - 1;
+        const int chunk = 256;
+        parallelFor((nBatches + chunk - 1) / chunk, [&](int c) {
+            for(int b=c*chunk; (b<(c+1)*chunk) && (b<nBatches); b++)
+            {
+                int i0 = batches[b];
+                int cnt = batches[b+1] - i0 < 4 ? batches[b+1] - i0 : 4;
+                int key = mayaKey[composeList[i0]];
+#if defined(BK3D_SSE2)
+                MayaComposeInput in[4];
+                const MayaComposeInput *pIn[4];
+                float tail[4][16];
+                float *pM[4];
+                for(int l=0; l<4; l++)
+                {
+                    // the lanes after cnt repeat the last bone and write elsewhere
+                    unsigned int ID = composeList[i0 + (l < cnt ? l : cnt - 1)];
+                    BoneDataType &bd = pPool->tableBoneData[ID];
+                    getMayaComposeInput(pPool->tableMayaTransformData[ID], bd.validComps, bd.matrix.pos(), pScale[ID], in[l]);
+                    pIn[l] = in + l;
+                    pM[l] = l < cnt ? bd.matrix.m : tail[l];
+                }
+                composeMayaLocal4(pIn, key / 6, key % 6, pM);
+#else
+                for(int l=0; l<cnt; l++)
+                    composeLocalScalar(composeList[i0 + l]);
+#endif
+            }
+        }, nBatches > chunk ? maxThreads : 1);
+    }
+    /// bones order[i0, i1) of a level
+    void updateRange(int i0, int i1)
+    {
+        BoneDataType *pData = pPool->tableBoneData;
+        int count = 0;
+        for(int i=i0; i<i1; i++)
+        {
+            unsigned int ID = order[i];
+            int p = parent[ID];
+            if(!pData[ID].bDirty && !((p >= 0) && changed[p]))
+            {
+                changed[ID] = 0;
+                continue;
+            }
+            computeBone(ID);
+            changed[ID] = 1;
+            count++;
+        }
+        if(count)
+            nUpdated += count;
+    }
+    /// runs f(i0, i1) over [begin, end), across threads when big enough
+    template<typename F> void forLevel(int begin, int end, int maxThreads, F f)
+    {
+        const int chunk = BK3D_TRANSFORMS_PARALLELLEVEL / 4;
+        if((maxThreads == 1) || (end - begin < BK3D_TRANSFORMS_PARALLELLEVEL))
+            f(begin, end);
+        else
+            parallelFor((end - begin + chunk - 1) / chunk, [&](int c) {
+                f(begin + c * chunk, begin + (c+1) * chunk < end ? begin + (c+1) * chunk : end);
+            }, maxThreads);
+    }
+    /// \param maxThreads : for the levels of at least BK3D_TRANSFORMS_PARALLELLEVEL bones. See parallelFor()
+    /// \return the amount of absolute matrices computed
+    int update(int maxThreads = 1)
+    {
+        nUpdated = 0;
+        changedIDs.clear();
+        changedLevels.clear();
+        if(!pPool || order.empty())
+            return 0;
+        composeList.clear();
+        for(size_t i=0; i<order.size(); i++)
+            if(pPool->tableBoneData[i].bDirty && (localSrc[i] == LOCALSRC_MAYA))
+                composeList.push_back((unsigned int)i);
+        if(!composeList.empty())
+        {
+            std::vector<unsigned int> dirty(composeList);
+            composeLocals(&dirty[0], (int)dirty.size(), maxThreads);
+        }
+        for(size_t l=0; l+1<levels.size(); l++)
+        {
+            forLevel(levels[l], levels[l+1], maxThreads, [&](int i0, int i1) { updateRange(i0, i1); });
+            // journal : in depth order
+            changedLevels.push_back((int)changedIDs.size());
+            for(int i=levels[l]; i<levels[l+1]; i++)
+                if(changed[order[i]])
+                    changedIDs.push_back(order[i]);
+        }
+        changedLevels.push_back((int)changedIDs.size());
+        // back to the state of markDirty() : nothing queued. The marked bones were dirty, so they got updated
+        for(size_t i=0; i<changedIDs.size(); i++)
+            changed[changedIDs[i]] = 0;
+        pending.clear();
+        return nUpdated;
+    }
+    /// a writer changed the components of the bone : for updateChanged(). Sets bDirty
+    inline void markDirty(unsigned int ID)
+    {
+        pPool->tableBoneData[ID].bDirty = 1;
+        if(!changed[ID])
+        {
+            changed[ID] = 1;
+            pending.push_back(ID);
+        }
+    }
+    void markDirty(const unsigned int *pIDs, int n)
+    {
+        for(int i=0; i<n; i++)
+            markDirty(pIDs[i]);
+    }
+    /// a writer changed BoneDataType::matrix itself (IK...) : for updateChanged(), which takes it
+    /// as it is instead of composing it from the components. bDirty isn't set
+    inline void markLocalChanged(unsigned int ID)
+    {
+        if(!changed[ID])
+        {
+            changed[ID] = 1;
+            pending.push_back(ID);
+        }
+    }
+    /// updates the bones given to markDirty() and their subtrees, nothing else
+    /// \return the amount of absolute matrices computed
+    int updateChanged(int maxThreads = 1)
+    {
+        changedIDs.clear();
+        changedLevels.clear();
+        if(!pPool || order.empty())
+            return 0;
+        if(!pending.empty())
+            composeLocals(&pending[0], (int)pending.size(), maxThreads);
+        // subtrees of the marked bones. changed[] tells what is already in : a marked bone
+        // under another marked one is only visited once
+        std::vector<unsigned int> &list = pending;
+        for(size_t i=0; i<list.size(); i++)
+        {
+            unsigned int ID = list[i];
+            for(int c=childFirst[ID]; c<childFirst[ID+1]; c++)
+                if(!changed[children[c]])
+                {
+                    changed[children[c]] = 1;
+                    list.push_back(children[c]);
+                }
+        }
+        // by depth : counting sort on the levels
+        int nLevels = (int)levels.size() - 1;
+        changedLevels.assign(nLevels + 1, 0);
+        for(size_t i=0; i<list.size(); i++)
+            changedLevels[depth[list[i]] + 1]++;
+        for(int l=0; l<nLevels; l++)
+            changedLevels[l+1] += changedLevels[l];
+        changedIDs.resize(list.size());
+        std::vector<int> fill(changedLevels.begin(), changedLevels.end() - 1);
+        for(size_t i=0; i<list.size(); i++)
+        {
+            changedIDs[fill[depth[list[i]]]++] = list[i];
+            changed[list[i]] = 0;
+        }
+        pending.clear();
+        for(int l=0; l<nLevels; l++)
+            forLevel(changedLevels[l], changedLevels[l+1], maxThreads, [&](int i0, int i1) {
+                for(int i=i0; i<i1; i++)
+                    computeBone(changedIDs[i]);
+            });
+        nUpdated = (int)changedIDs.size();
+        return nUpdated;
+    }
+    /// the journal as ranges of consecutive IDs [first, first+count) : for the uploads of the
+    /// matrix tables. Ranges closer than maxGap IDs are merged
+    void getChangedRanges(std::vector<unsigned int> &ranges, unsigned int maxGap = 8) const
+    {
+        ranges.clear();
+        std::vector<unsigned int> ids(changedIDs);
+        std::sort(ids.begin(), ids.end());
+        for(size_t i=0; i<ids.size(); i++)
+        {
+            if(!ranges.empty() && (ids[i] <= ranges[ranges.size()-2] + ranges.back() + maxGap))
+                ranges.back() = ids[i] + 1 - ranges[ranges.size()-2];
+            else {
+                ranges.push_back(ids[i]);
+                ranges.push_back(1);
+            }
+        }
+    }
+};
+
+} //namespace bk3d
+
+#endif //__BK3DTRANSFORMS__
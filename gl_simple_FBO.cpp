@@ -27,15 +27,67 @@
 #pragma GCC diagnostic warning "-fpermissive"
 #include "main.h"
 #include "nv_helpers_gl/WindowInertiaCamera.h"
-#include "nv_helpers_gl/GLSLProgram.h"
 #include <list>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <chrono>
 
 #include "bk3dEx.h" // a baked binary format for few models
+#include "bk3dMeshUtils.h"
+#include "bk3dParallel.h"
+#include "bk3dCulling.h"
+#include "bk3dAnimation.h"
+#include "bk3dTransforms.h"
+#include "bk3dSkinning.h"
+#include "bk3dBlendShapes.h"
+#include "bk3dIK.h"
+#include "bk3dJobs.h"
 
 #include "SvCMFCUI.h"
 
 #include "nv_math/nv_math_glsltypes.h"
 //-----------------------------------------------------------------------------
+// Frame pipeline : the simulation of a frame (the frame graph) writes a FramePacket. The GL
+// thread renders from the packet only, while the simulation of the next frame runs and
+// changes the transforms, the skinned vertices and the visibility lists behind it
+//-----------------------------------------------------------------------------
+#define FRAME_PACKETS   3   // the one rendered, the ones ready, the one being simulated
+#define FRAME_MAXDEPTH  (FRAME_PACKETS - 1)
+struct FramePacket
+{
+    int                 frame;
+    // camera of the simulation : culling and rendering see the same one
+    mat4f               mVP, mWVP, view;
+    float               pixelScale;
+    std::vector<int>    visibleList, occludedList;  ///< indices in g_pgItems
+    // what the GL thread uploads before rendering
+    std::vector<int>    blendSlots;     ///< Mesh, Slot : base Slots changed by the Blendshapes
+    std::vector<char>   blendData;      ///< their vertex data, one after the other
+    std::vector<int>    skinUploads;    ///< Meshes skinned on the CPU
+    std::vector<float>  skinData;       ///< their deformed vertices, one after the other
+    std::vector<int>    skinDispatches; ///< Meshes for g_progSkinning
+    std::vector<bk3d::MatrixType> skinMatrices; ///< TransformPool::tableMatrixAbsInvBindposeMatrix, if dispatches
+};
+struct FramePipeline
+{
+    FramePacket     packets[FRAME_PACKETS];
+    int             depth;          ///< frames the rendering is behind the simulation. 0 : none, no overlap
+    int             simulating;     ///< packet of the graph in flight; -1
+    int             rendering;      ///< packet of the frame being rendered; -1
+    std::deque<int> ready;          ///< packets simulated, oldest first
+    int             nextFrame;
+    FramePipeline() : depth(1), simulating(-1), rendering(-1), nextFrame(0) {}
+    int freePacket() const
+    {
+        for(int p=0; p<FRAME_PACKETS; p++)
+            if((p != simulating) && (p != rendering) && (std::find(ready.begin(), ready.end(), p) == ready.end()))
+                return p;
+        return -1;
+    }
+};
+//-----------------------------------------------------------------------------
 // Derive the Window for this sample
 //-----------------------------------------------------------------------------
 class MyWindow: public WindowInertiaCamera
@@ -55,62 +107,177 @@ public:
     //virtual void idle();
     virtual void display();
 
-	void renderScene();
+	void renderScene(const FramePacket &packet);
+    void getSceneMatrices(mat4f &mVP, mat4f &mWVP);
+    void startSimulation();
+    void finishSimulation();
+    void flushPipeline();
+
+    bk3d::JobSystem m_jobs;     ///< the frame graph and bk3d::parallelFor()
+    FramePipeline   m_pipeline;
+};
+
+/////////////////////////////////////////////////////////////////////////
+// Uniform blocks : their data are written in the per-frame ring buffer (see FrameRingBuffer)
+// and bound with glBindBufferRange() to these binding points
+#define UBO_FRAME   0
+#define UBO_MESH    1
+#define UBO_RESOLVE 2
+#define UBO_FRAMEDATA \
+"layout(std140) uniform FrameData {\n" \
+"   mat4 mVP;\n"       /* grid */ \
+"   mat4 mWVP;\n"      /* meshes */ \
+"   vec4 lightDir;\n" \
+"   vec4 gridColor;\n" \
+"};\n"
+struct FrameData
+{
+    mat4f   mVP;
+    mat4f   mWVP;
+    float   lightDir[4];
+    float   gridColor[4];
+};
+// dequantization (see bk3d::quantizeMesh()). posScale=1, posBias=0 and normalEnc=0 for float data
+#define UBO_MESHDATA \
+"layout(std140) uniform MeshData {\n" \
+"   vec4  posBias;\n" \
+"   vec4  posScale;\n" \
+"   ivec4 normalEnc;\n" \
+"};\n"
+struct MeshData
+{
+    float   posBias[4];
+    float   posScale[4];
+    int     normalEnc[4];
+};
+#define UBO_RESOLVEDATA \
+"layout(std140) uniform ResolveData {\n" \
+"   ivec4 viewportSz;\n" \
+"};\n"
+struct ResolveData
+{
+    int     viewportSz[4];
 };
 
 /////////////////////////////////////////////////////////////////////////
 // grid Floor
 static const char *g_glslv_grid = 
 "#version 330\n"
-"uniform mat4 mWVP;\n"
+UBO_FRAMEDATA
 "layout(location=0) in  vec3 P;\n"
 "out gl_PerVertex {\n"
 "    vec4  gl_Position;\n"
 "};\n"
 "void main() {\n"
-"   gl_Position = mWVP * vec4(P, 1.0);\n"
+"   gl_Position = mVP * vec4(P, 1.0);\n"
 "}\n"
 ;
 static const char *g_glslf_grid = 
 "#version 330\n"
 "#extension GL_ARB_separate_shader_objects : enable\n"
-"uniform vec3 diffuse;"
+UBO_FRAMEDATA
 "layout(location=0) out vec4 outColor;\n"
 "void main() {\n"
-"   outColor = vec4(diffuse,1);\n"
+"   outColor = gridColor;\n"
 "}\n"
 ;
 
 /////////////////////////////////////////////////////////////////////////
-// Mesh
+// Mesh : permutations from the attributes a Mesh has. getMeshProgram() prepends
+// "#version" and one HAS_xxx define per semantic of s_attribSemantics present in the Mesh
+// Locations 4-7 are taken by the instance matrix
+struct AttribSemantic
+{
+    const char *name;       ///< bk3d::Attribute::name
+    const char *define;
+    const char *input;      ///< name of the input in the vertex shader
+    GLuint      location;
+};
+static AttribSemantic s_attribSemantics[] = {
+    { MESH_POSITION,  "HAS_POSITION",  "P",   0 },
+    { MESH_NORMAL,    "HAS_NORMAL",    "N",   1 },
+    { MESH_TEXCOORD0, "HAS_TEXCOORD0", "TC0", 2 },
+    { MESH_TANGENT,   "HAS_TANGENT",   "T",   3 },
+    { MESH_COLOR,     "HAS_COLOR",     "C",   8 },
+    { MESH_BINORMAL,  "HAS_BINORMAL",  "B",   9 },
+};
+#define NUM_ATTRIBSEMANTICS (int)(sizeof(s_attribSemantics)/sizeof(AttribSemantic))
 static const char *g_glslv_mesh = 
-"#version 330\n"
 "#extension GL_ARB_separate_shader_objects : enable\n"
-"uniform mat4 mWVP;\n"
-"uniform mat4 mVP;\n"
-"layout(location=0) in  vec3 P;\n"
-"layout(location=1) in  vec3 N;\n"
+UBO_FRAMEDATA
+UBO_MESHDATA
+"layout(location=0) in  vec4 P;\n"
+"#ifdef HAS_NORMAL\n"
+"layout(location=1) in  vec4 N;\n"
 "layout(location=1) out vec3 outN;\n"
+"#else\n"
+"layout(location=1) out vec3 outWP;\n" // the face normal comes from its derivatives
+"#endif\n"
+"#ifdef HAS_TEXCOORD0\n"
+"layout(location=2) in  vec4 TC0;\n"
+"#endif\n"
+"#ifdef HAS_TANGENT\n"
+"layout(location=3) in  vec4 T;\n"
+"#endif\n"
+"layout(location=4) in  mat4 mInstance;\n" // per instance (divisor 1). See MeshGL
+"#ifdef HAS_COLOR\n"
+"layout(location=8) in  vec4 C;\n"
+"layout(location=2) out vec4 outC;\n"
+"#endif\n"
 "out gl_PerVertex {\n"
 "    vec4  gl_Position;\n"
 "};\n"
+"vec3 octDecode(vec2 e) {\n"
+"   vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+"   float t = max(-n.z, 0.0);\n"
+"   n.x += n.x >= 0.0 ? -t : t;\n"
+"   n.y += n.y >= 0.0 ? -t : t;\n"
+"   return normalize(n);\n"
+"}\n"
 "void main() {\n"
-"   outN = N;\n"
-"   gl_Position = mWVP * vec4(P, 1.0);\n"
+"   vec4 wp = mInstance * vec4(posBias.xyz + P.xyz * posScale.xyz, 1.0);\n"
+"#ifdef HAS_NORMAL\n"
+"   vec3 n = N.xyz;\n"
+"   if(normalEnc.x == 1)\n"
+"       n = octDecode(N.xy);\n"
+"   else if(normalEnc.x == 2)\n"
+"       n = N.xyz * 2.0 - 1.0;\n"
+"   outN = normalize(mat3(mInstance) * n);\n"
+"#else\n"
+"   outWP = wp.xyz;\n"
+"#endif\n"
+"#ifdef HAS_COLOR\n"
+"   outC = C;\n"
+"#endif\n"
+"   gl_Position = mWVP * wp;\n"
 "}\n"
 ;
 static const char *g_glslf_mesh = 
-"#version 330\n"
 "#extension GL_ARB_separate_shader_objects : enable\n"
-"uniform vec3 diffuse;"
-"uniform vec3 lightDir;"
+UBO_FRAMEDATA
+"uniform vec3 diffuse;\n"
+"#ifdef HAS_NORMAL\n"
 "layout(location=1) in  vec3 N;\n"
+"#else\n"
+"layout(location=1) in  vec3 WP;\n"
+"#endif\n"
+"#ifdef HAS_COLOR\n"
+"layout(location=2) in  vec4 C;\n"
+"#endif\n"
 "layout(location=0) out vec4 outColor;\n"
 "void main() {\n"
-"\n"
-"   float d1 = max(0.0, dot(N, lightDir) );\n"
-"   float d2 = 0.6 * max(0.0, dot(N, -lightDir) );\n"
+"#ifdef HAS_NORMAL\n"
+"   vec3 n = N;\n"
+"#else\n"
+"   vec3 n = normalize(cross(dFdx(WP), dFdy(WP)));\n"
+"#endif\n"
+"   float d1 = max(0.0, dot(n, lightDir.xyz) );\n"
+"   float d2 = 0.6 * max(0.0, dot(n, -lightDir.xyz) );\n"
+"#ifdef HAS_COLOR\n"
+"   outColor = vec4(diffuse * C.rgb * (d2 + d1),1);\n"
+"#else\n"
 "   outColor = vec4(diffuse * (d2 + d1),1);\n"
+"#endif\n"
 "}\n"
 ;
 
@@ -120,7 +287,7 @@ static const char *g_glslf_mesh =
 static const char *g_glslv_Tc = 
 "#version 330\n"
 "#extension GL_ARB_separate_shader_objects : enable\n"
-"uniform ivec2 viewportSz;\n"
+UBO_RESOLVEDATA
 "layout(location=0) in  ivec2 P;\n"
 "layout(location=0) out vec2 TcOut;\n"
 "out gl_PerVertex {\n"
@@ -128,7 +295,7 @@ static const char *g_glslv_Tc =
 "};\n"
 "void main() {\n"
 "   TcOut = vec2(P);\n"
-"   gl_Position = vec4(vec2(P)/vec2(viewportSz)*2.0 - 1.0, 0.0, 1.0);\n"
+"   gl_Position = vec4(vec2(P)/vec2(viewportSz.xy)*2.0 - 1.0, 0.0, 1.0);\n"
 "}\n"
 ;
 // for sampling MSAA Texture
@@ -185,25 +352,509 @@ static const char *g_glslf_Image =
 "}\n"
 ;
 
+/////////////////////////////////////////////////////////////////////////
+// Hi-Z : min/max depth pyramid (RG32F). Level 0 comes from the depth texture of the FBO;
+// each next level reduces 2x2 texels (3x3 on the last row/column of odd sizes)
+static const char *g_glslf_hizDepth = 
+"#version 330\n"
+"uniform sampler2D depthTex;\n"
+"layout(location=0) out vec2 outMinMax;\n"
+"void main() {\n"
+"   float d = texelFetch(depthTex, ivec2(gl_FragCoord.xy), 0).r;\n"
+"   outMinMax = vec2(d, d);\n"
+"}\n"
+;
+static const char *g_glslf_hizDepthMS = 
+"#version 330\n"
+"uniform sampler2DMS depthTex;\n"
+"uniform int samples;\n" // the ones the driver gave to textureDSTMS
+"layout(location=0) out vec2 outMinMax;\n"
+"void main() {\n"
+"   vec2 mm = vec2(1.0, 0.0);\n"
+"   for(int i=0; i<samples; i++) {\n"
+"       float d = texelFetch(depthTex, ivec2(gl_FragCoord.xy), i).r;\n"
+"       mm = vec2(min(mm.x, d), max(mm.y, d));\n"
+"   }\n"
+"   outMinMax = mm;\n"
+"}\n"
+;
+static const char *g_glslf_hizReduce = 
+"#version 330\n"
+"uniform sampler2D src;\n" // base and max levels are set to the source level
+"layout(location=0) out vec2 outMinMax;\n"
+"void main() {\n"
+"   ivec2 sz = textureSize(src, 0);\n"
+"   ivec2 c = ivec2(gl_FragCoord.xy) * 2;\n"
+"   ivec2 e = min(c + ivec2(1), sz - 1);\n"
+"   if(((sz.x & 1) != 0) && (c.x + 3 == sz.x)) e.x = sz.x - 1;\n"
+"   if(((sz.y & 1) != 0) && (c.y + 3 == sz.y)) e.y = sz.y - 1;\n"
+"   vec2 mm = vec2(1.0, 0.0);\n"
+"   for(int y=c.y; y<=e.y; y++)\n"
+"       for(int x=c.x; x<=e.x; x++) {\n"
+"           vec2 t = texelFetch(src, ivec2(x, y), 0).rg;\n"
+"           mm = vec2(min(mm.x, t.x), max(mm.y, t.y));\n"
+"       }\n"
+"   outMinMax = mm;\n"
+"}\n"
+;
+
+/////////////////////////////////////////////////////////////////////////
+// GPU skinning : one thread per vertex. Writes position + normal in the VBO the VAO of the
+// Mesh reads (MeshGL::skinnedVbo), like the CPU path does. Bone indices are entries of
+// TransformPool::tableMatrixAbsInvBindposeMatrix, 16 bits each
+static const char *g_glslc_skinning = 
+"#version 430\n"
+"layout(local_size_x=64) in;\n"
+"struct SkinVertex {\n"
+"   vec3 P; uint bones01;\n"
+"   vec3 N; uint bones23;\n"
+"   vec4 W;\n"
+"};\n"
+"layout(std430, binding=0) readonly buffer SkinMatrices { mat4 skinMatrices[]; };\n"
+"layout(std430, binding=1) readonly buffer SkinVertices { SkinVertex vertices[]; };\n"
+"layout(std430, binding=2) writeonly buffer Deformed { float deformed[]; };\n"
+"uniform uint nVertices;\n"
+"void main() {\n"
+"   uint v = gl_GlobalInvocationID.x;\n"
+"   if(v >= nVertices)\n"
+"       return;\n"
+"   SkinVertex sv = vertices[v];\n"
+"   vec3 p = sv.P;\n"
+"   vec3 n = sv.N;\n"
+"   if(sv.W.x > 0.0) {\n" // no influence : bind pose
+"       mat4 m = sv.W.x * skinMatrices[sv.bones01 & 0xFFFFu]\n"
+"              + sv.W.y * skinMatrices[sv.bones01 >> 16]\n"
+"              + sv.W.z * skinMatrices[sv.bones23 & 0xFFFFu]\n"
+"              + sv.W.w * skinMatrices[sv.bones23 >> 16];\n"
+"       p = (m * vec4(p, 1.0)).xyz;\n"
+"       n = mat3(m) * n;\n"
+"       float l = dot(n, n);\n"
+"       n = l > 0.0 ? n * inversesqrt(l) : vec3(0.0);\n"
+"   }\n"
+"   for(int c=0; c<3; c++) {\n"
+"       deformed[v*6u + uint(c)] = p[c];\n"
+"       deformed[v*6u + 3u + uint(c)] = n[c];\n"
+"   }\n"
+"}\n"
+;
+
+/////////////////////////////////////////////////////////////////////////
+// Programs, with an on-disk cache of their binaries (glGetProgramBinary).
+// An entry is keyed by a hash of the sources (so of the #defines of the
+// permutations, too) and of the vendor/renderer/version strings of the driver.
+// begin() only issues the compile and link : with GL_KHR_parallel_shader_compile
+// the driver builds all the programs started before the first finish() concurrently.
+// The files are in the temporary directory of the user, not in the working directory
+//
+#define PROGCACHE_PREFIX "gl_simple_FBO_prog_"
+#define PROGCACHE_MAGIC  0x42505347 // "GSPB"
+void bindUniformBlocks(GLuint prog);
 
-GLSLProgram g_progGrid;
-GLSLProgram g_progMesh;
+struct ProgramBinaryCache
+{
+    bool        bEnabled;       ///< false to always compile (and not save)
+    bool        bParallel;      ///< GL_KHR_parallel_shader_compile
+    std::string driver;         ///< vendor/renderer/version : part of the keys
+    std::string dir;            ///< where the binaries are, with its trailing separator
+    int         loaded;         ///< from the cache
+    int         compiled;       ///< from the sources (cache miss)
+    int         rejected;       ///< binaries the driver refused (new driver...) : recompiled
+
+    ProgramBinaryCache() : bEnabled(true), bParallel(false), loaded(0), compiled(0), rejected(0) {}
+    void init()
+    {
+        driver  = (const char*)glGetString(GL_VENDOR);
+        driver += (const char*)glGetString(GL_RENDERER);
+        driver += (const char*)glGetString(GL_VERSION);
+        const char *tmp = getenv("TMPDIR");
+        if(!tmp) tmp = getenv("TEMP");
+        if(!tmp) tmp = getenv("TMP");
+        dir = tmp ? tmp : "/tmp";
+        if(!dir.empty() && (dir[dir.size()-1] != '/') && (dir[dir.size()-1] != '\\'))
+            dir += '/';
+        GLint n = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+        for(GLint e=0; e<n; e++)
+            if(!strcmp((const char*)glGetStringi(GL_EXTENSIONS, e), "GL_KHR_parallel_shader_compile"))
+                bParallel = true;
+#ifdef GL_KHR_parallel_shader_compile
+        if(bParallel)
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+#endif
+    }
+    /// FNV-1a 64 of the sources and of the driver strings
+    unsigned long long key(const char **sources, int n)
+    {
+        unsigned long long h = 14695981039346656037ULL;
+        for(int s=0; s<=n; s++)
+        {
+            const char *p = s < n ? sources[s] : driver.c_str();
+            for(; p && *p; p++)
+                h = (h ^ (unsigned char)*p) * 1099511628211ULL;
+            h = (h ^ 0xFF) * 1099511628211ULL; // so that moving text from a source to the next changes the key
+        }
+        return h;
+    }
+    std::string fileName(unsigned long long k)
+    {
+        char name[64];
+        sprintf(name, PROGCACHE_PREFIX "%016llx.bin", k);
+        return dir + name;
+    }
+    struct Header { unsigned int magic; GLenum format; unsigned long long key; GLint length; int pad; };
+    /// binary of a key; false if none or if the file isn't for this key
+    bool load(unsigned long long k, GLenum &format, std::vector<char> &data)
+    {
+        if(!bEnabled)
+            return false;
+        FILE *fd = fopen(fileName(k).c_str(), "rb");
+        if(!fd)
+            return false;
+        Header h;
+        bool bOK = (fread(&h, sizeof(Header), 1, fd) == 1) && (h.magic == PROGCACHE_MAGIC) && (h.key == k) && (h.length > 0);
+        if(bOK)
+        {
+            data.resize(h.length);
+            format = h.format;
+            bOK = fread(&data[0], 1, h.length, fd) == (size_t)h.length;
+        }
+        fclose(fd);
+        return bOK;
+    }
+    void save(unsigned long long k, GLuint prog)
+    {
+        if(!bEnabled)
+            return;
+        Header h = { PROGCACHE_MAGIC, 0, k, 0, 0 };
+        glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &h.length);
+        if(h.length <= 0)
+            return;
+        std::vector<char> data(h.length);
+        glGetProgramBinary(prog, h.length, NULL, &h.format, &data[0]);
+        FILE *fd = fopen(fileName(k).c_str(), "wb");
+        if(!fd)
+            return;
+        fwrite(&h, sizeof(Header), 1, fd);
+        fwrite(&data[0], 1, h.length, fd);
+        fclose(fd);
+    }
+};
+ProgramBinaryCache g_progCache;
 
-GLSLProgram g_progCopyTexMSAA;
-GLSLProgram g_progCopyTex;
-GLSLProgram g_progCopyImageMSAA;
-GLSLProgram g_progCopyImage;
+//
+// program made of VS/GS/FS strings, or of a compute shader. Same entry points as GLSLProgram for what the sample uses
+//
+class CachedProgram
+{
+public:
+    CachedProgram() : m_prog(0), m_key(0), m_bFromCache(false), m_sortId(s_sortIds++) { m_src[0] = m_src[1] = m_src[2] = m_src[3] = NULL; }
+    ~CachedProgram() { release(); }
+    /// starts building the program : from the cache if possible. finish() tells if it worked.
+    /// The sources must stay valid until finish() : it may have to compile them after all
+    void begin(const char *vsource, const char *gsource, const char *fsource, const char *csource = NULL)
+    {
+        release();
+        m_src[0] = vsource; m_src[1] = gsource; m_src[2] = fsource; m_src[3] = csource;
+        const char *keySrc[4] = { vsource, gsource ? gsource : "", fsource, csource };
+        m_key = g_progCache.key(keySrc, csource ? 4 : 3);
+        GLenum format;
+        std::vector<char> data;
+        m_bFromCache = g_progCache.load(m_key, format, data);
+        m_prog = glCreateProgram();
+        if(m_bFromCache)
+            glProgramBinary(m_prog, format, &data[0], (GLsizei)data.size());
+        else
+            compileSources();
+    }
+    /// waits for the program; saves its binary if it got compiled
+    bool finish()
+    {
+        if(m_prog == 0)
+            return false;
+        GLint status = 0;
+        if(m_bFromCache)
+        {
+            glGetProgramiv(m_prog, GL_LINK_STATUS, &status);
+            if(status)
+                g_progCache.loaded++;
+            else {
+                // the driver refused the binary : back to the sources
+                g_progCache.rejected++;
+                m_bFromCache = false;
+                glDeleteProgram(m_prog);
+                m_prog = glCreateProgram();
+                compileSources();
+            }
+        }
+        if(!m_bFromCache)
+        {
+            bool bOK = true;
+            GLuint shaders[4];
+            GLsizei n = 0;
+            glGetAttachedShaders(m_prog, 4, &n, shaders);
+            for(int s=0; s<n; s++)
+            {
+                glGetShaderiv(shaders[s], GL_COMPILE_STATUS, &status);
+                if(!status)
+                {
+                    printInfoLog(shaders[s], true);
+                    bOK = false;
+                }
+                glDetachShader(m_prog, shaders[s]);
+                glDeleteShader(shaders[s]);
+            }
+            glGetProgramiv(m_prog, GL_LINK_STATUS, &status);
+            if(bOK && !status)
+            {
+                printInfoLog(m_prog, false);
+                bOK = false;
+            }
+            if(!bOK)
+            {
+                release();
+                return false;
+            }
+            g_progCache.compiled++;
+            g_progCache.save(m_key, m_prog);
+        }
+        bindUniformBlocks(m_prog);
+        return true;
+    }
+    bool compileProgram(const char *vsource, const char *gsource, const char *fsource)
+    {
+        begin(vsource, gsource, fsource);
+        return finish();
+    }
+    void release()
+    {
+        if(m_prog)
+            glDeleteProgram(m_prog);
+        m_prog = 0;
+    }
+    inline GLuint getProgId() { return m_prog; }
+    /// dense index for the sort keys of the render queues : GL names can be anything
+    inline int getSortId() { return m_sortId; }
+    inline void enable() { glUseProgram(m_prog); }
+    void setUniform3f(const char *name, float x, float y, float z)
+    {
+        glUniform3f(glGetUniformLocation(m_prog, name), x, y, z);
+    }
+    void setUniform1i(const char *name, GLint x)
+    {
+        glUniform1i(glGetUniformLocation(m_prog, name), x);
+    }
+    void setUniform1ui(const char *name, GLuint x)
+    {
+        glUniform1ui(glGetUniformLocation(m_prog, name), x);
+    }
+    void bindTexture(const char *name, GLuint tex, GLenum target, GLint unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, tex);
+        glUniform1i(glGetUniformLocation(m_prog, name), unit);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    void bindImage(const char *name, GLint unit, GLuint tex, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format)
+    {
+        glBindImageTexture(unit, tex, level, layered, layer, access, format);
+        glUniform1i(glGetUniformLocation(m_prog, name), unit);
+    }
+private:
+    void compileSources()
+    {
+        static const GLenum types[4] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER, GL_COMPUTE_SHADER };
+        for(int s=0; s<4; s++)
+        {
+            if(!m_src[s])
+                continue;
+            GLuint shader = glCreateShader(types[s]);
+            glShaderSource(shader, 1, &m_src[s], NULL);
+            glCompileShader(shader);
+            glAttachShader(m_prog, shader);
+        }
+        glProgramParameteri(m_prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(m_prog);
+    }
+    void printInfoLog(GLuint obj, bool bShader)
+    {
+        char log[4096];
+        GLsizei len = 0;
+        if(bShader)
+            glGetShaderInfoLog(obj, sizeof(log), &len, log);
+        else
+            glGetProgramInfoLog(obj, sizeof(log), &len, log);
+        LOGE("%s error:\n%s\n", bShader ? "compile" : "link", log);
+    }
+    GLuint              m_prog;
+    const char         *m_src[4];
+    unsigned long long  m_key;
+    bool                m_bFromCache;
+    int                 m_sortId;
+    static int          s_sortIds;
+};
+int CachedProgram::s_sortIds = 0;
+
+CachedProgram g_progGrid;
+std::map<unsigned int, CachedProgram*> g_meshPrograms; // one per layout (bits of s_attribSemantics). NULL if it failed
+
+CachedProgram g_progCopyTexMSAA;
+CachedProgram g_progCopyTex;
+CachedProgram g_progCopyImageMSAA;
+CachedProgram g_progCopyImage;
+CachedProgram g_progHiZDepth;
+CachedProgram g_progHiZDepthMS;
+CachedProgram g_progHiZReduce;
+CachedProgram g_progSkinning;   // compute. The CPU skins all the Meshes if it failed to build
+// what init() builds. The image programs are optional
+struct ProgramSources { CachedProgram *prog; const char *vs; const char *fs; bool bRequired; };
+static ProgramSources s_programSources[] = {
+    { &g_progGrid,          g_glslv_grid,   g_glslf_grid,       true },
+    { &g_progCopyTexMSAA,   g_glslv_Tc,     g_glslf_texMSAA,    true },
+    { &g_progCopyTex,       g_glslv_Tc,     g_glslf_tex,        true },
+    { &g_progCopyImageMSAA, g_glslv_Tc,     g_glslf_ImageMSAA,  false },
+    { &g_progCopyImage,     g_glslv_Tc,     g_glslf_Image,      false },
+    { &g_progHiZDepth,      g_glslv_Tc,     g_glslf_hizDepth,   true },
+    { &g_progHiZDepthMS,    g_glslv_Tc,     g_glslf_hizDepthMS, true },
+    { &g_progHiZReduce,     g_glslv_Tc,     g_glslf_hizReduce,  true },
+};
+#define NUM_PROGRAMSOURCES (int)(sizeof(s_programSources)/sizeof(ProgramSources))
 
 GLuint      g_vboGrid = 0;
-GLuint      g_vboQuad = 0;
+GLintptr    g_quadOffset = 0;   // the resolve quad : written each frame in the ring buffer
+
+//------------------------------------------------------------------------------
+// Per-frame streaming : one persistently mapped, coherent buffer split in N regions.
+// The region of a frame is reused N frames later, after its fence got signaled.
+// Allocations are just an aligned offset increment : no driver call. A frame that
+// doesn't fit in its region continues in a new buffer with bigger regions
+//------------------------------------------------------------------------------
+#define RING_FRAMES     3
+#define RING_REGIONSZ   (256*1024)
+struct FrameRingBuffer
+{
+    GLuint      buffer;
+    char*       ptr;
+    GLsizeiptr  regionSize;
+    int         region;
+    GLsizeiptr  offset;         ///< in the current region
+    GLint       uboAlign;
+    GLsync      fences[RING_FRAMES];
+    std::vector<GLuint> retired;    ///< replaced by bigger buffers during the last frame : deleted by beginFrame()
+    // stats
+    int         fenceWaits;     ///< frames that had to wait for the GPU to release their region
+    double      fenceWaitMs;
+    int         overflows;      ///< a frame needed more than regionSize : the buffer grew
+    GLsizeiptr  peakBytes;      ///< max bytes allocated in a frame
+    GLsizeiptr  frameBytes;     ///< allocated in the current frame, before the last overflow
+
+    bool init(GLsizeiptr sz)
+    {
+        region = 0;
+        offset = 0;
+        for(int i=0; i<RING_FRAMES; i++)
+            fences[i] = NULL;
+        fenceWaits = overflows = 0;
+        fenceWaitMs = 0.0;
+        peakBytes = frameBytes = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uboAlign);
+        return create(sz);
+    }
+    bool create(GLsizeiptr sz)
+    {
+        regionSize = sz;
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, regionSize * RING_FRAMES, NULL, flags);
+        ptr = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * RING_FRAMES, flags);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return ptr != NULL;
+    }
+    void beginFrame()
+    {
+        if(!retired.empty())
+        {
+            // the bindings of the last frame to them are reset, they are set again in each frame. GL
+            // keeps their storage until the commands still reading them are done
+            glDeleteBuffers((GLsizei)retired.size(), &retired[0]);
+            retired.clear();
+        }
+        region = (region + 1) % RING_FRAMES;
+        offset = 0;
+        frameBytes = 0;
+        if(!fences[region])
+            return;
+        GLenum res = glClientWaitSync(fences[region], 0, 0);
+        if((res != GL_ALREADY_SIGNALED) && (res != GL_CONDITION_SATISFIED))
+        {
+            std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+            do {
+                res = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            } while((res == GL_TIMEOUT_EXPIRED));
+            fenceWaits++;
+            fenceWaitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        }
+        glDeleteSync(fences[region]);
+        fences[region] = NULL;
+    }
+    void endFrame()
+    {
+        if(frameBytes + offset > peakBytes)
+            peakBytes = frameBytes + offset;
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    /// returns where to write (NULL if the buffer couldn't grow); gpuOffset is the offset to use with the buffer
+    void* alloc(GLsizeiptr sz, GLsizeiptr align, GLintptr *gpuOffset)
+    {
+        GLsizeiptr o = (offset + align - 1) / align * align;
+        if(o + sz > regionSize)
+        {
+            // the commands already recorded read this region : it is never rewound. The frame
+            // continues in a new buffer with twice bigger regions, the old one stays bound until
+            // the next frame. The fences of the previous frames guarded regions of the old buffer
+            overflows++;
+            frameBytes += offset;
+            GLsizeiptr newSize = regionSize * 2;
+            while(newSize < sz + align)
+                newSize *= 2;
+            retired.push_back(buffer);
+            for(int i=0; i<RING_FRAMES; i++)
+                if(fences[i])
+                {
+                    glDeleteSync(fences[i]);
+                    fences[i] = NULL;
+                }
+            if(!create(newSize))
+                return NULL;
+            o = 0;
+        }
+        offset = o + sz;
+        *gpuOffset = region * regionSize + o;
+        return ptr + *gpuOffset;
+    }
+    /// writes a uniform block and binds it to a binding point
+    void bindUniforms(GLuint binding, const void *data, GLsizeiptr sz)
+    {
+        GLintptr o;
+        void *p = alloc(sz, uboAlign, &o);
+        if(!p)
+            return;
+        memcpy(p, data, sz);
+        glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, o, sz);
+    }
+};
+FrameRingBuffer g_ring;
 
-GLuint      g_vao = 0;
+// vertex arrays built once : the quad only gets its offset in the ring buffer changed each frame
+GLuint      g_vaoGrid = 0;
+GLuint      g_vaoQuad = 0;
 
 // FBO Stuff
 GLuint fboSz[2] = {0,0};
 GLuint textureRGBA, textureRGBAMS;
 GLuint rbRGBA, rbRGBAMS;
-GLuint rbDST, rbDSTMS;
+GLuint textureDST, textureDSTMS; // depth-stencil textures : the Hi-Z pyramid is built from them
+GLint  g_depthSamples = 8;      // samples of textureDSTMS
 GLuint fboTexMS, fboTex, fboRbMS, fboRb;
 enum FboMode {
     RENDERTOTEXMS = 0,
@@ -249,8 +900,283 @@ static bool    s_bCameraAnim        = true;
 #   define MODELNAME "NV_Shaderball_v134.bk3d.gz"
 #endif
 bk3d::FileHeader * meshFile;
+bk3d::NameIndex g_nameIndex; // name -> Node of meshFile, for the animation connections
 vec3f g_posOffset = vec3f(0,0,0);
 float g_scale = 1.0f;
+//
+// Vertex quantization : done once after load, before creating the VBOs
+//
+static bool                 s_bQuantize  = true;
+static bk3d::NormalEncoding s_normalEnc  = bk3d::NORMAL_OCT16;
+std::vector<bk3d::MeshQuantization> g_meshQuant; // dequantization params, one per Mesh
+//
+// what we keep for each Mesh. Stored in Mesh::userPtr
+//
+struct MeshGL
+{
+    std::vector<bk3d::MatrixType> baseInstances; ///< from Mesh::pTransforms; one identity matrix if not instanced
+    GLuint  instanceVbo;    ///< baseInstances replicated by the stress grid
+    GLuint  vao;            ///< attributes of the Slots + instance matrices (buildMeshVAO())
+    unsigned int layout;    ///< bit N set when the Mesh has s_attribSemantics[N]
+    CachedProgram *prog;      ///< permutation for this layout. NULL if the Mesh can't be drawn
+    int     instanceCount;
+    bk3d::SkinnedMesh *pSkin; ///< NULL if the Mesh isn't skinned
+    bk3d::BlendShapeMesh *pBlend; ///< NULL if the Mesh has no Blendshape
+    GLuint  skinnedVbo;     ///< deformed positions + normals of pSkin, replaced each time it changes
+    GLuint  skinInputBuffer;///< bind pose + influences of pSkin for g_progSkinning. 0 if the GPU can't skin it
+    bool    bGPUSkinning;   ///< skinnedVbo written by g_progSkinning rather than by the CPU
+    bool    bSkinStale;     ///< skinnedVbo must be rewritten even if the skin matrices didn't change
+    // results of the frame graph for the GL thread
+    bool    bBlendUpload;   ///< the base Slots got new Blendshapes
+    bool    bSkinUpload;    ///< pSkin->getDeformed() goes to skinnedVbo
+    bool    bSkinDispatch;  ///< g_progSkinning writes skinnedVbo
+};
+//
+// Instancing stress mode : replicates the whole model on a N x N grid (F5 to cycle N)
+//
+static int   s_stressGrid = 1;
+static float s_stressSpacing = 1.0f;    // object space; set from the size of the model
+static int   s_stressFrames = 0;        // frames left to measure after the grid changed
+static double s_stressMs = 0.0;
+static int   s_drawCalls = 0;
+//
+// what we keep for each PrimGroup. Stored in PrimGroup::userPtr
+//
+struct PrimGroupGL
+{
+    GLuint  ibo;
+    GLint   baseVertex;     ///< != 0 when the indices got rebased for 16 bits (bk3d::demoteIndices())
+    bk3d::MeshletPool* pMeshlets; ///< NULL if the PrimGroup couldn't be split
+    bk3d::LodPool*     pLods;     ///< NULL if no LOD. Their indices follow the ones of the PrimGroup in the IBO
+    int     materialId;     ///< 1 + Material::ID; 0 if none. Used in the sort keys
+};
+static bool s_bDemoteIndices = true;
+static bool s_bBuildMeshlets = true;
+static bool s_bBackfaceCulling = false; // the shaders light both sides : off to match the reference image
+static bool s_bMeshletCulling = true;  // cone culling : only when s_bBackfaceCulling culls the same triangles
+static int  s_meshletsDrawn = 0;
+static int  s_meshletsCulled = 0;
+//
+// LODs : generated once after load. A LOD is picked per Mesh from the size of its bsphere on screen
+//
+static bool  s_bBuildLods = true;
+static bool  s_bUseLods = true;
+static float s_lodRatios[BK3D_MAXLODS-1] = { 0.5f, 0.25f, 0.125f };
+static float s_lodFullDetailRadius = 300.0f; // in pixels. LOD 0 above this; one LOD further each time the size halves
+static int   s_trianglesDrawn = 0;
+//
+// Frustum culling : bounds of all the Meshes and PrimGroups in SoA, tested each frame.
+// g_pgItems is sorted by Mesh so that the visible list is, too
+//
+static bool s_bFrustumCulling = true;
+bk3d::BoundsSoA g_meshBounds;
+bk3d::BoundsSoA g_pgBounds;
+std::vector<std::pair<int,int> > g_pgItems; // (mesh, primgroup) of each entry of g_pgBounds
+std::vector<unsigned char> g_meshVisible;
+std::vector<unsigned char> g_pgVisible;
+//
+// Render queue : the draws of a pass get a 64 bits sort key, are radix-sorted and then
+// submitted with the state changes that are really needed
+//
+enum RenderLayer {
+    LAYER_SCENE = 0,
+    LAYER_OVERLAY,      // depth test off, wireframe (Hi-Z debug)
+    LAYER_RESOLVE,
+};
+enum VertexSource {
+    VTXSRC_GRID = 0,
+    VTXSRC_QUAD,
+    VTXSRC_MESH0,       // + Mesh index
+};
+enum DrawItemType {
+    DRAWITEM_ARRAYS = 0,
+    DRAWITEM_ELEMENTS,
+    DRAWITEM_MESHLETS,
+};
+#define MATERIAL_OVERLAY 0xFFFF
+struct DrawItem
+{
+    DrawItemType    type;
+    int             layer;
+    CachedProgram    *prog;
+    int             vertexSource;
+    int             materialId;
+    const float    *diffuse;        ///< NULL if the program has no "diffuse"
+    bk3d::PrimGroup *pPG;           ///< DRAWITEM_MESHLETS
+    GLuint          ibo;
+    GLenum          topology;
+    GLenum          indexFormat;
+    GLsizei         count;
+    size_t          indexOffset;    ///< bytes
+    GLsizei         instances;
+    GLint           baseVertex;
+    // texture or image read by the resolve programs
+    const char     *texName;
+    GLuint          tex;
+    GLenum          texTarget;
+    bool            bImage;
+};
+struct RenderQueue
+{
+    struct SortEntry { unsigned long long key; unsigned int item; };
+    std::vector<DrawItem>   items;
+    std::vector<SortEntry>  order;
+    std::vector<SortEntry>  tmp;
+    float                   eyeObj[3]; ///< for the cone culling of DRAWITEM_MESHLETS
+
+    void clear() { items.clear(); order.clear(); }
+    void push(unsigned long long key, const DrawItem &item)
+    {
+        SortEntry e = { key, (unsigned int)items.size() };
+        order.push_back(e);
+        items.push_back(item);
+    }
+    /// LSD radix sort, 8 bits per pass. Passes where all the keys share the same byte are skipped
+    void sort()
+    {
+        size_t n = order.size();
+        tmp.resize(n);
+        for(int shift=0; shift<64; shift+=8)
+        {
+            size_t count[256];
+            memset(count, 0, sizeof(count));
+            for(size_t i=0; i<n; i++)
+                count[(order[i].key >> shift) & 0xFF]++;
+            if((n == 0) || (count[(order[0].key >> shift) & 0xFF] == n))
+                continue;
+            size_t sum = 0;
+            for(int b=0; b<256; b++)
+            {
+                size_t c = count[b];
+                count[b] = sum;
+                sum += c;
+            }
+            for(size_t i=0; i<n; i++)
+                tmp[count[(order[i].key >> shift) & 0xFF]++] = order[i];
+            order.swap(tmp);
+        }
+    }
+};
+/// layer(4) | program(8) | depth(20) | vertex source(16) | material(16). Depth is front to back,
+/// per Mesh (the PrimGroups of a Mesh share it, so they stay together) : it goes before the
+/// vertex source, which is per Mesh too and would leave nothing for it to order
+inline unsigned long long makeSortKey(int layer, int progSortId, int vertexSource, int materialId, float depth)
+{
+    // the bits of a positive float sort like its value
+    unsigned int d = 0;
+    if(depth > 0.0f)
+        memcpy(&d, &depth, sizeof(float));
+    return ((unsigned long long)(layer & 0xF) << 60)
+        | ((unsigned long long)(progSortId & 0xFF) << 52)
+        | ((unsigned long long)(d >> 12) << 32)
+        | ((unsigned long long)(vertexSource & 0xFFFF) << 16)
+        | (unsigned long long)(materialId & 0xFFFF);
+}
+RenderQueue g_sceneQueue;
+RenderQueue g_resolveQueue;
+static int s_stateChanges = 0;          // program, vertex source, IBO and material changes issued this frame
+static int s_stateChangesAvoided = 0;   // the ones that were redundant after sorting
+std::vector<int> g_visibleList;             // indices in g_pgItems
+static int s_meshesCulled = 0;
+static int s_primGroupsCulled = 0;
+//
+// Hi-Z occlusion culling : the depth pyramid of a previous frame is read back asynchronously
+// (ring of PBOs) and the PrimGroups that passed the frustum test are tested against it
+//
+#define HIZ_READBACKS       3
+#define HIZ_READBACKMAXSZ   160     // the level read back is the first one smaller than this
+#define HIZ_MAXTEXELS       64      // bigger footprints on the read-back level are always drawn
+static bool s_bHiZCulling = true;
+static bool s_bHiZDebug = false;    // draws the occluded PrimGroups in red wireframe, on top
+GLuint  textureHiZ = 0;
+GLuint  fboHiZ = 0;
+int     g_hizLevels = 0;
+int     g_hizReadLevel = 0;
+int     g_hizReadSz[2] = {0,0};
+GLuint  g_pboHiZ[HIZ_READBACKS] = {0,0,0};
+GLsync  g_fenceHiZ[HIZ_READBACKS] = {NULL,NULL,NULL};
+int     g_hizWriteIdx = 0;
+mat4f   g_hizReadVP[HIZ_READBACKS]; // mWVP of the frame each read-back comes from
+std::vector<float> g_hizCPU;        // min/max of the read-back level; empty until a read-back completed
+int     g_hizCPUSz[2] = {0,0};
+mat4f   g_hizCPUVP;                 // mWVP the depths of g_hizCPU were rendered with
+std::vector<int> g_occludedList;    // indices in g_pgItems
+static int s_hizTested = 0;
+static int s_hizOccluded = 0;
+//
+// F3 : frame time and triangles along the camera animation; a pass with LODs then without
+//
+static int    s_camBenchPass = -1; // -1 : not running
+static int    s_camBenchFrames = 0;
+static double s_camBenchMs = 0.0;
+static double s_camBenchTris = 0.0;
+static std::chrono::high_resolution_clock::time_point s_camBenchLastFrame;
+//
+// Animation : the curves of the model are evaluated each frame into their FloatArrays
+//
+bk3d::MayaCurveEvaluator g_curveEval;
+bk3d::QuatCurveEvaluator g_quatEval;
+bk3d::ConnectionGraph g_connections;
+bk3d::TransformUpdater g_transforms;
+//
+// IK : the IKHandles solved on top of the animation, then the subtrees of the joints they moved
+//
+bk3d::IKSolver g_ik;
+static bool   s_bIK = true;
+static bool   s_bIKFABRIK = false;
+static bool   s_bIKSolved = false;    // the joints hold a solution : given back when IK gets turned off
+static double s_ikMs = 0.0;
+//
+// Frame graph (MyWindow::m_jobs) : sums since the last F4
+//
+static int    s_jobFrames = 0;
+static double s_jobFrameMs = 0.0;
+static double s_jobCriticalMs = 0.0;
+static double s_jobUtilization = 0.0;
+//
+// CPU skinning : skinned Meshes get their positions and normals from a VBO updated each frame
+//
+static bool   s_bCPUSkinning = true;
+static int    s_skinnedVertices = 0;  // last frame
+static double s_skinMs = 0.0;
+//
+// Blendshapes : summed into the base Slots when a weight changed; before the skinning
+//
+static int    s_blendVertices = 0;    // last update
+static int    s_blendShapesActive = 0;
+static double s_blendMs = 0.0;
+static double s_uploadMs = 0.0;       // Blendshapes and CPU skinning of the last packet that had some
+//
+// GPU skinning : the skin matrices are uploaded once per frame, then g_progSkinning writes the
+// same VBO the CPU would. Every pass drawing the Mesh reads it : it is skinned once per frame at most
+//
+enum SkinMode
+{
+    SKINMODE_CPU = 0,
+    SKINMODE_GPU,
+    SKINMODE_MIXED,     // every other Mesh on the GPU : both paths in the same frame
+    NUM_SKINMODES
+};
+static const char *s_skinModeNames[] = { "CPU", "GPU", "CPU and GPU alternated per Mesh" };
+static SkinMode s_skinMode = SKINMODE_CPU;
+GLuint        g_skinMatricesBuffer = 0; // TransformPool::tableMatrixAbsInvBindposeMatrix
+GLuint        g_skinQuery = 0;          // GL_TIME_ELAPSED of the dispatches, read one frame later
+static bool   s_skinQueryPending = false;
+static int    s_gpuSkinnedVertices = 0;
+static double s_gpuSkinMs = 0.0;
+//
+// input of g_progSkinning for a vertex (std430 struct SkinVertex)
+//
+struct SkinVertexGPU
+{
+    float        P[3];
+    unsigned int bones01;   ///< 2 indices in the matrix table; 16 bits each
+    float        N[3];
+    unsigned int bones23;
+    float        W[4];
+};
+static float  s_animTime = 0.0f;
+static std::chrono::high_resolution_clock::time_point s_animLastFrame = std::chrono::high_resolution_clock::now();
 
 //------------------------------------------------------------------------------
 // It is possible that this callback is invoked from another thread
@@ -432,6 +1358,27 @@ GLuint createRenderBufferD24S8(int w, int h, int samples, int coverageSamples)
     return createRenderBuffer(w, h, samples, coverageSamples, GL_DEPTH24_STENCIL8);
 }
 
+//------------------------------------------------------------------------------
+// depth-stencil texture, so that the depth can be read after the scene got rendered
+//------------------------------------------------------------------------------
+GLuint createTextureD24S8(int w, int h, int samples, int coverageSamples)
+{
+    GLuint textureID;
+    if(samples <= 1)
+    {
+        glGenTextures(1, &textureID);
+        glBindTexture( GL_TEXTURE_2D, textureID);
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, w, h, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture( GL_TEXTURE_2D, 0);
+        return textureID;
+    }
+    return createTexture(w, h, samples, coverageSamples, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL);
+}
+
 //------------------------------------------------------------------------------
 // 
 //------------------------------------------------------------------------------
@@ -588,14 +1535,145 @@ void deleteRenderTargets()
         deleteRenderBuffer(rbRGBA);
     if(rbRGBAMS)
         deleteRenderBuffer(rbRGBAMS);
-    if(rbDST)
-        deleteRenderBuffer(rbDST);
-    if(rbDSTMS)
-        deleteRenderBuffer(rbDSTMS);
+    if(textureDST)
+        deleteTexture(textureDST);
+    if(textureDSTMS)
+        deleteTexture(textureDSTMS);
+    if(fboHiZ)
+        deleteFBO(fboHiZ);
+    if(textureHiZ)
+        deleteTexture(textureHiZ);
+    for(int i=0; i<HIZ_READBACKS; i++)
+    {
+        if(g_fenceHiZ[i])
+            glDeleteSync(g_fenceHiZ[i]);
+        g_fenceHiZ[i] = NULL;
+    }
+    if(g_pboHiZ[0])
+        glDeleteBuffers(HIZ_READBACKS, g_pboHiZ);
+    fboHiZ = textureHiZ = 0;
+    g_pboHiZ[0] = g_pboHiZ[1] = g_pboHiZ[2] = 0;
+    g_hizCPU.clear();
     fboSz[0] = 0;
     fboSz[1] = 0;
 }
 
+//------------------------------------------------------------------------------
+// builds the programs of init() again, without then with the binary cache
+//------------------------------------------------------------------------------
+void benchmarkProgramStartup()
+{
+    ProgramBinaryCache stats = g_progCache;
+    CachedProgram progs[NUM_PROGRAMSOURCES];
+    double ms[2];
+    for(int pass=0; pass<2; pass++)
+    {
+        g_progCache.bEnabled = pass == 1;
+        std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+        for(int p=0; p<NUM_PROGRAMSOURCES; p++)
+            progs[p].begin(s_programSources[p].vs, NULL, s_programSources[p].fs);
+        for(int p=0; p<NUM_PROGRAMSOURCES; p++)
+            progs[p].finish();
+        ms[pass] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        for(int p=0; p<NUM_PROGRAMSOURCES; p++)
+            progs[p].release();
+    }
+    LOGI("%d programs : cold (compiled) %.2f ms; warm (binary cache) %.2f ms; %d loaded from the cache\n",
+        (int)NUM_PROGRAMSOURCES, ms[0], ms[1], g_progCache.loaded - stats.loaded);
+    g_progCache = stats;
+}
+
+//------------------------------------------------------------------------------
+// assigns the binding points of the uniform blocks a program uses
+//------------------------------------------------------------------------------
+void bindUniformBlocks(GLuint prog)
+{
+    if(prog == 0)
+        return;
+    const char* names[] = { "FrameData", "MeshData", "ResolveData" };
+    GLuint bindings[] = { UBO_FRAME, UBO_MESH, UBO_RESOLVE };
+    for(int b=0; b<3; b++)
+    {
+        GLuint idx = glGetUniformBlockIndex(prog, names[b]);
+        if(idx != GL_INVALID_INDEX)
+            glUniformBlockBinding(prog, idx, bindings[b]);
+    }
+}
+
+//------------------------------------------------------------------------------
+// semantics of s_attribSemantics the Mesh has
+//------------------------------------------------------------------------------
+unsigned int getMeshLayout(bk3d::Mesh *pMesh)
+{
+    unsigned int layout = 0;
+    for(int s=0; s<NUM_ATTRIBSEMANTICS; s++)
+        if(bk3d::findAttribute(pMesh, s_attribSemantics[s].name))
+            layout |= 1 << s;
+    return layout;
+}
+
+//------------------------------------------------------------------------------
+// mesh program for a layout : compiled the first time a layout shows up
+//------------------------------------------------------------------------------
+CachedProgram* getMeshProgram(unsigned int layout)
+{
+    std::map<unsigned int, CachedProgram*>::iterator it = g_meshPrograms.find(layout);
+    if(it != g_meshPrograms.end())
+        return it->second;
+    CachedProgram *prog = NULL;
+    if(layout & 1) // no position : nothing to draw
+    {
+        std::string header("#version 330\n");
+        for(int s=0; s<NUM_ATTRIBSEMANTICS; s++)
+            if(layout & (1 << s))
+                header += std::string("#define ") + s_attribSemantics[s].define + "\n";
+        std::string vs = header + g_glslv_mesh;
+        std::string fs = header + g_glslf_mesh;
+        prog = new CachedProgram;
+        if(!prog->compileProgram(vs.c_str(), NULL, fs.c_str()))
+        {
+            LOGE("couldn't compile the mesh program for the layout 0x%x\n", layout);
+            delete prog;
+            prog = NULL;
+        }
+    }
+    g_meshPrograms[layout] = prog;
+    return prog;
+}
+
+//------------------------------------------------------------------------------
+// Hi-Z pyramid with its full mip chain, and the PBOs to read one level back
+//------------------------------------------------------------------------------
+void buildHiZ(int w, int h)
+{
+    int sz = w > h ? w : h;
+    g_hizLevels = 1;
+    while((sz >> g_hizLevels) > 0)
+        g_hizLevels++;
+    glGenTextures(1, &textureHiZ);
+    glBindTexture(GL_TEXTURE_2D, textureHiZ);
+    glTexStorage2D(GL_TEXTURE_2D, g_hizLevels, GL_RG32F, w, h);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    fboHiZ = createFBO();
+    g_hizReadLevel = 0;
+    while((g_hizReadLevel < g_hizLevels-1) && (((w >> g_hizReadLevel) > HIZ_READBACKMAXSZ) || ((h >> g_hizReadLevel) > HIZ_READBACKMAXSZ)))
+        g_hizReadLevel++;
+    g_hizReadSz[0] = (w >> g_hizReadLevel) > 0 ? (w >> g_hizReadLevel) : 1;
+    g_hizReadSz[1] = (h >> g_hizReadLevel) > 0 ? (h >> g_hizReadLevel) : 1;
+    glGenBuffers(HIZ_READBACKS, g_pboHiZ);
+    for(int i=0; i<HIZ_READBACKS; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, g_pboHiZ[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, g_hizReadSz[0]*g_hizReadSz[1]*2*sizeof(float), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    g_hizWriteIdx = 0;
+}
+
 //------------------------------------------------------------------------------
 // 
 //------------------------------------------------------------------------------
@@ -613,59 +1691,649 @@ void buildRenderTargets(int w, int h)
     // a renderbuffer in MSAA
     rbRGBAMS = createRenderBufferRGBA8(w,h,8,0);
     // a depth stencil
-    rbDST = createRenderBufferD24S8(w,h,0,0);
+    textureDST = createTextureD24S8(w,h,0,0);
     // a depth stencil in MSAA
-    rbDSTMS = createRenderBufferD24S8(w,h,8,0);
+    textureDSTMS = createTextureD24S8(w,h,8,0);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, textureDSTMS);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D_MULTISAMPLE, 0, GL_TEXTURE_SAMPLES, &g_depthSamples);
+    glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
     // fbo for texture MSAA as the color buffer
     fboTexMS = createFBO();
     {
         attachTexture2DMS(fboTexMS, textureRGBAMS, 0);
-        attachDSTRenderbuffer(fboTexMS, rbDSTMS);
+        attachDSTTexture2DMS(fboTexMS, textureDSTMS);
     }
     // fbo for a texture as the color buffer
     fboTex = createFBO();
     {
         attachTexture2D(fboTex, textureRGBA, 0);
-        attachDSTRenderbuffer(fboTex, rbDST);
+        attachDSTTexture2D(fboTex, textureDST);
     }
     // fbo for renderbuffer MSAA as the color buffer
     fboRbMS = createFBO();
     {
         attachRenderbuffer(fboRbMS, rbRGBAMS, 0);
-        attachDSTRenderbuffer(fboRbMS, rbDSTMS);
+        attachDSTTexture2DMS(fboRbMS, textureDSTMS);
     }
     // fbo for renderbuffer as the color buffer
     fboRb = createFBO();
     {
         attachRenderbuffer(fboRb, rbRGBA, 0);
-        attachDSTRenderbuffer(fboRb, rbDST);
+        attachDSTTexture2D(fboRb, textureDST);
     }
-
-    // build a VBO for the size of the FBO
-    //
-    // make a VBO for Quad
-    //
-    if(g_vboQuad == 0)
-        glGenBuffers(1, &g_vboQuad);
-    glBindBuffer(GL_ARRAY_BUFFER, g_vboQuad);
-    int vertices[2*4] = { 0,0, w,0, 0,h, w,h };
-    glBufferData(GL_ARRAY_BUFFER, sizeof(int)*2*4, vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    buildHiZ(w, h);
 }
 //------------------------------------------------------------------------------
-//
+// (re)creates the IBOs of all the PrimGroups from the CPU index data
 //------------------------------------------------------------------------------
-bool MyWindow::init()
+void uploadIndexBuffers()
 {
-	if(!WindowInertiaCamera::init())
-		return false;
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+    {
+        bk3d::Mesh *pMesh = meshFile->pMeshes->p[i];
+        for(int pg=0; pg<pMesh->pPrimGroups->n; pg++)
+        {
+            bk3d::PrimGroup* pPG = pMesh->pPrimGroups->p[pg];
+            PrimGroupGL* pPGGL = (PrimGroupGL*)pPG->userPtr;
+            if(pPGGL->ibo == 0)
+                glGenBuffers(1, &pPGGL->ibo);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, pPGGL->ibo); // no VAO bound here : a generic target
+            unsigned int lodBytes = pPGGL->pLods ? pPGGL->pLods->indexArrayByteSize : 0;
+            glBufferData(GL_COPY_WRITE_BUFFER, pPG->indexArrayByteSize + lodBytes, NULL, GL_STATIC_DRAW);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, pPG->indexArrayByteSize, pPG->pIndexBufferData);
+            if(lodBytes)
+                glBufferSubData(GL_COPY_WRITE_BUFFER, pPG->indexArrayByteSize, lodBytes, pPGGL->pLods->pIndexBufferData);
+        }
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
 
-#ifdef USESVCUI
-    initMFCUIBase(0, m_winSz[1]+40, m_winSz[0], 150);
-#endif
-#ifdef USESVCUI
+//------------------------------------------------------------------------------
+// builds the meshlets of all the PrimGroups, in parallel across PrimGroups.
+// maxThreads = 0 : all the cores. Returns the time spent in ms
+// Note: the index data get reordered : IBOs must be uploaded again after this
+//------------------------------------------------------------------------------
+double buildAllMeshlets(int maxThreads)
+{
+    std::vector<std::pair<int,int> > items; // (mesh, primgroup)
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+        for(int pg=0; pg<meshFile->pMeshes->p[i]->pPrimGroups->n; pg++)
+            items.push_back(std::pair<int,int>(i, pg));
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    bk3d::parallelFor((int)items.size(), [&](int n) {
+        bk3d::Mesh      *pMesh = meshFile->pMeshes->p[items[n].first];
+        bk3d::PrimGroup *pPG = pMesh->pPrimGroups->p[items[n].second];
+        PrimGroupGL     *pPGGL = (PrimGroupGL*)pPG->userPtr;
+        if(pPGGL->pMeshlets)
+            free(pPGGL->pMeshlets);
+        pPGGL->pMeshlets = bk3d::buildMeshlets(pMesh, pPG, pPGGL->baseVertex, &g_meshQuant[items[n].first]);
+    }, maxThreads);
+    std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
 
-    IControlCombo* pCombo = g_pWinHandler->CreateCtrlCombo("FBOMode", "FBO Mode", g_pToggleContainer);
+//------------------------------------------------------------------------------
+// generates the LODs of all the PrimGroups, in parallel across PrimGroups.
+// Returns the time spent in ms. IBOs must be uploaded again after this
+//------------------------------------------------------------------------------
+double buildAllLods(int maxThreads)
+{
+    std::vector<std::pair<int,int> > items; // (mesh, primgroup)
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+        for(int pg=0; pg<meshFile->pMeshes->p[i]->pPrimGroups->n; pg++)
+            items.push_back(std::pair<int,int>(i, pg));
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    bk3d::parallelFor((int)items.size(), [&](int n) {
+        bk3d::Mesh      *pMesh = meshFile->pMeshes->p[items[n].first];
+        bk3d::PrimGroup *pPG = pMesh->pPrimGroups->p[items[n].second];
+        PrimGroupGL     *pPGGL = (PrimGroupGL*)pPG->userPtr;
+        if(pPGGL->pLods)
+            free(pPGGL->pLods);
+        pPGGL->pLods = bk3d::buildLods(pMesh, pPG, pPGGL->baseVertex, &g_meshQuant[items[n].first], s_lodRatios, BK3D_MAXLODS-1);
+    }, maxThreads);
+    std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+//------------------------------------------------------------------------------
+// instance matrices of a Mesh : the regular transforms of Mesh::pTransforms, when there are many
+// (a single transform or bones mean no instancing : the Mesh is drawn as it was baked)
+//------------------------------------------------------------------------------
+void gatherBaseInstances(bk3d::Mesh *pMesh, std::vector<bk3d::MatrixType> &instances)
+{
+    instances.clear();
+    bk3d::TransformRefs *pRefs = pMesh->pTransforms;
+    if(pRefs && (pRefs->n > 1) && (pMesh->numJointInfluence == 0))
+        for(int t=0; t<pRefs->n; t++)
+        {
+            bk3d::Bone *pB = pRefs->p[t];
+            if((pB->nodeType == NODE_TRANSFORM) || (pB->nodeType == NODE_TRANSFORMSIMPLE))
+                instances.push_back(pB->MatrixAbs());
+        }
+    if(instances.size() <= 1)
+    {
+        bk3d::MatrixType id;
+        memset(&id, 0, sizeof(id));
+        id.m[0] = id.m[5] = id.m[10] = id.m[15] = 1.0f;
+        instances.assign(1, id);
+    }
+}
+
+//------------------------------------------------------------------------------
+// fills the instance VBOs : base instances of each Mesh times the cells of the stress grid
+//------------------------------------------------------------------------------
+void buildInstanceBuffers()
+{
+    std::vector<bk3d::MatrixType> matrices;
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+    {
+        MeshGL *pMGL = (MeshGL*)meshFile->pMeshes->p[i]->userPtr;
+        matrices.clear();
+        for(int gz=0; gz<s_stressGrid; gz++)
+            for(int gx=0; gx<s_stressGrid; gx++)
+                for(size_t b=0; b<pMGL->baseInstances.size(); b++)
+                {
+                    bk3d::MatrixType m = pMGL->baseInstances[b];
+                    m.m[12] += ((float)gx - (float)(s_stressGrid-1)*0.5f) * s_stressSpacing;
+                    m.m[14] += ((float)gz - (float)(s_stressGrid-1)*0.5f) * s_stressSpacing;
+                    matrices.push_back(m);
+                }
+        if(pMGL->instanceVbo == 0)
+            glGenBuffers(1, &pMGL->instanceVbo);
+        glBindBuffer(GL_ARRAY_BUFFER, pMGL->instanceVbo);
+        glBufferData(GL_ARRAY_BUFFER, matrices.size()*sizeof(bk3d::MatrixType), &matrices[0], GL_STATIC_DRAW);
+        pMGL->instanceCount = (int)matrices.size();
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+inline int getInstanceCount(int mesh)
+{
+    return ((MeshGL*)meshFile->pMeshes->p[mesh]->userPtr)->instanceCount;
+}
+
+//------------------------------------------------------------------------------
+// VAO of a Mesh from its bk3d::Attribute descriptors : each semantic goes to its location
+// in s_attribSemantics, only if the program of the Mesh reads it. The instance matrix is at 4-7.
+// Built once the VBOs of the Slots and of the instances exist
+//------------------------------------------------------------------------------
+void buildMeshVAO(bk3d::Mesh *pMesh)
+{
+    MeshGL *pMGL = (MeshGL*)pMesh->userPtr;
+    if(!pMGL->prog)
+        return;
+    if(pMGL->vao == 0)
+        glGenVertexArrays(1, &pMGL->vao);
+    glBindVertexArray(pMGL->vao);
+    for(int s=0; s<NUM_ATTRIBSEMANTICS; s++)
+    {
+        if(!(pMGL->layout & (1 << s)) || (glGetAttribLocation(pMGL->prog->getProgId(), s_attribSemantics[s].input) < 0))
+            continue;
+        bk3d::Attribute* pAttr = bk3d::findAttribute(pMesh, s_attribSemantics[s].name);
+        GLuint loc = s_attribSemantics[s].location;
+        // skinned on the CPU : interleaved position + normal
+        if(pMGL->pSkin && (!strcmp(pAttr->name, MESH_POSITION) || (!strcmp(pAttr->name, MESH_NORMAL) && pMGL->pSkin->bHasNormals)))
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, pMGL->skinnedVbo);
+            glVertexAttribPointer(loc, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                (void*)(strcmp(pAttr->name, MESH_POSITION) ? 3 * sizeof(float) : 0));
+            glEnableVertexAttribArray(loc);
+            continue;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, pMesh->pSlots->p[pAttr->slot]->userData);
+        glVertexAttribPointer(loc,
+            pAttr->numComp,
+            pAttr->formatGL,
+            bk3d::isNormalizedFormat(pAttr),
+            pAttr->strideBytes,
+            (void*)(size_t)pAttr->dataOffsetBytes);
+        glEnableVertexAttribArray(loc);
+    }
+    // instance matrices : one mat4 takes 4 locations
+    glBindBuffer(GL_ARRAY_BUFFER, pMGL->instanceVbo);
+    for(int c=0; c<4; c++)
+    {
+        glVertexAttribPointer(4+c, 4, GL_FLOAT, GL_FALSE, sizeof(bk3d::MatrixType), (void*)(c*4*sizeof(float)));
+        glVertexAttribDivisor(4+c, 1);
+        glEnableVertexAttribArray(4+c);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//------------------------------------------------------------------------------
+// copies the bounding volumes in SoA for the culling
+//------------------------------------------------------------------------------
+void buildCullingBounds()
+{
+    g_pgItems.clear();
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+        for(int pg=0; pg<meshFile->pMeshes->p[i]->pPrimGroups->n; pg++)
+            g_pgItems.push_back(std::pair<int,int>(i, pg));
+    g_meshBounds.resize(meshFile->pMeshes->n);
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+        g_meshBounds.set(i, meshFile->pMeshes->p[i]->bsphere, meshFile->pMeshes->p[i]->aabbox);
+    g_pgBounds.resize((unsigned int)g_pgItems.size());
+    for(size_t n=0; n<g_pgItems.size(); n++)
+    {
+        bk3d::PrimGroup *pPG = meshFile->pMeshes->p[g_pgItems[n].first]->pPrimGroups->p[g_pgItems[n].second];
+        g_pgBounds.set((unsigned int)n, pPG->bsphere, pPG->aabbox);
+    }
+    g_meshVisible.resize(g_meshBounds.n);
+    g_pgVisible.resize(g_pgBounds.n);
+    g_visibleList.reserve(g_pgItems.size());
+}
+
+//------------------------------------------------------------------------------
+// input of g_progSkinning for a SkinnedMesh. tableIds : entry in the skin matrix table
+// of each bone the influences refer to. 0 if there is no compute program
+//------------------------------------------------------------------------------
+GLuint createSkinInputBuffer(const bk3d::SkinnedMesh &skin, const std::vector<unsigned int> &tableIds)
+{
+    if(!g_progSkinning.getProgId())
+        return 0;
+    std::vector<SkinVertexGPU> vertices(skin.nVertices);
+    for(int v=0; v<skin.nVertices; v++)
+    {
+        const bk3d::SkinInfluences &si = skin.influences[v];
+        SkinVertexGPU &sv = vertices[v];
+        memcpy(sv.P, &skin.bindPose[v * 6], 3 * sizeof(float));
+        memcpy(sv.N, &skin.bindPose[v * 6 + 3], 3 * sizeof(float));
+        sv.bones01 = tableIds[si.bone[0]] | (tableIds[si.bone[1]] << 16);
+        sv.bones23 = tableIds[si.bone[2]] | (tableIds[si.bone[3]] << 16);
+        memcpy(sv.W, si.weight, 4 * sizeof(float));
+    }
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, vertices.size() * sizeof(SkinVertexGPU), &vertices[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return buffer;
+}
+// the skin matrices of the Mesh must all be in the table of meshFile->pTransforms. The bind pose
+// of a Mesh with Blendshapes changes : it stays on the CPU
+GLuint createSkinInputBuffer(bk3d::Mesh *pMesh, const bk3d::SkinnedMesh &skin)
+{
+    bk3d::TransformPool *pPool = meshFile->pTransforms;
+    if(!pPool || !pPool->tableMatrixAbsInvBindposeMatrix.p || (pMesh->pBSSlots && (pMesh->pBSSlots->n > 0)))
+        return 0;
+    std::vector<unsigned int> tableIds(pMesh->pTransforms->n);
+    for(int i=0; i<pMesh->pTransforms->n; i++)
+    {
+        const bk3d::MatrixType *pM = pMesh->pTransforms->p[i]->pMatrixAbsInvBindposeMatrix;
+        ptrdiff_t id = pM - pPool->tableMatrixAbsInvBindposeMatrix.p;
+        if(!pM || (id < 0) || (id >= pPool->nBones) || (id > 0xFFFF))
+            return 0;
+        tableIds[i] = (unsigned int)id;
+    }
+    return createSkinInputBuffer(skin, tableIds);
+}
+
+//------------------------------------------------------------------------------
+// GPU skinning : the matrix table goes to binding 0 for the next dispatches
+//------------------------------------------------------------------------------
+void uploadSkinMatrices(const bk3d::MatrixType *pMatrices, int n)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_skinMatricesBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, n * sizeof(bk3d::MatrixType), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, n * sizeof(bk3d::MatrixType), pMatrices);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g_skinMatricesBuffer);
+}
+// g_progSkinning must be enabled
+void dispatchSkinning(GLuint inputBuffer, GLuint outputBuffer, int nVertices)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, inputBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, outputBuffer);
+    g_progSkinning.setUniform1ui("nVertices", nVertices);
+    glDispatchCompute((nVertices + 63) / 64, 1, 1);
+}
+
+//------------------------------------------------------------------------------
+// CPU or GPU for each skinned Mesh. A Mesh the GPU can't skin stays on the CPU
+//------------------------------------------------------------------------------
+void setSkinMode(SkinMode mode)
+{
+    int k = 0;
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+    {
+        MeshGL *pMGL = (MeshGL*)meshFile->pMeshes->p[i]->userPtr;
+        if(!pMGL->pSkin)
+            continue;
+        bool bGPU = (mode == SKINMODE_GPU) || ((mode == SKINMODE_MIXED) && ((k++ & 1) == 0));
+        pMGL->bGPUSkinning = bGPU && (pMGL->skinInputBuffer != 0);
+        pMGL->bSkinStale = true;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Blendshapes of the Meshes whose weights changed. The result is in the base Slots : they
+// get uploaded by the GL thread (see publishFramePacket()), unless the Mesh is skinned (its
+// bind pose changed : skinned again). No GL : a job of the frame graph
+//------------------------------------------------------------------------------
+void updateBlendShapes()
+{
+    if(!meshFile)
+        return;
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    int vertices = 0, shapes = 0;
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+    {
+        bk3d::Mesh *pMesh = meshFile->pMeshes->p[i];
+        MeshGL *pMGL = (MeshGL*)pMesh->userPtr;
+        if(!pMGL->pBlend || (pMGL->pBlend->update(0) == 0))
+            continue;
+        vertices += pMGL->pBlend->nVertices;
+        shapes += (int)pMGL->pBlend->active.size();
+        if(pMGL->pSkin)
+        {
+            pMGL->pSkin->readBindPose();
+            pMGL->bSkinStale = true;
+        }
+        else
+            pMGL->bBlendUpload = true;
+    }
+    if(vertices == 0)
+        return;
+    s_blendVertices = vertices;
+    s_blendShapesActive = shapes;
+    s_blendMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+//------------------------------------------------------------------------------
+// skins the Meshes whose skin matrices changed : on the CPU, or tells the GL thread to
+// dispatch g_progSkinning (see publishFramePacket()). No GL : a job of the frame graph
+//------------------------------------------------------------------------------
+void updateSkinnedMeshes()
+{
+    if(!meshFile)
+        return;
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    s_skinnedVertices = 0;
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+    {
+        MeshGL *pMGL = (MeshGL*)meshFile->pMeshes->p[i]->userPtr;
+        if(!pMGL->pSkin)
+            continue;
+        if(pMGL->bGPUSkinning)
+        {
+            // the palette only tells if something changed : the table has it all
+            if(!pMGL->pSkin->updatePalette() && !pMGL->bSkinStale)
+                continue;
+            pMGL->bSkinDispatch = true;
+        }
+        else
+        {
+            if(pMGL->pSkin->skin(0, bk3d::getBestSkinningSIMD(), pMGL->bSkinStale) == 0)
+                continue;
+            pMGL->bSkinUpload = true;
+            s_skinnedVertices += pMGL->pSkin->nVertices;
+        }
+        pMGL->bSkinStale = false;
+    }
+    if(s_skinnedVertices > 0)
+        s_skinMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+//------------------------------------------------------------------------------
+// the last job of the frame graph : what the GL thread needs to render the frame, copied in
+// its packet. The next simulation can change everything else while the frame gets rendered
+//------------------------------------------------------------------------------
+void publishFramePacket(FramePacket &packet)
+{
+    packet.visibleList = g_visibleList;
+    packet.occludedList = g_occludedList;
+    packet.blendSlots.clear();
+    packet.blendData.clear();
+    packet.skinUploads.clear();
+    packet.skinData.clear();
+    packet.skinDispatches.clear();
+    if(!meshFile)
+        return;
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+    {
+        bk3d::Mesh *pMesh = meshFile->pMeshes->p[i];
+        MeshGL *pMGL = (MeshGL*)pMesh->userPtr;
+        if(pMGL->bBlendUpload)
+        {
+            bk3d::Attribute *pAttrs[2] = { pMGL->pBlend->pPos, pMGL->pBlend->pNormal };
+            for(int a=0; a<2; a++)
+            {
+                if(!pAttrs[a] || ((a == 1) && (pAttrs[1]->slot == pAttrs[0]->slot)))
+                    continue;
+                bk3d::Slot *pS = pMesh->pSlots->p[pAttrs[a]->slot];
+                const char *pData = (const char*)pS->pVtxBufferData;
+                packet.blendSlots.push_back(i);
+                packet.blendSlots.push_back(pAttrs[a]->slot);
+                packet.blendData.insert(packet.blendData.end(), pData, pData + pS->vtxBufferSizeBytes);
+            }
+            pMGL->bBlendUpload = false;
+        }
+        if(pMGL->bSkinUpload)
+        {
+            const float *pDeformed = pMGL->pSkin->getDeformed();
+            packet.skinUploads.push_back(i);
+            packet.skinData.insert(packet.skinData.end(), pDeformed, pDeformed + pMGL->pSkin->nVertices * 6);
+            pMGL->bSkinUpload = false;
+        }
+        if(pMGL->bSkinDispatch)
+        {
+            packet.skinDispatches.push_back(i);
+            pMGL->bSkinDispatch = false;
+        }
+    }
+    if(!packet.skinDispatches.empty())
+    {
+        const bk3d::MatrixType *pTable = meshFile->pTransforms->tableMatrixAbsInvBindposeMatrix;
+        packet.skinMatrices.assign(pTable, pTable + meshFile->pTransforms->nBones);
+    }
+}
+
+//------------------------------------------------------------------------------
+// the Blendshapes and the skinned vertices of a packet. On the CPU, the VBO is orphaned so
+// that the draws of the previous frame don't stall the upload. On the GPU, the matrix table
+// is uploaded once for all the Meshes
+//------------------------------------------------------------------------------
+void uploadFramePacket(const FramePacket &packet)
+{
+    if(!meshFile)
+        return;
+    // GPU time of the last measured frame, if the GPU is done with it
+    if(s_skinQueryPending)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(g_skinQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available)
+        {
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(g_skinQuery, GL_QUERY_RESULT, &ns);
+            s_gpuSkinMs = (double)ns / 1e6;
+            s_skinQueryPending = false;
+        }
+    }
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    size_t offset = 0;
+    for(size_t i=0; i<packet.blendSlots.size(); i+=2)
+    {
+        bk3d::Slot *pS = meshFile->pMeshes->p[packet.blendSlots[i]]->pSlots->p[packet.blendSlots[i+1]];
+        glBindBuffer(GL_ARRAY_BUFFER, pS->userData);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, pS->vtxBufferSizeBytes, &packet.blendData[offset]);
+        offset += pS->vtxBufferSizeBytes;
+    }
+    offset = 0;
+    for(size_t i=0; i<packet.skinUploads.size(); i++)
+    {
+        MeshGL *pMGL = (MeshGL*)meshFile->pMeshes->p[packet.skinUploads[i]]->userPtr;
+        GLsizeiptr sz = pMGL->pSkin->nVertices * 6 * sizeof(float);
+        glBindBuffer(GL_ARRAY_BUFFER, pMGL->skinnedVbo);
+        glBufferData(GL_ARRAY_BUFFER, sz, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sz, &packet.skinData[offset]);
+        offset += pMGL->pSkin->nVertices * 6;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    int gpuVertices = 0;
+    for(size_t i=0; i<packet.skinDispatches.size(); i++)
+    {
+        MeshGL *pMGL = (MeshGL*)meshFile->pMeshes->p[packet.skinDispatches[i]]->userPtr;
+        if(i == 0)
+        {
+            uploadSkinMatrices(&packet.skinMatrices[0], (int)packet.skinMatrices.size());
+            g_progSkinning.enable();
+            if(!s_skinQueryPending)
+                glBeginQuery(GL_TIME_ELAPSED, g_skinQuery);
+        }
+        dispatchSkinning(pMGL->skinInputBuffer, pMGL->skinnedVbo, pMGL->pSkin->nVertices);
+        gpuVertices += pMGL->pSkin->nVertices;
+    }
+    if(gpuVertices > 0)
+    {
+        if(!s_skinQueryPending)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            s_skinQueryPending = true;
+            s_gpuSkinnedVertices = gpuVertices;
+        }
+        // the draws read the result as vertex attributes
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        glUseProgram(0);
+    }
+    if(!packet.blendSlots.empty() || !packet.skinUploads.empty())
+        s_uploadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+}
+
+//------------------------------------------------------------------------------
+// meshlet build time versus triangle count
+//------------------------------------------------------------------------------
+void benchmarkMeshlets()
+{
+    if(!meshFile)
+        return;
+    LOGI("Meshlet build benchmark (%d max vertices, %d max triangles)\n", BK3D_MESHLET_MAXVERTICES, BK3D_MESHLET_MAXTRIANGLES);
+    LOGI("triangles\tmeshlets\tms\tMTris/s\n");
+    unsigned int totalTris = 0;
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+    {
+        bk3d::Mesh *pMesh = meshFile->pMeshes->p[i];
+        for(int pg=0; pg<pMesh->pPrimGroups->n; pg++)
+        {
+            bk3d::PrimGroup *pPG = pMesh->pPrimGroups->p[pg];
+            PrimGroupGL     *pPGGL = (PrimGroupGL*)pPG->userPtr;
+            std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+            bk3d::MeshletPool *pML = bk3d::buildMeshlets(pMesh, pPG, pPGGL->baseVertex, &g_meshQuant[i]);
+            std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+            if(!pML)
+                continue;
+            double ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+            unsigned int tris = pPG->indexCount / 3;
+            totalTris += tris;
+            LOGI("%d\t%d\t%.3f\t%.2f\n", tris, pML->n, ms, ms > 0.0 ? (double)tris / (ms * 1000.0) : 0.0);
+            if(pPGGL->pMeshlets)
+                free(pPGGL->pMeshlets);
+            pPGGL->pMeshlets = pML;
+        }
+    }
+    double ms1 = buildAllMeshlets(1);
+    double msN = buildAllMeshlets(0);
+    LOGI("whole scene: %d triangles; 1 thread %.2f ms; %d threads %.2f ms\n", totalTris, ms1, bk3d::getNumWorkerThreads(), msN);
+    LOGI("last frame: %d meshlets drawn, %d culled\n", s_meshletsDrawn, s_meshletsCulled);
+    uploadIndexBuffers();
+}
+
+//------------------------------------------------------------------------------
+// GPU skinning against the CPU one, in the current pose : g_progSkinning writes each Mesh
+// it can skin in a scratch buffer that is read back and compared to skinRange()
+//------------------------------------------------------------------------------
+void checkGPUSkinning()
+{
+    if(!meshFile || !g_progSkinning.getProgId() || !meshFile->pTransforms
+    || !meshFile->pTransforms->tableMatrixAbsInvBindposeMatrix.p)
+        return;
+    uploadSkinMatrices(meshFile->pTransforms->tableMatrixAbsInvBindposeMatrix.p, meshFile->pTransforms->nBones);
+    g_progSkinning.enable();
+    GLuint scratch;
+    glGenBuffers(1, &scratch);
+    int meshes = 0, failed = 0;
+    float maxErr = 0.0f;
+    for(int i=0; i< meshFile->pMeshes->n; i++)
+    {
+        bk3d::Mesh *pMesh = meshFile->pMeshes->p[i];
+        MeshGL *pMGL = (MeshGL*)pMesh->userPtr;
+        if(!pMGL->pSkin || !pMGL->skinInputBuffer)
+            continue;
+        bk3d::SkinnedMesh &skin = *pMGL->pSkin;
+        int n = skin.nVertices;
+        std::vector<float> cpu(n * 6), gpu(n * 6);
+        // the palette now has the pose : the VBO must be rewritten even if it doesn't change
+        skin.updatePalette();
+        pMGL->bSkinStale = true;
+        skin.skinRange(0, n, &cpu[0], bk3d::SKINSIMD_SCALAR);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, scratch);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, n * 6 * sizeof(float), NULL, GL_STREAM_READ);
+        dispatchSkinning(pMGL->skinInputBuffer, scratch, n);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, scratch);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, n * 6 * sizeof(float), &gpu[0]);
+        // relative to the magnitude of the positions
+        float err = 0.0f;
+        for(int k=0; k<n*6; k++)
+            err = std::max(err, fabsf(gpu[k] - cpu[k]) / std::max(1.0f, fabsf(cpu[k])));
+        if(err > 1e-4f)
+        {
+            LOGE("%s : the GPU skinning is off by %g\n", pMesh->name, err);
+            failed++;
+        }
+        maxErr = std::max(maxErr, err);
+        meshes++;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glUseProgram(0);
+    glDeleteBuffers(1, &scratch);
+    if(meshes)
+        LOGI("GPU skinning against the CPU : %d Meshes, %d wrong; max difference %g\n", meshes, failed, maxErr);
+}
+
+//------------------------------------------------------------------------------
+// F1 : what needs GL or the model. The bk3d headers alone have their checks and
+// benchmarks in tests/ (bk3d_tests -bench)
+//------------------------------------------------------------------------------
+void benchmarkScene()
+{
+    benchmarkMeshlets();
+    benchmarkProgramStartup();
+    checkGPUSkinning();
+}
+
+//------------------------------------------------------------------------------
+// camera position in the object space of the model (see the transformation in renderScene())
+//------------------------------------------------------------------------------
+void computeEyeObjectSpace(const mat4f &view, float *eye)
+{
+    // view = [R|t] => eye = -transpose(R) * t
+    const float *m = view.mat_array;
+    float w[3];
+    for(int k=0; k<3; k++)
+        w[k] = -(m[k*4+0]*m[12] + m[k*4+1]*m[13] + m[k*4+2]*m[14]);
+    // world = rotY(180) * scale * (P - posOffset)
+    eye[0] = -w[0] / g_scale + g_posOffset[0];
+    eye[1] =  w[1] / g_scale + g_posOffset[1];
+    eye[2] = -w[2] / g_scale + g_posOffset[2];
+}
+
+//------------------------------------------------------------------------------
+//
+//------------------------------------------------------------------------------
+bool MyWindow::init()
+{
+	if(!WindowInertiaCamera::init())
+		return false;
+    // the job threads : the frame graph, and every bk3d::parallelFor() (the load included)
+    m_jobs.init();
+    bk3d::setParallelForScheduler(&m_jobs);
+    LOGI("job system: %d threads\n", m_jobs.getNumThreads());
+
+#ifdef USESVCUI
+    initMFCUIBase(0, m_winSz[1]+40, m_winSz[0], 150);
+#endif
+#ifdef USESVCUI
+
+    IControlCombo* pCombo = g_pWinHandler->CreateCtrlCombo("FBOMode", "FBO Mode", g_pToggleContainer);
     pCombo->AddItem("Render to Texture MS.", (size_t)RENDERTOTEXMS);
     pCombo->AddItem("Render To Texture",   (size_t)RENDERTOTEX);
     pCombo->AddItem("Render To Renderbuffer MS.",  (size_t)RENDERTORBMS);
@@ -685,25 +2353,52 @@ bool MyWindow::init()
     //
     addToggleKeyToMFCUI(' ', &m_realtime.bNonStopRendering, "space: toggles continuous rendering\n");
     addToggleKeyToMFCUI('a', &s_bCameraAnim, "'a': animate camera\n");
+    addToggleKeyToMFCUI('b', &s_bBackfaceCulling, "'b': backface culling (GL_CULL_FACE)\n");
+    addToggleKeyToMFCUI('m', &s_bMeshletCulling, "'m': meshlet backface cone culling, with 'b'\n");
+    addToggleKeyToMFCUI('l', &s_bUseLods, "'l': LODs\n");
+    addToggleKeyToMFCUI('c', &s_bFrustumCulling, "'c': frustum culling\n");
+    addToggleKeyToMFCUI('o', &s_bHiZCulling, "'o': Hi-Z occlusion culling\n");
+    addToggleKeyToMFCUI('d', &s_bHiZDebug, "'d': shows the occluded PrimGroups in red\n");
+    addToggleKeyToMFCUI('i', &s_bIK, "'i': IK handles\n");
+    addToggleKeyToMFCUI('f', &s_bIKFABRIK, "'f': FABRIK instead of CCD for the IK\n");
     //
     // Shader compilation
     //
-    if(!g_progGrid.compileProgram(g_glslv_grid, NULL, g_glslf_grid))
-        return false;
-    if(!g_progMesh.compileProgram(g_glslv_mesh, NULL, g_glslf_mesh))
-        return false;
-    if(!g_progCopyTexMSAA.compileProgram(g_glslv_Tc, NULL, g_glslf_texMSAA))
-        return false;
-    if(!g_progCopyTex.compileProgram(g_glslv_Tc, NULL, g_glslf_tex))
+    // all the programs are started before waiting for any of them
+    std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+    g_progCache.init();
+    for(int p=0; p<NUM_PROGRAMSOURCES; p++)
+        s_programSources[p].prog->begin(s_programSources[p].vs, NULL, s_programSources[p].fs);
+    g_progSkinning.begin(NULL, NULL, NULL, g_glslc_skinning);
+    for(int p=0; p<NUM_PROGRAMSOURCES; p++)
+        if(!s_programSources[p].prog->finish() && s_programSources[p].bRequired)
+            return false;
+    if(g_progSkinning.finish())
+    {
+        glGenBuffers(1, &g_skinMatricesBuffer);
+        glGenQueries(1, &g_skinQuery);
+    } else
+        LOGW("the skinning compute shader failed to build : the CPU skins all the Meshes\n");
+    LOGI("programs : %d from the binary cache, %d compiled, %d stale binaries; %.2f ms%s\n",
+        g_progCache.loaded, g_progCache.compiled, g_progCache.rejected,
+        std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count(),
+        g_progCache.bParallel ? " (parallel compile)" : "");
+    if(!g_ring.init(RING_REGIONSZ))
+    {
+        LOGE("couldn't create the persistent-mapped ring buffer (GL 4.4 or ARB_buffer_storage needed)\n");
         return false;
-    g_progCopyImageMSAA.compileProgram(g_glslv_Tc, NULL, g_glslf_ImageMSAA);
-    g_progCopyImage.compileProgram(g_glslv_Tc, NULL, g_glslf_Image);
+    }
     //
     // Misc OGL setup
     //
     glClearColor(0.0f, 0.1f, 0.1f, 1.0f);
-    glGenVertexArrays(1, &g_vao);
-    glBindVertexArray(g_vao);
+    // the quad : separate format, so that the buffer offset can move without re-specifying the attribute
+    glGenVertexArrays(1, &g_vaoQuad);
+    glBindVertexArray(g_vaoQuad);
+    glEnableVertexAttribArray(0);
+    glVertexAttribIFormat(0, 2, GL_INT, 0);
+    glVertexAttribBinding(0, 0);
+    glBindVertexArray(0);
     //
     // Grid floor
     //
@@ -722,6 +2417,11 @@ bool MyWindow::init()
         *(p++) = vec3f(GRIDSZ*(-1.0f+2.0f*(float)i/(float)GRIDDEF), 0.0, GRIDSZ*(1.0f-2.0f/(float)GRIDDEF));
     }
     glBufferData(GL_ARRAY_BUFFER, sizeof(vec3f)*GRIDDEF*4, data[0].vec_array, GL_STATIC_DRAW);
+    glGenVertexArrays(1, &g_vaoGrid);
+    glBindVertexArray(g_vaoGrid);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3f), NULL);
+    glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     //
@@ -733,10 +2433,48 @@ bool MyWindow::init()
             meshFile = bk3d::load(PROJECT_ABSDIRECTORY MODELNAME);
     if(meshFile)
     {
+        // quantize the vertex attributes
+        g_meshQuant.resize(meshFile->pMeshes->n);
+        if(s_bQuantize)
+        {
+            std::vector<bk3d::AttributeQuantReport> report;
+            for(int i=0; i< meshFile->pMeshes->n; i++)
+                bk3d::quantizeMesh(meshFile->pMeshes->p[i], s_normalEnc, g_meshQuant[i], &report);
+            unsigned int bytesBefore = 0, bytesAfter = 0;
+            for(size_t r=0; r<report.size(); r++)
+            {
+                LOGI("quantized %s.%s: %d -> %d bytes; error max %f avg %f\n", report[r].meshName, report[r].attrName,
+                    report[r].bytesBefore, report[r].bytesAfter, report[r].maxError, report[r].avgError);
+                bytesBefore += report[r].bytesBefore;
+                bytesAfter  += report[r].bytesAfter;
+            }
+            if(!report.empty())
+                LOGI("quantization: %d attributes, %d -> %d bytes per vertex (summed)\n", (int)report.size(), bytesBefore, bytesAfter);
+        }
         // create VBOs
+        unsigned int ibBytesBefore = 0, ibBytesAfter = 0, ibBytesEncoded = 0;
+        unsigned int ibDecodeErrors = 0;
+        double ibDecodeMs = 0.0;
 	    for(int i=0; i< meshFile->pMeshes->n; i++)
 	    {
 		    bk3d::Mesh *pMesh = meshFile->pMeshes->p[i];
+            MeshGL *pMGL = new MeshGL;
+            pMGL->instanceVbo = 0;
+            pMGL->vao = 0;
+            pMGL->layout = getMeshLayout(pMesh);
+            pMGL->prog = getMeshProgram(pMGL->layout);
+            pMGL->instanceCount = 0;
+            pMGL->pSkin = NULL;
+            pMGL->pBlend = NULL;
+            pMGL->skinnedVbo = 0;
+            pMGL->skinInputBuffer = 0;
+            pMGL->bGPUSkinning = false;
+            pMGL->bSkinStale = false;
+            pMGL->bBlendUpload = false;
+            pMGL->bSkinUpload = false;
+            pMGL->bSkinDispatch = false;
+            gatherBaseInstances(pMesh, pMGL->baseInstances);
+            pMesh->userPtr = pMGL;
             for(int s=0; s<pMesh->pSlots->n; s++)
             {
                 bk3d::Slot* pS = pMesh->pSlots->p[s];
@@ -744,15 +2482,82 @@ bool MyWindow::init()
                 glBindBuffer(GL_ARRAY_BUFFER, pS->userData);
                 glBufferData(GL_ARRAY_BUFFER, pS->vtxBufferSizeBytes, pS->pVtxBufferData, GL_STATIC_DRAW);
             }
+            pMGL->pBlend = new bk3d::BlendShapeMesh;
+            if(pMGL->pBlend->build(pMesh))
+                LOGI("%s : %d blendshapes\n", pMesh->name, (int)pMGL->pBlend->shapes.size());
+            else {
+                delete pMGL->pBlend;
+                pMGL->pBlend = NULL;
+            }
+            if(s_bCPUSkinning)
+            {
+                pMGL->pSkin = new bk3d::SkinnedMesh;
+                if(pMGL->pSkin->build(pMesh))
+                {
+                    glGenBuffers(1, &pMGL->skinnedVbo);
+                    glBindBuffer(GL_ARRAY_BUFFER, pMGL->skinnedVbo);
+                    glBufferData(GL_ARRAY_BUFFER, pMGL->pSkin->nVertices * 6 * sizeof(float), pMGL->pSkin->getDeformed(), GL_STREAM_DRAW);
+                    pMGL->skinInputBuffer = createSkinInputBuffer(pMesh, *pMGL->pSkin);
+                    LOGI("%s : %d vertices skinned by %d transforms%s\n", pMesh->name, pMGL->pSkin->nVertices, pMesh->pTransforms->n,
+                        pMGL->skinInputBuffer ? "" : " (CPU only : Blendshapes, or bones outside the matrix table)");
+                } else {
+                    delete pMGL->pSkin;
+                    pMGL->pSkin = NULL;
+                }
+            }
             for(int pg=0; pg<pMesh->pPrimGroups->n; pg++)
             {
                 bk3d::PrimGroup* pPG = pMesh->pPrimGroups->p[pg];
-                glGenBuffers(1, (GLuint*)&pPG->userPtr);
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (GLuint)pMesh->pPrimGroups->p[pg]->userPtr);
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, pPG->indexArrayByteSize, pPG->pIndexBufferData, GL_STATIC_DRAW);
+                PrimGroupGL* pPGGL = new PrimGroupGL;
+                pPGGL->ibo = 0;
+                pPGGL->pMeshlets = NULL;
+                pPGGL->pLods = NULL;
+                pPGGL->materialId = pPG->pMaterial ? (int)pPG->pMaterial->ID + 1 : 0;
+                pPG->userPtr = pPGGL;
+                ibBytesBefore += pPG->indexArrayByteSize;
+                if(s_bDemoteIndices)
+                    bk3d::demoteIndices(pPG, &pPGGL->baseVertex);
+                else
+                    pPGGL->baseVertex = 0;
+                ibBytesAfter += pPG->indexArrayByteSize;
+                // what the delta encoding would cost on disk, and the decoding of it at load
+                std::vector<unsigned char> encoded;
+                bk3d::encodeIndices(pPG->pIndexBufferData, pPG->indexFormatGL, pPG->indexCount, encoded);
+                ibBytesEncoded += (unsigned int)encoded.size();
+                std::vector<char> decoded(pPG->indexCount * bk3d::formatGLComponentSize(pPG->indexFormatGL));
+                std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+                bk3d::decodeIndices(&encoded[0], decoded.empty() ? NULL : &decoded[0], pPG->indexFormatGL);
+                ibDecodeMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+                if(!decoded.empty() && memcmp(&decoded[0], pPG->pIndexBufferData, decoded.size()))
+                    ibDecodeErrors++;
             }
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	    }
+        LOGI("index buffers: %d bytes; %d bytes after 16 bits demotion; %d bytes delta-encoded (decoded in %.3f ms)\n",
+            ibBytesBefore, ibBytesAfter, ibBytesEncoded, ibDecodeMs);
+        if(ibDecodeErrors)
+            LOGE("%d index buffers don't survive the delta encoding\n", ibDecodeErrors);
+        // meshlets reorder the triangles : must be done before creating the IBOs
+        if(s_bBuildMeshlets)
+        {
+            double ms = buildAllMeshlets(0);
+            LOGI("meshlets built in %.2f ms\n", ms);
+        }
+        if(s_bBuildLods)
+        {
+            double ms = buildAllLods(0);
+            unsigned int tris[BK3D_MAXLODS] = { 0, 0, 0, 0 };
+            for(int i=0; i< meshFile->pMeshes->n; i++)
+                for(int pg=0; pg<meshFile->pMeshes->p[i]->pPrimGroups->n; pg++)
+                {
+                    bk3d::PrimGroup *pPG = meshFile->pMeshes->p[i]->pPrimGroups->p[pg];
+                    bk3d::LodPool *pLods = ((PrimGroupGL*)pPG->userPtr)->pLods;
+                    for(int l=0; l<BK3D_MAXLODS; l++)
+                        tris[l] += (!pLods || (l == 0)) ? pPG->indexCount/3 : pLods->lod[(l > (int)pLods->n ? pLods->n : l) - 1].indexCount/3;
+                }
+            LOGI("LODs generated in %.2f ms; triangles per LOD: %d %d %d %d\n", ms, tris[0], tris[1], tris[2], tris[3]);
+        }
+        uploadIndexBuffers();
+        buildCullingBounds();
 	    //
 	    // Some adjustment for the display
 	    //
@@ -780,6 +2585,35 @@ bool MyWindow::init()
 		    g_scale = 1.0 / bigger;
 		    PRINTF(("Scaling the model by %f...\n", g_scale));
 	    }
+        s_stressSpacing = bigger * 1.2f;
+        g_nameIndex.build(meshFile);
+        LOGI("name index : %d Nodes\n", g_nameIndex.count);
+        g_curveEval.build(meshFile->pMayaCurves);
+        if(!g_curveEval.curves.empty())
+            LOGI("%d animation curves, %d segments\n", (int)g_curveEval.curves.size(), (int)g_curveEval.segments.size() - 1);
+        g_quatEval.build(meshFile->pQuatCurves);
+        if(!g_quatEval.curves.empty())
+            LOGI("%d quaternion curves\n", (int)g_quatEval.curves.size());
+        g_connections.compile(meshFile, &g_nameIndex);
+        if(g_connections.nConnections)
+            LOGI("%d connections : %d copies in %d independent groups (%d by name, %d unresolved, %d in cycles)\n",
+                g_connections.nConnections, (int)g_connections.ops.size(), g_connections.nGroups,
+                g_connections.nByName, g_connections.nUnresolved, g_connections.nCycles);
+        g_transforms.build(meshFile->pTransforms);
+        if(!g_transforms.order.empty())
+            LOGI("%d transforms in %d levels\n", (int)g_transforms.order.size(), (int)g_transforms.levels.size() - 1);
+        // the rest pose of the IK limits : the local matrices composed once
+        g_transforms.update(0);
+        g_ik.build(meshFile->pIKHandles, &g_transforms);
+        s_bIKSolved = false;
+        if(!g_ik.chains.empty())
+            LOGI("%d IK handles on %d joints, in %d independent groups\n", (int)g_ik.chains.size(),
+                (int)g_ik.jointIDs.size(), (int)g_ik.groupFirst.size() - 1);
+        buildInstanceBuffers();
+        // the instance VBOs keep their names when the stress grid changes : the VAOs stay valid
+        for(int i=0; i< meshFile->pMeshes->n; i++)
+            buildMeshVAO(meshFile->pMeshes->p[i]);
+        LOGI("%d mesh program permutations for %d Meshes\n", (int)g_meshPrograms.size(), meshFile->pMeshes->n);
     } else {
         LOGE("error in loading mesh\n");
     }
@@ -794,6 +2628,9 @@ bool MyWindow::init()
 //------------------------------------------------------------------------------
 void MyWindow::shutdown()
 {
+    finishSimulation();
+    bk3d::setParallelForScheduler(NULL);
+    m_jobs.shutdown();
 #ifdef USESVCUI
     shutdownMFCUI();
 #endif
@@ -807,22 +2644,101 @@ void MyWindow::reshape(int w, int h)
     // rebuild the FBOs to match the new size
     //
     if(m_validated)
+    {
+        flushPipeline(); // the culling reads the Hi-Z read-back
         buildRenderTargets(w, h);
+    }
 }
 
 //------------------------------------------------------------------------------
 #define KEYTAU 0.10f
 void MyWindow::keyboard(NVPWindow::KeyCode key, MyWindow::ButtonAction action, int mods, int x, int y)
 {
+    // before the base class : its toggle keys change what the jobs in flight read
+    if(action != MyWindow::BUTTON_RELEASE)
+        flushPipeline();
 	WindowInertiaCamera::keyboard(key, action, mods, x, y);
 	if(action == MyWindow::BUTTON_RELEASE)
         return;
     switch(key)
     {
     case NVPWindow::KEY_F1:
+        benchmarkScene();
+        break;
+    case NVPWindow::KEY_F3:
+        if(!meshFile)
+            break;
+        LOGI("Camera path benchmark : one loop with LODs, one without...\n");
+        s_camBenchPass = 0;
+        s_camBenchFrames = 0;
+        s_camBenchMs = 0.0;
+        s_camBenchTris = 0.0;
+        s_bUseLods = true;
+        s_bCameraAnim = true;
+        s_cameraAnimItem = 0;
+        s_cameraAnimIntervals = 0.0f;
+        m_realtime.bNonStopRendering = true;
+        s_camBenchLastFrame = std::chrono::high_resolution_clock::now();
+        break;
+    case NVPWindow::KEY_F5:
+        if(!meshFile)
+            break;
+        s_stressGrid = s_stressGrid >= 32 ? 1 : s_stressGrid * 2;
+        buildInstanceBuffers();
+        s_stressFrames = 100;
+        s_stressMs = 0.0;
+        m_realtime.bNonStopRendering = true;
+        LOGI("Instancing stress : %dx%d copies of the model\n", s_stressGrid, s_stressGrid);
+        break;
+    case NVPWindow::KEY_F4:
+        LOGI("last frame: %d triangles; frustum culled %d/%d Meshes, %d/%d PrimGroups; meshlets %d drawn, %d culled\n",
+            s_trianglesDrawn, s_meshesCulled, g_meshBounds.n, s_primGroupsCulled, (int)g_pgItems.size(), s_meshletsDrawn, s_meshletsCulled);
+        LOGI("render queue: %d state changes, %d redundant ones skipped\n", s_stateChanges, s_stateChangesAvoided);
+        LOGI("ring buffer: %d frames waited on a fence (%.3f ms in total); peak %d bytes/frame; %d overflows\n",
+            g_ring.fenceWaits, g_ring.fenceWaitMs, (int)g_ring.peakBytes, g_ring.overflows);
+        LOGI("Hi-Z: %d PrimGroups tested, %d occluded (%dx%d read-back level %d of %d)\n",
+            s_hizTested, s_hizOccluded, g_hizCPUSz[0], g_hizCPUSz[1], g_hizReadLevel, g_hizLevels);
+        if(s_skinnedVertices > 0)
+            LOGI("CPU skinning: %d vertices in %.3f ms (%.1f M vertices/s)\n",
+                s_skinnedVertices, s_skinMs, (double)s_skinnedVertices / (s_skinMs * 1000.0));
+        if(s_blendVertices > 0)
+            LOGI("blendshapes: last update %d vertices, %d shapes with a weight in %.3f ms\n",
+                s_blendVertices, s_blendShapesActive, s_blendMs);
+        if(s_uploadMs > 0.0)
+            LOGI("uploads of the Blendshapes and of the CPU skinning: %.3f ms\n", s_uploadMs);
+        if(s_bIK && !g_ik.chains.empty())
+            LOGI("IK (%s): %d chains, %d iterations, %d converged, max error %.3g of the chain length, in %.3f ms\n",
+                g_ik.method == bk3d::IKMETHOD_FABRIK ? "FABRIK" : "CCD", (int)g_ik.chains.size(), g_ik.nIterations,
+                g_ik.nConverged, g_ik.maxError, s_ikMs);
+        if(s_jobFrames > 0)
+        {
+            LOGI("frame graph: %d jobs on %d threads; %.3f ms, critical path %.3f ms, CPU utilization %.0f%% (mean of %d frames)\n",
+                (int)m_jobs.jobs.size(), m_jobs.getNumThreads(), s_jobFrameMs / s_jobFrames, s_jobCriticalMs / s_jobFrames,
+                100.0 * s_jobUtilization / s_jobFrames, s_jobFrames);
+            std::string path;
+            for(size_t j=0; j<m_jobs.criticalPath.size(); j++)
+                path += (j ? " > " : "") + std::string(m_jobs.jobs[m_jobs.criticalPath[j]].name);
+            LOGI("  critical path of the last frame: %s\n", path.c_str());
+            LOGI("  frame pipeline depth %d (%d frames simulated)\n", m_pipeline.depth, m_pipeline.nextFrame);
+            s_jobFrames = 0;
+            s_jobFrameMs = s_jobCriticalMs = s_jobUtilization = 0.0;
+        }
+        if(s_gpuSkinnedVertices > 0)
+            LOGI("GPU skinning: %d vertices in %.3f ms of GPU time (%.1f M vertices/s)\n",
+                s_gpuSkinnedVertices, s_gpuSkinMs, (double)s_gpuSkinnedVertices / (s_gpuSkinMs * 1000.0));
         break;
 	//...
     case NVPWindow::KEY_F12:
+        if(!meshFile)
+            break;
+        if(!g_progSkinning.getProgId())
+        {
+            LOGW("no GPU skinning : its compute shader failed to build\n");
+            break;
+        }
+        s_skinMode = (SkinMode)((s_skinMode + 1) % NUM_SKINMODES);
+        setSkinMode(s_skinMode);
+        LOGI("skinning : %s\n", s_skinModeNames[s_skinMode]);
         break;
     }
 #ifdef USESVCUI
@@ -832,6 +2748,8 @@ void MyWindow::keyboard(NVPWindow::KeyCode key, MyWindow::ButtonAction action, i
 //------------------------------------------------------------------------------
 void MyWindow::keyboardchar(unsigned char key, int mods, int x, int y)
 {
+    // before the base class : its toggle keys change what the jobs in flight read
+    flushPipeline();
     WindowInertiaCamera::keyboardchar(key,  mods, x, y);
     switch( key )
     {
@@ -863,6 +2781,10 @@ void MyWindow::keyboardchar(unsigned char key, int mods, int x, int y)
             blitMode = RESOLVEWITHSHADERIMAGE;
             LOGI("blitting using fullscreenquad and image\n");
             break;
+        case 'p':
+            m_pipeline.depth = (m_pipeline.depth + 1) % (FRAME_MAXDEPTH + 1);
+            LOGI("frame pipeline : rendering %d frame(s) behind the simulation\n", m_pipeline.depth);
+            break;
         default:
             break;
     }
@@ -873,85 +2795,572 @@ void MyWindow::keyboardchar(unsigned char key, int mods, int x, int y)
 #endif
 }
 
-void MyWindow::renderScene()
+//------------------------------------------------------------------------------
+// draws the meshlets of a PrimGroup that aren't backfacing. Contiguous ranges are merged
+//------------------------------------------------------------------------------
+void drawMeshlets(bk3d::PrimGroup *pPG, const float *eyeObj)
+{
+    static std::vector<GLsizei>     counts;
+    static std::vector<const void*> offsets;
+    static std::vector<GLint>       baseVertices;
+    PrimGroupGL       *pPGGL = (PrimGroupGL*)pPG->userPtr;
+    bk3d::MeshletPool *pML = pPGGL->pMeshlets;
+    unsigned int idxSize = bk3d::formatGLComponentSize(pPG->indexFormatGL);
+    counts.clear();
+    offsets.clear();
+    unsigned int runEnd = 0xFFFFFFFF;
+    for(unsigned int m=0; m<pML->n; m++)
+    {
+        const bk3d::Meshlet &ml = pML->m[m];
+        if(bk3d::isMeshletBackfacing(ml, eyeObj))
+        {
+            s_meshletsCulled++;
+            continue;
+        }
+        s_meshletsDrawn++;
+        s_trianglesDrawn += ml.triangleCount;
+        if(ml.indexOffset == runEnd)
+            counts.back() += ml.triangleCount * 3;
+        else
+        {
+            counts.push_back(ml.triangleCount * 3);
+            offsets.push_back((const void*)(size_t)(ml.indexOffset * idxSize));
+        }
+        runEnd = ml.indexOffset + ml.triangleCount * 3;
+    }
+    if(counts.empty())
+        return;
+    baseVertices.assign(counts.size(), pPGGL->baseVertex);
+    glMultiDrawElementsBaseVertex(pPG->topologyGL, &counts[0], pPG->indexFormatGL, (const void* const*)&offsets[0], (GLsizei)counts.size(), &baseVertices[0]);
+    s_drawCalls++;
+}
+
+//------------------------------------------------------------------------------
+// builds the min/max pyramid from the depth of the FBO that just got rendered
+// with mWVP and starts the read-back of one of its levels
+//------------------------------------------------------------------------------
+void buildHiZPyramid(bool bMSAA, const mat4f &mWVP)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fboHiZ);
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(g_vaoQuad);
+    // level 0 : copy of the depth (min/max of the samples in MSAA)
+    CachedProgram &progDepth = bMSAA ? g_progHiZDepthMS : g_progHiZDepth;
+    progDepth.enable();
+    progDepth.bindTexture("depthTex", bMSAA ? textureDSTMS : textureDST, bMSAA ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, 0);
+    if(bMSAA)
+        progDepth.setUniform1i("samples", g_depthSamples);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureHiZ, 0);
+    glViewport(0, 0, fboSz[0], fboSz[1]);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    // reductions : the source level is isolated with the base/max levels, so that it isn't the one we render to
+    g_progHiZReduce.enable();
+    g_progHiZReduce.bindTexture("src", textureHiZ, GL_TEXTURE_2D, 0);
+    for(int l=1; l<g_hizLevels; l++)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, l-1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, l-1);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureHiZ, l);
+        glViewport(0, 0, (fboSz[0] >> l) > 0 ? (fboSz[0] >> l) : 1, (fboSz[1] >> l) > 0 ? (fboSz[1] >> l) : 1);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, g_hizLevels-1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    // read-back without waiting : a later frame will map it once its fence is signaled
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureHiZ, g_hizReadLevel);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, g_pboHiZ[g_hizWriteIdx]);
+    glReadPixels(0, 0, g_hizReadSz[0], g_hizReadSz[1], GL_RG, GL_FLOAT, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if(g_fenceHiZ[g_hizWriteIdx])
+        glDeleteSync(g_fenceHiZ[g_hizWriteIdx]);
+    g_fenceHiZ[g_hizWriteIdx] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    g_hizReadVP[g_hizWriteIdx] = mWVP;
+    g_hizWriteIdx = (g_hizWriteIdx + 1) % HIZ_READBACKS;
+    glViewport(0, 0, fboSz[0], fboSz[1]);
+    glEnable(GL_DEPTH_TEST);
+}
+
+//------------------------------------------------------------------------------
+// copies the most recent read-back that is complete in g_hizCPU. Never waits
+//------------------------------------------------------------------------------
+void fetchHiZReadback()
+{
+    for(int i=1; i<=HIZ_READBACKS; i++)
+    {
+        int idx = (g_hizWriteIdx - i + HIZ_READBACKS) % HIZ_READBACKS;
+        if(!g_fenceHiZ[idx])
+            continue;
+        GLenum res = glClientWaitSync(g_fenceHiZ[idx], 0, 0);
+        if((res != GL_ALREADY_SIGNALED) && (res != GL_CONDITION_SATISFIED))
+            continue;
+        size_t sz = g_hizReadSz[0]*g_hizReadSz[1]*2;
+        g_hizCPU.resize(sz);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, g_pboHiZ[idx]);
+        void *p = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sz*sizeof(float), GL_MAP_READ_BIT);
+        if(p)
+        {
+            memcpy(&g_hizCPU[0], p, sz*sizeof(float));
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        g_hizCPUSz[0] = g_hizReadSz[0];
+        g_hizCPUSz[1] = g_hizReadSz[1];
+        g_hizCPUVP = g_hizReadVP[idx];
+        // older read-backs are now useless
+        for(int j=i; j<=HIZ_READBACKS; j++)
+        {
+            int k = (g_hizWriteIdx - j + HIZ_READBACKS) % HIZ_READBACKS;
+            if(g_fenceHiZ[k])
+                glDeleteSync(g_fenceHiZ[k]);
+            g_fenceHiZ[k] = NULL;
+        }
+        return;
+    }
+}
+
+//------------------------------------------------------------------------------
+// fills g_visibleList with the PrimGroups in the frustum of mWVP (which maps the object space),
+// minus the ones occluded in g_hizCPU (fetchHiZReadback() before). No GL : a job of the frame graph
+// The read-back is a few frames old : the boxes are projected with the matrix of that frame
+// (g_hizCPUVP) so that they land where its depths are, and their footprint is grown by a texel
+// for what moved in between
+//------------------------------------------------------------------------------
+void cullScene(const mat4f &mWVP)
+{
+    g_visibleList.clear();
+    g_occludedList.clear();
+    s_hizTested = s_hizOccluded = 0;
+    // no model : the bounds and the visibility arrays are empty
+    if(!meshFile)
+        return;
+    if(!s_bFrustumCulling)
+    {
+        for(size_t n=0; n<g_pgItems.size(); n++)
+            g_visibleList.push_back((int)n);
+        s_meshesCulled = s_primGroupsCulled = 0;
+        return;
+    }
+    float planes[6][4];
+    bk3d::extractFrustumPlanes(mWVP.mat_array, planes);
+    s_meshesCulled = g_meshBounds.n - bk3d::cullBounds(g_meshBounds, planes, &g_meshVisible[0]);
+    bk3d::cullBounds(g_pgBounds, planes, &g_pgVisible[0]);
+    // the bounds are the ones of the first instance : instanced Meshes are always drawn
+    for(size_t n=0; n<g_pgItems.size(); n++)
+        if((g_meshVisible[g_pgItems[n].first] && g_pgVisible[n]) || (getInstanceCount(g_pgItems[n].first) > 1))
+            g_visibleList.push_back((int)n);
+    s_primGroupsCulled = (int)(g_pgItems.size() - g_visibleList.size());
+    //
+    // occlusion against the depth of a previous frame
+    //
+    if(!s_bHiZCulling)
+        return;
+    if(g_hizCPU.empty())
+        return;
+    size_t w = 0;
+    for(size_t v=0; v<g_visibleList.size(); v++)
+    {
+        int n = g_visibleList[v];
+        float c[3], e[3];
+        if((getInstanceCount(g_pgItems[n].first) == 1) && g_pgBounds.getBox(n, c, e))
+        {
+            s_hizTested++;
+            if(bk3d::isBoxOccluded(g_hizCPUVP.mat_array, c, e, &g_hizCPU[1], g_hizCPUSz[0], g_hizCPUSz[1], 2, HIZ_MAXTEXELS, 1))
+            {
+                g_occludedList.push_back(n);
+                continue;
+            }
+        }
+        g_visibleList[w++] = n;
+    }
+    g_visibleList.resize(w);
+    s_hizOccluded = (int)g_occludedList.size();
+}
+
+//------------------------------------------------------------------------------
+// LOD of a Mesh from the projected size of its bounding sphere
+//------------------------------------------------------------------------------
+int selectMeshLod(bk3d::Mesh *pMesh, const float *eyeObj, float pixelScale)
+{
+    float c[3], r;
+    if(pMesh->bsphere.radius > 0.0f)
+    {
+        c[0] = pMesh->bsphere.pos.x; c[1] = pMesh->bsphere.pos.y; c[2] = pMesh->bsphere.pos.z;
+        r = pMesh->bsphere.radius;
+    } else {
+        const bk3d::AABBox &b = pMesh->aabbox;
+        c[0] = (b.min.x + b.max.x)*0.5f; c[1] = (b.min.y + b.max.y)*0.5f; c[2] = (b.min.z + b.max.z)*0.5f;
+        float d[3] = { b.max.x - c[0], b.max.y - c[1], b.max.z - c[2] };
+        r = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+        if(r <= 0.0f)
+            return 0;
+    }
+    float d[3] = { c[0] - eyeObj[0], c[1] - eyeObj[1], c[2] - eyeObj[2] };
+    float dist = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+    if(dist <= r)
+        return 0;
+    // the LodPools of the PrimGroups may have different amounts of LODs : clamped when drawing
+    int lod = 0;
+    for(int pg=0; pg<pMesh->pPrimGroups->n; pg++)
+    {
+        int l = bk3d::selectLod(((PrimGroupGL*)pMesh->pPrimGroups->p[pg]->userPtr)->pLods, r * pixelScale / dist, s_lodFullDetailRadius);
+        if(l > lod)
+            lod = l;
+    }
+    return lod;
+}
+
+//------------------------------------------------------------------------------
+// dequantization uniforms and VAO of a Mesh
+//------------------------------------------------------------------------------
+void bindMesh(int i)
+{
+    bk3d::Mesh *pMesh = meshFile->pMeshes->p[i];
+    bk3d::MeshQuantization &q = g_meshQuant[i];
+    MeshData meshData;
+    memset(&meshData, 0, sizeof(MeshData));
+    for(int c=0; c<3; c++)
+    {
+        meshData.posBias[c] = q.posBias[c];
+        meshData.posScale[c] = q.posScale[c];
+    }
+    meshData.normalEnc[0] = q.normalEnc;
+    g_ring.bindUniforms(UBO_MESH, &meshData, sizeof(MeshData));
+    glBindVertexArray(((MeshGL*)pMesh->userPtr)->vao);
+}
+
+//------------------------------------------------------------------------------
+// draws a sorted queue. The state of the previous item is kept so that only the
+// program, vertex source, IBO, material and layer changes get issued
+//------------------------------------------------------------------------------
+void submitRenderQueue(RenderQueue &queue)
+{
+    int         curLayer = -1;
+    CachedProgram *curProg = NULL;
+    int         curVtxSrc = -1;
+    int         curMaterial = -1;
+    GLuint      curIbo = 0xFFFFFFFF;
+    for(size_t o=0; o<queue.order.size(); o++)
+    {
+        const DrawItem &item = queue.items[queue.order[o].item];
+        if(item.layer != curLayer)
+        {
+            // the other layers keep the state of the pass
+            if(item.layer == LAYER_OVERLAY)
+            {
+                glDisable(GL_DEPTH_TEST);
+                glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+            } else if(curLayer == LAYER_OVERLAY) {
+                glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+                glEnable(GL_DEPTH_TEST);
+            }
+            curLayer = item.layer;
+        }
+        if(item.prog != curProg)
+        {
+            curProg = item.prog;
+            curProg->enable();
+            // uniforms and textures belong to the program : they must be set again
+            curMaterial = -1;
+            s_stateChanges++;
+        } else
+            s_stateChangesAvoided++;
+        if(item.vertexSource != curVtxSrc)
+        {
+            curVtxSrc = item.vertexSource;
+            switch(curVtxSrc)
+            {
+            case VTXSRC_GRID:
+                glBindVertexArray(g_vaoGrid);
+                break;
+            case VTXSRC_QUAD:
+                glBindVertexArray(g_vaoQuad);
+                break;
+            default:
+                bindMesh(curVtxSrc - VTXSRC_MESH0);
+                break;
+            }
+            // the IBO binding is part of the VAO
+            curIbo = 0xFFFFFFFF;
+            s_stateChanges++;
+        } else
+            s_stateChangesAvoided++;
+        if(item.materialId != curMaterial)
+        {
+            curMaterial = item.materialId;
+            if(item.texName)
+            {
+                if(item.bImage)
+                    curProg->bindImage(item.texName, 0, item.tex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
+                else
+                    curProg->bindTexture(item.texName, item.tex, item.texTarget, 0);
+            }
+            if(item.diffuse)
+                curProg->setUniform3f("diffuse", item.diffuse[0], item.diffuse[1], item.diffuse[2]);
+            s_stateChanges++;
+        } else
+            s_stateChangesAvoided++;
+        if(item.type == DRAWITEM_ARRAYS)
+        {
+            glDrawArrays(item.topology, 0, item.count);
+            continue;
+        }
+        if(item.ibo != curIbo)
+        {
+            curIbo = item.ibo;
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, curIbo);
+            s_stateChanges++;
+        } else
+            s_stateChangesAvoided++;
+        if(item.type == DRAWITEM_MESHLETS)
+        {
+            drawMeshlets(item.pPG, queue.eyeObj);
+            continue;
+        }
+        glDrawElementsInstancedBaseVertex(item.topology, item.count, item.indexFormat,
+            (void*)item.indexOffset, item.instances, item.baseVertex);
+        if(item.layer == LAYER_SCENE)
+        {
+            s_trianglesDrawn += item.instances * item.count / 3;
+            s_drawCalls++;
+        }
+    }
+    glBindVertexArray(0);
+    if(curLayer == LAYER_OVERLAY)
+    {
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glEnable(GL_DEPTH_TEST);
+    }
+}
+
+//------------------------------------------------------------------------------
+// view-projection of the grid, and of the model (turned, scaled and centered)
+//------------------------------------------------------------------------------
+void MyWindow::getSceneMatrices(mat4f &mVP, mat4f &mWVP)
 {
+    mVP = m_projection * m_camera.m4_view /* * World transf...*/;
+    mWVP = mVP;
+    mWVP.rotate(nv_to_rad*180.0, vec3f(0,1,0));
+    mWVP.scale(g_scale);
+    mWVP.translate(-g_posOffset);
+}
+
+void MyWindow::renderScene(const FramePacket &packet)
+{
+    /////////////////////////////////////////////////
+    //// per-frame uniforms : one block for the whole frame
+    const mat4f &mWVP = packet.mWVP;
+    FrameData frameData;
+    frameData.mVP = packet.mVP;
+    frameData.mWVP = mWVP;
+    vec3f lightDir(0.4,0.8,0.3);
+    lightDir.normalize();
+    frameData.lightDir[0] = lightDir[0]; frameData.lightDir[1] = lightDir[1]; frameData.lightDir[2] = lightDir[2]; frameData.lightDir[3] = 0.0f;
+    frameData.gridColor[0] = 0.3f; frameData.gridColor[1] = 0.3f; frameData.gridColor[2] = 1.0f; frameData.gridColor[3] = 1.0f;
+    g_ring.bindUniforms(UBO_FRAME, &frameData, sizeof(FrameData));
+    /////////////////////////////////////////////////
+    //// the draws of the pass go through the render queue
+    g_sceneQueue.clear();
+    DrawItem item;
+    memset(&item, 0, sizeof(DrawItem));
     /////////////////////////////////////////////////
     //// Grid floor
-    g_progGrid.enable();
-    mat4f mWVP;
-    mWVP = m_projection * m_camera.m4_view /* * World transf...*/;
-    g_progGrid.setUniformMatrix4fv("mWVP", mWVP.mat_array, false);
-    g_progGrid.setUniform3f("diffuse", 0.3, 0.3, 1.0);
-    glBindBuffer(GL_ARRAY_BUFFER, g_vboGrid);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3f), NULL);
-    glDrawArrays(GL_LINES, 0, GRIDDEF*4);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glDisableVertexAttribArray(0);
-    //g_progGrid.disable();
+    item.type = DRAWITEM_ARRAYS;
+    item.layer = LAYER_SCENE;
+    item.prog = &g_progGrid;
+    item.vertexSource = VTXSRC_GRID;
+    item.topology = GL_LINES;
+    item.count = GRIDDEF*4;
+    g_sceneQueue.push(makeSortKey(item.layer, g_progGrid.getSortId(), item.vertexSource, 0, 0.0f), item);
     ////////////////////////////////////////////////////////////////////////////////////
     // Display Meshes
-    // Note that we keep it too simple here: assuming pos + normals are at attr 0 & 1
+    // each Mesh uses the program of its attribute layout (getMeshProgram())
 	//
+    s_meshletsDrawn = 0;
+    s_meshletsCulled = 0;
+    s_trianglesDrawn = 0;
+    s_drawCalls = 0;
     if(meshFile)
     {
-        g_progMesh.enable();
-        vec3f lightDir(0.4,0.8,0.3);
-        lightDir.normalize();
-        g_progMesh.setUniform3f("lightDir", lightDir[0], lightDir[1], lightDir[2]);
-        mWVP.rotate(nv_to_rad*180.0, vec3f(0,1,0));
-        mWVP.scale(g_scale);
-	    mWVP.translate(-g_posOffset);
-        g_progMesh.setUniformMatrix4fv("mWVP", mWVP.mat_array, false);
-	    glEnableVertexAttribArray(0);
-	    glEnableVertexAttribArray(1);
-	    for(int i=0; i< meshFile->pMeshes->n; i++)
-	    {
-		    bk3d::Mesh *pMesh = meshFile->pMeshes->p[i];
+        computeEyeObjectSpace(packet.view, g_sceneQueue.eyeObj);
+        float pixelScale = packet.pixelScale;
+        static const float defaultDiffuse[3] = { 0.8f, 0.8f, 0.8f };
+        static const float occludedDiffuse[3] = { 1.0f, 0.0f, 0.0f };
+        int curMesh = -1;
+        int lod = 0;
+        int instances = 1;
+        float depth = 0.0f;
+        for(size_t v=0; v<packet.visibleList.size(); v++)
+        {
+            int i = g_pgItems[packet.visibleList[v]].first;
+            int pg = g_pgItems[packet.visibleList[v]].second;
+            bk3d::Mesh *pMesh = meshFile->pMeshes->p[i];
+            item.prog = ((MeshGL*)pMesh->userPtr)->prog;
+            if(!item.prog)
+                continue;
+            if(i != curMesh)
+            {
+                curMesh = i;
+                instances = getInstanceCount(i);
+                lod = 0;
+                if(s_bUseLods)
+                    lod = selectMeshLod(pMesh, g_sceneQueue.eyeObj, pixelScale);
+                // w in clip space of the bsphere center
+                const float *m = mWVP.mat_array;
+                const bk3d::Vec3Type &c = pMesh->bsphere.pos;
+                depth = m[3]*c.x + m[7]*c.y + m[11]*c.z + m[15];
+            }
+            bk3d::PrimGroup *pPG = pMesh->pPrimGroups->p[pg];
+            PrimGroupGL* pPGGL = (PrimGroupGL*)pPG->userPtr;
+            item.layer = LAYER_SCENE;
+            item.vertexSource = VTXSRC_MESH0 + i;
+            item.materialId = pPGGL->materialId;
+            item.diffuse = pPG->pMaterial ? pPG->pMaterial->MaterialData().diffuse : defaultDiffuse;
+            item.pPG = pPG;
+            item.ibo = pPGGL->ibo;
+            item.topology = pPG->topologyGL;
+            item.indexFormat = pPG->indexFormatGL;
+            item.instances = instances;
+            item.baseVertex = pPGGL->baseVertex;
+            bk3d::LodPool *pLods = pPGGL->pLods;
+            if(lod && pLods)
+            {
+                const bk3d::LodLevel &l = pLods->lod[(lod > (int)pLods->n ? pLods->n : lod) - 1];
+                item.type = DRAWITEM_ELEMENTS;
+                item.count = l.indexCount;
+                item.indexOffset = pPG->indexArrayByteSize + l.indexOffset * bk3d::formatGLComponentSize(pPG->indexFormatGL);
+            }
+            // the cones are in the space of the first instance
+            else if(s_bBackfaceCulling && s_bMeshletCulling && pPGGL->pMeshlets && (instances == 1))
+                item.type = DRAWITEM_MESHLETS;
+            else {
+                item.type = DRAWITEM_ELEMENTS;
+                item.count = pPG->indexCount;
+                item.indexOffset = 0;
+            }
+            g_sceneQueue.push(makeSortKey(item.layer, item.prog->getSortId(), item.vertexSource, item.materialId, depth), item);
+        }
+        // Hi-Z debug view : the PrimGroups that the occlusion culling skipped, in red wireframe on top
+        if(s_bHiZDebug)
+        {
+            for(size_t v=0; v<packet.occludedList.size(); v++)
+            {
+                int i = g_pgItems[packet.occludedList[v]].first;
+                item.prog = ((MeshGL*)meshFile->pMeshes->p[i]->userPtr)->prog;
+                if(!item.prog)
+                    continue;
+                bk3d::PrimGroup *pPG = meshFile->pMeshes->p[i]->pPrimGroups->p[g_pgItems[packet.occludedList[v]].second];
+                PrimGroupGL* pPGGL = (PrimGroupGL*)pPG->userPtr;
+                item.type = DRAWITEM_ELEMENTS;
+                item.layer = LAYER_OVERLAY;
+                item.vertexSource = VTXSRC_MESH0 + i;
+                item.materialId = MATERIAL_OVERLAY;
+                item.diffuse = occludedDiffuse;
+                item.ibo = pPGGL->ibo;
+                item.topology = pPG->topologyGL;
+                item.indexFormat = pPG->indexFormatGL;
+                item.count = pPG->indexCount;
+                item.indexOffset = 0;
+                item.instances = 1;
+                item.baseVertex = pPGGL->baseVertex;
+                g_sceneQueue.push(makeSortKey(item.layer, item.prog->getSortId(), item.vertexSource, item.materialId, 0.0f), item);
+            }
+        }
+    }
+    g_sceneQueue.sort();
+    submitRenderQueue(g_sceneQueue);
+}
 
-            bk3d::Attribute* pAttrPos = pMesh->pAttributes->p[0];
-		    glBindBuffer(GL_ARRAY_BUFFER, pMesh->pSlots->p[pAttrPos->slot]->userData);
-		    glVertexAttribPointer(0,
-			    pAttrPos->numComp, 
-			    pAttrPos->formatGL,
-                GL_FALSE,
-			    pAttrPos->strideBytes,
-			    (void*)pAttrPos->dataOffsetBytes);
-
-            bk3d::Attribute* pAttrN = pMesh->pAttributes->p[1];
-            if(pAttrN->slot != pAttrPos->slot)
-                glBindBuffer(GL_ARRAY_BUFFER, pMesh->pSlots->p[pAttrN->slot]->userData);
-		    glVertexAttribPointer(1, pAttrN->numComp,
-			    pAttrN->formatGL,
-                GL_TRUE,
-			    pAttrN->strideBytes,
-			    (void*)pAttrN->dataOffsetBytes);
-		    for(int pg=0; pg<pMesh->pPrimGroups->n; pg++)
-		    {
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (GLuint)pMesh->pPrimGroups->p[pg]->userPtr);
-			    bk3d::Material *pMat = pMesh->pPrimGroups->p[pg]->pMaterial;
-			    if(pMat)// && g_bUseMaterial)
-                    g_progMesh.setUniform3f("diffuse", pMat->MaterialData().diffuse[0], pMat->MaterialData().diffuse[1], pMat->MaterialData().diffuse[2]);
-			    else
-				    g_progMesh.setUniform3f("diffuse", 0.8, 0.8, 0.8);
-			    glDrawElements(
-				    pMesh->pPrimGroups->p[pg]->topologyGL,
-				    pMesh->pPrimGroups->p[pg]->indexCount,
-				    pMesh->pPrimGroups->p[pg]->indexFormatGL,
-				    NULL);
-		    }
-	    }
-	    glDisableVertexAttribArray(0);
-	    glDisableVertexAttribArray(1);
+//------------------------------------------------------------------------------
+// called when the camera animation looped during the F3 benchmark
+//------------------------------------------------------------------------------
+void endCameraBenchPass()
+{
+    if(s_camBenchFrames > 0)
+        LOGI("%s: %d frames; %.3f ms/frame; %.0f triangles/frame\n", s_bUseLods ? "LODs" : "no LOD",
+            s_camBenchFrames, s_camBenchMs / s_camBenchFrames, s_camBenchTris / s_camBenchFrames);
+    s_camBenchFrames = 0;
+    s_camBenchMs = 0.0;
+    s_camBenchTris = 0.0;
+    s_camBenchLastFrame = std::chrono::high_resolution_clock::now();
+    if(++s_camBenchPass == 1)
+        s_bUseLods = false;
+    else {
+        s_bUseLods = true;
+        s_camBenchPass = -1;
     }
 }
 
-void MyWindow::display()
+//------------------------------------------------------------------------------
+// hierarchy of the bones animated this frame, then the IK on top
+//------------------------------------------------------------------------------
+void updateTransforms()
 {
-    if(!m_validated)
-        return;
-    NXPROFILEFUNC(__FUNCTION__);
-    WindowInertiaCamera::display();
+    g_transforms.updateChanged(0);
+    g_ik.method = s_bIKFABRIK ? bk3d::IKMETHOD_FABRIK : bk3d::IKMETHOD_CCD;
+    if(s_bIK && !g_ik.chains.empty())
+    {
+        std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+        g_ik.solve(0);
+        s_ikMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count();
+        s_bIKSolved = true;
+        g_transforms.updateChanged(0);
+    }
+    else if(s_bIKSolved)
+    {
+        g_ik.restore();
+        s_bIKSolved = false;
+        g_transforms.updateChanged(0);
+    }
+}
+
+//------------------------------------------------------------------------------
+// the CPU work of a frame, for the job threads. The jobs split their own work with
+// bk3d::parallelFor(). The curves and the culling start at once; then :
+//  connections after both curves; transforms/IK and blendshapes after the connections;
+//  skinning after transforms/IK and blendshapes; the packet of the frame at the end
+//------------------------------------------------------------------------------
+void buildFrameGraph(bk3d::JobSystem &jobs, float animTime, FramePacket &packet)
+{
+    mat4f mWVP = packet.mWVP;
+    jobs.clear();
+    int curves = jobs.add("curves", [animTime]() { g_curveEval.evaluate(animTime, 0); });
+    int quatCurves = jobs.add("quaternion curves", [animTime]() { g_quatEval.evaluate(animTime, 0); });
+    int connections = jobs.add("connections", []() {
+        g_connections.run(0);
+        // only the subtrees of the animated bones
+        if(!g_connections.targetBones.empty())
+            g_transforms.markDirty(&g_connections.targetBones[0], (int)g_connections.targetBones.size());
+    });
+    jobs.depends(connections, curves);
+    jobs.depends(connections, quatCurves);
+    int transforms = jobs.add("transforms and IK", []() { updateTransforms(); });
+    jobs.depends(transforms, connections);
+    // the weights can be connected
+    int blendShapes = jobs.add("blendshapes", []() { updateBlendShapes(); });
+    jobs.depends(blendShapes, connections);
+    int skinning = jobs.add("skinning", []() { updateSkinnedMeshes(); });
+    jobs.depends(skinning, transforms);
+    jobs.depends(skinning, blendShapes);
+    int culling = jobs.add("culling", [mWVP]() { cullScene(mWVP); });
+    FramePacket *pPacket = &packet;
+    int publish = jobs.add("frame packet", [pPacket]() { publishFramePacket(*pPacket); });
+    jobs.depends(publish, skinning);
+    jobs.depends(publish, culling);
+}
+
+//------------------------------------------------------------------------------
+// the simulation of the next frame in a free packet : camera, animation time and the frame
+// graph kicked on the job threads. Nothing of the simulation is in flight : the Hi-Z readback
+// can be fetched
+//------------------------------------------------------------------------------
+void MyWindow::startSimulation()
+{
+    int p = m_pipeline.freePacket();
+    FramePacket &packet = m_pipeline.packets[p];
+    packet.frame = m_pipeline.nextFrame++;
     //
     // Simple camera change for animation
     //
@@ -965,9 +3374,102 @@ void MyWindow::display()
           m_camera.look_at(s_cameraAnim[s_cameraAnimItem].eye, s_cameraAnim[s_cameraAnimItem].focus);
           s_cameraAnimItem++;
           if(s_cameraAnimItem >= s_cameraAnimItems)
+          {
               s_cameraAnimItem = 0;
+              if(s_camBenchPass >= 0)
+                  endCameraBenchPass();
+          }
       }
     }
+    std::chrono::high_resolution_clock::time_point tNow = std::chrono::high_resolution_clock::now();
+    s_animTime += std::chrono::duration<float>(tNow - s_animLastFrame).count();
+    s_animLastFrame = tNow;
+    if(s_bHiZCulling)
+        fetchHiZReadback();
+    getSceneMatrices(packet.mVP, packet.mWVP);
+    packet.view = m_camera.m4_view;
+    packet.pixelScale = m_projection.mat_array[5] * (float)m_winSz[1] * 0.5f;
+    buildFrameGraph(m_jobs, s_animTime, packet);
+    m_jobs.kick();
+    m_pipeline.simulating = p;
+}
+
+//------------------------------------------------------------------------------
+// waits for the simulation in flight, if any : its packet is ready to be rendered. Before
+// anything changes what the jobs read (keys...)
+//------------------------------------------------------------------------------
+void MyWindow::finishSimulation()
+{
+    if(m_pipeline.simulating < 0)
+        return;
+    m_jobs.wait();
+    m_pipeline.ready.push_back(m_pipeline.simulating);
+    m_pipeline.simulating = -1;
+    s_jobFrames++;
+    s_jobFrameMs += m_jobs.frameMs;
+    s_jobCriticalMs += m_jobs.criticalMs;
+    s_jobUtilization += m_jobs.utilization;
+}
+
+//------------------------------------------------------------------------------
+// nothing in flight nor waiting : before the keys change the scene, its buffers or the modes.
+// The uploads of the packets are kept, the next display() simulates again
+//------------------------------------------------------------------------------
+void MyWindow::flushPipeline()
+{
+    finishSimulation();
+    while(!m_pipeline.ready.empty())
+    {
+        uploadFramePacket(m_pipeline.packets[m_pipeline.ready.front()]);
+        m_pipeline.ready.pop_front();
+    }
+}
+
+void MyWindow::display()
+{
+    if(!m_validated)
+        return;
+    NXPROFILEFUNC(__FUNCTION__);
+    WindowInertiaCamera::display();
+    //
+    // streamed data of this frame : resolve parameters and quad
+    //
+    g_ring.beginFrame();
+    s_stateChanges = 0;
+    s_stateChangesAvoided = 0;
+    ResolveData resolveData = { { (int)fboSz[0], (int)fboSz[1], 0, 0 } };
+    g_ring.bindUniforms(UBO_RESOLVE, &resolveData, sizeof(ResolveData));
+    int quad[2*4] = { 0,0, (int)fboSz[0],0, 0,(int)fboSz[1], (int)fboSz[0],(int)fboSz[1] };
+    void *pQuad = g_ring.alloc(sizeof(quad), sizeof(int), &g_quadOffset);
+    if(pQuad)
+        memcpy(pQuad, quad, sizeof(quad));
+    glBindVertexArray(g_vaoQuad);
+    glBindVertexBuffer(0, g_ring.buffer, g_quadOffset, sizeof(int)*2);
+    glBindVertexArray(0);
+    //
+    // Animation, skinning and culling : the frame graph on the job threads. With a depth > 0,
+    // the simulation of the next frame runs while this one gets rendered from its packet
+    //
+    finishSimulation();
+    int want = m_pipeline.depth > 0 ? m_pipeline.depth : 1;
+    // the depth got smaller : the oldest packets are skipped, but their uploads are deltas
+    while((int)m_pipeline.ready.size() > want)
+    {
+        uploadFramePacket(m_pipeline.packets[m_pipeline.ready.front()]);
+        m_pipeline.ready.pop_front();
+    }
+    // first frames, or the depth got bigger : the pipeline gets filled
+    while((int)m_pipeline.ready.size() < want)
+    {
+        startSimulation();
+        finishSimulation();
+    }
+    m_pipeline.rendering = m_pipeline.ready.front();
+    m_pipeline.ready.pop_front();
+    const FramePacket &packet = m_pipeline.packets[m_pipeline.rendering];
+    if(m_pipeline.depth > 0)
+        startSimulation();
+    uploadFramePacket(packet);
 
     GLuint fbo;
     switch(fboMode)
@@ -990,10 +3492,48 @@ void MyWindow::display()
     {
         glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
         glEnable(GL_DEPTH_TEST);
-        renderScene();
+        if(s_bBackfaceCulling)
+            glEnable(GL_CULL_FACE);
+        renderScene(packet);
+        glDisable(GL_CULL_FACE);
+    }
+    if(s_bHiZCulling || s_bHiZDebug)
+        buildHiZPyramid((fboMode == RENDERTOTEXMS) || (fboMode == RENDERTORBMS), packet.mWVP);
+    if(s_stressFrames > 0)
+    {
+        static std::chrono::high_resolution_clock::time_point s_last;
+        std::chrono::high_resolution_clock::time_point t = std::chrono::high_resolution_clock::now();
+        if(s_stressFrames < 100) // the first frame after the change is not measured
+            s_stressMs += std::chrono::duration<double, std::milli>(t - s_last).count();
+        s_last = t;
+        if(--s_stressFrames == 0)
+        {
+            int instances = 0;
+            for(int i=0; i< meshFile->pMeshes->n; i++)
+                instances += getInstanceCount(i);
+            LOGI("%d instances (all Meshes): %.3f ms/frame; %d draw calls; %.2f M triangles/frame\n",
+                instances, s_stressMs / 99.0, s_drawCalls, (double)s_trianglesDrawn / 1e6);
+        }
+    }
+    if(s_camBenchPass >= 0)
+    {
+        std::chrono::high_resolution_clock::time_point t = std::chrono::high_resolution_clock::now();
+        s_camBenchMs += std::chrono::duration<double, std::milli>(t - s_camBenchLastFrame).count();
+        s_camBenchLastFrame = t;
+        s_camBenchTris += s_trianglesDrawn;
+        s_camBenchFrames++;
     }
     // Done. Back to the backbuffer
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    g_resolveQueue.clear();
+    DrawItem resolveItem;
+    memset(&resolveItem, 0, sizeof(DrawItem));
+    resolveItem.type = DRAWITEM_ARRAYS;
+    resolveItem.layer = LAYER_RESOLVE;
+    resolveItem.vertexSource = VTXSRC_QUAD;
+    resolveItem.materialId = 1;
+    resolveItem.topology = GL_TRIANGLE_STRIP;
+    resolveItem.count = 4;
     switch(blitMode)
     {
     case RESOLVEWITHBLIT:
@@ -1003,62 +3543,49 @@ void MyWindow::display()
     case RESOLVEWITHSHADERTEX:
         if(fboMode == RENDERTOTEXMS)
         {
-            g_progCopyTexMSAA.enable();
-            g_progCopyTexMSAA.setUniform2i("viewportSz", m_winSz[0], m_winSz[1]);
-            g_progCopyTexMSAA.bindTexture("samplerMS", textureRGBAMS, GL_TEXTURE_2D_MULTISAMPLE, 0);
-            glBindBuffer(GL_ARRAY_BUFFER, g_vboQuad);
-            glEnableVertexAttribArray(0);
-            glVertexAttribIPointer(0, 2, GL_INT, sizeof(int)*2, NULL);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glDisableVertexAttribArray(0);
+            resolveItem.prog = &g_progCopyTexMSAA;
+            resolveItem.texName = "samplerMS";
+            resolveItem.tex = textureRGBAMS;
+            resolveItem.texTarget = GL_TEXTURE_2D_MULTISAMPLE;
         }
         else if(fboMode == RENDERTOTEX)
         {
-            g_progCopyTex.enable();
-            g_progCopyTex.setUniform2i("viewportSz", m_winSz[0], m_winSz[1]);
-            g_progCopyTex.bindTexture("s", textureRGBA, GL_TEXTURE_2D, 0);
-            glBindBuffer(GL_ARRAY_BUFFER, g_vboQuad);
-            glEnableVertexAttribArray(0);
-            glVertexAttribIPointer(0, 2, GL_INT, sizeof(int)*2, NULL);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glDisableVertexAttribArray(0);
+            resolveItem.prog = &g_progCopyTex;
+            resolveItem.texName = "s";
+            resolveItem.tex = textureRGBA;
+            resolveItem.texTarget = GL_TEXTURE_2D;
         }
         break;
     case RESOLVEWITHSHADERIMAGE:
         if((fboMode == RENDERTOTEXMS)&&(g_progCopyImageMSAA.getProgId()))
         {
-            g_progCopyImageMSAA.enable();
-            g_progCopyImageMSAA.setUniform2i("viewportSz", m_winSz[0], m_winSz[1]);
-            g_progCopyImageMSAA.bindImage("imageMS", 0, textureRGBAMS, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-            glBindBuffer(GL_ARRAY_BUFFER, g_vboQuad);
-            glEnableVertexAttribArray(0);
-            glVertexAttribIPointer(0, 2, GL_INT, sizeof(int)*2, NULL);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glDisableVertexAttribArray(0);
+            resolveItem.prog = &g_progCopyImageMSAA;
+            resolveItem.texName = "imageMS";
+            resolveItem.tex = textureRGBAMS;
+            resolveItem.bImage = true;
         }
         else if((fboMode == RENDERTOTEX)&&(g_progCopyImage.getProgId()))
         {
-            g_progCopyImage.enable();
-            g_progCopyImage.setUniform2i("viewportSz", m_winSz[0], m_winSz[1]);
-            g_progCopyImage.bindImage("image", 0, textureRGBA, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-            glBindBuffer(GL_ARRAY_BUFFER, g_vboQuad);
-            glEnableVertexAttribArray(0);
-            glVertexAttribIPointer(0, 2, GL_INT, sizeof(int)*2, NULL);
-            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
-            glDisableVertexAttribArray(0);
+            resolveItem.prog = &g_progCopyImage;
+            resolveItem.texName = "image";
+            resolveItem.tex = textureRGBA;
+            resolveItem.bImage = true;
         }
         break;
     }
+    if(resolveItem.prog)
+    {
+        g_resolveQueue.push(makeSortKey(resolveItem.layer, resolveItem.prog->getSortId(), resolveItem.vertexSource, resolveItem.materialId, 0.0f), resolveItem);
+        submitRenderQueue(g_resolveQueue);
+    }
 
     ///////////////////////////////////////////////
     // additional HUD stuff
 	WindowInertiaCamera::displayHUD();
 
+    g_ring.endFrame();
     swapBuffers();
+    m_pipeline.rendering = -1;
 }
 /////////////////////////////////////////////////////////////////////////
 // Main initialization point
@@ -1070,7 +3597,7 @@ int sample_main(int argc, const char** argv)
 
     NVPWindow::ContextFlags context(
     4,      //major;
-    3,      //minor;
+    4,      //minor; 4.4 for glBufferStorage (FrameRingBuffer)
     true,   //core;
     8,      //MSAA;
     24,     //depth bits
@@ -0,0 +1,149 @@
+#pragma once
+/*-----------------------------------------------------------------------
+    Copyright (c) 2013, Tristan Lorach. All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions
+    are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of its contributors may be used to endorse
+       or promote products derived from this software without specific
+       prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+    PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+    CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+    EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+    PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+    OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    feedback to lorachnroll@gmail.com (Tristan Lorach)
+
+ ** Checks and benchmarks of the bk3d headers, without GL nor a model :
+ ** synthetic data from one random generator, timings from one timer
+ **/
+#ifndef __BK3DTEST__
+#define __BK3DTEST__
+// what the sample includes before the bk3d headers
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "bk3dEx.h"
+#include "bk3dMeshUtils.h"
+#include "bk3dParallel.h"
+#include "bk3dAnimation.h"
+#include "bk3dTransforms.h"
+#include "bk3dSkinning.h"
+#include "bk3dBlendShapes.h"
+#include "bk3dIK.h"
+
+namespace bk3dTest
+{
+//------------------------------------------------------------------------------------------
+/// \brief the same sequence on every platform (rand() isn't) : a test fails the same way
+/// everywhere. Each test starts its own from a fixed seed
+//------------------------------------------------------------------------------------------
+struct Random
+{
+    unsigned int state;
+    Random(unsigned int seed = 1) : state(seed) {}
+    unsigned int next()
+    {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    }
+    /// [0,1]
+    float f() { return (float)next() / (float)0xFFFFFF; }
+    /// [a,b]
+    float f(float a, float b) { return a + (b - a) * f(); }
+    /// [0,n)
+    int i(int n) { return (int)(next() % (unsigned int)n); }
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief milliseconds since the construction or the last restart()
+//------------------------------------------------------------------------------------------
+struct Timer
+{
+    std::chrono::high_resolution_clock::time_point t0;
+    Timer() { restart(); }
+    void restart() { t0 = std::chrono::high_resolution_clock::now(); }
+    double ms() const { return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t0).count(); }
+};
+
+//------------------------------------------------------------------------------------------
+/// \brief a test of the runner (see main.cpp). With -bench, the sizes get those of a
+/// benchmark and the timings are printed; the checks stay the same
+//------------------------------------------------------------------------------------------
+typedef void (*TestFunc)();
+struct Test
+{
+    const char  *group;     ///< what ctest runs : one group per header
+    const char  *name;
+    TestFunc    func;
+};
+inline std::vector<Test>& tests()
+{
+    static std::vector<Test> t;
+    return t;
+}
+struct TestRegistrar
+{
+    TestRegistrar(const char *group, const char *name, TestFunc func)
+    {
+        Test t = { group, name, func };
+        tests().push_back(t);
+    }
+};
+inline bool& benchMode()
+{
+    static bool b = false;
+    return b;
+}
+/// small for the checks, big for the benchmarks
+inline int size(int check, int bench) { return benchMode() ? bench : check; }
+inline int& failures()
+{
+    static int n = 0;
+    return n;
+}
+/// the max of |a[i] - b[i]|
+inline float maxError(const float *a, const float *b, size_t n)
+{
+    float e = 0.0f;
+    for(size_t i=0; i<n; i++)
+        e = std::max(e, fabsf(a[i] - b[i]));
+    return e;
+}
+
+} //namespace bk3dTest
+
+#define BK3D_TEST(group, name) \
+    static void test_##group##_##name(); \
+    static bk3dTest::TestRegistrar s_reg_##group##_##name(#group, #name, test_##group##_##name); \
+    static void test_##group##_##name()
+
+/// a failure is reported and counted; the test goes on
+#define BK3D_CHECK(cond, ...) \
+    do { if(!(cond)) { \
+        bk3dTest::failures()++; \
+        printf("  FAILED %s:%d : %s : ", __FILE__, __LINE__, #cond); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+    } } while(0)
+
+/// timings only in -bench
+#define BK3D_BENCH(...) do { if(bk3dTest::benchMode()) printf(__VA_ARGS__); } while(0)
+
+#endif //__BK3DTEST__
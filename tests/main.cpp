@@ -0,0 +1,34 @@
+//------------------------------------------------------------------------------
+// bk3d_tests [-bench] [group or test...]
+// runs the tests of the groups/names given (all of them without), returns the failures
+//------------------------------------------------------------------------------
+#include "bk3dTest.h"
+
+int main(int argc, char **argv)
+{
+    std::vector<const char*> filters;
+    for(int a=1; a<argc; a++)
+    {
+        if(!strcmp(argv[a], "-bench"))
+            bk3dTest::benchMode() = true;
+        else
+            filters.push_back(argv[a]);
+    }
+    int nRun = 0;
+    const std::vector<bk3dTest::Test> &tests = bk3dTest::tests();
+    for(size_t t=0; t<tests.size(); t++)
+    {
+        bool bRun = filters.empty();
+        for(size_t f=0; f<filters.size(); f++)
+            bRun |= !strcmp(filters[f], tests[t].group) || !strcmp(filters[f], tests[t].name);
+        if(!bRun)
+            continue;
+        int failures = bk3dTest::failures();
+        printf("%s.%s\n", tests[t].group, tests[t].name);
+        tests[t].func();
+        printf("  %s\n", bk3dTest::failures() == failures ? "ok" : "FAILED");
+        nRun++;
+    }
+    printf("%d tests, %d failed checks\n", nRun, bk3dTest::failures());
+    return (nRun == 0) || (bk3dTest::failures() > 0) ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+//------------------------------------------------------------------------------
+// bk3dAnimation.h : the batch evaluators against the reference evaluation of one curve
+//------------------------------------------------------------------------------
+#include "bk3dTest.h"
+
+//------------------------------------------------------------------------------
+// random curves (all the tangent and infinity types, 1/4 weighted) evaluated during a
+// playback, against bk3d::evaluateMayaCurve() one curve at a time
+//------------------------------------------------------------------------------
+BK3D_TEST(animation, mayaCurves)
+{
+    const int nCurves = bk3dTest::size(10000, 100000);
+    const int nFrames = 240;
+    const bk3d::EtTangentType tangents[] = { bk3d::kTangentSmooth, bk3d::kTangentLinear, bk3d::kTangentFlat,
+        bk3d::kTangentStep, bk3d::kTangentStepNext, bk3d::kTangentClamped };
+    const bk3d::EtInfinityType infinities[] = { bk3d::kInfinityConstant, bk3d::kInfinityLinear, bk3d::kInfinityCycle,
+        bk3d::kInfinityCycleRelative, bk3d::kInfinityOscillate };
+    bk3dTest::Random rnd;
+    std::vector<std::vector<char> > storage(nCurves);
+    std::vector<bk3d::MayaCurve*> pCurves(nCurves);
+    std::vector<float> targets(nCurves);
+    bk3d::MayaCurveEvaluator eval;
+    for(int c=0; c<nCurves; c++)
+    {
+        int nKeys = 1 + rnd.i(16);
+        storage[c].resize(sizeof(bk3d::MayaCurve) + nKeys * sizeof(bk3d::MayaReadKey));
+        bk3d::MayaCurve *pC = new(&storage[c][0]) bk3d::MayaCurve;
+        pC->nKeys = nKeys;
+        pC->isWeighted = rnd.i(4) == 0;
+        pC->preInfinity = infinities[rnd.i(5)];
+        pC->postInfinity = infinities[rnd.i(5)];
+        float t = 0.0f;
+        for(int k=0; k<nKeys; k++)
+        {
+            bk3d::MayaReadKey &key = pC->key[k];
+            key.time = t;
+            t += rnd.f(0.1f, 0.6f);
+            key.value = rnd.f(-5.0f, 5.0f);
+            key.inTangentType = key.outTangentType = tangents[rnd.i(6)];
+            key.inAngle = rnd.f(-1.0f, 1.0f);
+            key.outAngle = rnd.f(-1.0f, 1.0f);
+            key.inWeight = rnd.f(0.0f, 0.6f);
+            key.outWeight = rnd.f(0.0f, 0.6f);
+        }
+        pCurves[c] = pC;
+        // 1 curve in 8 without a destination : MayaCurve::fOut only
+        eval.addCurve(pC, (c % 8) ? &targets[c] : NULL);
+    }
+    // playback from before the first keys to after the last ones, to go through the infinities
+    double ms[3];
+    for(int pass=0; pass<3; pass++)
+    {
+        bk3dTest::Timer timer;
+        for(int f=0; f<nFrames; f++)
+        {
+            float time = -2.0f + (float)f / 24.0f;
+            if(pass == 0)
+                for(int c=0; c<nCurves; c++)
+                    targets[c] = bk3d::evaluateMayaCurve(pCurves[c], time);
+            else
+                eval.evaluate(time, pass == 1 ? 1 : 0);
+        }
+        ms[pass] = timer.ms();
+    }
+    float maxErr = 0.0f;
+    for(int f=0; f<nFrames; f+=10)
+    {
+        float time = -2.0f + (float)f / 24.0f;
+        eval.evaluate(time, 0);
+        for(int c=0; c<nCurves; c++)
+        {
+            float ref = bk3d::evaluateMayaCurve(pCurves[c], time);
+            maxErr = std::max(maxErr, fabsf(pCurves[c]->fOut - ref));
+            if(c % 8)
+                maxErr = std::max(maxErr, fabsf(targets[c] - ref));
+        }
+    }
+    BK3D_BENCH("  %d curves, %d frames : reference %.1f ns/curve; batch %.1f ns/curve; batch on %d threads %.1f ns/curve\n",
+        nCurves, nFrames, ms[0] * 1e6 / (nCurves * nFrames), ms[1] * 1e6 / (nCurves * nFrames),
+        bk3d::getNumWorkerThreads(), ms[2] * 1e6 / (nCurves * nFrames));
+    BK3D_CHECK(maxErr < 1e-3f, "batch evaluation off by %g", maxErr);
+}
+
+//------------------------------------------------------------------------------
+// random QuatCurves evaluated during a playback with each interpolation mode, against the
+// double precision slerp of bk3d::evaluateQuatCurve()
+//------------------------------------------------------------------------------
+BK3D_TEST(animation, quatCurves)
+{
+    const int nCurves = bk3dTest::size(10000, 100000);
+    const int nFrames = 240;
+    const char *modeNames[] = { "nlerp", "fast slerp", "slerp" };
+    // nlerp only approximates the angle
+    const float tolerances[] = { 0.2f, 1e-2f, 1e-3f };
+    bk3dTest::Random rnd;
+    std::vector<std::vector<char> > storage(nCurves);
+    std::vector<bk3d::QuatCurve*> pCurves(nCurves);
+    std::vector<float> targets(nCurves * 4);
+    bk3d::QuatCurveEvaluator eval;
+    for(int c=0; c<nCurves; c++)
+    {
+        int nKeys = 1 + rnd.i(16);
+        storage[c].resize(sizeof(bk3d::QuatCurve) + nKeys * sizeof(bk3d::QuatReadKey));
+        bk3d::QuatCurve *pC = new(&storage[c][0]) bk3d::QuatCurve;
+        pC->nKeys = nKeys;
+        float t = 0.0f;
+        for(int k=0; k<nKeys; k++)
+        {
+            bk3d::QuatReadKey &key = pC->key[k];
+            key.time = t;
+            t += rnd.f(0.05f, 0.55f);
+            float len2 = 0.0f;
+            for(int j=0; j<4; j++)
+            {
+                key.value[j] = rnd.f(-1.0f, 1.0f);
+                len2 += key.value[j] * key.value[j];
+            }
+            for(int j=0; j<4; j++)
+                key.value[j] /= sqrtf(len2);
+        }
+        pCurves[c] = pC;
+        eval.addCurve(pC, &targets[c * 4]);
+    }
+    bk3dTest::Timer timer;
+    for(int f=0; f<nFrames; f++)
+        for(int c=0; c<nCurves; c++)
+            bk3d::evaluateQuatCurve(pCurves[c], -1.0f + (float)f / 24.0f, &targets[c * 4]);
+    BK3D_BENCH("  %d QuatCurves, %d frames : reference %.1f ns/curve\n", nCurves, nFrames, timer.ms() * 1e6 / (nCurves * nFrames));
+    for(int m=bk3d::QUATINTERP_NLERP; m<=bk3d::QUATINTERP_SLERP; m++)
+    {
+        eval.mode = (bk3d::QuatInterpolation)m;
+        double ms[2];
+        for(int pass=0; pass<2; pass++)
+        {
+            timer.restart();
+            for(int f=0; f<nFrames; f++)
+                eval.evaluate(-1.0f + (float)f / 24.0f, pass == 0 ? 1 : 0);
+            ms[pass] = timer.ms();
+        }
+        // error as the angle between the rotations : 2 * |q - ref| for small errors, q and -q being the same
+        float maxErr = 0.0f;
+        for(int f=0; f<nFrames; f+=10)
+        {
+            float time = -1.0f + (float)f / 24.0f;
+            eval.evaluate(time, 0);
+            for(int c=0; c<nCurves; c++)
+            {
+                float q[4], dm = 0.0f, dp = 0.0f;
+                bk3d::evaluateQuatCurve(pCurves[c], time, q);
+                for(int j=0; j<4; j++)
+                {
+                    dm += (q[j] - targets[c*4+j]) * (q[j] - targets[c*4+j]);
+                    dp += (q[j] + targets[c*4+j]) * (q[j] + targets[c*4+j]);
+                }
+                maxErr = std::max(maxErr, 2.0f * sqrtf(std::min(dm, dp)));
+            }
+        }
+        BK3D_BENCH("  %-10s : %.1f ns/curve; on %d threads %.1f ns/curve; max error %g rad\n", modeNames[m],
+            ms[0] * 1e6 / (nCurves * nFrames), bk3d::getNumWorkerThreads(), ms[1] * 1e6 / (nCurves * nFrames), maxErr);
+        BK3D_CHECK(maxErr < tolerances[m], "%s off by %g rad", modeNames[m], maxErr);
+    }
+}
+
+//------------------------------------------------------------------------------
+// ConnectionGraph on 2 bones : a connection by destName whose pfTarget holds garbage (it
+// shares its bytes with ival[] in the file), and one given with setTarget(). Both write
+// their bone and make it dirty, and both bones are in targetBones
+//------------------------------------------------------------------------------
+BK3D_TEST(animation, connections)
+{
+    const int nBones = 2;
+    std::vector<char> headerMem(sizeof(bk3d::FileHeader), 0);
+    std::vector<char> poolMem(sizeof(bk3d::TransformPool) + nBones * sizeof(bk3d::Ptr64<bk3d::Bone>), 0);
+    bk3d::FileHeader *pH = (bk3d::FileHeader*)&headerMem[0];
+    bk3d::TransformPool *pPool = new(&poolMem[0]) bk3d::TransformPool;
+    pPool->nBones = nBones;
+    pH->pTransforms = pPool;
+    bk3d::TransformSimple bones[nBones];
+    bk3d::BoneDataType data[nBones];
+    bk3d::MatrixType matAbs[nBones];
+    const char *names[nBones] = { "hip", "knee" };
+    for(int b=0; b<nBones; b++)
+    {
+        bones[b].init();
+        strcpy(bones[b].name, names[b]);
+        bones[b].ID = b;
+        bones[b].pBoneData = &data[b];
+        bones[b].pMatrixAbs = &matAbs[b];
+        bones[b].parentPool = pPool;
+        data[b].init();
+        data[b].bDirty = 0;
+        pPool->pBones[b] = &bones[b];
+    }
+    // the sources : 3 floats each
+    std::vector<char> srcMem[2];
+    bk3d::FloatArray *pSrc[2];
+    for(int s=0; s<2; s++)
+    {
+        srcMem[s].assign(sizeof(bk3d::FloatArray) + 3 * sizeof(float), 0);
+        pSrc[s] = new(&srcMem[s][0]) bk3d::FloatArray;
+        pSrc[s]->dim = 3;
+        for(int c=0; c<3; c++)
+            pSrc[s]->f[c] = (float)(s * 10 + c + 1);
+    }
+    // the connections, in the FloatArrayPool of the first bone
+    std::vector<char> cnMem(sizeof(bk3d::FloatArrayPool) + 2 * sizeof(bk3d::FloatArrayPool::Connection), 0);
+    bk3d::FloatArrayPool *pCns = (bk3d::FloatArrayPool*)&cnMem[0];
+    pCns->n = 2;
+    strcpy(pCns->p[0].destName, "knee_translate");
+    pCns->p[0].p = pSrc[0];
+    pCns->p[0].ival[0] = 0x1234;
+    pCns->p[0].ival[1] = 0x5678;
+    strcpy(pCns->p[1].destName, "unknown");
+    pCns->p[1].p = pSrc[1];
+    bones[0].pFloatArrays = pCns;
+    float hipTarget[3] = { 0, 0, 0 };
+
+    bk3d::ConnectionGraph graph;
+    graph.setTarget(&pCns->p[1], hipTarget, &bones[0]);
+    int n = graph.compile(pH);
+    BK3D_CHECK((n == 2) && (graph.nUnresolved == 0), "%d ops, %d unresolved", n, graph.nUnresolved);
+    graph.run(1);
+    const float *knee = bones[1].Pos();
+    for(int c=0; c<3; c++)
+    {
+        BK3D_CHECK(knee[c] == pSrc[0]->f[c], "knee_translate[%d] is %g", c, knee[c]);
+        BK3D_CHECK(hipTarget[c] == pSrc[1]->f[c], "setTarget()[%d] is %g", c, hipTarget[c]);
+    }
+    BK3D_CHECK(data[0].bDirty && data[1].bDirty, "bones not dirty : %d %d", data[0].bDirty, data[1].bDirty);
+    BK3D_CHECK((graph.targetBones.size() == 2) && (graph.targetBones[0] == 0) && (graph.targetBones[1] == 1),
+        "%d target bones", (int)graph.targetBones.size());
+}
@@ -0,0 +1,72 @@
+//------------------------------------------------------------------------------
+// bk3dBlendShapes.h : the SIMD paths and the threads against the scalar blending
+//------------------------------------------------------------------------------
+#include "bk3dTest.h"
+
+//------------------------------------------------------------------------------
+// a synthetic facial rig : 150 Blendshapes (5 of all the vertices, the others sparse on
+// 10% of them), with a third then all of them weighted. Scalar, SSE2 and AVX on 1 thread,
+// then the best one on all the threads
+//------------------------------------------------------------------------------
+BK3D_TEST(blendshapes, simd)
+{
+    const int n = bk3dTest::size(5000, 20000);
+    const int nShapes = 150;
+    const int nFrames = bk3dTest::size(1, 20);
+    bk3dTest::Random rnd;
+    bk3d::BlendShapeMesh blend;
+    blend.nVertices = n;
+    blend.bHasNormals = true;
+    blend.base.resize(n * 6);
+    for(int v=0; v<n; v++)
+        for(int c=0; c<3; c++)
+        {
+            blend.base[v * 6 + c] = rnd.f(-1.0f, 1.0f);
+            blend.base[v * 6 + 3 + c] = rnd.f() - 0.5f;
+        }
+    blend.shapes.resize(nShapes);
+    blend.weights.resize(nShapes);
+    for(int s=0; s<nShapes; s++)
+    {
+        bk3d::BlendShape &bs = blend.shapes[s];
+        bs.weightId = s;
+        if(s >= 5)
+            for(int v=0; v<n; v++)
+                if(rnd.i(10) == 0)
+                    bs.vertexIds.push_back(v);
+        bs.deltas.resize((bs.vertexIds.empty() ? n : bs.vertexIds.size()) * 6);
+        for(size_t d=0; d<bs.deltas.size(); d++)
+            bs.deltas[d] = 0.1f * (rnd.f() - 0.5f);
+    }
+    std::vector<float> ref(n * 6), out(n * 6);
+    const char *names[] = { "scalar", "SSE2", "AVX" };
+    int best = (int)bk3d::getBestBlendShapeSIMD();
+    int nRanges = (n + BK3D_BLENDRANGE - 1) / BK3D_BLENDRANGE;
+    for(int w=0; w<2; w++)
+    {
+        blend.active.clear();
+        for(int s=0; s<nShapes; s++)
+        {
+            blend.weights[s] = ((w == 1) || (s % 3 == 0)) ? rnd.f() : 0.0f;
+            if(blend.weights[s] != 0.0f)
+                blend.active.push_back(s);
+        }
+        for(int mode=0; mode<=best+1; mode++)
+        {
+            bk3d::BlendShapeSIMD simd = (bk3d::BlendShapeSIMD)(mode <= best ? mode : best);
+            int threads = mode <= best ? 1 : 0;
+            std::vector<float> &dst = mode == 0 ? ref : out;
+            bk3dTest::Timer timer;
+            for(int f=0; f<nFrames; f++)
+                bk3d::parallelFor(nRanges, [&](int r) {
+                    int v0 = r * BK3D_BLENDRANGE;
+                    blend.blendRange(v0, std::min(n, v0 + BK3D_BLENDRANGE), &dst[v0 * 6], simd);
+                }, threads);
+            double ms = timer.ms() / nFrames;
+            float maxErr = mode ? bk3dTest::maxError(&out[0], &ref[0], n * 6) : 0.0f;
+            BK3D_BENCH("  %d vertices, %d/%d shapes weighted, %s, %d threads : %.3f ms\n", n,
+                (int)blend.active.size(), nShapes, names[simd], threads ? 1 : bk3d::getNumWorkerThreads(), ms);
+            BK3D_CHECK(maxErr < 1e-4f, "%s blendshapes don't match the scalar ones (%g)", names[simd], maxErr);
+        }
+    }
+}
@@ -0,0 +1,237 @@
+//------------------------------------------------------------------------------
+// bk3dIK.h : CCD and FABRIK on synthetic rigs, free then limited
+//------------------------------------------------------------------------------
+#include "bk3dTest.h"
+
+//------------------------------------------------------------------------------
+// characters made of a root and of chains of joints of length 1 along X, each chain with
+// its IKHandle under the root at a reachable target. With limits, the first joint of a
+// chain is in a cone and the others are hinges
+//------------------------------------------------------------------------------
+struct SyntheticIKRig
+{
+    std::vector<char>                   poolMem, handlePoolMem, effectorMem, weightMem;
+    std::vector<bk3d::TransformSimple>  bones;
+    std::vector<bk3d::IKHandle>         handles;
+    std::vector<bk3d::IKHandleData>     handleData;
+    std::vector<bk3d::TransformDOF>     dofs;
+    std::vector<bk3d::BoneDataType>     data;
+    std::vector<bk3d::MatrixType>       matAbs;
+    bk3d::TransformPool*                pPool;
+    bk3d::IKHandlePool*                 pHandles;
+
+    void build(int nChars, int nChains, int nJoints, bool bLimits, bk3dTest::Random &rnd)
+    {
+        int perChar = 1 + nChains * nJoints;
+        int nb = nChars * perChar;
+        int nh = nChars * nChains;
+        int n = nb + nh;
+        poolMem.assign(sizeof(bk3d::TransformPool) + n * sizeof(bk3d::Ptr64<bk3d::Bone>), 0);
+        pPool = new(&poolMem[0]) bk3d::TransformPool;
+        pPool->nBones = n;
+        bones.resize(nb);
+        handles.resize(nh);
+        handleData.resize(nh);
+        dofs.resize(nb);
+        data.resize(n);
+        matAbs.resize(n);
+        pPool->tableBoneData = &data[0];
+        pPool->tableMatrixAbs = &matAbs[0];
+        handlePoolMem.assign(sizeof(bk3d::IKHandlePool) + nh * sizeof(bk3d::Ptr64<bk3d::IKHandle>), 0);
+        pHandles = new(&handlePoolMem[0]) bk3d::IKHandlePool;
+        pHandles->n = nh;
+        size_t effStride = sizeof(bk3d::TransformPool2) + nJoints * sizeof(bk3d::Ptr64<bk3d::Bone>);
+        size_t weightStride = (sizeof(bk3d::FloatPool) + nJoints * sizeof(float) + 7) & ~7;
+        effectorMem.assign(nh * effStride, 0);
+        weightMem.assign(nh * weightStride, 0);
+        for(int i=0; i<n; i++)
+        {
+            bk3d::Bone *pB;
+            if(i < nb)
+            {
+                bk3d::TransformSimple &b = bones[i];
+                b.init();
+                b.scale.x = b.scale.y = b.scale.z = 1.0f;
+                pB = &b;
+            } else {
+                handles[i - nb].init();
+                pB = &handles[i - nb];
+            }
+            pB->ID = i;
+            pB->pBoneData = &data[i];
+            pB->pMatrixAbs = &matAbs[i];
+            pB->parentPool = pPool;
+            data[i].init();
+            pPool->pBones[i] = pB;
+        }
+        for(int ch=0; ch<nChars; ch++)
+        {
+            int root = ch * perChar;
+            bk3d::BoneDataType &dr = data[root];
+            dr.validComps = TRANSFCOMP_pos|TRANSFCOMP_Quat|TRANSFCOMP_scale|TRANSFCOMP_isBone;
+            dr.quat.w = 1.0f;
+            float *pos = dr.matrix.pos();
+            pos[0] = 100.0f * rnd.f(); pos[1] = 0.0f; pos[2] = 100.0f * rnd.f();
+            for(int c=0; c<nChains; c++)
+            {
+                // the joints, bent a bit around Z
+                float origin[3] = { 0.0f, 0.3f * c, 0.0f };
+                for(int j=0; j<nJoints; j++)
+                {
+                    int ID = root + 1 + c * nJoints + j;
+                    bones[ID].pParent = j ? &bones[ID - 1] : &bones[root];
+                    bk3d::BoneDataType &d = data[ID];
+                    d.validComps = TRANSFCOMP_pos|TRANSFCOMP_Quat|TRANSFCOMP_scale|TRANSFCOMP_isBone;
+                    float a = 0.3f * (rnd.f() - 0.5f);
+                    d.quat.x = d.quat.y = 0.0f; d.quat.z = sinf(0.5f * a); d.quat.w = cosf(0.5f * a);
+                    pos = d.matrix.pos();
+                    pos[0] = j ? 1.0f : origin[0]; pos[1] = j ? 0.0f : origin[1]; pos[2] = j ? 0.0f : origin[2];
+                    d.posBoneTail.x = 1.0f;
+                    if(!bLimits)
+                        continue;
+                    bk3d::TransformDOF &dof = dofs[ID];
+                    dof.init();
+                    bones[ID].pDOF = &dof;
+                    if(j == 0)
+                    {
+                        dof.mode = bk3d::DOF_CONE;
+                        dof.DOFAlpha = 70.0f;
+                    } else {
+                        // hinge around Z : X rotated by -90 degrees around Y
+                        dof.mode = bk3d::DOF_SINGLE_AXIS_X;
+                        dof.quat.y = -0.70710678f; dof.quat.w = 0.70710678f;
+                        dof.AxisLimitStart = -10.0f;
+                        dof.AxisLimitRange = 160.0f;
+                    }
+                }
+                // the handle : the tip of the chain in a random pose within the limits, in the space of the root
+                int h = ch * nChains + c;
+                bk3d::IKHandle &H = handles[h];
+                H.pParent = &bones[root];
+                bk3d::BoneDataType &dh = data[nb + h];
+                dh.validComps = TRANSFCOMP_matrix;
+                dh.matrix.m[0] = dh.matrix.m[5] = dh.matrix.m[10] = dh.matrix.m[15] = 1.0f;
+                pos = dh.matrix.pos();
+                float W[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+                memcpy(pos, origin, sizeof(origin));
+                for(int j=0; j<nJoints; j++)
+                {
+                    const bk3d::Vec4Type &rest = data[root + 1 + c * nJoints + j].quat;
+                    float rel[4], axis[3] = { 0.0f, 0.0f, 1.0f };
+                    if(!bLimits || (j == 0))
+                    {
+                        // around a random axis; for the cone, orthogonal to the bone then a twist
+                        float r[3] = { rnd.f() - 0.5f, rnd.f() - 0.5f, rnd.f() - 0.5f };
+                        float X[3] = { 1.0f, 0.0f, 0.0f };
+                        bk3d::quatRotate(X, &rest.x, X);
+                        if(bLimits)
+                        {
+                            float d = r[0]*X[0] + r[1]*X[1] + r[2]*X[2];
+                            for(int k=0; k<3; k++)
+                                r[k] -= d * X[k];
+                        }
+                        float l = sqrtf(r[0]*r[0] + r[1]*r[1] + r[2]*r[2]) + 1e-6f;
+                        for(int k=0; k<3; k++)
+                            axis[k] = r[k] / l;
+                        bk3d::quatFromAxisAngle(rel, axis, 1.2f * rnd.f());
+                        if(bLimits)
+                        {
+                            float twist[4];
+                            bk3d::quatFromAxisAngle(twist, X, 6.0f * rnd.f());
+                            bk3d::quatMul(rel, rel, twist);
+                        }
+                    }
+                    else
+                        bk3d::quatFromAxisAngle(rel, axis, rnd.f(-10.0f, 150.0f) * 3.14159265f / 180.0f);
+                    // the joint in the space of the root, then its bone
+                    float q[4], X[3] = { 1.0f, 0.0f, 0.0f };
+                    bk3d::quatMul(q, rel, &rest.x);
+                    bk3d::quatMul(W, W, q);
+                    bk3d::quatRotate(X, W, X);
+                    for(int k=0; k<3; k++)
+                        pos[k] += X[k];
+                }
+                bk3d::IKHandleData &hd = handleData[h];
+                hd.priority = c;
+                hd.maxIter = 16;
+                hd.weight = 1.0f;
+                H.pIKHandleData = &hd;
+                // effectors : the tip, then its parents up to the first joint
+                bk3d::TransformPool2 *pEff = (bk3d::TransformPool2*)&effectorMem[h * effStride];
+                bk3d::FloatPool *pW = (bk3d::FloatPool*)&weightMem[h * weightStride];
+                pEff->n = pW->n = nJoints;
+                for(int j=0; j<nJoints; j++)
+                {
+                    pEff->p[j] = &bones[root + 1 + c * nJoints + nJoints - 1 - j];
+                    pW->f[j] = 1.0f;
+                }
+                H.pEffectorTransforms = pEff;
+                H.pEffectorWeights = pW;
+                pHandles->p[h] = &H;
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+// characters of 4 IK chains of 4 joints, free then limited. CCD and FABRIK : iterations,
+// converged chains and time on 1 thread for 4, 16 and 64 iterations at most, then 16
+// iterations on all the threads. The end-effectors after the transform update must be
+// where the solver left them
+//------------------------------------------------------------------------------
+BK3D_TEST(ik, solvers)
+{
+    const int nChars = bk3dTest::size(100, 500), nChains = 4, nJoints = 4;
+    const int nFrames = bk3dTest::size(1, 10);
+    const int maxIters[] = { 4, 16, 64 };
+    const char *methodNames[] = { "CCD", "FABRIK" };
+    for(int limits=0; limits<2; limits++)
+    {
+        bk3dTest::Random rnd;
+        SyntheticIKRig rig;
+        rig.build(nChars, nChains, nJoints, limits == 1, rnd);
+        bk3d::TransformUpdater updater;
+        updater.build(rig.pPool);
+        updater.update(1);
+        bk3d::IKSolver ik;
+        ik.build(rig.pHandles, &updater);
+        BK3D_CHECK((int)ik.chains.size() == nChars * nChains, "%d chains", (int)ik.chains.size());
+        BK3D_BENCH("  %d chains of %d joints (%s), %d independent groups\n", (int)ik.chains.size(), nJoints,
+            limits ? "cone and hinge limits" : "no limits", (int)ik.groupFirst.size() - 1);
+        for(int m=0; m<2; m++)
+        {
+            ik.method = (bk3d::IKMethod)m;
+            for(int it=0; it<4; it++)
+            {
+                int threads = it < 3 ? 1 : 0;
+                for(size_t c=0; c<ik.chains.size(); c++)
+                    ik.chains[c].maxIter = maxIters[it < 3 ? it : 1];
+                bk3dTest::Timer timer;
+                for(int f=0; f<nFrames; f++)
+                    ik.solve(threads);
+                double ms = timer.ms() / nFrames;
+                timer.restart();
+                updater.updateChanged(threads);
+                double msUpdate = timer.ms();
+                // the end-effectors from the absolute matrices, against what the solver measured
+                float maxMismatch = 0.0f;
+                for(size_t c=0; c<ik.chains.size(); c++)
+                {
+                    const bk3d::IKChain &chain = ik.chains[c];
+                    const float *tip = rig.matAbs[chain.joints.back()].m, *target = rig.matAbs[chain.handleID].m + 12;
+                    float d[3] = { tip[0] + tip[12] - target[0], tip[1] + tip[13] - target[1], tip[2] + tip[14] - target[2] };
+                    float err = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]) / nJoints;
+                    maxMismatch = std::max(maxMismatch, fabsf(err - chain.error));
+                }
+                BK3D_BENCH("  %s, %d iterations max, %d threads : %.2f iterations/chain, %.1f%% converged, max error %.3g; %.3f ms (+%.3f ms transforms)\n",
+                    methodNames[m], maxIters[it < 3 ? it : 1], threads ? 1 : bk3d::getNumWorkerThreads(),
+                    (float)ik.nIterations / ik.chains.size(), 100.0f * ik.nConverged / ik.chains.size(), ik.maxError, ms, msUpdate);
+                BK3D_CHECK(maxMismatch < 1e-3f, "%s : the end-effectors don't match the solution (%g)", methodNames[m], maxMismatch);
+                // the free rig is always reachable. CCD converges slowly on its last chains
+                if(!limits && (m == bk3d::IKMETHOD_FABRIK) && (it == 2))
+                    BK3D_CHECK(ik.nConverged * 10 >= (int)ik.chains.size() * 9, "%s : %d/%d converged", methodNames[m],
+                        ik.nConverged, (int)ik.chains.size());
+            }
+        }
+    }
+}
@@ -0,0 +1,126 @@
+//------------------------------------------------------------------------------
+// bk3dMeshUtils.h : the delta index codec
+//------------------------------------------------------------------------------
+#include "bk3dTest.h"
+
+//------------------------------------------------------------------------------
+// encodeIndices() then decodeIndices() must give the indices back : 16 and 32 bits, partial
+// last blocks, and deltas of each width (local triangles, jumps, primitive restarts)
+//------------------------------------------------------------------------------
+BK3D_TEST(meshutils, indexCodec)
+{
+    const int nIndices = bk3dTest::size(100000, 3000000);
+    const GLType formats[] = { GL_UNSIGNED_SHORT, GL_UNSIGNED_INT };
+    const char *formatNames[] = { "16 bits", "32 bits" };
+    bk3dTest::Random rnd;
+    for(int f=0; f<2; f++)
+    {
+        // counts around the size of a block, then a big buffer
+        const int counts[] = { 0, 1, BK3D_IDXBLOCK - 1, BK3D_IDXBLOCK, BK3D_IDXBLOCK + 1, 5 * BK3D_IDXBLOCK + 7, nIndices };
+        for(int c=0; c<7; c++)
+        {
+            unsigned int n = (unsigned int)counts[c];
+            unsigned int maxIdx = formats[f] == GL_UNSIGNED_SHORT ? 0xFFFF : 0xFFFFFFFF;
+            std::vector<unsigned int> idx(n);
+            unsigned int cur = 0;
+            for(unsigned int i=0; i<n; i++)
+            {
+                int r = rnd.i(100);
+                if(r < 90)
+                    cur += rnd.i(16) - 8;      // 1 byte
+                else if(r < 97)
+                    cur += rnd.i(40000) - 20000; // 2 bytes
+                else if(r < 99)
+                    cur = rnd.next();           // 4 bytes
+                else
+                    cur = maxIdx;               // restart
+                idx[i] = cur & maxIdx;
+            }
+            std::vector<unsigned short> idx16(idx.begin(), idx.end());
+            const void *pSrc = formats[f] == GL_UNSIGNED_SHORT ? (const void*)(n ? &idx16[0] : NULL) : (const void*)(n ? &idx[0] : NULL);
+            size_t bytes = n * bk3d::formatGLComponentSize(formats[f]);
+            std::vector<unsigned char> encoded;
+            bk3d::encodeIndices(pSrc, formats[f], n, encoded);
+            BK3D_CHECK(bk3d::encodedIndexCount(&encoded[0]) == n, "%s : %d indices stored for %d", formatNames[f],
+                bk3d::encodedIndexCount(&encoded[0]), n);
+            // one more index : nothing must be written after the last one
+            std::vector<unsigned char> decoded(bytes + 4, 0xCD);
+            bk3dTest::Timer timer;
+            bk3d::decodeIndices(&encoded[0], &decoded[0], formats[f]);
+            double ms = timer.ms();
+            BK3D_CHECK(!bytes || !memcmp(&decoded[0], pSrc, bytes), "%s : %d indices decoded wrong", formatNames[f], n);
+            BK3D_CHECK((decoded[bytes] == 0xCD) && (decoded[bytes + 3] == 0xCD), "%s : %d indices, written past the end", formatNames[f], n);
+            if((int)n == nIndices)
+                BK3D_BENCH("  %d indices, %s : %.2f bytes/index encoded; decoded in %.3f ms (%.0f M indices/s)\n", n,
+                    formatNames[f], (double)encoded.size() / n, ms, (double)n / (ms * 1000.0));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// quantizeMesh() on positions with an empty Mesh::aabbox, then with one smaller than the data :
+// the dequantized positions must stay within the 16 bits step of the real bounds
+//------------------------------------------------------------------------------
+BK3D_TEST(meshutils, quantizePositions)
+{
+    const int nVertices = 1000;
+    bk3dTest::Random rnd;
+    for(int box=0; box<2; box++)
+    {
+        // x in [-5,5], y in [0,100], z flat
+        std::vector<float> positions(nVertices * 3);
+        float range[3] = { 10.0f, 100.0f, 0.0f };
+        for(int v=0; v<nVertices; v++)
+        {
+            positions[v * 3 + 0] = rnd.f(-5.0f, 5.0f);
+            positions[v * 3 + 1] = rnd.f(0.0f, 100.0f);
+            positions[v * 3 + 2] = 3.0f;
+        }
+        std::vector<float> ref(positions);
+        bk3d::Attribute attr;
+        strcpy(attr.name, MESH_POSITION);
+        attr.formatGL = GL_FLOAT;
+        attr.numComp = 3;
+        attr.strideBytes = 3 * sizeof(float);
+        attr.pAttributeBufferData = &positions[0];
+        std::vector<char> attrPoolMem(sizeof(bk3d::AttributePool), 0);
+        std::vector<char> slotPoolMem(sizeof(bk3d::SlotPool), 0);
+        bk3d::AttributePool *pAttrs = (bk3d::AttributePool*)&attrPoolMem[0];
+        bk3d::SlotPool *pSlots = (bk3d::SlotPool*)&slotPoolMem[0];
+        pAttrs->n = 1;
+        pAttrs->p[0] = &attr;
+        bk3d::Slot slot;
+        slot.vertexCount = nVertices;
+        slot.vtxBufferStrideBytes = 3 * sizeof(float);
+        slot.vtxBufferSizeBytes = nVertices * 3 * sizeof(float);
+        slot.pVtxBufferData = &positions[0];
+        slot.pAttributes = pAttrs;
+        pSlots->n = 1;
+        pSlots->p[0] = &slot;
+        bk3d::Mesh mesh;
+        mesh.pSlots = pSlots;
+        mesh.pAttributes = pAttrs;
+        if(box == 1)
+        {
+            // stale : a quarter of the data
+            mesh.aabbox.min.x = -1.0f; mesh.aabbox.min.y = 0.0f;  mesh.aabbox.min.z = 3.0f;
+            mesh.aabbox.max.x = 1.0f;  mesh.aabbox.max.y = 25.0f; mesh.aabbox.max.z = 3.0f;
+        }
+        bk3d::MeshQuantization q;
+        bool bQuantized = bk3d::quantizeMesh(&mesh, bk3d::NORMAL_FLOAT, q);
+        BK3D_CHECK(bQuantized && (attr.formatGL == GL_UNSIGNED_SHORT), "%s aabbox : positions not quantized", box ? "stale" : "empty");
+        if(!bQuantized)
+            continue;
+        float maxErr[3] = { 0.0f, 0.0f, 0.0f };
+        for(int v=0; v<nVertices; v++)
+        {
+            float p[3];
+            bk3d::readPosition(&attr, v, &q, p);
+            for(int c=0; c<3; c++)
+                maxErr[c] = std::max(maxErr[c], fabsf(p[c] - ref[v * 3 + c]));
+        }
+        for(int c=0; c<3; c++)
+            BK3D_CHECK(maxErr[c] <= range[c] / 65535.0f + 1e-5f, "%s aabbox : component %d off by %g", box ? "stale" : "empty", c, maxErr[c]);
+        free(slot.pVtxBufferData);
+    }
+}
@@ -0,0 +1,155 @@
+//------------------------------------------------------------------------------
+// bk3dSkinning.h : the SIMD paths and the threads against the scalar skinning
+//------------------------------------------------------------------------------
+#include "bk3dTest.h"
+
+//------------------------------------------------------------------------------
+// vertices with 1 to 4 random influences out of 100 bones, skinned by the scalar, SSE2 and
+// AVX paths on 1 thread, then by the best one on all the threads
+//------------------------------------------------------------------------------
+BK3D_TEST(skinning, simd)
+{
+    const int n = bk3dTest::size(50000, 1000000);
+    const int nBones = 100;
+    const int nFrames = bk3dTest::size(1, 10);
+    bk3dTest::Random rnd;
+    bk3d::SkinnedMesh skin;
+    skin.nVertices = n;
+    skin.bHasNormals = true;
+    skin.bindPose.resize(n * 6);
+    skin.influences.resize(n);
+    for(int v=0; v<n; v++)
+    {
+        float *p = &skin.bindPose[v * 6];
+        for(int c=0; c<3; c++)
+        {
+            p[c] = rnd.f(-1.0f, 1.0f);
+            p[3+c] = rnd.f() - 0.5f;
+        }
+        bk3d::SkinInfluences &si = skin.influences[v];
+        int nInf = 1 + rnd.i(BK3D_SKINMAXINFLUENCES);
+        float sum = 0.0f;
+        for(int i=0; i<BK3D_SKINMAXINFLUENCES; i++)
+        {
+            si.bone[i] = (unsigned short)rnd.i(nBones);
+            si.weight[i] = i < nInf ? 0.01f + rnd.f() : 0.0f;
+            sum += si.weight[i];
+        }
+        for(int i=0; i<BK3D_SKINMAXINFLUENCES; i++)
+            si.weight[i] /= sum;
+    }
+    skin.palette.resize(nBones);
+    for(int b=0; b<nBones; b++)
+    {
+        float a = rnd.f() * 3.14159265f;
+        float *m = skin.palette[b].m;
+        memset(m, 0, sizeof(bk3d::MatrixType));
+        m[0] = m[5] = cosf(a);
+        m[1] = sinf(a);
+        m[4] = -m[1];
+        m[10] = m[15] = 1.0f;
+        for(int c=0; c<3; c++)
+            m[12+c] = rnd.f() - 0.5f;
+    }
+    skin.deformed[0] = skin.bindPose;
+    skin.deformed[1] = skin.bindPose;
+    std::vector<float> ref(n * 6);
+    skin.skinRange(0, n, &ref[0], bk3d::SKINSIMD_SCALAR);
+    const char *names[] = { "scalar", "SSE2", "AVX" };
+    int best = (int)bk3d::getBestSkinningSIMD();
+    for(int mode=0; mode<=best+1; mode++)
+    {
+        int simd = mode <= best ? mode : best;
+        int threads = mode <= best ? 1 : 0;
+        bk3dTest::Timer timer;
+        for(int f=0; f<nFrames; f++)
+            skin.skin(threads, (bk3d::SkinningSIMD)simd, true);
+        double ms = timer.ms() / nFrames;
+        float maxErr = bk3dTest::maxError(skin.getDeformed(), &ref[0], n * 6);
+        BK3D_BENCH("  %d vertices, %s, %d threads : %.2f ms (%.1f M vertices/s)\n", n, names[simd],
+            threads ? 1 : bk3d::getNumWorkerThreads(), ms, (double)n / (ms * 1000.0));
+        BK3D_CHECK(maxErr < 1e-4f, "%s skinning doesn't match the scalar one (%g)", names[simd], maxErr);
+    }
+}
+
+//------------------------------------------------------------------------------
+// SkinnedMesh::build() on a Mesh of 4 vertices whose influences have holes : a weight of 0 or
+// an invalid bone between valid ones. The valid influences must be packed and normalized,
+// else skinRange() stops at the hole
+//------------------------------------------------------------------------------
+BK3D_TEST(skinning, build)
+{
+    const int nVertices = 4, nBones = 3;
+    // bone of each influence (7 isn't in pTransforms) and its weight
+    const float bones[nVertices][4]   = { { 0, 1, 2, 0 },       { 1, 7, 2, 0 },         { 2, 0, 0, 0 }, { 0, 0, 0, 0 } };
+    const float weights[nVertices][4] = { { 0.5f, 0, 0.5f, 0 }, { 0.25f, 0.5f, 0.25f, 0 }, { 1, 0, 0, 0 }, { 0, 0, 0, 0 } };
+    // translation of each bone, and the positions they should give
+    const float moves[nBones][3] = { { 1, 0, 0 }, { 0, 2, 0 }, { 0, 0, 4 } };
+    const float expected[nVertices][3] = { { 0.5f, 0, 2 }, { 1, 1, 2 }, { 2, 0, 4 }, { 3, 0, 0 } };
+    std::vector<float> positions(nVertices * 3, 0.0f), influences(nVertices * 8);
+    for(int v=0; v<nVertices; v++)
+    {
+        positions[v * 3] = (float)v;
+        memcpy(&influences[v * 8], bones[v], 4 * sizeof(float));
+        memcpy(&influences[v * 8 + 4], weights[v], 4 * sizeof(float));
+    }
+    // position in slot 0; bones and weights interleaved in slot 1
+    bk3d::Attribute attrs[3];
+    const char *names[3] = { MESH_POSITION, MESH_BONESOFFSETS, MESH_BONESWEIGHTS };
+    for(int a=0; a<3; a++)
+    {
+        strcpy(attrs[a].name, names[a]);
+        attrs[a].formatGL = GL_FLOAT;
+        attrs[a].numComp = a ? 4 : 3;
+        attrs[a].strideBytes = a ? 8 * sizeof(float) : 3 * sizeof(float);
+        attrs[a].slot = a ? 1 : 0;
+        attrs[a].dataOffsetBytes = a == 2 ? 4 * sizeof(float) : 0;
+        attrs[a].pAttributeBufferData = a ? (void*)&influences[a == 2 ? 4 : 0] : (void*)&positions[0];
+    }
+    std::vector<char> attrPoolMem(sizeof(bk3d::AttributePool) + 3 * sizeof(bk3d::Ptr64<bk3d::Attribute>), 0);
+    std::vector<char> slotPoolMem(sizeof(bk3d::SlotPool) + 2 * sizeof(bk3d::Ptr64<bk3d::Slot>), 0);
+    std::vector<char> refsMem(sizeof(bk3d::TransformRefs) + nBones * sizeof(bk3d::Ptr64<bk3d::Bone>), 0);
+    bk3d::AttributePool *pAttrs = (bk3d::AttributePool*)&attrPoolMem[0];
+    bk3d::SlotPool *pSlots = (bk3d::SlotPool*)&slotPoolMem[0];
+    bk3d::TransformRefs *pRefs = (bk3d::TransformRefs*)&refsMem[0];
+    pAttrs->n = 3;
+    for(int a=0; a<3; a++)
+        pAttrs->p[a] = &attrs[a];
+    bk3d::Slot slots[2];
+    pSlots->n = 2;
+    for(int s=0; s<2; s++)
+    {
+        slots[s].vertexCount = nVertices;
+        pSlots->p[s] = &slots[s];
+    }
+    pRefs->n = nBones;
+    bk3d::Mesh mesh;
+    mesh.pSlots = pSlots;
+    mesh.pAttributes = pAttrs;
+    mesh.pTransforms = pRefs;
+    mesh.numJointInfluence = 4;
+
+    bk3d::SkinnedMesh skin;
+    BK3D_CHECK(skin.build(&mesh), "the Mesh isn't skinned");
+    if(skin.nVertices != nVertices)
+        return;
+    const bk3d::SkinInfluences &si1 = skin.influences[1];
+    BK3D_CHECK((si1.bone[0] == 1) && (si1.bone[1] == 2) && (si1.weight[2] == 0.0f), "invalid influence not removed");
+    BK3D_CHECK((fabsf(si1.weight[0] - 0.5f) < 1e-6f) && (fabsf(si1.weight[1] - 0.5f) < 1e-6f), "weights not normalized");
+    for(int b=0; b<nBones; b++)
+    {
+        float *m = skin.palette[b].m;
+        m[0] = m[5] = m[10] = m[15] = 1.0f;
+        memcpy(m + 12, moves[b], 3 * sizeof(float));
+    }
+    const char *simdNames[] = { "scalar", "SSE2", "AVX" };
+    for(int simd=0; simd<=(int)bk3d::getBestSkinningSIMD(); simd++)
+    {
+        std::vector<float> out(nVertices * 6);
+        skin.skinRange(0, nVertices, &out[0], (bk3d::SkinningSIMD)simd);
+        for(int v=0; v<nVertices; v++)
+            for(int c=0; c<3; c++)
+                BK3D_CHECK(fabsf(out[v * 6 + c] - expected[v][c]) < 1e-5f, "%s : vertex %d at %g instead of %g", simdNames[simd],
+                    v, out[v * 6 + c], expected[v][c]);
+    }
+}
@@ -0,0 +1,231 @@
+//------------------------------------------------------------------------------
+// bk3dTransforms.h : the journal (markDirty() + updateChanged()) against the update of the
+// whole hierarchy, and the Maya compositions against the chain of matrices
+//------------------------------------------------------------------------------
+#include "bk3dTest.h"
+
+//------------------------------------------------------------------------------
+// a TransformPool of random characters : bonesPerChar bones each, every bone being the
+// child of one of the 3 previous ones
+//------------------------------------------------------------------------------
+struct SyntheticSkeleton
+{
+    std::vector<char>                   poolMem;
+    std::vector<bk3d::TransformSimple>  bones;
+    std::vector<bk3d::BoneDataType>     data;
+    std::vector<bk3d::MatrixType>       matAbs, matInvBP, matAbsInvBP;
+    bk3d::TransformPool*                pPool;
+
+    void build(int n, int bonesPerChar, bk3dTest::Random &rnd)
+    {
+        poolMem.assign(sizeof(bk3d::TransformPool) + n * sizeof(bk3d::Ptr64<bk3d::Bone>), 0);
+        pPool = new(&poolMem[0]) bk3d::TransformPool;
+        pPool->nBones = n;
+        bones.resize(n);
+        data.resize(n);
+        matAbs.resize(n);
+        matInvBP.resize(n);
+        matAbsInvBP.resize(n);
+        pPool->tableBoneData = &data[0];
+        pPool->tableMatrixAbs = &matAbs[0];
+        pPool->tableMatrixInvBindpose = &matInvBP[0];
+        pPool->tableMatrixAbsInvBindposeMatrix = &matAbsInvBP[0];
+        for(int i=0; i<n; i++)
+        {
+            bk3d::TransformSimple &b = bones[i];
+            b.init();
+            b.ID = i;
+            b.pBoneData = &data[i];
+            b.pMatrixAbs = &matAbs[i];
+            b.pMatrixInvBindpose = &matInvBP[i];
+            b.pMatrixAbsInvBindposeMatrix = &matAbsInvBP[i];
+            b.parentPool = pPool;
+            int p = i - 1 - rnd.i(3);
+            b.pParent = p >= i - i % bonesPerChar ? &bones[p] : NULL;
+            b.scale.x = b.scale.y = b.scale.z = 1.0f;
+            bk3d::BoneDataType &d = data[i];
+            d.init();
+            d.validComps = TRANSFCOMP_pos|TRANSFCOMP_Quat|TRANSFCOMP_scale|TRANSFCOMP_isBone;
+            randomRotation(i, rnd);
+            float *pos = d.matrix.pos();
+            pos[0] = rnd.f(); pos[1] = rnd.f(); pos[2] = rnd.f();
+            memset(&matInvBP[i], 0, sizeof(bk3d::MatrixType));
+            matInvBP[i].m[0] = matInvBP[i].m[5] = matInvBP[i].m[10] = matInvBP[i].m[15] = 1.0f;
+            pPool->pBones[i] = &b;
+        }
+    }
+    void randomRotation(int i, bk3dTest::Random &rnd)
+    {
+        float q[4] = { rnd.f() - 0.5f, rnd.f() - 0.5f, rnd.f() - 0.5f, rnd.f() - 0.5f };
+        float l = sqrtf(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+        bk3d::Vec4Type &quat = data[i].quat;
+        quat.x = q[0] / l; quat.y = q[1] / l; quat.z = q[2] / l; quat.w = q[3] / l;
+    }
+};
+
+//------------------------------------------------------------------------------
+// hierarchy update of characters of 100 bones, with all the bones animated, 1% of them and
+// 10 : update() of the whole hierarchy versus markDirty() + updateChanged(), which only
+// visits the animated subtrees. Both must give the same matrices
+//------------------------------------------------------------------------------
+BK3D_TEST(transforms, journal)
+{
+    const int n = bk3dTest::size(5000, 100000);
+    const int nFrames = bk3dTest::size(4, 20);
+    const char *modeNames[] = { "update, 1 thread", "update, all threads", "journal" };
+    // the same skeleton twice : the journal on one, update() on the other
+    bk3dTest::Random rnd, rndRef;
+    SyntheticSkeleton skel, ref;
+    skel.build(n, 100, rnd);
+    ref.build(n, 100, rndRef);
+    bk3d::TransformUpdater updater, updaterRef;
+    bk3dTest::Timer timer;
+    updater.build(skel.pPool);
+    double msBuild = timer.ms();
+    updaterRef.build(ref.pPool);
+    updater.update(1);
+    updaterRef.update(1);
+    BK3D_BENCH("  %d bones, %d levels : build %.2f ms\n", n, (int)updater.levels.size() - 1, msBuild);
+    const int animated[] = { n, n / 100, 10 };
+    std::vector<unsigned int> ids, ranges;
+    for(int a=0; a<3; a++)
+    {
+        for(int mode=0; mode<3; mode++)
+        {
+            double ms = 0.0;
+            int updated = 0;
+            for(int f=0; f<nFrames; f++)
+            {
+                ids.clear();
+                for(int i=0; i<animated[a]; i++)
+                    ids.push_back(animated[a] == n ? i : rnd.i(n));
+                for(size_t i=0; i<ids.size(); i++)
+                {
+                    unsigned int seed = rnd.next();
+                    bk3dTest::Random r(seed), rRef(seed);
+                    skel.randomRotation(ids[i], r);
+                    ref.randomRotation(ids[i], rRef);
+                    ref.data[ids[i]].bDirty = 1;
+                }
+                timer.restart();
+                if(mode == 2)
+                {
+                    updater.markDirty(&ids[0], (int)ids.size());
+                    updated += updater.updateChanged(0);
+                } else {
+                    for(size_t i=0; i<ids.size(); i++)
+                        skel.data[ids[i]].bDirty = 1;
+                    updated += updater.update(mode == 0 ? 1 : 0);
+                }
+                // what a consumer would upload
+                updater.getChangedRanges(ranges);
+                ms += timer.ms();
+                updaterRef.update(1);
+            }
+            BK3D_BENCH("  %6d animated, %-20s : %.3f ms/frame (%d matrices, %d ranges)\n", animated[a], modeNames[mode],
+                ms / nFrames, updated / nFrames, (int)ranges.size() / 2);
+            float maxErr = bk3dTest::maxError(skel.matAbs[0].m, ref.matAbs[0].m, n * 16);
+            BK3D_CHECK(maxErr < 1e-4f, "%s : %d animated, off by %g", modeNames[mode], animated[a], maxErr);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// local matrices of random Maya transforms (all the rotation orders, with and without
+// orientations and pivots) : the chain of 4x4 matrices in double precision,
+// composeMayaLocal() and composeMayaLocal4(). The last 2 must match the first
+//------------------------------------------------------------------------------
+BK3D_TEST(transforms, mayaCompose)
+{
+    const int n = bk3dTest::size(10000, 100000);
+    bk3dTest::Random rnd;
+    std::vector<bk3d::MayaComposeInput> inputs(n);
+    std::vector<int> keys(n);
+    for(int i=0; i<n; i++)
+    {
+        bk3d::MayaComposeInput &in = inputs[i];
+        memset(&in, 0, sizeof(in));
+        for(int k=0; k<3; k++)
+        {
+            in.angles[k] = rnd.f(-360.0f, 360.0f) * 3.14159265f / 180.0f;
+            in.pos[k] = rnd.f(-5.0f, 5.0f);
+            in.scale[k] = rnd.f(0.5f, 2.0f);
+        }
+        in.jointOrient[3] = in.rotOrient[3] = 1.0f;
+        int path = rnd.i(bk3d::NUM_MAYAPATHS);
+        if(path >= bk3d::MAYAPATH_ORIENT)
+            for(int k=0; k<4; k++)
+            {
+                in.jointOrient[k] = rnd.f() - 0.5f;
+                in.rotOrient[k] = rnd.f() - 0.5f;
+            }
+        float lj = sqrtf(in.jointOrient[0]*in.jointOrient[0] + in.jointOrient[1]*in.jointOrient[1] + in.jointOrient[2]*in.jointOrient[2] + in.jointOrient[3]*in.jointOrient[3]);
+        float lr = sqrtf(in.rotOrient[0]*in.rotOrient[0] + in.rotOrient[1]*in.rotOrient[1] + in.rotOrient[2]*in.rotOrient[2] + in.rotOrient[3]*in.rotOrient[3]);
+        for(int k=0; k<4; k++)
+        {
+            in.jointOrient[k] /= lj;
+            in.rotOrient[k] /= lr;
+        }
+        if(path == bk3d::MAYAPATH_PIVOTS)
+            for(int k=0; k<3; k++)
+            {
+                in.scalePivot[k] = rnd.f(-2.0f, 2.0f);
+                in.scalePivotTranslate[k] = rnd.f() - 0.5f;
+                in.rotPivot[k] = rnd.f(-2.0f, 2.0f);
+                in.rotPivotTranslate[k] = rnd.f() - 0.5f;
+            }
+        keys[i] = path * 6 + rnd.i(6);
+    }
+    // same order as TransformUpdater::composeLocals() : by path and rotation order
+    std::vector<int> sorted(n);
+    for(int i=0; i<n; i++)
+        sorted[i] = i;
+    std::stable_sort(sorted.begin(), sorted.end(), [&](int a, int b) { return keys[a] < keys[b]; });
+    std::vector<bk3d::MayaComposeInput> in(n);
+    std::vector<int> key(n);
+    for(int i=0; i<n; i++)
+    {
+        in[i] = inputs[sorted[i]];
+        key[i] = keys[sorted[i]];
+    }
+    std::vector<float> ref(n * 16), res(n * 16);
+    const char *modeNames[] = { "naive chain", "closed form", "4 at once" };
+    for(int mode=0; mode<3; mode++)
+    {
+        std::vector<float> &out = mode == 0 ? ref : res;
+        bk3dTest::Timer timer;
+        if(mode == 0)
+            for(int i=0; i<n; i++)
+                bk3d::composeMayaLocalNaive(in[i], key[i] % 6, &out[i * 16]);
+        else if(mode == 1)
+            for(int i=0; i<n; i++)
+                bk3d::composeMayaLocal(in[i], key[i] / 6, key[i] % 6, &out[i * 16]);
+#if defined(BK3D_SSE2)
+        else
+            for(int i=0; i<n; )
+            {
+                int cnt = 1;
+                while((cnt < 4) && (i + cnt < n) && (key[i + cnt] == key[i]))
+                    cnt++;
+                const bk3d::MayaComposeInput *pIn[4];
+                float tail[4][16];
+                float *pM[4];
+                for(int l=0; l<4; l++)
+                {
+                    int j = i + (l < cnt ? l : cnt - 1);
+                    pIn[l] = &in[j];
+                    pM[l] = l < cnt ? &out[j * 16] : tail[l];
+                }
+                bk3d::composeMayaLocal4(pIn, key[i] / 6, key[i] % 6, pM);
+                i += cnt;
+            }
+#else
+        else
+            break;
+#endif
+        double ms = timer.ms();
+        float maxErr = mode ? bk3dTest::maxError(&out[0], &ref[0], n * 16) : 0.0f;
+        BK3D_BENCH("  %d Maya transforms, %-12s : %.1f ns\n", n, modeNames[mode], ms * 1e6 / n);
+        BK3D_CHECK(maxErr < 1e-4f, "%s doesn't match the chain of matrices (%g)", modeNames[mode], maxErr);
+    }
+}